@@ -32,102 +32,254 @@ typedef struct moauthd_authdata_s	// PAM authentication data
 		*password;		// Password string
 } moauthd_authdata_t;
 
+struct moauthd_authreq_s		// Queued authentication request
+{
+  moauthd_client_t	*client;	// Client object
+  const char		*username,	// Username string
+			*password;	// Password string
+  struct timespec	queued;		// When the request was queued
+  bool			done,		// Has the request been processed?
+			status;		// Was the user authenticated?
+};
+
 
 //
 // Local functions...
 //
 
 #ifdef HAVE_LIBPAM
+static void	cache_user(moauthd_server_t *server, const unsigned char *digest);
+static bool	find_user(moauthd_server_t *server, const unsigned char *digest);
+static bool	hash_user(moauthd_server_t *server, const char *username, const char *password, unsigned char *digest);
 static int	moauthd_pam_func(int num_msg, const struct pam_message **msg, struct pam_response **resp, moauthd_authdata_t *data);
+static bool	pam_user(moauthd_authreq_t *req);
+static double	update_timing(moauthd_server_t *server, moauthd_timing_t timing, struct timespec *start);
 #endif // HAVE_LIBPAM
 
 
 //
 // 'moauthdAuthenticateUser()' - Validate a username + password combination.
 //
+// Successful PAM authentications are cached for `AuthCacheLife` seconds so
+// that repeated requests with the same credentials skip PAM.  Otherwise the
+// request is queued for the PAM authentication threads, and
+// `MOAUTHD_AUTH_BUSY` is returned if `AuthQueueSize` requests are already
+// waiting.
+//
 
-bool					// O - `true` if correct, `false` otherwise
+moauthd_auth_t				// O - Authentication result
 moauthdAuthenticateUser(
     moauthd_client_t *client,		// I - Client object
     const char       *username,		// I - Username string
     const char       *password)		// I - Password string
 {
-  int	status = 0;			// Return status
+  moauthd_server_t	*server = client->server;
+					// Server object
+  bool			status = false;	// Return status
 
 
   (void)username;
 
-  if (client->server->test_password)
-  {
-    status = !strcmp(client->server->test_password, password);
-
-    moauthdLogc(client, MOAUTHD_LOGLEVEL_INFO, "Test authentication of \"%s\" %s.", username, status ? "succeeded" : "failed");
-  }
+  if (server->test_password)
+    status = !strcmp(server->test_password, password);
 
 #ifdef HAVE_LIBPAM
   else
   {
     // Authenticate using PAM...
-    moauthd_authdata_t	data;		// Authorization data
-    pam_handle_t	*pamh;		// PAM authentication handle
-    int			pamerr;		// PAM error code
-    struct pam_conv	pamdata;	// PAM conversation data
-
-    data.username = username;
-    data.password = password;
+    moauthd_authreq_t	req;		// Authentication request
+    unsigned char	digest[32];	// Salted hash of credentials
+    bool		cache;		// Cache the credentials?
 
-    pamdata.conv        = (int (*)(int, const struct pam_message **, struct pam_response **, void *))moauthd_pam_func;
-    pamdata.appdata_ptr = &data;
-    pamh                = NULL;
+    cache = hash_user(server, username, password, digest);
 
-    if ((pamerr = pam_start(client->server->auth_service, data.username, &pamdata, &pamh)) != PAM_SUCCESS)
+    if (cache && find_user(server, digest))
     {
-      moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "pam_start() returned %d (%s)", pamerr, pam_strerror(pamh, pamerr));
-    }
+      moauthdCountMetric(server, MOAUTHD_METRIC_AUTH_CACHE_HITS);
 
-#  ifdef PAM_RHOST
-    else if ((pamerr = pam_set_item(pamh, PAM_RHOST, client->remote_host)) != PAM_SUCCESS)
-    {
-      moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "pam_set_item(PAM_RHOST) returned %d (%s)", pamerr, pam_strerror(pamh, pamerr));
+      moauthdLogc(client, MOAUTHD_LOGLEVEL_DEBUG, "Cached authentication of \"%s\" succeeded.", username);
+      return (MOAUTHD_AUTH_SUCCEEDED);
     }
-#  endif // PAM_RHOST
+    else if (cache)
+      moauthdCountMetric(server, MOAUTHD_METRIC_AUTH_CACHE_MISSES);
 
-#  ifdef PAM_TTY
-    else if ((pamerr = pam_set_item(pamh, PAM_TTY, "moauthd")) != PAM_SUCCESS)
-    {
-      moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "pam_set_item(PAM_TTY) returned %d (%s)", pamerr, pam_strerror(pamh, pamerr));
-    }
-#  endif // PAM_TTY
+    memset(&req, 0, sizeof(req));
+    req.client   = client;
+    req.username = username;
+    req.password = password;
 
-    else if ((pamerr = pam_authenticate(pamh, PAM_SILENT)) != PAM_SUCCESS)
-    {
-      moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "pam_authenticate() returned %d (%s)", pamerr, pam_strerror(pamh, pamerr));
-    }
-    else if ((pamerr = pam_setcred(pamh, PAM_ESTABLISH_CRED | PAM_SILENT)) != PAM_SUCCESS)
+    clock_gettime(CLOCK_MONOTONIC, &req.queued);
+
+    if (server->auth_queue)
     {
-      moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "pam_setcred() returned %d (%s)", pamerr, pam_strerror(pamh, pamerr));
+      // Queue the request and wait for an authentication thread...
+      cupsMutexLock(&server->auth_lock);
+
+      if (server->auth_queue_count >= (size_t)server->auth_queue_size)
+      {
+	cupsMutexUnlock(&server->auth_lock);
+
+	moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Too many pending authentications (AuthQueueSize %d), try again later.", server->auth_queue_size);
+	return (MOAUTHD_AUTH_BUSY);
+      }
+
+      server->auth_queue[(server->auth_queue_start + server->auth_queue_count) % (size_t)server->auth_queue_size] = &req;
+      server->auth_queue_count ++;
+
+      cupsCondBroadcast(&server->auth_cond);
+
+      while (!req.done)
+        cupsCondWait(&server->auth_done_cond, &server->auth_lock, 0.0);
+
+      cupsMutexUnlock(&server->auth_lock);
+
+      status = req.status;
     }
-    else if ((pamerr = pam_acct_mgmt(pamh, PAM_SILENT)) != PAM_SUCCESS)
+    else
     {
-      moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "pam_acct_mgmt() returned %d (%s)", pamerr, pam_strerror(pamh, pamerr));
+      // No authentication threads, authenticate here...
+      status = pam_user(&req);
     }
 
-    if (pamh)
-      pam_end(pamh, PAM_SUCCESS);
+    if (status && cache)
+      cache_user(server, digest);
+  }
+#endif // HAVE_LIBPAM
 
-    if (pamerr == PAM_SUCCESS)
-    {
-      moauthdLogc(client, MOAUTHD_LOGLEVEL_INFO, "PAM authentication of \"%s\" succeeded.", username);
-      status = 1;
-    }
+  return (status ? MOAUTHD_AUTH_SUCCEEDED : MOAUTHD_AUTH_FAILED);
+}
+
+
+//
+// 'moauthdRunAuth()' - Process queued PAM authentication requests.
+//
+
+void *					// O - Thread exit status
+moauthdRunAuth(
+    moauthd_server_t *server)		// I - Server object
+{
+#ifdef HAVE_LIBPAM
+  moauthd_authreq_t	*req;		// Current request
+  bool			status;		// Authentication status
+
+
+  for (;;)
+  {
+    // Wait for a request...
+    cupsMutexLock(&server->auth_lock);
+
+    while (server->auth_queue_count == 0)
+      cupsCondWait(&server->auth_cond, &server->auth_lock, 0.0);
+
+    req = server->auth_queue[server->auth_queue_start];
+    server->auth_queue_start = (server->auth_queue_start + 1) % (size_t)server->auth_queue_size;
+    server->auth_queue_count --;
+
+    cupsMutexUnlock(&server->auth_lock);
+
+    // Authenticate and wake up the requesting thread...
+    status = pam_user(req);
+
+    cupsMutexLock(&server->auth_lock);
+    req->status = status;
+    req->done   = true;
+    cupsCondBroadcast(&server->auth_done_cond);
+    cupsMutexUnlock(&server->auth_lock);
   }
+
+#else
+  (void)server;
 #endif // HAVE_LIBPAM
 
-  return (status);
+  return (NULL);
 }
 
 
 #ifdef HAVE_LIBPAM
+//
+// 'cache_user()' - Add successfully authenticated credentials to the cache.
+//
+
+static void
+cache_user(
+    moauthd_server_t    *server,	// I - Server object
+    const unsigned char *digest)	// I - Salted hash of credentials
+{
+  moauthd_authcache_t	*entry;		// Cache entry
+
+
+  entry = server->auth_cache + (((size_t)digest[0] << 24 | (size_t)digest[1] << 16 | (size_t)digest[2] << 8 | digest[3]) % server->auth_cache_size);
+
+  cupsRWLockWrite(&server->auth_cache_lock);
+
+  memcpy(entry->digest, digest, sizeof(entry->digest));
+  entry->expires = time(NULL) + server->auth_cache_life;
+
+  cupsRWUnlock(&server->auth_cache_lock);
+}
+
+
+//
+// 'find_user()' - Look for unexpired credentials in the cache.
+//
+
+static bool				// O - `true` if found, `false` otherwise
+find_user(
+    moauthd_server_t    *server,	// I - Server object
+    const unsigned char *digest)	// I - Salted hash of credentials
+{
+  moauthd_authcache_t	*entry;		// Cache entry
+  bool			found;		// Found in cache?
+
+
+  entry = server->auth_cache + (((size_t)digest[0] << 24 | (size_t)digest[1] << 16 | (size_t)digest[2] << 8 | digest[3]) % server->auth_cache_size);
+
+  cupsRWLockRead(&server->auth_cache_lock);
+
+  found = entry->expires > time(NULL) && !memcmp(entry->digest, digest, sizeof(entry->digest));
+
+  cupsRWUnlock(&server->auth_cache_lock);
+
+  return (found);
+}
+
+
+//
+// 'hash_user()' - Compute the salted hash of a username and password.
+//
+// The cache only stores this hash, never the password itself.
+//
+
+static bool				// O - `true` if the credentials can be cached, `false` otherwise
+hash_user(moauthd_server_t    *server,	// I - Server object
+          const char          *username,// I - Username string
+          const char          *password,// I - Password string
+          unsigned char       *digest)	// O - Salted hash
+{
+  char		buffer[1024];		// Salt and credentials
+  size_t	saltlen = sizeof(server->auth_cache_salt);
+					// Length of salt
+  int		length;			// Length of credentials
+  bool		ret;			// Return value
+
+
+  if (!server->auth_cache)
+    return (false);
+
+  // The length of the username keeps "a:b" + "c" distinct from "a" + "b:c"...
+  memcpy(buffer, server->auth_cache_salt, saltlen);
+
+  if ((length = snprintf(buffer + saltlen, sizeof(buffer) - saltlen, "%u:%s:%s", (unsigned)strlen(username), username, password)) < 0 || (size_t)length >= (sizeof(buffer) - saltlen))
+    return (false);
+
+  ret = cupsHashData("sha2-256", buffer, saltlen + (size_t)length, digest, 32) == 32;
+
+  memset(buffer, 0, sizeof(buffer));
+
+  return (ret);
+}
+
+
 //
 // 'moauthd_pam_func()' - PAM conversation function.
 //
@@ -174,4 +326,120 @@ moauthd_pam_func(
 
   return (PAM_SUCCESS);
 }
+
+
+//
+// 'pam_user()' - Authenticate a user using PAM.
+//
+
+static bool				// O - `true` if authenticated, `false` otherwise
+pam_user(moauthd_authreq_t *req)	// I - Authentication request
+{
+  moauthd_client_t	*client = req->client;
+					// Client object
+  moauthd_server_t	*server = client->server;
+					// Server object
+  moauthd_authdata_t	data;		// Authorization data
+  pam_handle_t		*pamh;		// PAM authentication handle
+  int			pamerr;		// PAM error code
+  struct pam_conv	pamdata;	// PAM conversation data
+  struct timespec	start;		// Start of current stage
+  double		wait_time,	// Time waiting in queue
+			auth_time = 0.0,// Time in pam_authenticate
+			acct_time = 0.0;// Time in pam_acct_mgmt
+
+
+  wait_time = update_timing(server, MOAUTHD_TIMING_AUTH_WAIT, &req->queued);
+
+  data.username = req->username;
+  data.password = req->password;
+
+  pamdata.conv        = (int (*)(int, const struct pam_message **, struct pam_response **, void *))moauthd_pam_func;
+  pamdata.appdata_ptr = &data;
+  pamh                = NULL;
+
+  if ((pamerr = pam_start(server->auth_service, data.username, &pamdata, &pamh)) != PAM_SUCCESS)
+  {
+    moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "pam_start() returned %d (%s)", pamerr, pam_strerror(pamh, pamerr));
+  }
+
+#  ifdef PAM_RHOST
+  else if ((pamerr = pam_set_item(pamh, PAM_RHOST, client->remote_host)) != PAM_SUCCESS)
+  {
+    moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "pam_set_item(PAM_RHOST) returned %d (%s)", pamerr, pam_strerror(pamh, pamerr));
+  }
+#  endif // PAM_RHOST
+
+#  ifdef PAM_TTY
+  else if ((pamerr = pam_set_item(pamh, PAM_TTY, "moauthd")) != PAM_SUCCESS)
+  {
+    moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "pam_set_item(PAM_TTY) returned %d (%s)", pamerr, pam_strerror(pamh, pamerr));
+  }
+#  endif // PAM_TTY
+
+  else
+  {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pamerr    = pam_authenticate(pamh, PAM_SILENT);
+    auth_time = update_timing(server, MOAUTHD_TIMING_PAM_AUTHENTICATE, &start);
+
+    if (pamerr != PAM_SUCCESS)
+    {
+      moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "pam_authenticate() returned %d (%s)", pamerr, pam_strerror(pamh, pamerr));
+    }
+    else if ((pamerr = pam_setcred(pamh, PAM_ESTABLISH_CRED | PAM_SILENT)) != PAM_SUCCESS)
+    {
+      moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "pam_setcred() returned %d (%s)", pamerr, pam_strerror(pamh, pamerr));
+    }
+    else
+    {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      pamerr    = pam_acct_mgmt(pamh, PAM_SILENT);
+      acct_time = update_timing(server, MOAUTHD_TIMING_PAM_ACCT_MGMT, &start);
+
+      if (pamerr != PAM_SUCCESS)
+	moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "pam_acct_mgmt() returned %d (%s)", pamerr, pam_strerror(pamh, pamerr));
+    }
+  }
+
+  if (pamh)
+    pam_end(pamh, PAM_SUCCESS);
+
+  moauthdLogc(client, MOAUTHD_LOGLEVEL_DEBUG, "PAM timing for \"%s\": queue %.3fs, pam_authenticate %.3fs, pam_acct_mgmt %.3fs.", req->username, wait_time, auth_time, acct_time);
+
+  if (pamerr == PAM_SUCCESS)
+  {
+    moauthdCountMetric(server, MOAUTHD_METRIC_PAM_SUCCEEDED);
+    moauthdLogc(client, MOAUTHD_LOGLEVEL_INFO, "PAM authentication of \"%s\" succeeded.", req->username);
+    return (true);
+  }
+
+  moauthdCountMetric(server, MOAUTHD_METRIC_PAM_FAILED);
+
+  return (false);
+}
+
+
+//
+// 'update_timing()' - Add the time since `start` to a latency histogram.
+//
+
+static double				// O - Elapsed time in seconds
+update_timing(
+    moauthd_server_t *server,		// I - Server object
+    moauthd_timing_t timing,		// I - Latency histogram
+    struct timespec  *start)		// I - Start time
+{
+  struct timespec	end;		// End time
+  uint64_t		usecs;		// Elapsed microseconds
+
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  usecs = (uint64_t)((end.tv_sec - start->tv_sec) * 1000000 + (end.tv_nsec - start->tv_nsec) / 1000);
+
+  moauthdCountTime(server, (size_t)timing, usecs);
+
+  return (usecs / 1000000.0);
+}
 #endif // HAVE_LIBPAM
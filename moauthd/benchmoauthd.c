@@ -0,0 +1,1627 @@
+//
+// Microbenchmark program for moauth daemon
+//
+// Copyright © 2026 by Michael R Sweet
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Usage:
+//
+//   ./benchmoauthd [-j THREADS] [-t SECONDS] [NAME ...]
+//
+// Each benchmark calls the daemon functions directly and runs for the given
+// number of seconds (default 1).  Only the request benchmarks use a socket - a
+// plain loopback connection, since moauthdGetFile needs a HTTP connection to
+// respond on - and their responses are read and discarded by a second thread.  Threaded benchmarks
+// are run with 1, 2, 4, and so on up to the given number of threads (default
+// 32).  Benchmarks whose names start with one of the NAME arguments are run,
+// or all of them when no names are given.  Results are written to stdout as
+// one JSON object per line:
+//
+//   {"name":"FindToken/100000","threads":1,"iterations":N,"ns_per_op":N,"ops_per_sec":N}
+//
+// Benchmarks that process text or send files also report "mb_per_sec".  The
+// "FileGet" benchmarks send 1MB, 100MB, and 1GB files that are created in
+// $TMPDIR and removed afterwards, and the 1MB file is also sent with the log
+// writer running at each log level ("FileGet/1MB/info" and so on).  The
+// "Authorize" benchmark requests the /authorize login form.  The "PageGet"
+// benchmarks request the home
+// page and DOCUMENTATION.md with the rendered page cache disabled ("nocache")
+// and with the default cache size ("cache").  The "LogClient" benchmarks log
+// the two info level lines of a request through the log writer thread, either
+// to /dev/null ("devnull") or to a pipe that is drained at about 4MB/sec
+// ("slow"), and also write the number of dropped lines:
+//
+//   {"name":"LogClient/slow","threads":1,"log_dropped":N,"dropped_pct":N}
+//
+// The "AddToken"
+// benchmarks insert up to 10% more tokens into the table, which are then
+// reaped so each run starts with the same number of tokens.
+//
+// The "TokenStress" benchmark finds, deletes, re-adds, and reaps the same
+// tokens from all threads and checks each token it finds.  It exits with a
+// non-zero status if a token is corrupted - run it from a sanitizer build
+// ("./configure --with-sanitizer=address" or "thread") to catch races that
+// do not corrupt the token contents.
+//
+
+#include "moauthd.h"
+#include "mmd.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <cups/form.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+
+//
+// Local types...
+//
+
+typedef void (*bench_cb_t)(void *data, size_t first, size_t count);
+					// Benchmark callback
+
+typedef struct bench_data_s		// Benchmark data
+{
+  moauthd_server_t	*server;	// Server object
+  moauthd_client_t	*client;	// Client object for HTML output
+  moauthd_token_t	*token;		// Token to journal
+  size_t		num_strings;	// Number of strings
+  char			**strings;	// Token strings, resource paths, or journal records
+  const char		*text;		// Username, Markdown, or form text
+} bench_data_t;
+
+typedef struct bench_conn_s		// Loopback HTTP connection
+{
+  http_t		*http;		// Requesting side of connection
+  const char		*resource;	// Resource to request
+  cups_thread_t		thread;		// Request thread
+} bench_conn_t;
+
+typedef struct bench_thread_s		// Benchmark thread
+{
+  bench_cb_t		cb;		// Benchmark callback
+  void			*data;		// Benchmark data
+  uint64_t		end_time;	// End of run
+  size_t		first,		// First iteration number
+			max_iterations,	// Maximum iterations or 0 for no limit
+			iterations;	// Iterations run
+} bench_thread_t;
+
+
+//
+// Local globals...
+//
+
+static int	bench_threads = 32;	// Maximum threads for threaded benchmarks
+static _Atomic(size_t) insert_count = 0;// Number of tokens inserted
+static _Atomic(size_t) request_errors = 0;// Number of failed requests
+static uint64_t	bench_usecs = 1000000;	// Run time in microseconds
+static int	num_names = 0;		// Number of benchmark names
+static char	**names = NULL;		// Benchmark names
+static _Atomic(size_t) stress_errors = 0;// Number of bad tokens found
+
+
+//
+// Local functions...
+//
+
+static void	add_tokens(bench_data_t *data, size_t count);
+static void	close_conn(bench_data_t *data, bench_conn_t *conn);
+static bool	create_file(const char *filename, size_t length);
+static moauthd_server_t *create_server(cups_jwa_t alg);
+static void	create_tokens(bench_data_t *data, size_t first, size_t count);
+static void	decode_form(bench_data_t *data, size_t first, size_t count);
+static void	*drain_pipe(int *fds);
+static void	find_resources(bench_data_t *data, size_t first, size_t count);
+static void	find_tokens(bench_data_t *data, size_t first, size_t count);
+static void	free_strings(bench_data_t *data);
+static void	insert_tokens(bench_data_t *data, size_t first, size_t count);
+static void	journal_tokens(bench_data_t *data, size_t first, size_t count);
+static char	*load_file(const char *filename);
+static void	load_markdown(bench_data_t *data, size_t first, size_t count);
+static void	load_snapshot(bench_data_t *data, size_t first, size_t count);
+static void	log_client(bench_data_t *data, size_t first, size_t count);
+static moauthd_token_t *new_token(const char *s, const char *user, time_t expires);
+static bool	open_conn(bench_data_t *data, bench_conn_t *conn, const char *resource);
+static void	render_markdown(bench_data_t *data, size_t first, size_t count);
+static void	replay_tokens(bench_data_t *data, size_t first, size_t count);
+static size_t	run_bench(const char *name, bench_cb_t cb, bench_data_t *data, int threads, size_t max_iterations, size_t bytes);
+static void	run_requests(const char *name, bench_data_t *data, const char *resource, size_t bytes);
+static void	*run_thread(bench_thread_t *thread);
+static void	*send_requests(bench_conn_t *conn);
+static void	serve_requests(bench_data_t *data, size_t first, size_t count);
+static void	stress_tokens(bench_data_t *data, size_t first, size_t count);
+static bool	want_bench(const char *prefix);
+static void	write_html(bench_data_t *data, size_t first, size_t count);
+
+
+//
+// 'main()' - Main entry for microbenchmark program.
+//
+
+int					// O - Exit status
+main(int  argc,				// I - Number of command-line arguments
+     char *argv[])			// I - Command-line arguments
+{
+  int			i, k;		// Looping vars
+  char			name[256];	// Benchmark name
+  bench_data_t		data;		// Benchmark data
+  moauthd_client_t	client;		// Client for HTML output
+  moauthd_server_t	*server;	// Server object
+  char			*markdown,	// Markdown text
+			html[257],	// HTML text
+			filename[1024];	// Snapshot state file
+  size_t		count;		// Number of tokens or resources
+  const char		*tmpdir;	// Temporary directory
+  static const size_t	token_counts[] =// Token table sizes
+  {
+    1000,
+    10000,
+    100000,
+    1000000
+  };
+  static const int	thread_counts[] =// Thread counts for threaded benchmarks
+  {
+    1,
+    2,
+    4,
+    8,
+    16,
+    32
+  };
+  static const size_t	resource_counts[] =
+  {					// Numbers of resources
+    10,
+    1000,
+    10000
+  };
+  static const struct
+  {
+    const char		*name;		// Algorithm name
+    cups_jwa_t		alg;		// Algorithm
+  }			algs[] =	// Signing algorithms
+  {
+    { "RS256", CUPS_JWA_RS256 },
+    { "RS384", CUPS_JWA_RS384 },
+    { "RS512", CUPS_JWA_RS512 },
+    { "ES256", CUPS_JWA_ES256 },
+    { "ES384", CUPS_JWA_ES384 },
+    { "ES512", CUPS_JWA_ES512 }
+  };
+  static const struct
+  {
+    const char		*name;		// Size name
+    size_t		length;		// Length of file
+  }			file_sizes[] =	// Large file sizes
+  {
+    { "1MB", 1048576 },
+    { "100MB", 104857600 },
+    { "1GB", 1073741824 }
+  };
+  static const struct
+  {
+    const char		*name;		// Level name
+    moauthd_loglevel_t	level;		// Log level
+  }			log_levels[] =	// Log levels for file requests
+  {
+    { "error", MOAUTHD_LOGLEVEL_ERROR },
+    { "info", MOAUTHD_LOGLEVEL_INFO },
+    { "debug", MOAUTHD_LOGLEVEL_DEBUG }
+  };
+  static const struct
+  {
+    const char		*name;		// Cache name
+    size_t		size;		// Page cache size
+  }			page_caches[] =	// Page cache sizes
+  {
+    { "nocache", 0 },
+    { "cache", 4194304 }
+  };
+  static const char html_text[] = "Fish & Chips <b>\"Best\"</b> in town. ";
+					// Text with HTML special characters
+  static const char * const forms[][2] =// /token request bodies
+  {
+    { "password", "grant_type=password&username=user&password=test123&scope=private+shared" },
+    { "code", "grant_type=authorization_code&code=q7dY1kH0CqRmFs4Xb2yZ_Wn9p3vE5tLgUoA8jMiN6c&client_id=testmoauthd&redirect_uri=https%3A%2F%2Flocalhost%3A10000&code_verifier=Zk3pQ9wX1mN7bV5cR2tY8uI4oP6aS0dF3gH7jK1lE9q" }
+  };
+
+
+  // Parse command-line arguments...
+  for (i = 1; i < argc; i ++)
+  {
+    if (!strcmp(argv[i], "-j") && (i + 1) < argc)
+    {
+      i ++;
+      if ((bench_threads = atoi(argv[i])) < 1 || bench_threads > 256)
+      {
+        fprintf(stderr, "benchmoauthd: Bad number of threads '%s'.\n", argv[i]);
+        return (1);
+      }
+    }
+    else if (!strcmp(argv[i], "-t") && (i + 1) < argc)
+    {
+      double	seconds = atof(argv[++ i]);
+					// Run time in seconds
+
+      if (seconds <= 0.0 || seconds > 3600.0)
+      {
+        fprintf(stderr, "benchmoauthd: Bad run time '%s'.\n", argv[i]);
+        return (1);
+      }
+
+      bench_usecs = (uint64_t)(seconds * 1000000.0);
+    }
+    else if (argv[i][0] == '-')
+    {
+      fputs("Usage: ./benchmoauthd [-j THREADS] [-t SECONDS] [NAME ...]\n", stderr);
+      return (1);
+    }
+    else
+    {
+      break;
+    }
+  }
+
+  num_names = argc - i;
+  names     = argv + i;
+
+  // Closing a loopback connection can interrupt a response...
+  signal(SIGPIPE, SIG_IGN);
+
+  memset(&data, 0, sizeof(data));
+  data.client = &client;
+  data.text   = cupsGetUser();
+
+  // Token creation for each signing algorithm...
+  for (i = 0; i < (int)(sizeof(algs) / sizeof(algs[0])); i ++)
+  {
+    snprintf(name, sizeof(name), "CreateToken/%s", algs[i].name);
+
+    if (!want_bench(name))
+      continue;
+
+    if ((data.server = create_server(algs[i].alg)) == NULL)
+      continue;
+
+    run_bench(name, (bench_cb_t)create_tokens, &data, 1, 0, 0);
+
+    moauthdDeleteServer(data.server);
+  }
+
+  // Token lookups and the journal...
+  for (i = 0; i < (int)(sizeof(token_counts) / sizeof(token_counts[0])); i ++)
+  {
+    count = token_counts[i];
+
+    if (!want_bench("FindToken") && !want_bench("AddToken") && !want_bench("JournalToken") && !want_bench("ReplayToken") && !want_bench("LoadSnapshot"))
+      break;
+
+    if ((data.server = create_server(CUPS_JWA_RS256)) == NULL)
+      break;
+
+    add_tokens(&data, count);
+
+    snprintf(name, sizeof(name), "FindToken/%lu", (unsigned long)count);
+
+    for (k = 0; k < (int)(sizeof(thread_counts) / sizeof(thread_counts[0])) && thread_counts[k] <= bench_threads; k ++)
+      run_bench(name, (bench_cb_t)find_tokens, &data, thread_counts[k], 0, 0);
+
+    snprintf(name, sizeof(name), "AddToken/%lu", (unsigned long)count);
+
+    for (k = 0; k < (int)(sizeof(thread_counts) / sizeof(thread_counts[0])) && thread_counts[k] <= bench_threads; k ++)
+    {
+      // Insert already-expired tokens and then reap them...
+      run_bench(name, (bench_cb_t)insert_tokens, &data, thread_counts[k], count / 10 / (size_t)thread_counts[k] + 1, 0);
+      moauthdReapTokens(data.server, time(NULL));
+    }
+
+    if (i == 0)
+    {
+      // Write journal records for an issued token...
+      if ((data.server->journal_fd = open("/dev/null", O_WRONLY)) >= 0 && (data.token = moauthdFindToken(data.server, data.strings[0])) != NULL)
+      {
+        run_bench("JournalToken", (bench_cb_t)journal_tokens, &data, 1, 0, 0);
+
+        moauthdReleaseToken(data.token);
+        data.token = NULL;
+      }
+    }
+    else if (want_bench("ReplayToken") || want_bench("LoadSnapshot"))
+    {
+      // Save the tokens to a snapshot and journal...
+      moauthd_server_t	*saved = data.server;
+					// Server with tokens
+      moauthd_token_t	*token;	// Current token
+      char		*record,	// Current journal record
+			*next;		// Next journal record
+      size_t		j;		// Looping var
+
+      if ((tmpdir = getenv("TMPDIR")) == NULL)
+        tmpdir = "/tmp";
+
+      snprintf(filename, sizeof(filename), "%s/benchmoauthd-%d.state", tmpdir, (int)getpid());
+      saved->state_file = strdup(filename);
+
+      if ((saved->journal_fd = open("/dev/null", O_WRONLY)) >= 0)
+      {
+        for (j = 0; j < data.num_strings; j ++)
+        {
+          if ((token = moauthdFindToken(saved, data.strings[j])) != NULL)
+          {
+            moauthdJournalCreateToken(saved, token);
+            moauthdReleaseToken(token);
+          }
+        }
+      }
+
+      if (moauthdSaveSnapshot(saved) && (data.server = create_server(CUPS_JWA_RS256)) != NULL)
+      {
+        data.server->state_file = strdup(filename);
+
+        snprintf(name, sizeof(name), "LoadSnapshot/%lu", (unsigned long)count);
+        run_bench(name, (bench_cb_t)load_snapshot, &data, 1, 0, 0);
+
+        moauthdDeleteServer(data.server);
+      }
+
+      if (saved->journal_buffer && (data.server = create_server(CUPS_JWA_RS256)) != NULL)
+      {
+        // Split the journal into record values...
+        free_strings(&data);
+
+        if ((data.strings = calloc(count, sizeof(char *))) != NULL)
+        {
+          for (record = saved->journal_buffer; record < (saved->journal_buffer + saved->journal_used) && data.num_strings < count; record = next)
+          {
+            if ((next = strchr(record, '\n')) == NULL)
+              break;
+
+            *next++ = '\0';
+
+            if (!strncmp(record, "Token ", 6))
+              data.strings[data.num_strings ++] = strdup(record + 6);
+          }
+
+          snprintf(name, sizeof(name), "ReplayToken/%lu", (unsigned long)count);
+          run_bench(name, (bench_cb_t)replay_tokens, &data, 1, data.num_strings, 0);
+        }
+
+        moauthdDeleteServer(data.server);
+      }
+
+      snprintf(filename, sizeof(filename), "%s.tokens", saved->state_file);
+      unlink(filename);
+
+      data.server = saved;
+    }
+
+    free_strings(&data);
+    moauthdDeleteServer(data.server);
+  }
+
+  // Concurrent lookups, deletions, and reaping of a small set of tokens...
+  if (want_bench("TokenStress") && (data.server = create_server(CUPS_JWA_RS256)) != NULL)
+  {
+    add_tokens(&data, 1000);
+
+    run_bench("TokenStress", (bench_cb_t)stress_tokens, &data, bench_threads, 0, 0);
+
+    free_strings(&data);
+    moauthdDeleteServer(data.server);
+
+    if (stress_errors)
+    {
+      fprintf(stderr, "benchmoauthd: TokenStress found %lu bad tokens.\n", (unsigned long)stress_errors);
+      return (1);
+    }
+  }
+
+  // Stateless token verification, first with a cold verified token cache and
+  // then with a warm one...
+  if (want_bench("VerifyToken") && (data.server = create_server(CUPS_JWA_ES256)) != NULL)
+  {
+    data.server->options |= MOAUTHD_OPTION_STATELESS_TOKENS;
+
+    if ((data.strings = calloc(1000, sizeof(char *))) != NULL)
+    {
+      moauthd_token_t	*token;		// Current token
+
+      for (; data.num_strings < 1000; data.num_strings ++)
+      {
+        if ((token = moauthdCreateToken(data.server, MOAUTHD_TOKTYPE_ACCESS, NULL, data.text, "private shared", NULL)) == NULL)
+          break;
+
+        data.strings[data.num_strings] = strdup(token->token);
+        moauthdReleaseToken(token);
+      }
+
+      run_bench("VerifyToken/cold", (bench_cb_t)find_tokens, &data, 1, data.num_strings, 0);
+      run_bench("VerifyToken/warm", (bench_cb_t)find_tokens, &data, 1, 0, 0);
+    }
+
+    free_strings(&data);
+    moauthdDeleteServer(data.server);
+  }
+
+  // Resource lookups...
+  for (i = 0; i < (int)(sizeof(resource_counts) / sizeof(resource_counts[0])); i ++)
+  {
+    size_t	j;			// Looping var
+    char	path[256];		// Remote path
+
+    count = resource_counts[i];
+
+    snprintf(name, sizeof(name), "FindResource/%lu", (unsigned long)count);
+
+    if (!want_bench(name) || (data.server = create_server(CUPS_JWA_RS256)) == NULL)
+      continue;
+
+    if ((data.strings = calloc(count, sizeof(char *))) != NULL)
+    {
+      for (j = 0; j < count; j ++)
+      {
+        snprintf(path, sizeof(path), "/%lu/index.md", (unsigned long)j);
+        moauthdCreateResource(data.server, MOAUTHD_RESTYPE_STATIC_FILE, path, NULL, "text/markdown", "public");
+
+        snprintf(path, sizeof(path), "/%lu/index.md", (unsigned long)((j * 7919) % count));
+        data.strings[data.num_strings ++] = strdup(path);
+      }
+
+      run_bench(name, (bench_cb_t)find_resources, &data, 1, 0, 0);
+    }
+
+    free_strings(&data);
+    moauthdDeleteServer(data.server);
+  }
+
+  // Large file requests, sent with pread through write_file()...
+  if (want_bench("FileGet") && (data.server = create_server(CUPS_JWA_RS256)) != NULL)
+  {
+    char	path[256],		// Remote path
+		levelname[256];		// Benchmark name with log level
+
+    if ((tmpdir = getenv("TMPDIR")) == NULL)
+      tmpdir = "/tmp";
+
+    for (i = 0; i < (int)(sizeof(file_sizes) / sizeof(file_sizes[0])); i ++)
+    {
+      snprintf(name, sizeof(name), "FileGet/%s", file_sizes[i].name);
+
+      if (!want_bench(name))
+        continue;
+
+      snprintf(filename, sizeof(filename), "%s/benchmoauthd-%d-%s.dat", tmpdir, (int)getpid(), file_sizes[i].name);
+      snprintf(path, sizeof(path), "/%s.dat", file_sizes[i].name);
+
+      if (create_file(filename, file_sizes[i].length))
+      {
+        moauthdCreateResource(data.server, MOAUTHD_RESTYPE_FILE, path, filename, "application/octet-stream", "public");
+
+        run_requests(name, &data, path, file_sizes[i].length);
+
+        for (k = 0; i == 0 && k < (int)(sizeof(log_levels) / sizeof(log_levels[0])); k ++)
+        {
+          // Send the 1MB file with the log writer running...
+          snprintf(levelname, sizeof(levelname), "%s/%s", name, log_levels[k].name);
+
+          if (!want_bench(levelname) || (data.server->log_file = open("/dev/null", O_WRONLY)) < 0)
+            continue;
+
+          data.server->log_level = log_levels[k].level;
+
+          moauthdStartLog(data.server);
+          run_requests(levelname, &data, path, file_sizes[i].length);
+          moauthdStopLog(data.server);
+
+          close(data.server->log_file);
+          data.server->log_file  = -1;
+          data.server->log_level = MOAUTHD_LOGLEVEL_ERROR;
+        }
+      }
+
+      unlink(filename);
+    }
+
+    moauthdDeleteServer(data.server);
+  }
+
+  // Authorization form requests...
+  if (want_bench("Authorize") && (data.server = create_server(CUPS_JWA_RS256)) != NULL)
+  {
+    moauthdAddApplication(data.server, "benchmoauthd", "https://localhost:10000/", "Benchmark", NULL, NULL, NULL);
+
+    run_requests("Authorize", &data, "/authorize?client_id=benchmoauthd&redirect_uri=https%3A%2F%2Flocalhost%3A10000%2F&response_type=code&state=benchmark", 0);
+
+    moauthdDeleteServer(data.server);
+  }
+
+  // Markdown page requests with and without the rendered page cache...
+  for (i = 0; i < (int)(sizeof(page_caches) / sizeof(page_caches[0])); i ++)
+  {
+    moauthd_resource_t	*r;		// Home page resource
+
+    if (!want_bench("PageGet") || (data.server = create_server(CUPS_JWA_RS256)) == NULL)
+      break;
+
+    data.server->page_cache_size = page_caches[i].size;
+
+    // Serve the home page from memory like the default one...
+    if ((markdown = load_file("index.md")) != NULL)
+    {
+      r         = moauthdCreateResource(data.server, MOAUTHD_RESTYPE_STATIC_FILE, "/index.md", NULL, "text/markdown", "public");
+      r->data   = markdown;
+      r->length = strlen(markdown);
+
+      snprintf(name, sizeof(name), "PageGet/index/%s", page_caches[i].name);
+      run_requests(name, &data, "/", 0);
+    }
+
+    moauthdCreateResource(data.server, MOAUTHD_RESTYPE_FILE, "/DOCUMENTATION.md", "../DOCUMENTATION.md", NULL, "public");
+
+    snprintf(name, sizeof(name), "PageGet/DOCUMENTATION/%s", page_caches[i].name);
+    run_requests(name, &data, "/DOCUMENTATION.md", 0);
+
+    moauthdDeleteServer(data.server);
+    free(markdown);
+  }
+
+  // Client log messages at info level, written to /dev/null and to a slowly
+  // drained pipe...
+  if (want_bench("LogClient") && (data.server = create_server(CUPS_JWA_ES256)) != NULL)
+  {
+    int			fds[2];		// Log pipe
+    cups_thread_t	drain;		// Pipe drain thread
+    size_t		dropped,	// Dropped log lines
+			iterations;	// Iterations run
+
+    data.server->log_level = MOAUTHD_LOGLEVEL_INFO;
+
+    memset(&client, 0, sizeof(client));
+    client.number = 1;
+    client.server = data.server;
+
+    for (i = 0; i < 2; i ++)
+    {
+      snprintf(name, sizeof(name), "LogClient/%s", i ? "slow" : "devnull");
+
+      for (k = 0; k < (int)(sizeof(thread_counts) / sizeof(thread_counts[0])) && thread_counts[k] <= bench_threads && want_bench(name); k ++)
+      {
+        drain = CUPS_THREAD_INVALID;
+
+        if (i == 0)
+        {
+          fds[0] = -1;
+          fds[1] = open("/dev/null", O_WRONLY);
+        }
+        else if (pipe(fds))
+        {
+          fds[1] = -1;
+        }
+        else if ((drain = cupsThreadCreate((cups_thread_func_t)drain_pipe, fds)) == CUPS_THREAD_INVALID)
+        {
+          close(fds[0]);
+          close(fds[1]);
+          fds[1] = -1;
+        }
+
+        if (fds[1] < 0)
+        {
+          fprintf(stderr, "benchmoauthd: Unable to open log for %s: %s\n", name, strerror(errno));
+          break;
+        }
+
+        data.server->log_file = fds[1];
+        dropped               = atomic_load(&data.server->log_dropped);
+
+        moauthdStartLog(data.server);
+
+        iterations = run_bench(name, (bench_cb_t)log_client, &data, thread_counts[k], 0, 0);
+
+        // Write the pending lines, then let the drain thread see EOF...
+        moauthdStopLog(data.server);
+
+        close(fds[1]);
+        data.server->log_file = -1;
+
+        if (drain != CUPS_THREAD_INVALID)
+        {
+          cupsThreadWait(drain);
+          close(fds[0]);
+        }
+
+        dropped = atomic_load(&data.server->log_dropped) - dropped;
+
+        if (iterations)
+        {
+          printf("{\"name\":\"%s\",\"threads\":%d,\"log_dropped\":%lu,\"dropped_pct\":%.1f}\n", name, thread_counts[k], (unsigned long)dropped, 100.0 * dropped / (2 * iterations));
+          fflush(stdout);
+        }
+      }
+    }
+
+    moauthdDeleteServer(data.server);
+  }
+
+  // HTML and Markdown output...
+  if ((server = create_server(CUPS_JWA_RS256)) != NULL)
+  {
+    memset(&client, 0, sizeof(client));
+    client.server       = server;
+    client.output_alloc = 65536;
+    client.output       = malloc(client.output_alloc);
+
+    for (count = 0; count < (sizeof(html) - 1); count ++)
+      html[count] = html_text[count % (sizeof(html_text) - 1)];
+    html[count] = '\0';
+
+    data.text = html;
+
+    if (client.output)
+      run_bench("HTMLPrintf", (bench_cb_t)write_html, &data, 1, 0, strlen(html));
+
+    if ((markdown = load_file("../DOCUMENTATION.md")) != NULL)
+    {
+      data.text = markdown;
+
+      run_bench("MarkdownLoad", (bench_cb_t)load_markdown, &data, 1, 0, strlen(markdown));
+
+      if (client.output)
+        run_bench("MarkdownRender", (bench_cb_t)render_markdown, &data, 1, 0, strlen(markdown));
+
+      free(markdown);
+    }
+
+    free(client.output);
+    moauthdDeleteServer(server);
+  }
+
+  // Form decoding of /token request bodies...
+  for (i = 0; i < (int)(sizeof(forms) / sizeof(forms[0])); i ++)
+  {
+    snprintf(name, sizeof(name), "FormDecode/%s", forms[i][0]);
+
+    data.text = forms[i][1];
+
+    run_bench(name, (bench_cb_t)decode_form, &data, 1, 0, strlen(forms[i][1]));
+  }
+
+  return (0);
+}
+
+
+//
+// 'add_tokens()' - Add access tokens to the token table.
+//
+
+static void
+add_tokens(bench_data_t *data,		// I - Benchmark data
+           size_t       count)		// I - Number of tokens
+{
+  moauthd_token_t	*token;		// Current token
+  char			temp[256];	// Token string
+  time_t		curtime = time(NULL);
+					// Current time
+
+
+  if ((data->strings = calloc(count, sizeof(char *))) == NULL)
+    return;
+
+  for (data->num_strings = 0; data->num_strings < count; data->num_strings ++)
+  {
+    // Use a JWT-like string so the token lands in the access token shards...
+    snprintf(temp, sizeof(temp), "eyJhbGciOiJSUzI1NiJ9.%08lx%08x.c2lnbmF0dXJl", (unsigned long)data->num_strings, (unsigned)(data->num_strings * 2654435761U));
+
+    if ((token = new_token(temp, data->text, curtime + 3600)) == NULL)
+      break;
+
+    data->strings[data->num_strings] = strdup(temp);
+
+    moauthdAddToken(data->server, token);
+  }
+}
+
+
+//
+// 'close_conn()' - Close a loopback connection.
+//
+// Closing the serving side ends the request thread's current response.
+//
+
+static void
+close_conn(bench_data_t *data,		// I - Benchmark data
+           bench_conn_t *conn)		// I - Loopback connection
+{
+  httpClose(data->client->http);
+  data->client->http = NULL;
+
+  cupsThreadWait(conn->thread);
+
+  httpClose(conn->http);
+  conn->http = NULL;
+}
+
+
+//
+// 'create_file()' - Create a file for the request benchmarks.
+//
+
+static bool				// O - `true` on success, `false` on error
+create_file(const char *filename,	// I - Filename
+            size_t     length)		// I - Length of file
+{
+  int		fd;			// File descriptor
+  char		*buffer;		// Write buffer
+  size_t	i,			// Looping var
+		count;			// Bytes to write
+  bool		ret = true;		// Return value
+
+
+  if ((buffer = malloc(1048576)) == NULL)
+    return (false);
+
+  for (i = 0; i < 1048576; i ++)
+    buffer[i] = (char)(' ' + i % 89);
+
+  if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+  {
+    fprintf(stderr, "benchmoauthd: Unable to create \"%s\": %s\n", filename, strerror(errno));
+    free(buffer);
+    return (false);
+  }
+
+  for (; length > 0; length -= count)
+  {
+    if ((count = length) > 1048576)
+      count = 1048576;
+
+    if (write(fd, buffer, count) != (ssize_t)count)
+    {
+      fprintf(stderr, "benchmoauthd: Unable to write \"%s\": %s\n", filename, strerror(errno));
+      ret = false;
+      break;
+    }
+  }
+
+  close(fd);
+  free(buffer);
+
+  return (ret);
+}
+
+
+//
+// 'create_server()' - Create a server object without listeners or threads.
+//
+
+static moauthd_server_t *		// O - Server object or `NULL` on error
+create_server(cups_jwa_t alg)		// I - Signing algorithm
+{
+  moauthd_server_t	*server;	// Server object
+
+
+  if ((server = calloc(1, sizeof(moauthd_server_t))) == NULL)
+    return (NULL);
+
+  cupsMutexInit(&server->applications_lock);
+  cupsMutexInit(&server->auth_lock);
+  cupsCondInit(&server->auth_cond);
+  cupsCondInit(&server->auth_done_cond);
+  cupsMutexInit(&server->clients_lock);
+  cupsCondInit(&server->clients_cond);
+  cupsMutexInit(&server->journal_lock);
+  cupsCondInit(&server->journal_cond);
+  cupsMutexInit(&server->log_lock);
+  cupsCondInit(&server->log_cond);
+  cupsRWInit(&server->resources_lock);
+  cupsRWInit(&server->auth_cache_lock);
+  cupsMutexInit(&server->users_lock);
+  cupsMutexInit(&server->files_lock);
+  cupsMutexInit(&server->pages_lock);
+
+  moauthdInitEndpoints(server);
+  moauthdInitTokens(server);
+
+  server->access_log       = -1;	// none
+  server->file_cache_size  = 4194304;	// 4MiB
+  server->introspect_group = -1;	// none
+  server->journal_fd       = -1;
+  server->log_file         = -1;	// none
+  server->log_level        = MOAUTHD_LOGLEVEL_ERROR;
+  server->max_grant_life   = 300;	// 5 minutes
+  server->max_token_life   = 604800;	// 1 week
+  server->metrics_group    = -1;	// none
+  server->page_cache_size  = 4194304;	// 4MiB
+  server->signing_alg      = alg;
+  server->register_group   = -1;	// none
+  server->user_cache_life  = 300;	// 5 minutes
+  server->user_cache_size  = 1024;
+  server->start_time       = time(NULL);
+  server->name             = strdup("localhost");
+  server->port             = 9000 + (getuid() % 1000);
+
+  moauthdAddScope(server, "public");	// MOAUTHD_SCOPE_PUBLIC
+  moauthdAddScope(server, "private");	// MOAUTHD_SCOPE_PRIVATE
+  moauthdAddScope(server, "shared");	// MOAUTHD_SCOPE_SHARED
+
+#ifdef HAVE_SYS_INOTIFY_H
+  server->inotify_fd       = -1;
+#endif // HAVE_SYS_INOTIFY_H
+
+#ifdef HAVE_SYS_EPOLL_H
+  server->event_fd         = -1;
+#else
+  server->wake_pipe[0]     = -1;
+  server->wake_pipe[1]     = -1;
+#endif // HAVE_SYS_EPOLL_H
+
+  if ((server->private_key = cupsJWTMakePrivateKey(alg)) == NULL)
+  {
+    fputs("benchmoauthd: Unable to create signing key.\n", stderr);
+    moauthdDeleteServer(server);
+    return (NULL);
+  }
+
+  return (server);
+}
+
+
+//
+// 'create_tokens()' - Create and delete access tokens.
+//
+
+static void
+create_tokens(bench_data_t *data,	// I - Benchmark data
+              size_t       first,	// I - First iteration (unused)
+              size_t       count)	// I - Number of iterations
+{
+  moauthd_token_t	*token;		// New token
+
+
+  (void)first;
+
+  while (count > 0)
+  {
+    if ((token = moauthdCreateToken(data->server, MOAUTHD_TOKTYPE_ACCESS, NULL, data->text, "private shared", NULL)) != NULL)
+    {
+      moauthdDeleteToken(data->server, token);
+      moauthdReleaseToken(token);
+    }
+
+    count --;
+  }
+}
+
+
+//
+// 'decode_form()' - Decode a form.
+//
+
+static void
+decode_form(bench_data_t *data,		// I - Benchmark data
+            size_t       first,		// I - First iteration (unused)
+            size_t       count)		// I - Number of iterations
+{
+  size_t	num_vars;		// Number of form variables
+  cups_option_t	*vars;			// Form variables
+
+
+  (void)first;
+
+  while (count > 0)
+  {
+    num_vars = cupsFormDecode(data->text, &vars);
+    cupsFreeOptions(num_vars, vars);
+
+    count --;
+  }
+}
+
+
+//
+// 'drain_pipe()' - Slowly read a log pipe until it is closed.
+//
+
+static void *				// O - Thread exit status
+drain_pipe(int *fds)			// I - Log pipe
+{
+  char		buffer[4096];		// Log data
+
+
+  // Read 4k every millisecond, or about 4MB/sec...
+  while (read(fds[0], buffer, sizeof(buffer)) > 0)
+    usleep(1000);
+
+  return (NULL);
+}
+
+
+//
+// 'find_resources()' - Find resources.
+//
+
+static void
+find_resources(bench_data_t *data,	// I - Benchmark data
+               size_t       first,	// I - First iteration
+               size_t       count)	// I - Number of iterations
+{
+  char		name[1024];		// Local filename
+  struct stat	info;			// File information
+
+
+  while (count > 0)
+  {
+    moauthdFindResource(data->server, data->strings[first % data->num_strings], name, sizeof(name), &info);
+
+    first ++;
+    count --;
+  }
+}
+
+
+//
+// 'find_tokens()' - Find tokens.
+//
+
+static void
+find_tokens(bench_data_t *data,		// I - Benchmark data
+            size_t       first,		// I - First iteration
+            size_t       count)		// I - Number of iterations
+{
+  while (count > 0)
+  {
+    moauthdReleaseToken(moauthdFindToken(data->server, data->strings[first % data->num_strings]));
+
+    first ++;
+    count --;
+  }
+}
+
+
+//
+// 'free_strings()' - Free the benchmark strings.
+//
+
+static void
+free_strings(bench_data_t *data)	// I - Benchmark data
+{
+  size_t	i;			// Looping var
+
+
+  for (i = 0; i < data->num_strings; i ++)
+    free(data->strings[i]);
+
+  free(data->strings);
+
+  data->strings     = NULL;
+  data->num_strings = 0;
+}
+
+
+//
+// 'insert_tokens()' - Insert expired access tokens.
+//
+
+static void
+insert_tokens(bench_data_t *data,	// I - Benchmark data
+              size_t       first,	// I - First iteration (unused)
+              size_t       count)	// I - Number of iterations
+{
+  moauthd_token_t	*token;		// New token
+  char			temp[256];	// Token string
+  time_t		expires = time(NULL) - 1;
+					// Expiration time
+
+
+  (void)first;
+
+  while (count > 0)
+  {
+    // Use a counter since iteration numbers overlap between threads...
+    snprintf(temp, sizeof(temp), "eyJhbGciOiJSUzI1NiJ9.%016lx.aW5zZXJ0", (unsigned long)atomic_fetch_add(&insert_count, 1));
+
+    if ((token = new_token(temp, data->text, expires)) != NULL)
+      moauthdAddToken(data->server, token);
+
+    count --;
+  }
+}
+
+
+//
+// 'journal_tokens()' - Write journal records for a token.
+//
+
+static void
+journal_tokens(bench_data_t *data,	// I - Benchmark data
+               size_t       first,	// I - First iteration (unused)
+               size_t       count)	// I - Number of iterations
+{
+  (void)first;
+
+  // Discard the records from the last batch since no journal thread is
+  // running...
+  data->server->journal_used = 0;
+
+  while (count > 0)
+  {
+    moauthdJournalCreateToken(data->server, data->token);
+
+    count --;
+  }
+}
+
+
+//
+// 'load_file()' - Load a text file into memory.
+//
+
+static char *				// O - File contents or `NULL` on error
+load_file(const char *filename)		// I - Filename
+{
+  int		fd;			// File descriptor
+  struct stat	info;			// File information
+  char		*buffer = NULL;		// File contents
+
+
+  if ((fd = open(filename, O_RDONLY)) < 0)
+  {
+    fprintf(stderr, "benchmoauthd: Unable to open \"%s\": %s\n", filename, strerror(errno));
+    return (NULL);
+  }
+
+  if (!fstat(fd, &info) && (buffer = malloc((size_t)info.st_size + 1)) != NULL)
+  {
+    if (read(fd, buffer, (size_t)info.st_size) != (ssize_t)info.st_size)
+    {
+      fprintf(stderr, "benchmoauthd: Unable to read \"%s\": %s\n", filename, strerror(errno));
+      free(buffer);
+      buffer = NULL;
+    }
+    else
+    {
+      buffer[info.st_size] = '\0';
+    }
+  }
+
+  close(fd);
+
+  return (buffer);
+}
+
+
+//
+// 'load_markdown()' - Load Markdown text.
+//
+
+static void
+load_markdown(bench_data_t *data,	// I - Benchmark data
+              size_t       first,	// I - First iteration (unused)
+              size_t       count)	// I - Number of iterations
+{
+  (void)first;
+
+  while (count > 0)
+  {
+    mmdFree(mmdLoadString(NULL, data->text));
+
+    count --;
+  }
+}
+
+
+//
+// 'load_snapshot()' - Map and check the token snapshot.
+//
+
+static void
+load_snapshot(bench_data_t *data,	// I - Benchmark data
+              size_t       first,	// I - First iteration (unused)
+              size_t       count)	// I - Number of iterations
+{
+  (void)first;
+
+  while (count > 0)
+  {
+    moauthdLoadSnapshot(data->server);
+    moauthdCloseSnapshot(data->server);
+
+    count --;
+  }
+}
+
+
+//
+// 'log_client()' - Log the info level lines for a request.
+//
+
+static void
+log_client(bench_data_t *data,		// I - Benchmark data
+           size_t       first,		// I - First iteration (unused)
+           size_t       count)		// I - Number of iterations
+{
+  (void)first;
+
+  while (count > 0)
+  {
+    // moauthdRunClient and moauthdRespondClient log these for each request...
+    moauthdLogc(data->client, MOAUTHD_LOGLEVEL_INFO, "%s %s", "GET", "/shared/shared.pdf");
+    moauthdLogc(data->client, MOAUTHD_LOGLEVEL_INFO, "HTTP/1.1 %d %s", 200, "OK");
+
+    count --;
+  }
+}
+
+
+//
+// 'new_token()' - Create an access token for the token table.
+//
+
+static moauthd_token_t *		// O - New token or `NULL` on error
+new_token(const char *s,		// I - Token string
+          const char *user,		// I - Username
+          time_t     expires)		// I - Expiration time
+{
+  moauthd_token_t	*token;		// New token
+
+
+  if ((token = (moauthd_token_t *)calloc(1, sizeof(moauthd_token_t))) == NULL)
+    return (NULL);
+
+  token->type    = MOAUTHD_TOKTYPE_ACCESS;
+  token->token   = strdup(s);
+  token->user    = strdup(user);
+  token->scopes  = strdup("private shared");
+  token->uid     = getuid();
+  token->gid     = getgid();
+  token->created = time(NULL);
+  token->expires = expires;
+
+  return (token);
+}
+
+
+//
+// 'open_conn()' - Open a loopback connection and start the request thread.
+//
+// The serving side of the connection is stored in the benchmark client.
+//
+
+static bool				// O - `true` on success, `false` on error
+open_conn(bench_data_t *data,		// I - Benchmark data
+          bench_conn_t *conn,		// I - Loopback connection
+          const char   *resource)	// I - Resource to request
+{
+  int			fd;		// Listening socket
+  struct sockaddr_in	addr;		// Loopback address
+  socklen_t		addrlen = sizeof(addr);
+					// Length of address
+
+
+  memset(conn, 0, sizeof(bench_conn_t));
+  conn->resource = resource;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 1) || getsockname(fd, (struct sockaddr *)&addr, &addrlen))
+  {
+    fprintf(stderr, "benchmoauthd: Unable to listen on loopback: %s\n", strerror(errno));
+
+    if (fd >= 0)
+      close(fd);
+
+    return (false);
+  }
+
+  if ((conn->http = httpConnect("127.0.0.1", ntohs(addr.sin_port), NULL, AF_INET, HTTP_ENCRYPTION_NEVER, true, 30000, NULL)) == NULL || (data->client->http = httpAcceptConnection(fd, true)) == NULL)
+  {
+    fprintf(stderr, "benchmoauthd: Unable to connect on loopback: %s\n", cupsGetErrorString());
+    close(fd);
+    httpClose(conn->http);
+    conn->http = NULL;
+    return (false);
+  }
+
+  close(fd);
+
+  if ((conn->thread = cupsThreadCreate((cups_thread_func_t)send_requests, conn)) == CUPS_THREAD_INVALID)
+  {
+    fputs("benchmoauthd: Unable to create request thread.\n", stderr);
+    httpClose(data->client->http);
+    data->client->http = NULL;
+    httpClose(conn->http);
+    conn->http = NULL;
+    return (false);
+  }
+
+  return (true);
+}
+
+
+//
+// 'render_markdown()' - Render Markdown text as HTML.
+//
+
+static void
+render_markdown(bench_data_t *data,	// I - Benchmark data
+                size_t       first,	// I - First iteration (unused)
+                size_t       count)	// I - Number of iterations
+{
+  (void)first;
+
+  while (count > 0)
+  {
+    data->client->output_used = 0;
+    moauthdWriteMarkdown(data->client, data->text);
+
+    count --;
+  }
+}
+
+
+//
+// 'replay_tokens()' - Replay journal records for tokens.
+//
+
+static void
+replay_tokens(bench_data_t *data,	// I - Benchmark data
+              size_t       first,	// I - First iteration
+              size_t       count)	// I - Number of iterations
+{
+  while (count > 0)
+  {
+    moauthdReplayState(data->server, "Token", data->strings[first % data->num_strings]);
+
+    first ++;
+    count --;
+  }
+}
+
+
+//
+// 'run_bench()' - Run a benchmark and write the results.
+//
+
+static size_t				// O - Number of iterations
+run_bench(const char   *name,		// I - Benchmark name
+          bench_cb_t   cb,		// I - Benchmark callback
+          bench_data_t *data,		// I - Benchmark data
+          int          threads,		// I - Number of threads
+          size_t       max_iterations,	// I - Maximum iterations per thread or 0 for no limit
+          size_t       bytes)		// I - Bytes processed per iteration or 0
+{
+  int			i;		// Looping var
+  bench_thread_t	*bthreads;	// Benchmark threads
+  cups_thread_t		*tids;		// Thread IDs
+  uint64_t		start,		// Start time
+			elapsed;	// Elapsed time
+  size_t		iterations = 0;	// Total iterations
+  double		ops_per_sec;	// Operations per second
+
+
+  if (!want_bench(name))
+    return (0);
+
+  if ((bthreads = calloc((size_t)threads, sizeof(bench_thread_t))) == NULL || (tids = calloc((size_t)threads, sizeof(cups_thread_t))) == NULL)
+  {
+    free(bthreads);
+    return (0);
+  }
+
+  start = moauthdGetTime();
+
+  for (i = 0; i < threads; i ++)
+  {
+    bthreads[i].cb             = cb;
+    bthreads[i].data           = data;
+    bthreads[i].end_time       = start + bench_usecs;
+    bthreads[i].first          = (size_t)i * 7919;
+    bthreads[i].max_iterations = max_iterations;
+  }
+
+  if (threads == 1)
+  {
+    run_thread(bthreads);
+  }
+  else
+  {
+    for (i = 0; i < threads; i ++)
+    {
+      if ((tids[i] = cupsThreadCreate((cups_thread_func_t)run_thread, bthreads + i)) == CUPS_THREAD_INVALID)
+        run_thread(bthreads + i);
+    }
+
+    for (i = 0; i < threads; i ++)
+    {
+      if (tids[i] != CUPS_THREAD_INVALID)
+        cupsThreadWait(tids[i]);
+    }
+  }
+
+  if ((elapsed = moauthdGetTime() - start) == 0)
+    elapsed = 1;
+
+  for (i = 0; i < threads; i ++)
+    iterations += bthreads[i].iterations;
+
+  free(bthreads);
+  free(tids);
+
+  if (iterations == 0)
+    return (0);
+
+  ops_per_sec = iterations * 1000000.0 / elapsed;
+
+  printf("{\"name\":\"%s\",\"threads\":%d,\"iterations\":%lu,\"ns_per_op\":%.1f,\"ops_per_sec\":%.1f", name, threads, (unsigned long)iterations, 1000.0 * elapsed * threads / iterations, ops_per_sec);
+  if (bytes)
+    printf(",\"mb_per_sec\":%.1f", ops_per_sec * bytes / 1048576.0);
+  puts("}");
+  fflush(stdout);
+
+  return (iterations);
+}
+
+
+//
+// 'run_requests()' - Run a request benchmark on a loopback connection.
+//
+// Requests are served on the calling thread like moauthdRunClient does.
+//
+
+static void
+run_requests(const char   *name,	// I - Benchmark name
+             bench_data_t *data,	// I - Benchmark data
+             const char   *resource,	// I - Resource to request
+             size_t       bytes)	// I - Bytes sent per request or 0
+{
+  bench_conn_t	conn;			// Loopback connection
+
+
+  if (!want_bench(name))
+    return;
+
+  memset(data->client, 0, sizeof(moauthd_client_t));
+  data->client->server = data->server;
+
+  if (!open_conn(data, &conn, resource))
+    return;
+
+  request_errors = 0;
+
+  run_bench(name, (bench_cb_t)serve_requests, data, 1, 0, bytes);
+
+  close_conn(data, &conn);
+
+  if (request_errors)
+    fprintf(stderr, "benchmoauthd: %lu %s requests failed.\n", (unsigned long)request_errors, name);
+}
+
+
+//
+// 'run_thread()' - Run batches of iterations until time runs out.
+//
+
+static void *				// O - Thread exit status
+run_thread(bench_thread_t *thread)	// I - Benchmark thread
+{
+  size_t	batch = 1,		// Iterations in current batch
+		count;			// Iterations to run
+
+
+  while ((!thread->max_iterations || thread->iterations < thread->max_iterations) && moauthdGetTime() < thread->end_time)
+  {
+    count = batch;
+    if (thread->max_iterations && count > (thread->max_iterations - thread->iterations))
+      count = thread->max_iterations - thread->iterations;
+
+    (thread->cb)(thread->data, thread->first + thread->iterations, count);
+
+    thread->iterations += count;
+
+    if (batch < 1024)
+      batch *= 2;
+  }
+
+  return (NULL);
+}
+
+
+//
+// 'send_requests()' - Send GET requests and discard the responses.
+//
+// The thread exits when the serving side of the connection is closed.
+//
+
+static void *				// O - Thread exit status
+send_requests(bench_conn_t *conn)	// I - Loopback connection
+{
+  http_status_t	status;			// HTTP status
+  char		buffer[65536];		// Response data
+
+
+  for (;;)
+  {
+    httpClearFields(conn->http);
+
+    if (!httpWriteRequest(conn->http, "GET", conn->resource))
+      break;
+
+    while ((status = httpUpdate(conn->http)) == HTTP_STATUS_CONTINUE);
+
+    if (status == HTTP_STATUS_ERROR)
+      break;
+    else if (status != HTTP_STATUS_OK)
+      request_errors ++;
+
+    while (httpRead(conn->http, buffer, sizeof(buffer)) > 0);
+  }
+
+  return (NULL);
+}
+
+
+//
+// 'serve_requests()' - Read and respond to requests.
+//
+
+static void
+serve_requests(bench_data_t *data,	// I - Benchmark data
+               size_t       first,	// I - First iteration (unused)
+               size_t       count)	// I - Number of iterations
+{
+  moauthd_client_t	*client = data->client;
+					// Client for the serving side
+  http_state_t		state;		// Request method
+  http_status_t		status;		// HTTP status
+  moauthd_endpoint_t	*endpoint;	// Endpoint for request
+
+
+  (void)first;
+
+  while (count > 0)
+  {
+    // Read the request line and header from the request thread...
+    while ((state = httpReadRequest(client->http, client->path_info, sizeof(client->path_info))) == HTTP_STATE_WAITING && httpWait(client->http, 10000));
+
+    if (state != HTTP_STATE_GET)
+    {
+      request_errors ++;
+      return;
+    }
+
+    if ((client->query_string = strchr(client->path_info, '?')) != NULL)
+      *(client->query_string)++ = '\0';
+
+    while ((status = httpUpdate(client->http)) == HTTP_STATUS_CONTINUE);
+
+    if (status != HTTP_STATUS_OK)
+    {
+      request_errors ++;
+      return;
+    }
+
+    client->request_method = state;
+    client->remote_scopes  = 1ULL << MOAUTHD_SCOPE_PUBLIC;
+    client->remote_uid     = (uid_t)-1;
+
+    moauthdLogc(client, MOAUTHD_LOGLEVEL_INFO, "%s %s", httpStateString(state), client->path_info);
+
+    // Respond like moauthdRunClient does...
+    if ((endpoint = moauthdFindEndpoint(client->server, client->path_info)) != NULL)
+      (endpoint->cb)(client);
+    else
+      moauthdGetFile(client);
+
+    count --;
+  }
+}
+
+
+//
+// 'stress_tokens()' - Find, delete, re-add, and reap tokens.
+//
+// Each thread starts at a different iteration number, so the threads are
+// always working on different operations for overlapping tokens.  Tokens are
+// re-added with a past expiration time half of the time so the reaper has
+// work to do.
+//
+
+static void
+stress_tokens(bench_data_t *data,	// I - Benchmark data
+              size_t       first,	// I - First iteration
+              size_t       count)	// I - Number of iterations
+{
+  const char		*s;		// Token string
+  moauthd_token_t	*token;		// Current token
+  time_t		curtime;	// Current time
+
+
+  while (count > 0)
+  {
+    s = data->strings[first % data->num_strings];
+
+    if ((first % 256) == 2)
+    {
+      // Reap expired tokens...
+      moauthdReapTokens(data->server, time(NULL));
+    }
+    else if ((first % 16) == 1)
+    {
+      // Add the token back if it was deleted...
+      curtime = time(NULL);
+
+      if ((token = new_token(s, data->text, (first & 16) ? curtime - 1 : curtime + 3600)) != NULL)
+        moauthdAddToken(data->server, token);
+    }
+    else if ((token = moauthdFindToken(data->server, s)) != NULL)
+    {
+      // Delete some of the tokens, then check the token while we still hold
+      // a reference to it...
+      if ((first % 16) == 0)
+        moauthdDeleteToken(data->server, token);
+
+      if (strcmp(token->token, s) || strcmp(token->user, data->text) || atomic_load(&token->refcount) < 1)
+      {
+        fprintf(stderr, "benchmoauthd: Bad token found for \"%s\".\n", s);
+        stress_errors ++;
+      }
+
+      moauthdReleaseToken(token);
+    }
+
+    first ++;
+    count --;
+  }
+}
+
+
+//
+// 'want_bench()' - Determine whether to run benchmarks starting with a name.
+//
+
+static bool				// O - `true` to run, `false` to skip
+want_bench(const char *prefix)		// I - Benchmark name or prefix
+{
+  int		i;			// Looping var
+  size_t	prefixlen = strlen(prefix);
+					// Length of prefix
+
+
+  if (num_names == 0)
+    return (true);
+
+  for (i = 0; i < num_names; i ++)
+  {
+    // Match either way so that "FindToken" runs all of the FindToken
+    // benchmarks and "FindToken/1000" asks for the setup that "FindToken"
+    // needs...
+    if (!strncmp(names[i], prefix, prefixlen) || !strncmp(names[i], prefix, strlen(names[i])))
+      return (true);
+  }
+
+  return (false);
+}
+
+
+//
+// 'write_html()' - Write HTML text with escaping.
+//
+
+static void
+write_html(bench_data_t *data,		// I - Benchmark data
+           size_t       first,		// I - First iteration (unused)
+           size_t       count)		// I - Number of iterations
+{
+  (void)first;
+
+  while (count > 0)
+  {
+    data->client->output_used = 0;
+    moauthdHTMLPrintf(data->client, "<p>%s</p>\n", data->text);
+
+    count --;
+  }
+}
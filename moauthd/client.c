@@ -9,25 +9,72 @@
 
 #include "moauthd.h"
 #include <cups/form.h>
-#include <pwd.h>
-#include <grp.h>
 
 
 //
 // Local functions...
 //
 
+static int	compare_endpoints(const void *a, const void *b);
 static bool	do_authorize(moauthd_client_t *client);
 static bool	do_introspect(moauthd_client_t *client);
 static bool	do_register(moauthd_client_t *client);
+static bool	do_revoke(moauthd_client_t *client);
 static bool	do_token(moauthd_client_t *client);
 static bool	do_userinfo(moauthd_client_t *client);
+static void	finish_request(moauthd_client_t *client);
+static void	set_remote_ident(moauthd_client_t *client, moauthd_ident_t *user);
+static bool	timeout_cb(http_t *http, moauthd_client_t *client);
 static bool	validate_uri(const char *uri, const char *urischeme);
 
 
+//
+// 'moauthdAddEndpoint()' - Add an endpoint handler.
+//
+// Endpoints are added while the server starts up and are looked up without
+// a lock.  The path string must remain valid for the life of the server.
+//
+
+bool					// O - `true` on success, `false` on error
+moauthdAddEndpoint(
+    moauthd_server_t      *server,	// I - Server object
+    const char            *path,	// I - Request path
+    unsigned              methods,	// I - Supported methods (`MOAUTHD_METHOD(state)` bits)
+    moauthd_endpoint_cb_t cb)		// I - Handler
+{
+  moauthd_endpoint_t	*endpoint;	// New endpoint
+
+
+  if (moauthdFindEndpoint(server, path))
+    return (false);
+
+  if ((endpoint = realloc(server->endpoints, (server->num_endpoints + 1) * sizeof(moauthd_endpoint_t))) == NULL)
+    return (false);
+
+  server->endpoints = endpoint;
+  endpoint += server->num_endpoints;
+  server->num_endpoints ++;
+
+  endpoint->path    = path;
+  endpoint->methods = methods;
+  endpoint->cb      = cb;
+
+  server->endpoint_methods |= methods;
+
+  qsort(server->endpoints, server->num_endpoints, sizeof(moauthd_endpoint_t), compare_endpoints);
+
+  return (true);
+}
+
+
 //
 // 'moauthdCreateClient()' - Accept a connection and create a client object.
 //
+// The TLS session is established by the first call to `moauthdRunClient`
+// so that the event loop is not blocked by the handshake.  Reads and writes
+// give up after `MOAUTHD_IO_TIMEOUT` seconds so that a stalled connection
+// cannot hold a worker thread.
+//
 
 moauthd_client_t *			// O - New client object
 moauthdCreateClient(
@@ -44,7 +91,7 @@ moauthdCreateClient(
     return (NULL);
   }
 
-  client->number = ++ server->num_clients;
+  client->number = atomic_fetch_add(&server->num_clients, 1) + 1;
   client->server = server;
 
   if ((client->http = httpAcceptConnection(fd, false)) == NULL)
@@ -56,21 +103,11 @@ moauthdCreateClient(
   }
 
   httpGetHostname(client->http, client->remote_host, sizeof(client->remote_host));
+  httpSetTimeout(client->http, MOAUTHD_IO_TIMEOUT, (http_timeout_cb_t)timeout_cb, client);
 
-  moauthdLogc(client, MOAUTHD_LOGLEVEL_INFO, "Accepted connection from \"%s\".", client->remote_host);
-
-  if (!httpSetEncryption(client->http, HTTP_ENCRYPTION_ALWAYS))
-  {
-    moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Unable to establish TLS session: %s", cupsGetErrorString());
-    httpClose(client->http);
-    free(client);
-
-    return (NULL);
-  }
-
-  httpSetBlocking(client->http, true);
+  client->activity = time(NULL);
 
-  moauthdLogc(client, MOAUTHD_LOGLEVEL_INFO, "TLS session established.");
+  moauthdLogc(client, MOAUTHD_LOGLEVEL_INFO, "Accepted connection from \"%s\".", client->remote_host);
 
   return (client);
 }
@@ -88,15 +125,64 @@ moauthdDeleteClient(
 
   moauthdLogc(client, MOAUTHD_LOGLEVEL_INFO, "Connection closed.");
 
+  moauthdReleaseToken(client->remote_token);
+  moauthdReleaseIdent(client->remote_ident);
+
+  free(client->output);
   free(client);
 }
 
 
+//
+// 'moauthdFindEndpoint()' - Find the endpoint for a request path.
+//
+
+moauthd_endpoint_t *			// O - Endpoint or `NULL` if none
+moauthdFindEndpoint(
+    moauthd_server_t *server,		// I - Server object
+    const char       *path)		// I - Request path
+{
+  moauthd_endpoint_t	key;		// Search key
+
+
+  if (!server->num_endpoints)
+    return (NULL);
+
+  key.path = path;
+
+  return ((moauthd_endpoint_t *)bsearch(&key, server->endpoints, server->num_endpoints, sizeof(moauthd_endpoint_t), compare_endpoints));
+}
+
+
+//
+// 'moauthdInitEndpoints()' - Add the standard OAuth endpoints.
+//
+
+void
+moauthdInitEndpoints(
+    moauthd_server_t *server)		// I - Server object
+{
+  moauthdAddEndpoint(server, "/authorize", MOAUTHD_METHOD(HTTP_STATE_GET) | MOAUTHD_METHOD(HTTP_STATE_HEAD) | MOAUTHD_METHOD(HTTP_STATE_POST), do_authorize);
+  moauthdAddEndpoint(server, "/introspect", MOAUTHD_METHOD(HTTP_STATE_POST), do_introspect);
+  moauthdAddEndpoint(server, "/metrics", MOAUTHD_METHOD(HTTP_STATE_GET) | MOAUTHD_METHOD(HTTP_STATE_HEAD), moauthdSendMetrics);
+  moauthdAddEndpoint(server, "/register", MOAUTHD_METHOD(HTTP_STATE_POST), do_register);
+  moauthdAddEndpoint(server, "/revoke", MOAUTHD_METHOD(HTTP_STATE_POST), do_revoke);
+  moauthdAddEndpoint(server, "/token", MOAUTHD_METHOD(HTTP_STATE_POST), do_token);
+  moauthdAddEndpoint(server, "/userinfo", MOAUTHD_METHOD(HTTP_STATE_GET) | MOAUTHD_METHOD(HTTP_STATE_POST), do_userinfo);
+}
+
+
 //
 // 'moauthdRunClient()' - Process requests from a client object.
 //
+// This function processes requests until no more data is available from the
+// client, at which point the connection can be parked in the event loop until
+// the next request arrives.  The TLS handshake and each request line and
+// header must be read within `MOAUTHD_REQUEST_TIMEOUT` seconds, otherwise the
+// event loop shuts the connection down.
+//
 
-void *					// O - Thread return status (ignored)
+bool					// O - `true` to keep the connection open, `false` to close it
 moauthdRunClient(
     moauthd_client_t *client)		// I - Client object
 {
@@ -109,17 +195,46 @@ moauthdRunClient(
   int			host_port;	// Port number
   char			uri_prefix[300];// URI prefix for server
   size_t		uri_prefix_len;	// Length of URI prefix
+  moauthd_endpoint_t	*endpoint;	// Endpoint for request
+  uint64_t		auth_time;	// Start of authentication
 
 
   snprintf(host_value, sizeof(host_value), "%s:%d", client->server->name, client->server->port);
   snprintf(uri_prefix, sizeof(uri_prefix), "https://%s:%d", client->server->name, client->server->port);
   uri_prefix_len = strlen(uri_prefix);
 
+  if (!client->started)
+  {
+    // Establish the TLS session for a new connection...
+    client->deadline = time(NULL) + MOAUTHD_REQUEST_TIMEOUT;
+
+    if (!httpSetEncryption(client->http, HTTP_ENCRYPTION_ALWAYS))
+    {
+      moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Unable to establish TLS session: %s", cupsGetErrorString());
+      return (false);
+    }
+
+    httpSetBlocking(client->http, true);
+
+    client->started = true;
+
+    moauthdLogc(client, MOAUTHD_LOGLEVEL_INFO, "TLS session established.");
+  }
+
   while (!done)
   {
     // Get a request line...
-    while ((state = httpReadRequest(client->http, client->path_info, sizeof(client->path_info))) == HTTP_STATE_WAITING)
-      usleep(1);
+    client->deadline = time(NULL) + MOAUTHD_REQUEST_TIMEOUT;
+
+    if ((state = httpReadRequest(client->http, client->path_info, sizeof(client->path_info))) == HTTP_STATE_WAITING)
+    {
+      // No request yet, wait for more data in the event loop as needed...
+      if (httpWait(client->http, 0))
+        continue;
+
+      client->deadline = 0;
+      return (true);
+    }
 
     if (state == HTTP_STATE_ERROR)
     {
@@ -130,7 +245,18 @@ moauthdRunClient(
 
       break;
     }
-    else if (state == HTTP_STATE_UNKNOWN_METHOD)
+
+    // Start timing the request...
+    client->request_time    = moauthdGetTime();
+    client->request_method  = state;
+    client->header_usecs    = 0;
+    client->auth_usecs      = 0;
+    client->write_usecs     = 0;
+    client->response_status = HTTP_STATUS_NONE;
+    client->response_bytes  = 0;
+    client->request_timing  = MOAUTHD_TIMING_REQUEST + client->server->num_endpoints + 1;
+
+    if (state == HTTP_STATE_UNKNOWN_METHOD)
     {
       moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Bad/unknown operation.");
       moauthdRespondClient(client, HTTP_STATUS_BAD_REQUEST, NULL, NULL, 0, 0);
@@ -143,8 +269,6 @@ moauthdRunClient(
       break;
     }
 
-    client->request_method = state;
-
     moauthdLogc(client, MOAUTHD_LOGLEVEL_INFO, "%s %s", httpStateString(state), client->path_info);
 
     if (client->path_info[0] != '/' && !strncmp(client->path_info, uri_prefix, uri_prefix_len) && client->path_info[uri_prefix_len] == '/')
@@ -179,6 +303,9 @@ moauthdRunClient(
       break;
     }
 
+    auth_time            = moauthdGetTime();
+    client->header_usecs = auth_time - client->request_time;
+
     // Validate Host: header...
     cupsCopyString(host_value, httpGetField(client->http, HTTP_FIELD_HOST), sizeof(host_value));
 
@@ -219,6 +346,12 @@ moauthdRunClient(
       }
     }
 
+    moauthdReleaseToken(client->remote_token);
+    moauthdReleaseIdent(client->remote_ident);
+
+    client->remote_token   = NULL;
+    client->remote_ident   = NULL;
+    client->remote_scopes  = 1ULL << MOAUTHD_SCOPE_PUBLIC;
     client->remote_user[0] = '\0';
     client->remote_uid     = (uid_t)-1;
 
@@ -233,7 +366,8 @@ moauthdRunClient(
 		*password;		// Password value
         size_t	userlen = sizeof(username);
 					// Length of username:password
-        struct passwd *user;		// User information
+        moauthd_ident_t *user;		// User information
+        moauthd_auth_t auth;		// Authentication result
 
 
         for (authorization += 6; *authorization && isspace(*authorization & 255); authorization ++);
@@ -243,31 +377,27 @@ moauthdRunClient(
         {
           *password++ = '\0';
 
-          if (moauthdAuthenticateUser(client, username, password))
+          if ((auth = moauthdAuthenticateUser(client, username, password)) == MOAUTHD_AUTH_SUCCEEDED)
           {
-            if ((user = getpwnam(username)) != NULL)
+            if ((user = moauthdFindUser(client->server, username)) != NULL)
 	    {
 	      moauthdLogc(client, MOAUTHD_LOGLEVEL_INFO, "Authenticated as \"%s\" using Basic.", username);
 	      cupsCopyString(client->remote_user, username, sizeof(client->remote_user));
-	      client->remote_uid = user->pw_uid;
-
-              client->num_remote_gids = (int)(sizeof(client->remote_gids) / sizeof(client->remote_gids[0]));
-
-#ifdef __APPLE__
-              if (getgrouplist(client->remote_user, (int)user->pw_gid, client->remote_gids, &client->num_remote_gids))
-#else
-              if (getgrouplist(client->remote_user, user->pw_gid, client->remote_gids, &client->num_remote_gids))
-#endif // __APPLE__
-              {
-                moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Unable to lookup groups for user \"%s\": %s", username, strerror(errno));
-                client->num_remote_gids = 0;
-	      }
+	      client->remote_uid = user->uid;
+
+	      set_remote_ident(client, user);
 	    }
 	    else
 	    {
 	      moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Unable to lookup user \"%s\".", username);
 	    }
 	  }
+	  else if (auth == MOAUTHD_AUTH_BUSY)
+	  {
+	    client->auth_usecs = moauthdGetTime() - auth_time;
+	    moauthdRespondClient(client, HTTP_STATUS_SERVICE_UNAVAILABLE, NULL, NULL, 0, 0);
+	    break;
+	  }
 	  else
 	  {
 	    moauthdLogc(client, MOAUTHD_LOGLEVEL_INFO, "Basic authentication of \"%s\" failed.", username);
@@ -293,9 +423,8 @@ moauthdRunClient(
           {
 	    moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Bearer token has expired.");
 
-            pthread_rwlock_wrlock(&client->server->tokens_lock);
-            cupsArrayRemove(client->server->tokens, token);
-            pthread_rwlock_unlock(&client->server->tokens_lock);
+            moauthdDeleteToken(client->server, token);
+            moauthdReleaseToken(token);
 
             token = NULL;
           }
@@ -303,6 +432,8 @@ moauthdRunClient(
           {
 	    moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Bearer token is of the wrong type.");
 
+            moauthdReleaseToken(token);
+
             token = NULL;
 	  }
 	}
@@ -314,16 +445,16 @@ moauthdRunClient(
           client->remote_uid   = token->uid;
           cupsCopyString(client->remote_user, token->user, sizeof(client->remote_user));
 
-	  client->num_remote_gids = (int)(sizeof(client->remote_gids) / sizeof(client->remote_gids[0]));
-
-#ifdef __APPLE__
-	  if (getgrouplist(token->user, (int)token->gid, client->remote_gids, &client->num_remote_gids))
-#else
-	  if (getgrouplist(token->user, token->gid, client->remote_gids, &client->num_remote_gids))
-#endif // __APPLE__
+	  if (token->identity)
 	  {
-	    moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Unable to lookup groups for user \"%s\": %s", token->user, strerror(errno));
-	    client->num_remote_gids = 0;
+	    // Use the groups saved when the token was issued...
+	    atomic_fetch_add(&token->identity->refcount, 1);
+	    set_remote_ident(client, token->identity);
+	  }
+	  else
+	  {
+	    // Token was loaded from the state file, use the user cache...
+	    set_remote_ident(client, moauthdFindUser(client->server, token->user));
 	  }
         }
       }
@@ -338,6 +469,8 @@ moauthdRunClient(
 	moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Unsupported Authorization scheme \"%s\".", scheme);
       }
 
+      client->auth_usecs = moauthdGetTime() - auth_time;
+
       if (!client->remote_user[0])
       {
 	moauthdRespondClient(client, HTTP_STATUS_UNAUTHORIZED, NULL, NULL, 0, 0);
@@ -365,6 +498,13 @@ moauthdRunClient(
       }
     }
 
+    endpoint = moauthdFindEndpoint(client->server, client->path_info);
+
+    if (endpoint)
+      client->request_timing = MOAUTHD_TIMING_REQUEST + (size_t)(endpoint - client->server->endpoints);
+    else if (client->request_method == HTTP_STATE_GET || client->request_method == HTTP_STATE_HEAD)
+      client->request_timing = MOAUTHD_TIMING_REQUEST + client->server->num_endpoints;
+
     switch (client->request_method)
     {
       case HTTP_STATE_OPTIONS :
@@ -374,47 +514,26 @@ moauthdRunClient(
 	  break;
 
       case HTTP_STATE_HEAD :
-	  if (!strcmp(client->path_info, "/authorize"))
-	    done = !do_authorize(client);
-	  else if (moauthdGetFile(client) >= HTTP_STATUS_BAD_REQUEST)
-	    done = true;
-	  break;
-
       case HTTP_STATE_GET :
-	  if (!strcmp(client->path_info, "/authorize"))
-	    done = !do_authorize(client);
-	  else if (!strcmp(client->path_info, "/userinfo"))
-	    done = !do_userinfo(client);
-	  else if (moauthdGetFile(client) >= HTTP_STATUS_BAD_REQUEST)
-	    done = true;
-	  break;
-
       case HTTP_STATE_POST :
-	  if (!strcmp(client->path_info, "/authorize"))
-	  {
-	    done = !do_authorize(client);
-	  }
-	  else if (!strcmp(client->path_info, "/introspect"))
-	  {
-	    done = !do_introspect(client);
-	  }
-	  else if (!strcmp(client->path_info, "/register"))
+	  if (endpoint && (endpoint->methods & MOAUTHD_METHOD(client->request_method)))
 	  {
-	    done = !do_register(client);
+	    done = !(endpoint->cb)(client);
 	  }
-	  else if (!strcmp(client->path_info, "/token"))
+	  else if (endpoint)
 	  {
-	    done = !do_token(client);
-	  }
-	  else if (!strcmp(client->path_info, "/userinfo"))
-	  {
-	    done = !do_userinfo(client);
+	    moauthdRespondClient(client, HTTP_STATUS_METHOD_NOT_ALLOWED, NULL, NULL, 0, 0);
+	    done = true;
 	  }
-	  else
+	  else if (client->request_method == HTTP_STATE_POST)
 	  {
 	    moauthdRespondClient(client, HTTP_STATUS_NOT_FOUND, NULL, NULL, 0, 0);
             done = true;
 	  }
+	  else if (moauthdGetFile(client) >= HTTP_STATUS_BAD_REQUEST)
+	  {
+	    done = true;
+	  }
           break;
 
       default :
@@ -423,11 +542,31 @@ moauthdRunClient(
           done = true;
 	  break;
     }
+
+    // Log the request...
+    finish_request(client);
+
+    // Park the connection if there is no pending request...
+    if (!done && !httpWait(client->http, 0))
+      return (true);
   }
 
-  moauthdDeleteClient(client);
+  // Log a request that ended the connection early...
+  finish_request(client);
 
-  return (NULL);
+  return (false);
+}
+
+
+//
+// 'compare_endpoints()' - Compare the paths of two endpoints.
+//
+
+static int				// O - Result of comparison
+compare_endpoints(const void *a,	// I - First endpoint
+                  const void *b)	// I - Second endpoint
+{
+  return (strcmp(((const moauthd_endpoint_t *)a)->path, ((const moauthd_endpoint_t *)b)->path));
 }
 
 
@@ -452,6 +591,7 @@ do_authorize(moauthd_client_t *client)	// I - Client object
 		*password;		// password variable
   moauthd_application_t *app;		// Application
   moauthd_token_t *token;		// Token
+  moauthd_auth_t auth;			// Authentication result
   char		uri[2048];		// Redirect URI
   const char	*prefix;		// Prefix string
 
@@ -613,20 +753,30 @@ do_authorize(moauthd_client_t *client)	// I - Client object
 	else
 	  prefix = "?";
 
-        if (!username || !password || !moauthdAuthenticateUser(client, username, password))
+        if (username && password)
+          auth = moauthdAuthenticateUser(client, username, password);
+        else
+          auth = MOAUTHD_AUTH_FAILED;
+
+        if (auth == MOAUTHD_AUTH_BUSY)
+        {
+          cupsFreeOptions(num_vars, vars);
+
+          return (moauthdRespondClient(client, HTTP_STATUS_SERVICE_UNAVAILABLE, NULL, NULL, 0, 0));
+        }
+        else if (auth == MOAUTHD_AUTH_FAILED)
         {
           snprintf(uri, sizeof(uri), "%s%serror=access_denied&error_description=Bad+username+or+password.%s%s", redirect_uri, prefix, state ? "&state=" : "", state ? state : "");
         }
-        else if ((token = moauthdCreateToken(client->server, MOAUTHD_TOKTYPE_GRANT, app, username, scope)) == NULL)
+        else if ((token = moauthdCreateToken(client->server, MOAUTHD_TOKTYPE_GRANT, app, username, scope, challenge)) == NULL)
         {
           snprintf(uri, sizeof(uri), "%s%serror=server_error&error_description=Unable+to+create+grant.%s%s", redirect_uri, prefix, state ? "&state=" : "", state ? state : "");
         }
         else
         {
-          if (challenge)
-            token->challenge = strdup(challenge);
-
           snprintf(uri, sizeof(uri), "%s%scode=%s%s%s", redirect_uri, prefix, token->token, state ? "&state=" : "", state ? state : "");
+
+          moauthdReleaseToken(token);
         }
 
         cupsFreeOptions(num_vars, vars);
@@ -673,16 +823,9 @@ do_introspect(moauthd_client_t *client)	// I - Client object
       // Not yet authenticated...
       status = HTTP_STATUS_UNAUTHORIZED;
     }
-    else
+    else if (!moauthdHasGroup(client->remote_ident, client->server->introspect_group))
     {
-      int i;				// Looping var
-
-      for (i = 0; i < client->num_remote_gids; i ++)
-	if (client->remote_gids[i] == client->server->introspect_group)
-	  break;
-
-      if (i >= client->num_remote_gids)
-	status = HTTP_STATUS_FORBIDDEN;
+      status = HTTP_STATUS_FORBIDDEN;
     }
   }
 
@@ -716,12 +859,15 @@ do_introspect(moauthd_client_t *client)	// I - Client object
   cupsJSONNew(json, cupsJSONNewKey(json, /*after*/NULL, "active"), token->expires > time(NULL) ? CUPS_JTYPE_TRUE : CUPS_JTYPE_FALSE);
   jarray = cupsJSONNew(json, cupsJSONNewKey(json, /*after*/NULL, "scope"), CUPS_JTYPE_ARRAY);
   cupsJSONNewString(jarray, /*after*/NULL, token->scopes);// TODO: Fix this
-  cupsJSONNewString(json, cupsJSONNewKey(json, /*after*/NULL, "client_id"), token->application->client_id);
+  if (token->application)
+    cupsJSONNewString(json, cupsJSONNewKey(json, /*after*/NULL, "client_id"), token->application->client_id);
   cupsJSONNewString(json, cupsJSONNewKey(json, /*after*/NULL, "username"), token->user);
   cupsJSONNewString(json, cupsJSONNewKey(json, /*after*/NULL, "token_type"), types[token->type]);
   cupsJSONNewNumber(json, cupsJSONNewKey(json, /*after*/NULL, "exp"), (double)token->expires);
   cupsJSONNewNumber(json, cupsJSONNewKey(json, /*after*/NULL, "iat"), (double)token->created);
 
+  moauthdReleaseToken(token);
+
   data = cupsJSONExportString(json);
   cupsJSONDelete(json);
 
@@ -742,7 +888,7 @@ do_introspect(moauthd_client_t *client)	// I - Client object
     return (false);
   }
 
-  if (httpWrite(client->http, data, datalen) < datalen)
+  if (!moauthdWriteClient(client, data, datalen))
   {
     free(data);
     return (false);
@@ -784,6 +930,7 @@ do_register(moauthd_client_t *client)	// I - Client object
   char		client_id[65];		// client_id value
   const char	*error = NULL;		// Error code, if any
   char		error_message[1024];	// Error message, if any
+  moauthd_application_t *app;		// Registered application
 
 
   if (client->server->register_group != (gid_t)-1)
@@ -794,18 +941,9 @@ do_register(moauthd_client_t *client)	// I - Client object
       // Not yet authenticated...
       status = HTTP_STATUS_UNAUTHORIZED;
     }
-    else
+    else if (!moauthdHasGroup(client->remote_ident, client->server->register_group))
     {
-      int i;				// Looping var
-
-      for (i = 0; i < client->num_remote_gids; i ++)
-      {
-	if (client->remote_gids[i] == client->server->register_group)
-	  break;
-      }
-
-      if (i >= client->num_remote_gids)
-	status = HTTP_STATUS_FORBIDDEN;
+      status = HTTP_STATUS_FORBIDDEN;
     }
   }
 
@@ -879,9 +1017,12 @@ do_register(moauthd_client_t *client)	// I - Client object
   {
     moauthdLogc(client, MOAUTHD_LOGLEVEL_DEBUG, "Client %s %s is already registered.", client_id, redirect_uris);
   }
-  else if (moauthdAddApplication(client->server, client_id, redirect_uris, client_name, client_uri, logo_uri, tos_uri))
+  else if ((app = moauthdAddApplication(client->server, client_id, redirect_uris, client_name, client_uri, logo_uri, tos_uri)) != NULL)
   {
     moauthdLogc(client, MOAUTHD_LOGLEVEL_DEBUG, "Client %s %s registered.", client_id, redirect_uris);
+
+    app->registered = true;
+    moauthdJournalApplication(client->server, app);
   }
   else
   {
@@ -936,7 +1077,7 @@ do_register(moauthd_client_t *client)	// I - Client object
     return (false);
   }
 
-  if (httpWrite(client->http, data, datalen) < datalen)
+  if (!moauthdWriteClient(client, data, datalen))
   {
     free(data);
     return (false);
@@ -976,6 +1117,77 @@ do_register(moauthd_client_t *client)	// I - Client object
 }
 
 
+//
+// 'do_revoke()' - Process a request for the /revoke endpoint.
+//
+// Tokens are revoked as described in RFC 7009.  Presenting a token is enough
+// to revoke it, except that a token issued to a registered application can
+// only be revoked using that application's client ID.  Unknown and expired
+// tokens are ignored.
+//
+
+static bool				// O - `true` to continue, `false` to stop
+do_revoke(moauthd_client_t *client)	// I - Client object
+{
+  http_status_t	status = HTTP_STATUS_OK;// Response status
+  size_t	num_vars;		// Number of form (request) variables
+  cups_option_t	*vars;			// Form (request) variables
+  char		*data;			// Form data
+  const char	*token_var,		// token variable (REQUIRED)
+		*client_id;		// client_id variable, if any
+  moauthd_token_t *token;		// Token
+
+
+  if ((data = _moauthCopyMessageBody(client->http)) == NULL)
+    return (moauthdRespondClient(client, HTTP_STATUS_BAD_REQUEST, NULL, NULL, 0, 0));
+
+  num_vars  = cupsFormDecode(data, &vars);
+  token_var = cupsGetOption("token", num_vars, vars);
+  client_id = cupsGetOption("client_id", num_vars, vars);
+
+  free(data);
+
+  if (!token_var)
+  {
+    // Missing required variables!
+    moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Missing token in revoke request.");
+
+    status = HTTP_STATUS_BAD_REQUEST;
+  }
+  else if ((token = moauthdFindToken(client->server, token_var)) != NULL)
+  {
+    // Stateless tokens keep their client_id claim even when the client is
+    // no longer registered...
+    const char *token_client = token->application ? token->application->client_id : token->client_id;
+					// Client the token was issued to
+
+    if (token_client && (!client_id || strcmp(client_id, token_client)))
+    {
+      moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Token in revoke request was issued to another client.");
+
+      status = HTTP_STATUS_BAD_REQUEST;
+    }
+    else if (moauthdDeleteToken(client->server, token))
+    {
+      moauthdLogc(client, MOAUTHD_LOGLEVEL_INFO, "Revoked token for \"%s\".", token->user);
+    }
+
+    moauthdReleaseToken(token);
+  }
+
+  cupsFreeOptions(num_vars, vars);
+
+  if (status != HTTP_STATUS_OK)
+    return (moauthdRespondClient(client, status, NULL, NULL, 0, 0));
+
+  // The response content is ignored by clients, send an empty JSON object...
+  if (!moauthdRespondClient(client, HTTP_STATUS_OK, "application/json", NULL, 0, 2))
+    return (false);
+
+  return (moauthdWriteClient(client, "{}", 2));
+}
+
+
 //
 // 'do_token()' - Process a request for the /token endpoint.
 //
@@ -995,8 +1207,9 @@ do_token(moauthd_client_t *client)	// I - Client object
 		*username,		// username variable (REQURIED for Resource Owner Password Grant)
 		*verifier;		// code_verify variable (OPTIONAL)
   moauthd_application_t *app;		// Application
-  moauthd_token_t *grant_token,		// Grant token
-		*access_token;		// Access token
+  moauthd_token_t *grant_token = NULL,	// Grant token
+		*access_token = NULL;	// Access token
+  moauthd_auth_t auth;			// Authentication result
   cups_json_t	*response;		// JSON response
   size_t	datalen;		// Length of JSON data
 
@@ -1047,10 +1260,21 @@ do_token(moauthd_client_t *client)	// I - Client object
 
   if (!strcmp(grant_type, "password"))
   {
-    if (!moauthdAuthenticateUser(client, username, password))
+    if ((auth = moauthdAuthenticateUser(client, username, password)) == MOAUTHD_AUTH_BUSY)
+    {
+      cupsFreeOptions(num_vars, vars);
+
+      return (moauthdRespondClient(client, HTTP_STATUS_SERVICE_UNAVAILABLE, NULL, NULL, 0, 0));
+    }
+    else if (auth == MOAUTHD_AUTH_FAILED)
       goto bad_request;
 
-    access_token = moauthdCreateToken(client->server, MOAUTHD_TOKTYPE_ACCESS, NULL, username, scope);
+    if ((access_token = moauthdCreateToken(client->server, MOAUTHD_TOKTYPE_ACCESS, NULL, username, scope, NULL)) == NULL)
+    {
+      moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Unable to create access token.");
+
+      goto bad_request;
+    }
   }
   else
   {
@@ -1064,8 +1288,10 @@ do_token(moauthd_client_t *client)	// I - Client object
       goto bad_request;
     }
 
-    if ((grant_token = moauthdFindToken(client->server, code)) == NULL)
+    if ((grant_token = moauthdFindToken(client->server, code)) == NULL || grant_token->type != MOAUTHD_TOKTYPE_GRANT)
     {
+      // Only grants can be exchanged - an access token presented as a code
+      // would otherwise be refreshed forever...
       moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Bad code in token request.");
 
       goto bad_request;
@@ -1112,14 +1338,23 @@ do_token(moauthd_client_t *client)	// I - Client object
       }
     }
 
-    if ((access_token = moauthdCreateToken(client->server, MOAUTHD_TOKTYPE_ACCESS, app, grant_token->user, grant_token->scopes)) == NULL)
+    // Consume the grant so it cannot be used again...
+    if (!moauthdDeleteToken(client->server, grant_token))
+    {
+      moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Grant token has already been used.");
+
+      goto bad_request;
+    }
+
+    if ((access_token = moauthdCreateToken(client->server, MOAUTHD_TOKTYPE_ACCESS, app, grant_token->user, grant_token->scopes, NULL)) == NULL)
     {
       moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Unable to create access token.");
 
       goto bad_request;
     }
 
-    moauthdDeleteToken(client->server, grant_token);
+    moauthdReleaseToken(grant_token);
+    grant_token = NULL;
   }
 
   response = cupsJSONNew(/*parent*/NULL, /*after*/NULL, CUPS_JTYPE_OBJECT);
@@ -1127,6 +1362,9 @@ do_token(moauthd_client_t *client)	// I - Client object
   cupsJSONNewString(response, cupsJSONNewKey(response, /*after*/NULL, "token_type"), "access");
   cupsJSONNewNumber(response, cupsJSONNewKey(response, /*after*/NULL, "expires_in"), client->server->max_token_life);
 
+  moauthdReleaseToken(access_token);
+  access_token = NULL;
+
   data = cupsJSONExportString(response);
   cupsJSONDelete(response);
 
@@ -1147,7 +1385,7 @@ do_token(moauthd_client_t *client)	// I - Client object
     return (false);
   }
 
-  if (httpWrite(client->http, data, datalen) < datalen)
+  if (!moauthdWriteClient(client, data, datalen))
   {
     free(data);
     return (false);
@@ -1162,6 +1400,9 @@ do_token(moauthd_client_t *client)	// I - Client object
   // TODO: generate JSON error message body
   bad_request:
 
+  moauthdReleaseToken(access_token);
+  moauthdReleaseToken(grant_token);
+
   cupsFreeOptions(num_vars, vars);
 
   return (moauthdRespondClient(client, HTTP_STATUS_BAD_REQUEST, NULL, NULL, 0, 0));
@@ -1176,12 +1417,9 @@ static bool				// O - `true` on success, `false` on error
 do_userinfo(moauthd_client_t *client)	// I - Client
 {
   bool		ret = false;		// Return value
-  int		error;			// Error value
   const char	*authorization;		// Authorization header
   moauthd_token_t *token;		// Token
-  struct passwd	pw,			// User info
-		*pwresult = NULL;	// Matching result
-  char		pwbuffer[16384];	// User info buffer
+  moauthd_ident_t *user;		// User info
   cups_json_t	*json;			// JSON response
   char		*data;			// Form data
   size_t	datalen;		// Length of JSON data
@@ -1206,21 +1444,25 @@ do_userinfo(moauthd_client_t *client)	// I - Client
     return (moauthdRespondClient(client, HTTP_STATUS_BAD_REQUEST, NULL, NULL, 0, 0));
   }
 
-  if ((error = getpwnam_r(token->user, &pw, pwbuffer, sizeof(pwbuffer), &pwresult)) != 0)
+  if (token->identity)
   {
-    moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Unable to lookup user '%s' information: %s", token->user, strerror(error));
-    return (moauthdRespondClient(client, HTTP_STATUS_BAD_REQUEST, NULL, NULL, 0, 0));
+    user = token->identity;
+    atomic_fetch_add(&user->refcount, 1);
   }
-  else if (!pwresult)
+  else if ((user = moauthdFindUser(client->server, token->user)) == NULL)
   {
-    moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Unable to lookup user '%s' information: NULL result", token->user);
+    moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Unable to lookup user '%s' information.", token->user);
+    moauthdReleaseToken(token);
     return (moauthdRespondClient(client, HTTP_STATUS_BAD_REQUEST, NULL, NULL, 0, 0));
   }
 
   // Return
   json = cupsJSONNew(/*parent*/NULL, /*after*/NULL, CUPS_JTYPE_OBJECT);
   cupsJSONNewString(json, cupsJSONNewKey(json, /*after*/NULL, "sub"), token->user);
-  cupsJSONNewString(json, cupsJSONNewKey(json, /*after*/NULL, "name"), pwresult->pw_gecos);
+  cupsJSONNewString(json, cupsJSONNewKey(json, /*after*/NULL, "name"), user->gecos);
+
+  moauthdReleaseIdent(user);
+  moauthdReleaseToken(token);
 
   data = cupsJSONExportString(json);
   cupsJSONDelete(json);
@@ -1235,7 +1477,7 @@ do_userinfo(moauthd_client_t *client)	// I - Client
 
   if (moauthdRespondClient(client, HTTP_STATUS_OK, "application/json", NULL, 0, datalen))
   {
-    if (httpWrite(client->http, data, datalen) == datalen)
+    if (moauthdWriteClient(client, data, datalen))
       ret = true;
   }
 
@@ -1245,6 +1487,53 @@ do_userinfo(moauthd_client_t *client)	// I - Client
 }
 
 
+//
+// 'finish_request()' - Count and log a completed request.
+//
+
+static void
+finish_request(
+    moauthd_client_t *client)		// I - Client object
+{
+  if (client->request_time)
+    moauthdCountTime(client->server, client->request_timing, moauthdGetTime() - client->request_time);
+
+  moauthdLogAccess(client);
+}
+
+
+//
+// 'set_remote_ident()' - Set the authenticated identity for a client.
+//
+// The client takes over the reference to the identity.
+//
+
+static void
+set_remote_ident(
+    moauthd_client_t *client,		// I - Client
+    moauthd_ident_t  *user)		// I - User identity or `NULL`
+{
+  client->remote_ident  = user;
+  client->remote_scopes = MOAUTHD_SCOPES_AUTHENTICATED | (user ? user->scopes : 0);
+}
+
+
+//
+// 'timeout_cb()' - Give up on a stalled read or write.
+//
+
+static bool				// O - `false` to stop waiting
+timeout_cb(http_t           *http,	// I - HTTP connection
+           moauthd_client_t *client)	// I - Client
+{
+  (void)http;
+
+  moauthdLogc(client, MOAUTHD_LOGLEVEL_INFO, "Timed out waiting for client.");
+
+  return (false);
+}
+
+
 //
 // 'validate_uri()' - Validate the URI.
 //
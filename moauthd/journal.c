@@ -0,0 +1,671 @@
+//
+// State journal for moauth daemon
+//
+// Copyright © 2017-2026 by Michael R Sweet
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Issued tokens and dynamically registered applications are recorded in an
+// append-only journal next to the state file ("STATEFILE.journal").  Records
+// use the same "Name value" format as the state file, with form-encoded
+// values.  The journal is periodically compacted by writing a new snapshot
+// of the current state with `moauthdSaveServer` and starting a new journal.
+// Tokens are saved in the binary token snapshot (see "snapshot.c").
+//
+
+#include "moauthd.h"
+#include <cups/form.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+
+//
+// Local functions...
+//
+
+static void	append_record(moauthd_server_t *server, const char *name, const char *value);
+static bool	compact_journal(moauthd_server_t *server);
+static char	*encode_application(moauthd_application_t *app);
+static char	*encode_revoked(const char *jti, time_t expires);
+static char	*encode_token(moauthd_token_t *token);
+static long	get_number(const char *name, size_t num_vars, cups_option_t *vars, long defval);
+static bool	open_journal(moauthd_server_t *server, bool truncate);
+static size_t	replay_file(moauthd_server_t *server, const char *filename);
+
+
+//
+// 'moauthdJournalApplication()' - Record a registered application.
+//
+
+void
+moauthdJournalApplication(
+    moauthd_server_t      *server,	// I - Server object
+    moauthd_application_t *app)		// I - Application
+{
+  char	*value;				// Encoded application
+
+
+  if ((value = encode_application(app)) != NULL)
+  {
+    append_record(server, "Application", value);
+    free(value);
+  }
+}
+
+
+//
+// 'moauthdJournalCreateToken()' - Record an issued token.
+//
+
+void
+moauthdJournalCreateToken(
+    moauthd_server_t *server,		// I - Server object
+    moauthd_token_t  *token)		// I - Token
+{
+  char	*value;				// Encoded token
+
+
+  if ((value = encode_token(token)) != NULL)
+  {
+    append_record(server, "Token", value);
+    free(value);
+  }
+}
+
+
+//
+// 'moauthdJournalDeleteToken()' - Record a deleted token.
+//
+
+void
+moauthdJournalDeleteToken(
+    moauthd_server_t *server,		// I - Server object
+    moauthd_token_t  *token)		// I - Token
+{
+  append_record(server, "DeleteToken", token->token);
+}
+
+
+//
+// 'moauthdJournalRevokeToken()' - Record a revoked stateless access token.
+//
+
+void
+moauthdJournalRevokeToken(
+    moauthd_server_t *server,		// I - Server object
+    const char       *jti,		// I - Unique ID of token
+    time_t           expires)		// I - When the token expires
+{
+  char	*value;				// Encoded revocation
+
+
+  if ((value = encode_revoked(jti, expires)) != NULL)
+  {
+    append_record(server, "RevokeToken", value);
+    free(value);
+  }
+}
+
+
+//
+// 'moauthdLoadJournal()' - Replay the journal and start a new one.
+//
+// This function is called after the state file has been loaded.  Any journal
+// records are applied on top of the state file, which is then rewritten so
+// that the server starts with an empty journal.
+//
+
+bool					// O - `true` on success, `false` on failure
+moauthdLoadJournal(
+    moauthd_server_t *server)		// I - Server object
+{
+  char		filename[1024];		// Old journal filename
+  size_t	count;			// Number of records replayed
+
+
+  snprintf(filename, sizeof(filename), "%s.journal", server->state_file);
+  server->journal_file = strdup(filename);
+
+  // Replay an old journal left behind by an interrupted compaction, then the
+  // current journal...
+  snprintf(filename, sizeof(filename), "%s.O", server->journal_file);
+
+  count = replay_file(server, filename);
+  count += replay_file(server, server->journal_file);
+
+  if (count > 0)
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_INFO, "Replayed %u journal records.", (unsigned)count);
+
+    if (!moauthdSaveServer(server))
+      return (false);
+  }
+
+  unlink(filename);
+
+  return (open_journal(server, true));
+}
+
+
+//
+// 'moauthdReplayState()' - Apply a state file or journal record.
+//
+// Records are idempotent - tokens that already exist or have expired are
+// ignored, as are deletions of unknown tokens and repeated revocations.
+//
+
+bool					// O - `true` if the record is known, `false` otherwise
+moauthdReplayState(
+    moauthd_server_t *server,		// I - Server object
+    const char       *name,		// I - Record name
+    const char       *value)		// I - Record value
+{
+  size_t	num_vars;		// Number of form variables
+  cups_option_t	*vars;			// Form variables
+
+
+  if (!value)
+    return (false);
+
+  if (!strcmp(name, "DeleteToken"))
+  {
+    moauthd_token_t *token;		// Token
+
+    if ((token = moauthdFindToken(server, value)) != NULL)
+    {
+      moauthdDeleteToken(server, token);
+      moauthdReleaseToken(token);
+    }
+
+    return (true);
+  }
+  else if (!strcmp(name, "Token"))
+  {
+    moauthd_token_t	*token;		// Token
+    const char		*client_id,	// Client ID, if any
+			*token_id,	// Token string
+			*user,		// Authenticated user
+			*scopes,	// Scopes
+			*challenge;	// Challenge, if any
+    time_t		expires;	// Expiration time
+    moauthd_application_t *app = NULL;	// Application
+
+    num_vars  = cupsFormDecode(value, &vars);
+    client_id = cupsGetOption("client_id", num_vars, vars);
+    token_id  = cupsGetOption("token", num_vars, vars);
+    user      = cupsGetOption("user", num_vars, vars);
+    scopes    = cupsGetOption("scopes", num_vars, vars);
+    challenge = cupsGetOption("challenge", num_vars, vars);
+    expires   = (time_t)get_number("expires", num_vars, vars, 0);
+
+    if (!token_id || !user || !scopes || expires <= time(NULL) || (client_id && (app = moauthdFindApplication(server, client_id, NULL)) == NULL))
+    {
+      // Bad, expired, or orphaned token...
+      cupsFreeOptions(num_vars, vars);
+      return (true);
+    }
+
+    if ((token = (moauthd_token_t *)calloc(1, sizeof(moauthd_token_t))) != NULL)
+    {
+      token->type         = (moauthd_toktype_t)get_number("type", num_vars, vars, 0);
+      token->token        = strdup(token_id);
+      token->challenge    = challenge ? strdup(challenge) : NULL;
+      token->user         = strdup(user);
+      token->application  = app;
+      token->scopes       = strdup(scopes);
+      token->scope_bits   = moauthdGetScopes(server, scopes);
+      token->uid          = (uid_t)get_number("uid", num_vars, vars, -1);
+      token->gid          = (gid_t)get_number("gid", num_vars, vars, -1);
+      token->created      = (time_t)get_number("created", num_vars, vars, 0);
+      token->expires      = expires;
+
+      if (token->type < MOAUTHD_TOKTYPE_ACCESS || token->type >= MOAUTHD_TOKTYPE_MAX)
+        token->type = MOAUTHD_TOKTYPE_ACCESS;
+
+      moauthdAddToken(server, token);
+    }
+
+    cupsFreeOptions(num_vars, vars);
+
+    return (true);
+  }
+  else if (!strcmp(name, "RevokeToken"))
+  {
+    const char	*jti;			// Unique ID of token
+    time_t	expires;		// Expiration time
+
+    num_vars = cupsFormDecode(value, &vars);
+    jti      = cupsGetOption("jti", num_vars, vars);
+    expires  = (time_t)get_number("expires", num_vars, vars, 0);
+
+    if (jti && expires > time(NULL))
+      moauthdRevokeToken(server, jti, expires);
+
+    cupsFreeOptions(num_vars, vars);
+
+    return (true);
+  }
+  else if (!strcmp(name, "Application"))
+  {
+    moauthd_application_t *app;		// Application
+    const char	*client_id,		// Client ID
+		*redirect_uri;		// Redirection URI
+
+    num_vars     = cupsFormDecode(value, &vars);
+    client_id    = cupsGetOption("client_id", num_vars, vars);
+    redirect_uri = cupsGetOption("redirect_uri", num_vars, vars);
+
+    if (client_id && redirect_uri && !moauthdFindApplication(server, client_id, NULL))
+    {
+      if ((app = moauthdAddApplication(server, client_id, redirect_uri, cupsGetOption("client_name", num_vars, vars), cupsGetOption("client_uri", num_vars, vars), cupsGetOption("logo_uri", num_vars, vars), cupsGetOption("tos_uri", num_vars, vars))) != NULL)
+        app->registered = true;
+    }
+
+    cupsFreeOptions(num_vars, vars);
+
+    return (true);
+  }
+
+  return (false);
+}
+
+
+//
+// 'moauthdRunJournal()' - Write journal records to disk.
+//
+// Records that arrive while the previous batch is being written and synced
+// are written together, so the cost of `fsync` is shared by all of the
+// requests in a batch.
+//
+
+void *					// O - Thread exit status
+moauthdRunJournal(
+    moauthd_server_t *server)		// I - Server object
+{
+  char		*buffer,		// Records to write
+		*bufptr;		// Pointer into records
+  size_t	bytes;			// Bytes to write
+  ssize_t	written;		// Bytes written
+  int		fd;			// Journal file
+  bool		compact;		// Compact the journal?
+
+
+  for (;;)
+  {
+    // Wait for records...
+    cupsMutexLock(&server->journal_lock);
+
+    while (server->journal_used == 0)
+      cupsCondWait(&server->journal_cond, &server->journal_lock, 0.0);
+
+    buffer  = server->journal_buffer;
+    bytes   = server->journal_used;
+    fd      = server->journal_fd;
+    compact = server->journal_records >= MOAUTHD_JOURNAL_COMPACT;
+
+    server->journal_buffer = NULL;
+    server->journal_used   = 0;
+    server->journal_alloc  = 0;
+
+    cupsMutexUnlock(&server->journal_lock);
+
+    // Write and sync the batch...
+    for (bufptr = buffer; bytes > 0; bufptr += written, bytes -= (size_t)written)
+    {
+      if ((written = write(fd, bufptr, bytes)) < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN)
+        {
+          written = 0;
+          continue;
+        }
+
+        moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to write journal \"%s\": %s", server->journal_file, strerror(errno));
+        break;
+      }
+    }
+
+    if (fsync(fd))
+      moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to sync journal \"%s\": %s", server->journal_file, strerror(errno));
+
+    free(buffer);
+
+    if (compact)
+      compact_journal(server);
+  }
+
+  return (NULL);
+}
+
+
+//
+// 'moauthdWriteState()' - Write registered applications and revoked tokens to
+//                         a state file.
+//
+
+void
+moauthdWriteState(
+    moauthd_server_t *server,		// I - Server object
+    cups_file_t      *fp)		// I - State file
+{
+  moauthd_application_t	*app;		// Current application
+  moauthd_revoked_t	*revoked;	// Current revoked token
+  char			*value;		// Encoded value
+
+
+  // Registered applications...
+  cupsMutexLock(&server->applications_lock);
+
+  for (app = (moauthd_application_t *)cupsArrayGetFirst(server->applications); app; app = (moauthd_application_t *)cupsArrayGetNext(server->applications))
+  {
+    if (app->registered && (value = encode_application(app)) != NULL)
+    {
+      cupsFilePutConf(fp, "Application", value);
+      free(value);
+    }
+  }
+
+  cupsMutexUnlock(&server->applications_lock);
+
+  // Revoked stateless access tokens...
+  cupsRWLockRead(&server->revoked_lock);
+
+  for (revoked = (moauthd_revoked_t *)cupsArrayGetFirst(server->revoked); revoked; revoked = (moauthd_revoked_t *)cupsArrayGetNext(server->revoked))
+  {
+    if ((value = encode_revoked(revoked->jti, revoked->expires)) != NULL)
+    {
+      cupsFilePutConf(fp, "RevokeToken", value);
+      free(value);
+    }
+  }
+
+  cupsRWUnlock(&server->revoked_lock);
+}
+
+
+//
+// 'append_record()' - Append a record to the journal buffer.
+//
+
+static void
+append_record(moauthd_server_t *server,	// I - Server object
+              const char       *name,	// I - Record name
+              const char       *value)	// I - Record value
+{
+  size_t	length;			// Length of record
+
+
+  length = strlen(name) + strlen(value) + 2;
+
+  cupsMutexLock(&server->journal_lock);
+
+  if (server->journal_fd < 0)
+  {
+    // Journal not open yet (replaying state)...
+    cupsMutexUnlock(&server->journal_lock);
+    return;
+  }
+
+  if ((server->journal_used + length + 1) > server->journal_alloc)
+  {
+    size_t	alloc;			// New buffer size
+    char	*buffer;		// New buffer
+
+    alloc = 2 * (server->journal_used + length + 1);
+    if (alloc < 65536)
+      alloc = 65536;
+
+    if ((buffer = realloc(server->journal_buffer, alloc)) == NULL)
+    {
+      cupsMutexUnlock(&server->journal_lock);
+      moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to allocate journal buffer: %s", strerror(errno));
+      return;
+    }
+
+    server->journal_buffer = buffer;
+    server->journal_alloc  = alloc;
+  }
+
+  snprintf(server->journal_buffer + server->journal_used, server->journal_alloc - server->journal_used, "%s %s\n", name, value);
+
+  server->journal_used += length;
+  server->journal_records ++;
+
+  cupsCondBroadcast(&server->journal_cond);
+  cupsMutexUnlock(&server->journal_lock);
+}
+
+
+//
+// 'compact_journal()' - Write a new state file and start a new journal.
+//
+// The current journal is renamed to "STATEFILE.journal.O" before the new state
+// file is written, so that records added during compaction go to the new
+// journal and nothing is lost if the server stops before the old journal is
+// removed.
+//
+
+static bool				// O - `true` on success, `false` on failure
+compact_journal(moauthd_server_t *server)// I - Server object
+{
+  char		filename[1024];		// Old journal filename
+  int		oldfd;			// Old journal file
+  bool		ret;			// Return value
+
+
+  snprintf(filename, sizeof(filename), "%s.O", server->journal_file);
+
+  cupsMutexLock(&server->journal_lock);
+
+  oldfd = server->journal_fd;
+
+  if (rename(server->journal_file, filename))
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to rename journal \"%s\": %s", server->journal_file, strerror(errno));
+    cupsMutexUnlock(&server->journal_lock);
+    return (false);
+  }
+  else if (!open_journal(server, true))
+  {
+    // Keep using the old journal...
+    rename(filename, server->journal_file);
+    server->journal_fd = oldfd;
+    cupsMutexUnlock(&server->journal_lock);
+    return (false);
+  }
+
+  server->journal_records = 0;
+
+  cupsMutexUnlock(&server->journal_lock);
+
+  close(oldfd);
+
+  // Keep the old journal if the state could not be saved, since the records
+  // in it are not in the state file...
+  if ((ret = moauthdSaveServer(server)) == true)
+  {
+    unlink(filename);
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_INFO, "Compacted journal \"%s\".", server->journal_file);
+  }
+  else
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to compact journal \"%s\", keeping \"%s\".", server->journal_file, filename);
+  }
+
+  return (ret);
+}
+
+
+//
+// 'encode_application()' - Encode an application as form data.
+//
+
+static char *				// O - Form data or `NULL` on error
+encode_application(
+    moauthd_application_t *app)		// I - Application
+{
+  size_t	num_vars = 0;		// Number of form variables
+  cups_option_t	*vars = NULL;		// Form variables
+  char		*value;			// Encoded value
+
+
+  num_vars = cupsAddOption("client_id", app->client_id, num_vars, &vars);
+  num_vars = cupsAddOption("redirect_uri", app->redirect_uri, num_vars, &vars);
+  if (app->client_name)
+    num_vars = cupsAddOption("client_name", app->client_name, num_vars, &vars);
+  if (app->client_uri)
+    num_vars = cupsAddOption("client_uri", app->client_uri, num_vars, &vars);
+  if (app->logo_uri)
+    num_vars = cupsAddOption("logo_uri", app->logo_uri, num_vars, &vars);
+  if (app->tos_uri)
+    num_vars = cupsAddOption("tos_uri", app->tos_uri, num_vars, &vars);
+
+  value = cupsFormEncode(/*url*/NULL, num_vars, vars);
+
+  cupsFreeOptions(num_vars, vars);
+
+  return (value);
+}
+
+
+//
+// 'encode_revoked()' - Encode a revoked token as form data.
+//
+
+static char *				// O - Form data or `NULL` on error
+encode_revoked(const char *jti,		// I - Unique ID of token
+               time_t     expires)	// I - When the token expires
+{
+  size_t	num_vars = 0;		// Number of form variables
+  cups_option_t	*vars = NULL;		// Form variables
+  char		temp[32],		// Temporary string
+		*value;			// Encoded value
+
+
+  num_vars = cupsAddOption("jti", jti, num_vars, &vars);
+  snprintf(temp, sizeof(temp), "%ld", (long)expires);
+  num_vars = cupsAddOption("expires", temp, num_vars, &vars);
+
+  value = cupsFormEncode(/*url*/NULL, num_vars, vars);
+
+  cupsFreeOptions(num_vars, vars);
+
+  return (value);
+}
+
+
+//
+// 'encode_token()' - Encode a token as form data.
+//
+
+static char *				// O - Form data or `NULL` on error
+encode_token(moauthd_token_t *token)	// I - Token
+{
+  size_t	num_vars = 0;		// Number of form variables
+  cups_option_t	*vars = NULL;		// Form variables
+  char		temp[32],		// Temporary string
+		*value;			// Encoded value
+
+
+  snprintf(temp, sizeof(temp), "%d", (int)token->type);
+  num_vars = cupsAddOption("type", temp, num_vars, &vars);
+  num_vars = cupsAddOption("user", token->user, num_vars, &vars);
+  num_vars = cupsAddOption("scopes", token->scopes, num_vars, &vars);
+  if (token->application)
+    num_vars = cupsAddOption("client_id", token->application->client_id, num_vars, &vars);
+  if (token->challenge)
+    num_vars = cupsAddOption("challenge", token->challenge, num_vars, &vars);
+  snprintf(temp, sizeof(temp), "%ld", (long)token->uid);
+  num_vars = cupsAddOption("uid", temp, num_vars, &vars);
+  snprintf(temp, sizeof(temp), "%ld", (long)token->gid);
+  num_vars = cupsAddOption("gid", temp, num_vars, &vars);
+  snprintf(temp, sizeof(temp), "%ld", (long)token->created);
+  num_vars = cupsAddOption("created", temp, num_vars, &vars);
+  snprintf(temp, sizeof(temp), "%ld", (long)token->expires);
+  num_vars = cupsAddOption("expires", temp, num_vars, &vars);
+  num_vars = cupsAddOption("token", token->token, num_vars, &vars);
+
+  value = cupsFormEncode(/*url*/NULL, num_vars, vars);
+
+  cupsFreeOptions(num_vars, vars);
+
+  return (value);
+}
+
+
+//
+// 'get_number()' - Get a numeric form variable.
+//
+
+static long				// O - Value
+get_number(const char    *name,		// I - Variable name
+           size_t        num_vars,	// I - Number of form variables
+           cups_option_t *vars,		// I - Form variables
+           long          defval)	// I - Default value
+{
+  const char	*value;			// String value
+
+
+  if ((value = cupsGetOption(name, num_vars, vars)) != NULL)
+    return (strtol(value, NULL, 10));
+  else
+    return (defval);
+}
+
+
+//
+// 'open_journal()' - Open the journal file for appending.
+//
+// The caller must hold the journal lock once the server is running.
+//
+
+static bool				// O - `true` on success, `false` on failure
+open_journal(moauthd_server_t *server,	// I - Server object
+             bool             truncate)	// I - Truncate the journal?
+{
+  int	fd;				// Journal file
+
+
+  if ((fd = open(server->journal_file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (truncate ? O_TRUNC : 0), 0600)) < 0)
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to open journal \"%s\": %s", server->journal_file, strerror(errno));
+    return (false);
+  }
+
+  server->journal_fd = fd;
+
+  return (true);
+}
+
+
+//
+// 'replay_file()' - Replay records from a journal file.
+//
+
+static size_t				// O - Number of records replayed
+replay_file(moauthd_server_t *server,	// I - Server object
+            const char       *filename)	// I - Journal filename
+{
+  cups_file_t	*fp;			// Journal file
+  char		line[16384],		// Line from journal
+		*value;			// Value from journal
+  int		linenum = 0;		// Current line number
+  size_t	count = 0;		// Number of records
+
+
+  if ((fp = cupsFileOpen(filename, "r")) == NULL)
+    return (0);
+
+  while (cupsFileGetConf(fp, line, sizeof(line), &value, &linenum))
+  {
+    if (moauthdReplayState(server, line, value))
+      count ++;
+    else
+      moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unknown journal record \"%s\" on line %d of \"%s\".", line, linenum, filename);
+  }
+
+  cupsFileClose(fp);
+
+  return (count);
+}
@@ -1,14 +1,58 @@
 //
 // Logging support for moauth daemon
 //
-// Copyright © 2017-2022 by Michael R Sweet
+// Copyright © 2017-2026 by Michael R Sweet
 //
 // Licensed under Apache License v2.0.  See the file "LICENSE" for more information.
 //
+// Once the server is running, log lines are formatted by the calling thread
+// into a per-thread ring buffer and written by a single log writer thread, so
+// a slow log file or syslog daemon never stalls request handling.  Each ring
+// has one producer (the owning thread) and one consumer (the writer), so no
+// locks are needed to add a line.  Lines are dropped and counted when a ring
+// is full.
+//
+// Access log records use a second ring in each buffer and are written by the
+// same thread as JSON Lines, one object per request.
+//
 
 #include "moauthd.h"
 #include <stdarg.h>
 #include <syslog.h>
+#include <sys/uio.h>
+
+
+//
+// Constants...
+//
+
+#define MOAUTHD_LOG_BATCH	64	// Maximum ring buffers per writev() call
+
+
+//
+// Types...
+//
+
+typedef struct moauthd_logring_s	// Ring of log lines
+{
+  atomic_size_t		head,		// Bytes added to the ring
+			tail;		// Bytes written from the ring
+  char			data[MOAUTHD_LOG_BUFFER];
+					// Ring data
+} moauthd_logring_t;
+
+struct moauthd_logbuf_s			// Per-thread log buffer
+{
+  moauthd_logbuf_t	*next;		// Next buffer
+  moauthd_server_t	*server;	// Server object
+  time_t		stamp_time,	// Time of cached timestamp
+			access_time;	// Time of cached access log timestamp
+  char			stamp[32],	// Cached timestamp string
+			access_stamp[32];
+					// Cached access log timestamp string
+  moauthd_logring_t	log,		// Log lines
+			access;		// Access log records
+};
 
 
 //
@@ -16,13 +60,193 @@
 //
 
 static const int priorities[] = { LOG_ERR, LOG_INFO, LOG_DEBUG };
+static _Thread_local moauthd_logbuf_t *log_buffer = NULL;
+					// Log buffer for the current thread
 
 
 //
 // Local functions...
 //
 
-static void	file_log(int fd, const char *message, va_list ap);
+static bool	add_line(moauthd_server_t *server, moauthd_logring_t *ring, const char *line, size_t length);
+static char	*copy_json(char *bufptr, size_t bufsize, const char *s);
+static size_t	format_line(moauthd_server_t *server, moauthd_logbuf_t *buf, moauthd_client_t *client, moauthd_loglevel_t level, char *line, const char *message, va_list ap);
+static moauthd_logbuf_t *get_buffer(moauthd_server_t *server);
+static void	log_message(moauthd_server_t *server, moauthd_client_t *client, moauthd_loglevel_t level, const char *message, va_list ap);
+static bool	write_buffers(moauthd_server_t *server);
+static void	write_iov(int fd, struct iovec *iov, int niov);
+static void	write_syslog(moauthd_logring_t *ring, size_t tail, size_t head);
+
+
+//
+// 'moauthdFreeLog()' - Free the per-thread log buffers.
+//
+// The log writer must be stopped and no other threads may be logging.
+//
+
+void
+moauthdFreeLog(
+    moauthd_server_t *server)		// I - Server object
+{
+  moauthd_logbuf_t	*buf,		// Current buffer
+			*next;		// Next buffer
+
+
+  for (buf = atomic_exchange(&server->log_buffers, NULL); buf; buf = next)
+  {
+    next = buf->next;
+
+    if (buf == log_buffer)
+      log_buffer = NULL;
+
+    free(buf);
+  }
+}
+
+
+//
+// 'moauthdGetTime()' - Get the current monotonic time in microseconds.
+//
+
+uint64_t				// O - Monotonic time in microseconds
+moauthdGetTime(void)
+{
+  struct timespec	curtime;	// Current time
+
+
+  clock_gettime(CLOCK_MONOTONIC, &curtime);
+
+  return ((uint64_t)curtime.tv_sec * 1000000 + (uint64_t)curtime.tv_nsec / 1000);
+}
+
+
+//
+// 'moauthdLogAccess()' - Log the current request to the access log.
+//
+// The record includes the response status and size along with the time spent
+// reading the request headers, authenticating, running the handler, and
+// writing the response.
+//
+
+void
+moauthdLogAccess(
+    moauthd_client_t *client)		// I - Client object
+{
+  moauthd_server_t	*server = client->server;
+					// Server object
+  moauthd_logbuf_t	*buf = NULL;	// Log buffer
+  char			line[MOAUTHD_LOG_LINE],
+					// Access log record
+			*lineptr,	// Pointer into record
+			*lineend = line + sizeof(line) - 2;
+					// End of record
+  const char		*method;	// Request method
+  time_t		curtime;	// Current date/time in seconds
+  struct tm		curdate;	// Current date/time info
+  char			temp[32],	// Timestamp string
+			*stamp;		// Timestamp to use
+  uint64_t		total,		// Total request time
+			used;		// Time accounted for
+  static const char * const types[] =	// Token types
+  {
+    "access",
+    "grant",
+    "renewal"
+  };
+
+
+  if (!client->request_time)
+    return;
+
+  total                = moauthdGetTime() - client->request_time;
+  client->request_time = 0;
+
+  if (server->access_log < 0)
+    return;
+
+  if (atomic_load(&server->log_running))
+    buf = get_buffer(server);
+
+  // Reuse the cached timestamp for the current second...
+  time(&curtime);
+
+  stamp = buf ? buf->access_stamp : temp;
+
+  if (!buf || curtime != buf->access_time)
+  {
+    gmtime_r(&curtime, &curdate);
+    snprintf(stamp, sizeof(temp), "%04d-%02d-%02dT%02d:%02d:%02dZ", curdate.tm_year + 1900, curdate.tm_mon + 1, curdate.tm_mday, curdate.tm_hour, curdate.tm_min, curdate.tm_sec);
+
+    if (buf)
+      buf->access_time = curtime;
+  }
+
+  switch (client->request_method)
+  {
+    case HTTP_STATE_OPTIONS :
+        method = "OPTIONS";
+        break;
+    case HTTP_STATE_GET :
+        method = "GET";
+        break;
+    case HTTP_STATE_HEAD :
+        method = "HEAD";
+        break;
+    case HTTP_STATE_POST :
+        method = "POST";
+        break;
+    case HTTP_STATE_PUT :
+        method = "PUT";
+        break;
+    case HTTP_STATE_DELETE :
+        method = "DELETE";
+        break;
+    case HTTP_STATE_TRACE :
+        method = "TRACE";
+        break;
+    case HTTP_STATE_CONNECT :
+        method = "CONNECT";
+        break;
+    default :
+        method = "";
+        break;
+  }
+
+  // Format the record, limiting the length of strings so the other fields fit...
+  used = client->header_usecs + client->auth_usecs + client->write_usecs;
+
+  snprintf(line, sizeof(line), "{\"time\":\"%s\",\"client\":%d,\"host\":", stamp, client->number);
+  lineptr = copy_json(line + strlen(line), 512, client->remote_host);
+  snprintf(lineptr, (size_t)(lineend - lineptr), ",\"method\":\"%s\",\"path\":", method);
+  lineptr = copy_json(lineptr + strlen(lineptr), 6144, client->path_info);
+  snprintf(lineptr, (size_t)(lineend - lineptr), ",\"status\":%d,\"bytes\":%lu,\"user\":", client->response_status, (unsigned long)client->response_bytes);
+  lineptr = copy_json(lineptr + strlen(lineptr), 512, client->remote_user);
+  if (client->remote_token && client->remote_token->type < MOAUTHD_TOKTYPE_MAX)
+    snprintf(lineptr, (size_t)(lineend - lineptr), ",\"token_type\":\"%s\"", types[client->remote_token->type]);
+  else
+    snprintf(lineptr, (size_t)(lineend - lineptr), ",\"token_type\":null");
+  lineptr += strlen(lineptr);
+  snprintf(lineptr, (size_t)(lineend - lineptr), ",\"header_us\":%lu,\"auth_us\":%lu,\"handler_us\":%lu,\"write_us\":%lu}\n", (unsigned long)client->header_usecs, (unsigned long)client->auth_usecs, (unsigned long)(total > used ? total - used : 0), (unsigned long)client->write_usecs);
+  lineptr += strlen(lineptr);
+
+  if (lineptr[-1] != '\n')
+    *lineptr++ = '\n';
+
+  if (buf)
+  {
+    add_line(server, &buf->access, line, (size_t)(lineptr - line));
+  }
+  else
+  {
+    // No log writer, write the record directly...
+    struct iovec iov;			// Record to write
+
+    iov.iov_base = line;
+    iov.iov_len  = (size_t)(lineptr - line);
+
+    write_iov(server->access_log, &iov, 1);
+  }
+}
 
 
 //
@@ -37,21 +261,14 @@ moauthdLogc(moauthd_client_t   *client,	// I - Client object
 {
   moauthd_server_t *server = client->server;
 					// Server object
-  char		cmessage[1024];		// Client message
   va_list	ap;			// Argument pointer
 
 
   if (level > server->log_level || server->log_file < 0)
     return;
 
-  snprintf(cmessage, sizeof(cmessage), "[Client %d] %s", client->number, message);
   va_start(ap, message);
-
-  if (server->log_file == 0)
-    vsyslog(priorities[level], cmessage, ap);
-  else
-    file_log(server->log_file, cmessage, ap);
-
+  log_message(server, client, level, message, ap);
   va_end(ap);
 }
 
@@ -73,53 +290,491 @@ moauthdLogs(moauthd_server_t   *server,	// I - Server object
     return;
 
   va_start(ap, message);
+  log_message(server, NULL, level, message, ap);
+  va_end(ap);
+}
 
-  if (server->log_file == 0)
-    vsyslog(priorities[level], message, ap);
+
+//
+// 'moauthdRunLog()' - Write log lines from the per-thread buffers.
+//
+
+void *					// O - Thread exit status
+moauthdRunLog(
+    moauthd_server_t *server)		// I - Server object
+{
+  size_t	dropped,		// Dropped lines
+		reported = 0;		// Dropped lines already reported
+  bool		running;		// Is the server still running?
+
+
+  for (;;)
+  {
+    running = atomic_load(&server->log_running);
+
+    if (!write_buffers(server))
+    {
+      if (!running)
+        break;
+
+      // Wait for more lines, rechecking after flagging that we are idle so
+      // that a line added concurrently is not missed...
+      cupsMutexLock(&server->log_lock);
+
+      atomic_store(&server->log_idle, true);
+
+      if (atomic_load(&server->log_running) && !write_buffers(server))
+        cupsCondWait(&server->log_cond, &server->log_lock, 1.0);
+
+      atomic_store(&server->log_idle, false);
+
+      cupsMutexUnlock(&server->log_lock);
+    }
+
+    if ((dropped = atomic_load(&server->log_dropped)) != reported)
+    {
+      moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Dropped %lu log lines.", (unsigned long)(dropped - reported));
+      reported = dropped;
+    }
+  }
+
+  return (NULL);
+}
+
+
+//
+// 'moauthdStartLog()' - Start the log writer thread.
+//
+
+bool					// O - `true` on success, `false` on failure
+moauthdStartLog(
+    moauthd_server_t *server)		// I - Server object
+{
+  if (server->log_file < 0 && server->access_log < 0)
+    return (true);
+
+  atomic_store(&server->log_running, true);
+
+  if ((server->log_thread = cupsThreadCreate((void *(*)(void *))moauthdRunLog, server)) == CUPS_THREAD_INVALID)
+  {
+    atomic_store(&server->log_running, false);
+    return (false);
+  }
+
+  return (true);
+}
+
+
+//
+// 'moauthdStopLog()' - Stop the log writer thread.
+//
+// Pending log lines are written before the writer exits.  Later log lines are
+// written directly by the calling thread.
+//
+
+void
+moauthdStopLog(
+    moauthd_server_t *server)		// I - Server object
+{
+  if (!atomic_exchange(&server->log_running, false))
+    return;
+
+  cupsMutexLock(&server->log_lock);
+  cupsCondBroadcast(&server->log_cond);
+  cupsMutexUnlock(&server->log_lock);
+
+  cupsThreadWait(server->log_thread);
+}
+
+
+//
+// 'add_line()' - Add a line to a ring.
+//
+
+static bool				// O - `true` on success, `false` if the ring is full
+add_line(moauthd_server_t  *server,	// I - Server object
+         moauthd_logring_t *ring,	// I - Ring
+         const char        *line,	// I - Line
+         size_t            length)	// I - Length of line
+{
+  size_t	head,			// Head of ring
+		offset;			// Offset in ring
+
+
+  head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+  if (length > (MOAUTHD_LOG_BUFFER - (head - atomic_load(&ring->tail))))
+  {
+    atomic_fetch_add(&server->log_dropped, 1);
+    return (false);
+  }
+
+  offset = head & (MOAUTHD_LOG_BUFFER - 1);
+
+  if (length > (MOAUTHD_LOG_BUFFER - offset))
+  {
+    memcpy(ring->data + offset, line, MOAUTHD_LOG_BUFFER - offset);
+    memcpy(ring->data, line + MOAUTHD_LOG_BUFFER - offset, length - (MOAUTHD_LOG_BUFFER - offset));
+  }
   else
-    file_log(server->log_file, message, ap);
+  {
+    memcpy(ring->data + offset, line, length);
+  }
 
-  va_end(ap);
+  atomic_store(&ring->head, head + length);
+
+  // Wake up the log writer as needed...
+  if (atomic_exchange(&server->log_idle, false))
+  {
+    cupsMutexLock(&server->log_lock);
+    cupsCondBroadcast(&server->log_cond);
+    cupsMutexUnlock(&server->log_lock);
+  }
+
+  return (true);
 }
 
 
 //
-// "file_log()" - Log a message to a file.
+// 'copy_json()' - Copy a quoted JSON string.
+//
+// Long strings are truncated to fit in the buffer.
 //
 
-static void
-file_log(int        fd,			// I - File to write to
-         const char *message,		// I - Printf-style message
-         va_list    ap)			// I - Argument pointer
+static char *				// O - End of string
+copy_json(char       *bufptr,		// I - Pointer into buffer
+          size_t     bufsize,		// I - Size of buffer
+          const char *s)		// I - String
+{
+  char	*bufend = bufptr + bufsize - 8;	// End of buffer, leaving room for an escape and quote
+
+
+  *bufptr++ = '"';
+
+  for (; *s && bufptr < bufend; s ++)
+  {
+    if (*s == '"' || *s == '\\')
+    {
+      *bufptr++ = '\\';
+      *bufptr++ = *s;
+    }
+    else if ((*s & 255) < ' ')
+    {
+      snprintf(bufptr, 7, "\\u%04x", *s & 255);
+      bufptr += 6;
+    }
+    else
+    {
+      *bufptr++ = *s;
+    }
+  }
+
+  *bufptr++ = '"';
+  *bufptr   = '\0';
+
+  return (bufptr);
+}
+
+
+//
+// 'format_line()' - Format a log line.
+//
+// File log lines start with a timestamp and end with a newline.  Syslog lines
+// start with the log level digit and end with a nul character.
+//
+
+static size_t				// O - Length of line
+format_line(
+    moauthd_server_t   *server,		// I - Server object
+    moauthd_logbuf_t   *buf,		// I - Log buffer or `NULL`
+    moauthd_client_t   *client,		// I - Client object or `NULL`
+    moauthd_loglevel_t level,		// I - Log level
+    char               *line,		// I - Line buffer (`MOAUTHD_LOG_LINE` bytes)
+    const char         *message,	// I - Printf-style message
+    va_list            ap)		// I - Argument pointer
 {
+  char		*lineptr,		// Pointer into line
+		*lineend = line + MOAUTHD_LOG_LINE - 1;
+					// End of line buffer
   time_t	curtime;		// Current date/time in seconds
   struct tm	curdate;		// Current date/time info
-  char		buffer[8192],		// Message buffer
-		*bufptr;		// Pointer into buffer
-  size_t        total;                  // Length of log line
-  ssize_t       bytes;                  // Bytes written
+  char		temp[32],		// Timestamp string
+		*stamp;			// Timestamp to use
 
 
-  time(&curtime);
-  gmtime_r(&curtime, &curdate);
+  if (server->log_file == 0)
+  {
+    line[0] = (char)('0' + level);
+    lineptr = line + 1;
+  }
+  else
+  {
+    // Reuse the cached timestamp for the current second...
+    time(&curtime);
 
-  snprintf(buffer, sizeof(buffer), "[%04d-%02d-%02d %02d:%02d:%02d+0000]  ", curdate.tm_year + 1900, curdate.tm_mon + 1, curdate.tm_mday, curdate.tm_hour, curdate.tm_min, curdate.tm_sec);
-  bufptr = buffer + strlen(buffer);
+    stamp = buf ? buf->stamp : temp;
 
-  vsnprintf(bufptr, sizeof(buffer) - (bufptr - buffer) - 1, message, ap);
-  bufptr += strlen(bufptr);
-  if (bufptr[-1] != '\n')
-    *bufptr++ = '\n';
+    if (!buf || curtime != buf->stamp_time)
+    {
+      gmtime_r(&curtime, &curdate);
+      snprintf(stamp, sizeof(temp), "[%04d-%02d-%02d %02d:%02d:%02d+0000]  ", curdate.tm_year + 1900, curdate.tm_mon + 1, curdate.tm_mday, curdate.tm_hour, curdate.tm_min, curdate.tm_sec);
 
-  for (total = bufptr - buffer, bufptr = buffer; total > 0; total -= (size_t)bytes, bufptr += bytes)
+      if (buf)
+        buf->stamp_time = curtime;
+    }
+
+    lineptr = line + cupsCopyString(line, stamp, MOAUTHD_LOG_LINE);
+  }
+
+  if (client)
   {
-    if ((bytes = write(fd, bufptr, total)) < 0)
+    snprintf(lineptr, (size_t)(lineend - lineptr), "[Client %d] ", client->number);
+    lineptr += strlen(lineptr);
+  }
+
+  vsnprintf(lineptr, (size_t)(lineend - lineptr), message, ap);
+  lineptr += strlen(lineptr);
+
+  if (server->log_file == 0)
+    *lineptr++ = '\0';
+  else if (lineptr[-1] != '\n')
+    *lineptr++ = '\n';
+
+  return ((size_t)(lineptr - line));
+}
+
+
+//
+// 'get_buffer()' - Get the log buffer for the current thread.
+//
+
+static moauthd_logbuf_t *		// O - Log buffer or `NULL` on error
+get_buffer(moauthd_server_t *server)	// I - Server object
+{
+  moauthd_logbuf_t	*buf;		// Log buffer
+
+
+  if ((buf = log_buffer) != NULL && buf->server == server)
+    return (buf);
+
+  if ((buf = (moauthd_logbuf_t *)calloc(1, sizeof(moauthd_logbuf_t))) == NULL)
+    return (NULL);
+
+  buf->server = server;
+  buf->next   = atomic_load(&server->log_buffers);
+
+  while (!atomic_compare_exchange_weak(&server->log_buffers, &buf->next, buf));
+
+  log_buffer = buf;
+
+  return (buf);
+}
+
+
+//
+// 'log_message()' - Log a message.
+//
+
+static void
+log_message(
+    moauthd_server_t   *server,		// I - Server object
+    moauthd_client_t   *client,		// I - Client object or `NULL`
+    moauthd_loglevel_t level,		// I - Log level
+    const char         *message,	// I - Printf-style message
+    va_list            ap)		// I - Argument pointer
+{
+  moauthd_logbuf_t *buf = NULL;		// Log buffer
+  char		line[MOAUTHD_LOG_LINE];	// Log line
+  size_t	length;			// Length of line
+
+
+  if (atomic_load(&server->log_running))
+    buf = get_buffer(server);
+
+  length = format_line(server, buf, client, level, line, message, ap);
+
+  if (buf)
+  {
+    add_line(server, &buf->log, line, length);
+  }
+  else if (server->log_file == 0)
+  {
+    // No log writer, send the line directly...
+    syslog(priorities[level], "%s", line + 1);
+  }
+  else
+  {
+    // No log writer, write the line directly...
+    struct iovec iov;			// Line to write
+
+    iov.iov_base = line;
+    iov.iov_len  = length;
+
+    write_iov(server->log_file, &iov, 1);
+  }
+}
+
+
+//
+// 'write_buffers()' - Write pending lines from all log buffers.
+//
+
+static bool				// O - `true` if lines were written, `false` otherwise
+write_buffers(moauthd_server_t *server)	// I - Server object
+{
+  moauthd_logbuf_t	*buf;		// Current buffer
+  moauthd_logring_t	*ring,		// Current ring
+			*rings[MOAUTHD_LOG_BATCH];
+					// Rings in batch
+  size_t		heads[MOAUTHD_LOG_BATCH],
+					// Heads of rings in batch
+			head,		// Head of current ring
+			tail,		// Tail of current ring
+			offset;		// Offset in ring
+  struct iovec		iov[2 * MOAUTHD_LOG_BATCH];
+					// Data to write
+  int			i,		// Looping var
+			access,		// Writing access log records?
+			fd,		// File to write to
+			nrings = 0,	// Number of rings in batch
+			niov = 0;	// Number of iovecs
+  bool			wrote = false;	// Were lines written?
+
+
+  for (access = 0; access < 2; access ++)
+  {
+    fd = access ? server->access_log : server->log_file;
+
+    for (buf = atomic_load(&server->log_buffers); buf; buf = buf->next)
+    {
+      ring = access ? &buf->access : &buf->log;
+      head = atomic_load(&ring->head);
+      tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+      if (head == tail)
+        continue;
+
+      wrote = true;
+
+      if (fd == 0 && !access)
+      {
+        write_syslog(ring, tail, head);
+        atomic_store(&ring->tail, head);
+        continue;
+      }
+
+      offset = tail & (MOAUTHD_LOG_BUFFER - 1);
+
+      if ((head - tail) > (MOAUTHD_LOG_BUFFER - offset))
+      {
+	iov[niov].iov_base   = ring->data + offset;
+	iov[niov ++].iov_len = MOAUTHD_LOG_BUFFER - offset;
+	iov[niov].iov_base   = ring->data;
+	iov[niov ++].iov_len = head - tail - (MOAUTHD_LOG_BUFFER - offset);
+      }
+      else
+      {
+	iov[niov].iov_base   = ring->data + offset;
+	iov[niov ++].iov_len = head - tail;
+      }
+
+      rings[nrings]    = ring;
+      heads[nrings ++] = head;
+
+      if (nrings == MOAUTHD_LOG_BATCH)
+      {
+        // Write a full batch...
+	write_iov(fd, iov, niov);
+
+	for (i = 0; i < nrings; i ++)
+	  atomic_store(&rings[i]->tail, heads[i]);
+
+	nrings = niov = 0;
+      }
+    }
+
+    if (nrings > 0)
+    {
+      // Write the remaining lines...
+      write_iov(fd, iov, niov);
+
+      for (i = 0; i < nrings; i ++)
+	atomic_store(&rings[i]->tail, heads[i]);
+
+      nrings = niov = 0;
+    }
+  }
+
+  return (wrote);
+}
+
+
+//
+// 'write_iov()' - Write data to a log file.
+//
+
+static void
+write_iov(int          fd,		// I - File to write to
+          struct iovec *iov,		// I - Data to write
+          int          niov)		// I - Number of iovecs
+{
+  ssize_t	bytes;			// Bytes written
+
+
+  while (niov > 0)
+  {
+    if ((bytes = writev(fd, iov, niov)) < 0)
     {
       if (errno == EAGAIN || errno == EINTR)
-        bytes = 0;
+        continue;
       else
         break;
     }
+
+    // Skip the data that was written...
+    while (niov > 0 && (size_t)bytes >= iov->iov_len)
+    {
+      bytes -= (ssize_t)iov->iov_len;
+      iov ++;
+      niov --;
+    }
+
+    if (niov > 0)
+    {
+      iov->iov_base = (char *)iov->iov_base + bytes;
+      iov->iov_len  -= (size_t)bytes;
+    }
   }
 }
 
+
+//
+// 'write_syslog()' - Send lines from a ring to syslog.
+//
+
+static void
+write_syslog(moauthd_logring_t *ring,	// I - Ring
+             size_t            tail,	// I - Tail of ring
+             size_t            head)	// I - Head of ring
+{
+  char		line[MOAUTHD_LOG_LINE],	// Log line
+		*lineptr;		// Pointer into line
+
+
+  while (tail < head)
+  {
+    for (lineptr = line; tail < head && lineptr < (line + sizeof(line) - 1); tail ++)
+    {
+      if ((*lineptr++ = ring->data[tail & (MOAUTHD_LOG_BUFFER - 1)]) == '\0')
+      {
+        tail ++;
+        break;
+      }
+    }
+
+    *lineptr = '\0';
+
+    if (line[0] >= '0' && line[0] <= '2')
+      syslog(priorities[line[0] - '0'], "%s", line + 1);
+  }
+}
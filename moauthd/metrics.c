@@ -0,0 +1,397 @@
+//
+// Metrics support for moauth daemon
+//
+// Copyright © 2026 by Michael R Sweet
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Counters and latency histograms are kept per thread and only added up when
+// the "/metrics" resource is read, so counting an event never touches a
+// cache line that is shared with another thread.  Each thread is the only
+// writer of its own counters, so updates are plain relaxed loads and stores
+// rather than atomic read-modify-write operations.
+//
+
+#include "moauthd.h"
+#include <stdarg.h>
+
+
+//
+// Types...
+//
+
+struct moauthd_metrics_s		// Per-thread metrics
+{
+  moauthd_metrics_t	*next;		// Next thread's metrics
+  moauthd_server_t	*server;	// Server object
+  atomic_uint_least64_t	counters[MOAUTHD_METRIC_MAX];
+					// Event counters
+  size_t		num_timings;	// Number of latency histograms
+  moauthd_histogram_t	timings[];	// Latency histograms
+};
+
+typedef struct moauthd_histsum_s	// Latency histogram totals
+{
+  uint64_t		counts[MOAUTHD_HISTOGRAM_BUCKETS],
+					// Counts for latencies up to 2^N ms
+			sum;		// Total latency in microseconds
+} moauthd_histsum_t;
+
+
+//
+// Local globals...
+//
+
+static _Thread_local moauthd_metrics_t *thread_metrics = NULL;
+					// Metrics for the current thread
+
+
+//
+// Local functions...
+//
+
+static moauthd_metrics_t *get_metrics(moauthd_server_t *server);
+static void	write_histogram(moauthd_client_t *client, const char *name, const char *label, const char *value, moauthd_histsum_t *histogram);
+static void	write_metric(moauthd_client_t *client, const char *format, ...) __attribute__((__format__(__printf__, 2, 3)));
+
+
+//
+// 'moauthdCountMetric()' - Count an event.
+//
+
+void
+moauthdCountMetric(
+    moauthd_server_t *server,		// I - Server object
+    moauthd_metric_t metric)		// I - Event counter
+{
+  moauthd_metrics_t	*metrics;	// Metrics for this thread
+
+
+  if ((metrics = get_metrics(server)) != NULL)
+    atomic_store_explicit(metrics->counters + metric, atomic_load_explicit(metrics->counters + metric, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+
+//
+// 'moauthdCountTime()' - Add a latency to a histogram.
+//
+// Bucket N counts latencies of up to 2^N milliseconds and the last bucket
+// counts everything longer.
+//
+
+void
+moauthdCountTime(
+    moauthd_server_t *server,		// I - Server object
+    size_t           timing,		// I - Latency histogram (`moauthd_timing_t` value)
+    uint64_t         usecs)		// I - Latency in microseconds
+{
+  moauthd_metrics_t	*metrics;	// Metrics for this thread
+  moauthd_histogram_t	*histogram;	// Latency histogram
+  size_t		bucket;		// Histogram bucket
+
+
+  if ((metrics = get_metrics(server)) == NULL || timing >= metrics->num_timings)
+    return;
+
+  for (bucket = 0; bucket < (MOAUTHD_HISTOGRAM_BUCKETS - 1) && usecs > (1000ULL << bucket); bucket ++);
+
+  histogram = metrics->timings + timing;
+
+  atomic_store_explicit(histogram->counts + bucket, atomic_load_explicit(histogram->counts + bucket, memory_order_relaxed) + 1, memory_order_relaxed);
+  atomic_store_explicit(&histogram->sum, atomic_load_explicit(&histogram->sum, memory_order_relaxed) + usecs, memory_order_relaxed);
+}
+
+
+//
+// 'moauthdFreeMetrics()' - Free the per-thread metrics.
+//
+// No other threads may be counting events.
+//
+
+void
+moauthdFreeMetrics(
+    moauthd_server_t *server)		// I - Server object
+{
+  moauthd_metrics_t	*metrics,	// Current metrics
+			*next;		// Next metrics
+
+
+  for (metrics = atomic_exchange(&server->metrics, NULL); metrics; metrics = next)
+  {
+    next = metrics->next;
+
+    if (metrics == thread_metrics)
+      thread_metrics = NULL;
+
+    free(metrics);
+  }
+}
+
+
+//
+// 'moauthdGetMetric()' - Get the total of an event counter.
+//
+
+uint64_t				// O - Number of events
+moauthdGetMetric(
+    moauthd_server_t *server,		// I - Server object
+    moauthd_metric_t metric)		// I - Event counter
+{
+  moauthd_metrics_t	*metrics;	// Current metrics
+  uint64_t		count = 0;	// Number of events
+
+
+  for (metrics = atomic_load(&server->metrics); metrics; metrics = metrics->next)
+    count += atomic_load_explicit(metrics->counters + metric, memory_order_relaxed);
+
+  return (count);
+}
+
+
+//
+// 'moauthdSendMetrics()' - Send the server metrics to the client.
+//
+// Metrics are sent using the Prometheus text format.  Access is limited to
+// members of the `MetricsGroup`, if any.
+//
+
+bool					// O - `true` to keep the connection open, `false` to close it
+moauthdSendMetrics(
+    moauthd_client_t *client)		// I - Client object
+{
+  moauthd_server_t	*server = client->server;
+					// Server object
+  moauthd_metrics_t	*metrics;	// Current metrics
+  moauthd_histsum_t	*timings;	// Latency histogram totals
+  size_t		i,		// Looping var
+			bucket,		// Histogram bucket
+			num_timings;	// Number of latency histograms
+  uint64_t		counters[MOAUTHD_METRIC_MAX];
+					// Event counter totals
+  moauthd_tokstats_t	stats;		// Token statistics
+  moauthd_client_t	*current;	// Current client
+  size_t		active = 0,	// Active connections
+			idle = 0;	// Idle connections
+  char			*output;	// Metrics text
+  size_t		output_used;	// Length of metrics text
+  bool			ret;		// Return value
+  static const char * const types[] =	// Token types
+  {
+    "access",
+    "grant",
+    "renewal"
+  };
+  static const struct
+  {
+    const char		*name;		// Cache name
+    moauthd_metric_t	hits,		// Hits counter
+			misses;		// Misses counter
+  }			caches[] =	// Caches
+  {
+    { "auth", MOAUTHD_METRIC_AUTH_CACHE_HITS, MOAUTHD_METRIC_AUTH_CACHE_MISSES },
+    { "file", MOAUTHD_METRIC_FILE_CACHE_HITS, MOAUTHD_METRIC_FILE_CACHE_MISSES },
+    { "page", MOAUTHD_METRIC_PAGE_CACHE_HITS, MOAUTHD_METRIC_PAGE_CACHE_MISSES },
+    { "user", MOAUTHD_METRIC_USER_CACHE_HITS, MOAUTHD_METRIC_USER_CACHE_MISSES },
+    { "verify", MOAUTHD_METRIC_VERIFY_HITS, MOAUTHD_METRIC_VERIFY_MISSES }
+  };
+
+
+  if (server->metrics_group != (gid_t)-1)
+  {
+    // See if the authenticated user is in the specified group...
+    if (!client->remote_user[0])
+      return (moauthdRespondClient(client, HTTP_STATUS_UNAUTHORIZED, NULL, NULL, 0, 0));
+    else if (!moauthdHasGroup(client->remote_ident, server->metrics_group))
+      return (moauthdRespondClient(client, HTTP_STATUS_FORBIDDEN, NULL, NULL, 0, 0));
+  }
+
+  // Add up the counters and histograms from each thread...
+  num_timings = MOAUTHD_TIMING_REQUEST + server->num_endpoints + 2;
+
+  if ((timings = calloc(num_timings, sizeof(moauthd_histsum_t))) == NULL)
+    return (moauthdRespondClient(client, HTTP_STATUS_SERVER_ERROR, NULL, NULL, 0, 0));
+
+  memset(counters, 0, sizeof(counters));
+
+  for (metrics = atomic_load(&server->metrics); metrics; metrics = metrics->next)
+  {
+    for (i = 0; i < MOAUTHD_METRIC_MAX; i ++)
+      counters[i] += atomic_load_explicit(metrics->counters + i, memory_order_relaxed);
+
+    for (i = 0; i < num_timings && i < metrics->num_timings; i ++)
+    {
+      for (bucket = 0; bucket < MOAUTHD_HISTOGRAM_BUCKETS; bucket ++)
+        timings[i].counts[bucket] += atomic_load_explicit(metrics->timings[i].counts + bucket, memory_order_relaxed);
+
+      timings[i].sum += atomic_load_explicit(&metrics->timings[i].sum, memory_order_relaxed);
+    }
+  }
+
+  moauthdGetTokenStats(server, &stats);
+
+  cupsMutexLock(&server->clients_lock);
+
+  for (current = (moauthd_client_t *)cupsArrayGetFirst(server->clients); current; current = (moauthd_client_t *)cupsArrayGetNext(server->clients))
+  {
+    if (current->busy)
+      active ++;
+    else
+      idle ++;
+  }
+
+  cupsMutexUnlock(&server->clients_lock);
+
+  // Format the metrics so they can be sent with a known length...
+  client->output_used  = 0;
+  client->output_alloc = 16384;
+
+  if ((client->output = malloc(client->output_alloc)) == NULL)
+  {
+    free(timings);
+    return (moauthdRespondClient(client, HTTP_STATUS_SERVER_ERROR, NULL, NULL, 0, 0));
+  }
+
+  write_metric(client, "# HELP moauthd_start_time_seconds Time the server was started.\n# TYPE moauthd_start_time_seconds gauge\nmoauthd_start_time_seconds %ld\n", (long)server->start_time);
+
+  write_metric(client, "# HELP moauthd_connections Open client connections.\n# TYPE moauthd_connections gauge\nmoauthd_connections{state=\"active\"} %lu\nmoauthd_connections{state=\"idle\"} %lu\n", (unsigned long)active, (unsigned long)idle);
+  write_metric(client, "# HELP moauthd_connections_total Client connections accepted.\n# TYPE moauthd_connections_total counter\nmoauthd_connections_total %d\n", atomic_load(&server->num_clients));
+
+  write_metric(client, "# HELP moauthd_request_duration_seconds Request latency by endpoint.\n# TYPE moauthd_request_duration_seconds histogram\n");
+  for (i = 0; i < server->num_endpoints; i ++)
+    write_histogram(client, "moauthd_request_duration_seconds", "endpoint", server->endpoints[i].path, timings + MOAUTHD_TIMING_REQUEST + i);
+  write_histogram(client, "moauthd_request_duration_seconds", "endpoint", "resource", timings + MOAUTHD_TIMING_REQUEST + server->num_endpoints);
+  write_histogram(client, "moauthd_request_duration_seconds", "endpoint", "other", timings + MOAUTHD_TIMING_REQUEST + server->num_endpoints + 1);
+
+  write_metric(client, "# HELP moauthd_tokens Live tokens by type.\n# TYPE moauthd_tokens gauge\n");
+  for (i = 0; i < MOAUTHD_TOKTYPE_MAX; i ++)
+    write_metric(client, "moauthd_tokens{type=\"%s\"} %lu\n", types[i], (unsigned long)stats.num_live[i]);
+
+  write_metric(client, "# HELP moauthd_tokens_issued_total Tokens issued by type.\n# TYPE moauthd_tokens_issued_total counter\n");
+  for (i = 0; i < MOAUTHD_TOKTYPE_MAX; i ++)
+    write_metric(client, "moauthd_tokens_issued_total{type=\"%s\"} %llu\n", types[i], (unsigned long long)counters[MOAUTHD_METRIC_TOKENS_ISSUED + i]);
+
+  write_metric(client, "# HELP moauthd_tokens_reaped_total Expired tokens removed by type.\n# TYPE moauthd_tokens_reaped_total counter\n");
+  for (i = 0; i < MOAUTHD_TOKTYPE_MAX; i ++)
+    write_metric(client, "moauthd_tokens_reaped_total{type=\"%s\"} %lu\n", types[i], (unsigned long)stats.num_reaped[i]);
+
+  write_metric(client, "# HELP moauthd_pam_authentications_total PAM authentications by result.\n# TYPE moauthd_pam_authentications_total counter\nmoauthd_pam_authentications_total{result=\"succeeded\"} %llu\nmoauthd_pam_authentications_total{result=\"failed\"} %llu\n", (unsigned long long)counters[MOAUTHD_METRIC_PAM_SUCCEEDED], (unsigned long long)counters[MOAUTHD_METRIC_PAM_FAILED]);
+
+  write_metric(client, "# HELP moauthd_pam_duration_seconds PAM authentication latency by stage.\n# TYPE moauthd_pam_duration_seconds histogram\n");
+  write_histogram(client, "moauthd_pam_duration_seconds", "stage", "queue", timings + MOAUTHD_TIMING_AUTH_WAIT);
+  write_histogram(client, "moauthd_pam_duration_seconds", "stage", "authenticate", timings + MOAUTHD_TIMING_PAM_AUTHENTICATE);
+  write_histogram(client, "moauthd_pam_duration_seconds", "stage", "acct_mgmt", timings + MOAUTHD_TIMING_PAM_ACCT_MGMT);
+
+  write_metric(client, "# HELP moauthd_cache_hits_total Cache hits by cache.\n# TYPE moauthd_cache_hits_total counter\n");
+  for (i = 0; i < (sizeof(caches) / sizeof(caches[0])); i ++)
+    write_metric(client, "moauthd_cache_hits_total{cache=\"%s\"} %llu\n", caches[i].name, (unsigned long long)counters[caches[i].hits]);
+
+  write_metric(client, "# HELP moauthd_cache_misses_total Cache misses by cache.\n# TYPE moauthd_cache_misses_total counter\n");
+  for (i = 0; i < (sizeof(caches) / sizeof(caches[0])); i ++)
+    write_metric(client, "moauthd_cache_misses_total{cache=\"%s\"} %llu\n", caches[i].name, (unsigned long long)counters[caches[i].misses]);
+
+  write_metric(client, "# HELP moauthd_log_dropped_total Log lines and access log records dropped.\n# TYPE moauthd_log_dropped_total counter\nmoauthd_log_dropped_total %lu\n", (unsigned long)atomic_load(&server->log_dropped));
+
+  free(timings);
+
+  // Send the metrics...
+  output               = client->output;
+  output_used          = client->output_used;
+  client->output       = NULL;
+  client->output_used  = 0;
+  client->output_alloc = 0;
+
+  if ((ret = moauthdRespondClient(client, HTTP_STATUS_OK, "text/plain; version=0.0.4; charset=utf-8", NULL, 0, output_used)) && client->request_method != HTTP_STATE_HEAD)
+    ret = moauthdWriteClient(client, output, output_used);
+
+  free(output);
+
+  return (ret);
+}
+
+
+//
+// 'get_metrics()' - Get the metrics for the current thread.
+//
+
+static moauthd_metrics_t *		// O - Metrics or `NULL` on error
+get_metrics(moauthd_server_t *server)	// I - Server object
+{
+  moauthd_metrics_t	*metrics;	// Metrics
+  size_t		num_timings;	// Number of latency histograms
+
+
+  if ((metrics = thread_metrics) != NULL && metrics->server == server)
+    return (metrics);
+
+  // Endpoints are all added at startup, so the number of histograms is fixed
+  // by the time requests are counted...
+  num_timings = MOAUTHD_TIMING_REQUEST + server->num_endpoints + 2;
+
+  if ((metrics = (moauthd_metrics_t *)calloc(1, sizeof(moauthd_metrics_t) + num_timings * sizeof(moauthd_histogram_t))) == NULL)
+    return (NULL);
+
+  metrics->server      = server;
+  metrics->num_timings = num_timings;
+  metrics->next        = atomic_load(&server->metrics);
+
+  while (!atomic_compare_exchange_weak(&server->metrics, &metrics->next, metrics));
+
+  thread_metrics = metrics;
+
+  return (metrics);
+}
+
+
+//
+// 'write_histogram()' - Write a latency histogram.
+//
+// Prometheus histogram buckets are cumulative, so each bucket includes the
+// counts of the smaller buckets.
+//
+
+static void
+write_histogram(
+    moauthd_client_t  *client,		// I - Client object
+    const char        *name,		// I - Metric name
+    const char        *label,		// I - Label name
+    const char        *value,		// I - Label value
+    moauthd_histsum_t *histogram)	// I - Latency histogram totals
+{
+  size_t	bucket;			// Histogram bucket
+  uint64_t	count = 0;		// Cumulative count
+
+
+  for (bucket = 0; bucket < MOAUTHD_HISTOGRAM_BUCKETS; bucket ++)
+  {
+    count += histogram->counts[bucket];
+
+    if (bucket < (MOAUTHD_HISTOGRAM_BUCKETS - 1))
+      write_metric(client, "%s_bucket{%s=\"%s\",le=\"%g\"} %llu\n", name, label, value, (double)(1ULL << bucket) / 1000.0, (unsigned long long)count);
+    else
+      write_metric(client, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %llu\n", name, label, value, (unsigned long long)count);
+  }
+
+  write_metric(client, "%s_sum{%s=\"%s\"} %.6f\n%s_count{%s=\"%s\"} %llu\n", name, label, value, histogram->sum / 1000000.0, name, label, value, (unsigned long long)count);
+}
+
+
+//
+// 'write_metric()' - Write formatted metrics text.
+//
+
+static void
+write_metric(moauthd_client_t *client,	// I - Client object
+             const char       *format,	// I - Printf-style format string
+             ...)			// I - Additional arguments as needed
+{
+  char		buffer[1024];		// Formatted text
+  va_list	ap;			// Argument pointer
+
+
+  va_start(ap, format);
+  vsnprintf(buffer, sizeof(buffer), format, ap);
+  va_end(ap);
+
+  moauthdWriteClient(client, buffer, strlen(buffer));
+}
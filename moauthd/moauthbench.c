@@ -0,0 +1,1013 @@
+//
+// HTTP load generator for moauth daemon
+//
+// Copyright © 2026 by Michael R Sweet
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Usage:
+//
+//   ./moauthbench [OPTIONS] [URL]
+//
+// Options:
+//
+//   -c CONNECTIONS      Number of keep-alive connections (default is threads)
+//   -d SECONDS          Duration of the run (default 10)
+//   -i IDLE             Number of idle keep-alive connections (default 0)
+//   -j THREADS          Number of client threads (default 4, 0 for none)
+//   -m NAME=WEIGHT,...  Request mix
+//   -n REQUESTS         Stop after this many requests
+//   -p PASSWORD         Password (default $TEST_PASSWORD or "test123")
+//   -P PID              Server process to measure (default is the started moauthd)
+//   -r RESOURCE         Resource for Bearer GETs (default "/shared/shared.pdf")
+//   -u USERNAME         Username (default current user)
+//
+// The request mix names the "password", "authorize", "code", "introspect",
+// "userinfo", "bearer", and "wellknown" operations with their relative
+// weights.  The default is
+// "password=1,authorize=1,code=1,introspect=4,userinfo=4,bearer=8,wellknown=2".
+//
+// Throughput and p50/p99/p999 latencies are reported for each operation.  An
+// "authorize" operation is just the /authorize request, while a "code"
+// operation is the /authorize and /token request pair.  The average length of
+// the /authorize redirection URL is also reported.
+//
+// When no URL is given, moauthd is started with the "test.conf" file so the
+// benchmark runs on localhost using its `TestPassword` instead of PAM.
+//
+// Idle connections make one request and then stay open for the run.  The
+// resident memory of the server is reported before and after opening them,
+// along with the CPU time the server used during the run ("/proc" is
+// required).  Use "-j 0" to measure the idle connections without any load.
+//
+
+#include <config.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <spawn.h>
+#include <cups/form.h>
+#include <cups/thread.h>
+#include <signal.h>
+#include <moauth/moauth-private.h>
+extern char **environ;
+
+
+//
+// Constants...
+//
+
+#define CLIENT_ID	"testmoauthd"
+#define REDIRECT_URI	"https://localhost:10000"
+
+
+//
+// Local types...
+//
+
+typedef enum bench_op_e			// Benchmark operations
+{
+  BENCH_OP_PASSWORD,			// POST /token with a password grant
+  BENCH_OP_AUTHORIZE,			// POST /authorize
+  BENCH_OP_CODE,			// POST /authorize and /token with an authorization code grant
+  BENCH_OP_INTROSPECT,			// POST /introspect
+  BENCH_OP_USERINFO,			// GET /userinfo
+  BENCH_OP_BEARER,			// GET a resource with a Bearer token
+  BENCH_OP_WELLKNOWN,			// GET /.well-known/oauth-authorization-server
+  BENCH_OP_MAX				// Number of operations
+} bench_op_t;
+
+typedef struct bench_stats_s		// Operation statistics
+{
+  uint64_t	*usecs;			// Latencies in microseconds
+  size_t	num_usecs,		// Number of latencies
+		alloc_usecs,		// Allocated latencies
+		errors;			// Number of failed operations
+} bench_stats_t;
+
+typedef struct bench_s			// Benchmark settings
+{
+  const char	*resource;		// Resource for Bearer GETs
+  char		*password_form,		// Form for password grants
+		*authorize_form,	// Form for authorization requests
+		*introspect_form,	// Form for introspection requests
+		token[2048];		// Access token for Bearer requests
+  int		weights[BENCH_OP_MAX],	// Weights for each operation
+		total_weight;		// Total of weights
+  uint64_t	end_time;		// End of run
+  size_t	max_requests;		// Maximum requests per thread
+} bench_t;
+
+typedef struct bench_thread_s		// Client thread data
+{
+  bench_t	*bench;			// Benchmark settings
+  size_t	num_https;		// Number of connections
+  http_t	**https;		// Connections for this thread
+  unsigned	seed;			// Random number seed
+  bench_stats_t	stats[BENCH_OP_MAX];	// Statistics for each operation
+  size_t	num_locations,		// Number of redirections
+		location_bytes;		// Total length of redirection URLs
+} bench_thread_t;
+
+
+//
+// Local globals...
+//
+
+static volatile bool	stop_bench = false;
+					// Stop the benchmark?
+static const char * const bench_ops[] =	// Operation names
+{
+  "password",
+  "authorize",
+  "code",
+  "introspect",
+  "userinfo",
+  "bearer",
+  "wellknown"
+};
+
+
+//
+// Local functions...
+//
+
+static int	compare_usecs(const uint64_t *a, const uint64_t *b);
+static uint64_t	get_time(void);
+static bool	get_usage(pid_t pid, size_t *rss, double *cpu);
+static bool	parse_mix(bench_t *bench, const char *mix);
+static bool	run_op(bench_t *bench, http_t *http, bench_op_t op, size_t *loclen);
+static void	*run_thread(bench_thread_t *thread);
+static http_status_t send_request(http_t *http, const char *method, const char *resource, const char *token, const char *form, char *body, size_t bodysize, char *location, size_t locsize);
+static void	show_stats(const char *name, bench_stats_t *stats, double elapsed);
+static void	sig_handler(int sig);
+static pid_t	start_moauthd(void);
+static int	usage(FILE *fp);
+
+
+//
+// 'main()' - Main entry for load generator.
+//
+
+int					// O - Exit status
+main(int  argc,				// I - Number of command-line arguments
+     char *argv[])			// I - Command-line arguments
+{
+  int			i,		// Looping var
+			status = 0;	// Exit status
+  const char		*opt,		// Current option
+			*url = NULL,	// Server URL
+			*mix = "password=1,authorize=1,code=1,introspect=4,userinfo=4,bearer=8,wellknown=2",
+					// Request mix
+			*username = NULL,
+					// Username
+			*password = NULL;
+					// Password
+  int			duration = 10,	// Duration in seconds
+			num_threads = 4,// Number of threads
+			num_https = 0,	// Number of connections
+			num_idle = 0;	// Number of idle connections
+  long			num_requests = 0;
+					// Maximum number of requests
+  pid_t			moauthd_pid = 0,// moauthd process ID
+			server_pid = 0;	// Server process ID to measure
+  char			scheme[32],	// URL scheme
+			userpass[256],	// URL username:password
+			host[256],	// URL hostname
+			resource[256];	// URL resource
+  int			port;		// URL port number
+  bench_t		bench;		// Benchmark settings
+  bench_thread_t	*threads = NULL;// Client threads
+  cups_thread_t		*tids = NULL;	// Client thread IDs
+  http_t		**https = NULL,	// Connections
+			**idles = NULL;	// Idle connections
+  size_t		num_form;	// Number of form variables
+  cups_option_t		*form;		// Form variables
+  char			body[8192];	// Response body
+  cups_json_t		*json;		// JSON response
+  const char		*value;		// JSON value
+  int			start_https;	// First connection for thread
+  uint64_t		start_time;	// Start of run
+  double		elapsed;	// Elapsed time in seconds
+  bench_stats_t		total;		// Total statistics
+  bench_op_t		op;		// Current operation
+  size_t		base_rss = 0,	// Server memory before idle connections
+			idle_rss = 0;	// Server memory with idle connections
+  double		base_cpu = 0.0,	// Server CPU time before the run
+			end_cpu = 0.0;	// Server CPU time after the run
+  bool			measure;	// Measure the server process?
+  size_t		num_locations,	// Number of redirections
+			location_bytes;	// Total length of redirection URLs
+
+
+  memset(&bench, 0, sizeof(bench));
+  bench.resource = "/shared/shared.pdf";
+
+  // Parse command-line arguments...
+  for (i = 1; i < argc; i ++)
+  {
+    if (!strcmp(argv[i], "--help"))
+    {
+      return (usage(stdout));
+    }
+    else if (argv[i][0] == '-' && argv[i][1])
+    {
+      for (opt = argv[i] + 1; *opt; opt ++)
+      {
+        if (!strchr("cdijmnpPru", *opt))
+        {
+          fprintf(stderr, "moauthbench: Unknown option '-%c'.\n", *opt);
+          return (usage(stderr));
+        }
+
+        i ++;
+        if (i >= argc)
+        {
+          fprintf(stderr, "moauthbench: Missing value after '-%c'.\n", *opt);
+          return (usage(stderr));
+        }
+
+        switch (*opt)
+        {
+          case 'c' : // -c CONNECTIONS
+              num_https = atoi(argv[i]);
+              break;
+          case 'd' : // -d SECONDS
+              duration = atoi(argv[i]);
+              break;
+          case 'i' : // -i IDLE
+              num_idle = atoi(argv[i]);
+              break;
+          case 'j' : // -j THREADS
+              num_threads = atoi(argv[i]);
+              break;
+          case 'm' : // -m NAME=WEIGHT,...
+              mix = argv[i];
+              break;
+          case 'n' : // -n REQUESTS
+              num_requests = atol(argv[i]);
+              break;
+          case 'p' : // -p PASSWORD
+              password = argv[i];
+              break;
+          case 'P' : // -P PID
+              server_pid = (pid_t)atoi(argv[i]);
+              break;
+          case 'r' : // -r RESOURCE
+              bench.resource = argv[i];
+              break;
+          case 'u' : // -u USERNAME
+              username = argv[i];
+              break;
+        }
+      }
+    }
+    else if (!url)
+    {
+      url = argv[i];
+    }
+    else
+    {
+      fprintf(stderr, "moauthbench: Unknown argument '%s'.\n", argv[i]);
+      return (usage(stderr));
+    }
+  }
+
+  if (duration <= 0 || num_threads < 0 || num_threads > 1000 || (num_threads == 0 && num_idle == 0) || num_https < 0 || num_https > 10000 || num_idle < 0 || num_idle > 100000 || num_requests < 0 || server_pid < 0)
+  {
+    fputs("moauthbench: Bad number of connections, duration, requests, or threads.\n", stderr);
+    return (usage(stderr));
+  }
+
+  if (num_https < num_threads)
+    num_https = num_threads;
+  if (num_https < 1)
+    num_https = 1;
+
+  if (!parse_mix(&bench, mix))
+    return (1);
+
+  if (!username)
+    username = cupsGetUser();
+
+  if (!password && (password = getenv("TEST_PASSWORD")) == NULL)
+    password = "test123";
+
+  // Catch signals...
+  signal(SIGINT, sig_handler);
+  signal(SIGTERM, sig_handler);
+
+  // Start the daemon as needed...
+  if (url)
+  {
+    if (httpSeparateURI(HTTP_URI_CODING_ALL, url, scheme, sizeof(scheme), userpass, sizeof(userpass), host, sizeof(host), &port, resource, sizeof(resource)) < HTTP_URI_STATUS_OK || strcmp(scheme, "https"))
+    {
+      fprintf(stderr, "moauthbench: Bad URL \"%s\".\n", url);
+      return (1);
+    }
+  }
+  else if ((moauthd_pid = start_moauthd()) <= 0)
+  {
+    fprintf(stderr, "moauthbench: Unable to start moauthd: %s\n", strerror(errno));
+    return (1);
+  }
+  else
+  {
+    httpGetHostname(NULL, host, sizeof(host));
+    port = 9000 + (getuid() % 1000);
+
+    if (!server_pid)
+      server_pid = moauthd_pid;
+  }
+
+  // Open the connections, waiting up to 30 seconds for the server to start...
+  if ((https = calloc((size_t)num_https, sizeof(http_t *))) == NULL || (num_idle > 0 && (idles = calloc((size_t)num_idle, sizeof(http_t *))) == NULL) || (num_threads > 0 && ((threads = calloc((size_t)num_threads, sizeof(bench_thread_t))) == NULL || (tids = calloc((size_t)num_threads, sizeof(cups_thread_t))) == NULL)))
+  {
+    perror("moauthbench: Unable to allocate memory");
+    status = 1;
+    goto finish_up;
+  }
+
+  for (i = 0; i < 30 && !stop_bench; i ++)
+  {
+    if ((https[0] = httpConnect(host, port, NULL, AF_UNSPEC, HTTP_ENCRYPTION_ALWAYS, true, 30000, NULL)) != NULL)
+      break;
+
+    sleep(1);
+  }
+
+  if (!https[0])
+  {
+    fprintf(stderr, "moauthbench: Unable to connect to \"%s\" on port %d: %s\n", host, port, cupsGetErrorString());
+    status = 1;
+    goto finish_up;
+  }
+
+  for (i = 1; i < num_https; i ++)
+  {
+    if ((https[i] = httpConnect(host, port, NULL, AF_UNSPEC, HTTP_ENCRYPTION_ALWAYS, true, 30000, NULL)) == NULL)
+    {
+      fprintf(stderr, "moauthbench: Unable to connect to \"%s\" on port %d: %s\n", host, port, cupsGetErrorString());
+      status = 1;
+      goto finish_up;
+    }
+  }
+
+  // Prepare the form data for each operation...
+  num_form = cupsAddOption("grant_type", "password", 0, &form);
+  num_form = cupsAddOption("username", username, num_form, &form);
+  num_form = cupsAddOption("password", password, num_form, &form);
+  num_form = cupsAddOption("scope", "private shared", num_form, &form);
+  bench.password_form = cupsFormEncode(/*url*/NULL, num_form, form);
+  cupsFreeOptions(num_form, form);
+
+  num_form = cupsAddOption("client_id", CLIENT_ID, 0, &form);
+  num_form = cupsAddOption("redirect_uri", REDIRECT_URI, num_form, &form);
+  num_form = cupsAddOption("response_type", "code", num_form, &form);
+  num_form = cupsAddOption("scope", "private shared", num_form, &form);
+  num_form = cupsAddOption("username", username, num_form, &form);
+  num_form = cupsAddOption("password", password, num_form, &form);
+  bench.authorize_form = cupsFormEncode(/*url*/NULL, num_form, form);
+  cupsFreeOptions(num_form, form);
+
+  // Get an access token for the Bearer requests...
+  if (send_request(https[0], "POST", "/token", NULL, bench.password_form, body, sizeof(body), NULL, 0) == HTTP_STATUS_OK)
+  {
+    json = cupsJSONImportString(body);
+
+    if ((value = cupsJSONGetString(cupsJSONFind(json, "access_token"))) != NULL)
+      cupsCopyString(bench.token, value, sizeof(bench.token));
+
+    cupsJSONDelete(json);
+  }
+
+  if (!bench.token[0])
+  {
+    fprintf(stderr, "moauthbench: Unable to get an access token for \"%s\".\n", username);
+    status = 1;
+    goto finish_up;
+  }
+
+  num_form = cupsAddOption("token", bench.token, 0, &form);
+  bench.introspect_form = cupsFormEncode(/*url*/NULL, num_form, form);
+  cupsFreeOptions(num_form, form);
+
+  if (!bench.password_form || !bench.authorize_form || !bench.introspect_form)
+  {
+    fputs("moauthbench: Unable to encode form data.\n", stderr);
+    status = 1;
+    goto finish_up;
+  }
+
+  // Open the idle connections, measuring the server memory before and after...
+  measure = server_pid > 0 && get_usage(server_pid, &base_rss, &base_cpu);
+
+  for (i = 0; i < num_idle && !stop_bench; i ++)
+  {
+    if ((idles[i] = httpConnect(host, port, NULL, AF_UNSPEC, HTTP_ENCRYPTION_ALWAYS, true, 30000, NULL)) == NULL || send_request(idles[i], "GET", "/.well-known/oauth-authorization-server", NULL, NULL, NULL, 0, NULL, 0) != HTTP_STATUS_OK)
+    {
+      fprintf(stderr, "moauthbench: Unable to open idle connection to \"%s\" on port %d: %s\n", host, port, cupsGetErrorString());
+      status = 1;
+      goto finish_up;
+    }
+  }
+
+  if (measure && num_idle > 0 && get_usage(server_pid, &idle_rss, &base_cpu))
+    printf("Server memory is %lu KiB, %lu KiB with %d idle connections (%.1f KiB per connection).\n", (unsigned long)base_rss, (unsigned long)idle_rss, num_idle, ((double)idle_rss - (double)base_rss) / num_idle);
+
+  // Run the client threads...
+  printf("Running %d threads over %d connections (%d idle) to \"%s:%d\" for %d seconds...\n", num_threads, num_https, num_idle, host, port, duration);
+
+  start_time         = get_time();
+  bench.end_time     = start_time + 1000000 * (uint64_t)duration;
+  bench.max_requests = num_requests ? ((size_t)num_requests + (size_t)num_threads - 1) / (size_t)num_threads : 0;
+
+  for (i = 0, start_https = 0; i < num_threads; i ++)
+  {
+    // Each thread gets its own share of the connections...
+    threads[i].bench     = &bench;
+    threads[i].https     = https + start_https;
+    threads[i].num_https = (size_t)(num_https / num_threads + (i < (num_https % num_threads)));
+    start_https          += (int)threads[i].num_https;
+    threads[i].seed      = (unsigned)(i + 1) * 2654435761U ^ (unsigned)getpid();
+
+    if ((tids[i] = cupsThreadCreate((cups_thread_func_t)run_thread, threads + i)) == CUPS_THREAD_INVALID)
+    {
+      perror("moauthbench: Unable to create client thread");
+      stop_bench = true;
+      num_threads = i;
+      status = 1;
+      break;
+    }
+  }
+
+  for (i = 0; i < num_threads; i ++)
+    cupsThreadWait(tids[i]);
+
+  while (num_threads == 0 && !stop_bench && get_time() < bench.end_time)
+    sleep(1);
+
+  elapsed = (get_time() - start_time) / 1000000.0;
+
+  if (measure && get_usage(server_pid, &idle_rss, &end_cpu))
+    printf("Server used %.2f seconds of CPU time (%.1f%% of one CPU), memory is %lu KiB.\n", end_cpu - base_cpu, 100.0 * (end_cpu - base_cpu) / elapsed, (unsigned long)idle_rss);
+
+  // Merge and report the statistics...
+  memset(&total, 0, sizeof(total));
+
+  printf("%-12s %10s %8s %10s %9s %9s %9s\n", "Operation", "Requests", "Errors", "Req/sec", "p50 ms", "p99 ms", "p999 ms");
+
+  for (op = BENCH_OP_PASSWORD; op < BENCH_OP_MAX; op ++)
+  {
+    bench_stats_t	stats;		// Operation statistics
+    uint64_t		*usecs;		// Latencies
+
+    memset(&stats, 0, sizeof(stats));
+
+    for (i = 0; i < num_threads; i ++)
+    {
+      bench_stats_t *tstats = threads[i].stats + op;
+					// Thread statistics
+
+      stats.errors    += tstats->errors;
+      stats.num_usecs += tstats->num_usecs;
+    }
+
+    if (stats.num_usecs && (stats.usecs = malloc(stats.num_usecs * sizeof(uint64_t))) != NULL)
+    {
+      for (i = 0, usecs = stats.usecs; i < num_threads; i ++)
+      {
+        memcpy(usecs, threads[i].stats[op].usecs, threads[i].stats[op].num_usecs * sizeof(uint64_t));
+        usecs += threads[i].stats[op].num_usecs;
+      }
+    }
+    else
+    {
+      stats.num_usecs = 0;
+    }
+
+    if (bench.weights[op])
+      show_stats(bench_ops[op], &stats, elapsed);
+
+    if (stats.num_usecs && (usecs = realloc(total.usecs, (total.num_usecs + stats.num_usecs) * sizeof(uint64_t))) != NULL)
+    {
+      memcpy(usecs + total.num_usecs, stats.usecs, stats.num_usecs * sizeof(uint64_t));
+      total.usecs     = usecs;
+      total.num_usecs += stats.num_usecs;
+    }
+
+    total.errors += stats.errors;
+
+    free(stats.usecs);
+  }
+
+  show_stats("total", &total, elapsed);
+  free(total.usecs);
+
+  for (i = 0, num_locations = 0, location_bytes = 0; i < num_threads; i ++)
+  {
+    num_locations  += threads[i].num_locations;
+    location_bytes += threads[i].location_bytes;
+  }
+
+  if (num_locations)
+    printf("Average /authorize redirection URL is %.1f bytes.\n", (double)location_bytes / num_locations);
+
+  if (total.errors)
+    status = 1;
+
+  // Stop the test server...
+  finish_up:
+
+  if (https)
+  {
+    for (i = 0; i < num_https; i ++)
+      httpClose(https[i]);
+  }
+
+  if (idles)
+  {
+    for (i = 0; i < num_idle; i ++)
+      httpClose(idles[i]);
+  }
+
+  if (threads)
+  {
+    for (i = 0; i < num_threads; i ++)
+    {
+      for (op = BENCH_OP_PASSWORD; op < BENCH_OP_MAX; op ++)
+        free(threads[i].stats[op].usecs);
+    }
+  }
+
+  free(https);
+  free(idles);
+  free(threads);
+  free(tids);
+  free(bench.password_form);
+  free(bench.authorize_form);
+  free(bench.introspect_form);
+
+  if (moauthd_pid > 0)
+    kill(moauthd_pid, SIGTERM);
+
+  return (status);
+}
+
+
+//
+// 'compare_usecs()' - Compare two latencies.
+//
+
+static int				// O - Result of comparison
+compare_usecs(const uint64_t *a,	// I - First latency
+              const uint64_t *b)	// I - Second latency
+{
+  if (*a < *b)
+    return (-1);
+  else if (*a > *b)
+    return (1);
+  else
+    return (0);
+}
+
+
+//
+// 'get_time()' - Get the monotonic time in microseconds.
+//
+
+static uint64_t				// O - Time in microseconds
+get_time(void)
+{
+  struct timespec	curtime;	// Current time
+
+
+  clock_gettime(CLOCK_MONOTONIC, &curtime);
+
+  return ((uint64_t)curtime.tv_sec * 1000000 + (uint64_t)curtime.tv_nsec / 1000);
+}
+
+
+//
+// 'get_usage()' - Get the resident memory and CPU time of a process.
+//
+
+static bool				// O - `true` on success, `false` if not available
+get_usage(pid_t  pid,			// I - Process ID
+          size_t *rss,			// O - Resident memory in KiB
+          double *cpu)			// O - User and system CPU time in seconds
+{
+  char		filename[256],		// /proc filename
+		buffer[1024],		// Line from file
+		*ptr;			// Pointer into line
+  FILE		*fp;			// File
+  unsigned long	pages,			// Resident pages
+		utime,			// User CPU time in clock ticks
+		stime;			// System CPU time in clock ticks
+  int		i;			// Looping var
+
+
+  // Resident pages are the second number in "statm"...
+  snprintf(filename, sizeof(filename), "/proc/%d/statm", (int)pid);
+  if ((fp = fopen(filename, "r")) == NULL)
+    return (false);
+
+  if (fscanf(fp, "%*s %lu", &pages) != 1)
+  {
+    fclose(fp);
+    return (false);
+  }
+
+  fclose(fp);
+
+  // User and system times are the 14th and 15th fields in "stat", after the
+  // parenthesized command name...
+  snprintf(filename, sizeof(filename), "/proc/%d/stat", (int)pid);
+  if ((fp = fopen(filename, "r")) == NULL)
+    return (false);
+
+  ptr = fgets(buffer, sizeof(buffer), fp);
+  fclose(fp);
+
+  if (!ptr || (ptr = strrchr(buffer, ')')) == NULL)
+    return (false);
+
+  for (i = 2; i < 14 && ptr; i ++)
+  {
+    if ((ptr = strchr(ptr + 1, ' ')) != NULL)
+      ptr ++;
+  }
+
+  if (!ptr || sscanf(ptr, "%lu%lu", &utime, &stime) != 2)
+    return (false);
+
+  *rss = (size_t)pages * (size_t)sysconf(_SC_PAGESIZE) / 1024;
+  *cpu = (double)(utime + stime) / (double)sysconf(_SC_CLK_TCK);
+
+  return (true);
+}
+
+
+//
+// 'parse_mix()' - Parse the request mix.
+//
+
+static bool				// O - `true` on success, `false` on error
+parse_mix(bench_t    *bench,		// I - Benchmark settings
+          const char *mix)		// I - "name=weight,..." string
+{
+  char		temp[1024],		// Temporary string
+		*name,			// Current name
+		*value,			// Current weight
+		*next;			// Next name
+  bench_op_t	op;			// Current operation
+
+
+  cupsCopyString(temp, mix, sizeof(temp));
+
+  for (name = temp; name && *name; name = next)
+  {
+    if ((next = strchr(name, ',')) != NULL)
+      *next++ = '\0';
+
+    if ((value = strchr(name, '=')) != NULL)
+      *value++ = '\0';
+
+    for (op = BENCH_OP_PASSWORD; op < BENCH_OP_MAX; op ++)
+    {
+      if (!strcmp(name, bench_ops[op]))
+        break;
+    }
+
+    if (op >= BENCH_OP_MAX)
+    {
+      fprintf(stderr, "moauthbench: Unknown operation \"%s\" in request mix.\n", name);
+      return (false);
+    }
+
+    if ((bench->weights[op] = value ? atoi(value) : 1) < 0 || bench->weights[op] > 1000)
+    {
+      fprintf(stderr, "moauthbench: Bad weight for \"%s\" in request mix.\n", name);
+      return (false);
+    }
+  }
+
+  for (op = BENCH_OP_PASSWORD, bench->total_weight = 0; op < BENCH_OP_MAX; op ++)
+    bench->total_weight += bench->weights[op];
+
+  if (bench->total_weight == 0)
+  {
+    fputs("moauthbench: Empty request mix.\n", stderr);
+    return (false);
+  }
+
+  return (true);
+}
+
+
+//
+// 'run_op()' - Run a single operation.
+//
+
+static bool				// O - `true` on success, `false` on failure
+run_op(bench_t    *bench,		// I - Benchmark settings
+       http_t     *http,		// I - HTTP connection
+       bench_op_t op,			// I - Operation
+       size_t     *loclen)		// O - Length of redirection URL or 0
+{
+  char		location[1024],		// Location of redirect
+		*code,			// Grant code
+		*ptr,			// Pointer into grant code
+		*form;			// Form data
+  size_t	num_form;		// Number of form variables
+  cups_option_t	*vars;			// Form variables
+  http_status_t	status;			// HTTP status
+
+
+  *loclen = 0;
+
+  switch (op)
+  {
+    case BENCH_OP_PASSWORD :
+        return (send_request(http, "POST", "/token", NULL, bench->password_form, NULL, 0, NULL, 0) == HTTP_STATUS_OK);
+
+    case BENCH_OP_AUTHORIZE :
+        if (send_request(http, "POST", "/authorize", NULL, bench->authorize_form, NULL, 0, location, sizeof(location)) != HTTP_STATUS_FOUND || !strstr(location, "code="))
+          return (false);
+
+        *loclen = strlen(location);
+
+        return (true);
+
+    case BENCH_OP_CODE :
+        // Get a grant code from the redirection...
+        if (send_request(http, "POST", "/authorize", NULL, bench->authorize_form, NULL, 0, location, sizeof(location)) != HTTP_STATUS_FOUND || (code = strstr(location, "code=")) == NULL)
+          return (false);
+
+        *loclen = strlen(location);
+
+        code += 5;
+        if ((ptr = strchr(code, '&')) != NULL)
+          *ptr = '\0';
+
+        // Then exchange it for an access token...
+        num_form = cupsAddOption("grant_type", "authorization_code", 0, &vars);
+        num_form = cupsAddOption("code", code, num_form, &vars);
+        num_form = cupsAddOption("client_id", CLIENT_ID, num_form, &vars);
+        num_form = cupsAddOption("redirect_uri", REDIRECT_URI, num_form, &vars);
+        form     = cupsFormEncode(/*url*/NULL, num_form, vars);
+        cupsFreeOptions(num_form, vars);
+
+        if (!form)
+          return (false);
+
+        status = send_request(http, "POST", "/token", NULL, form, NULL, 0, NULL, 0);
+        free(form);
+
+        return (status == HTTP_STATUS_OK);
+
+    case BENCH_OP_INTROSPECT :
+        return (send_request(http, "POST", "/introspect", NULL, bench->introspect_form, NULL, 0, NULL, 0) == HTTP_STATUS_OK);
+
+    case BENCH_OP_USERINFO :
+        return (send_request(http, "GET", "/userinfo", bench->token, NULL, NULL, 0, NULL, 0) == HTTP_STATUS_OK);
+
+    case BENCH_OP_BEARER :
+        return (send_request(http, "GET", bench->resource, bench->token, NULL, NULL, 0, NULL, 0) == HTTP_STATUS_OK);
+
+    case BENCH_OP_WELLKNOWN :
+        return (send_request(http, "GET", "/.well-known/oauth-authorization-server", NULL, NULL, NULL, 0, NULL, 0) == HTTP_STATUS_OK);
+
+    default :
+        return (false);
+  }
+}
+
+
+//
+// 'run_thread()' - Send requests until the run is over.
+//
+
+static void *				// O - Thread exit status
+run_thread(bench_thread_t *thread)	// I - Client thread data
+{
+  bench_t	*bench = thread->bench;	// Benchmark settings
+  size_t	i,			// Current connection
+		count;			// Number of requests
+  int		choice;			// Random choice
+  bench_op_t	op;			// Current operation
+  bench_stats_t	*stats;			// Statistics for operation
+  uint64_t	start,			// Start of operation
+		end;			// End of operation
+  bool		ok;			// Successful operation?
+  size_t	loclen;			// Length of redirection URL
+
+
+  for (i = 0, count = 0, end = get_time(); !stop_bench && end < bench->end_time && (!bench->max_requests || count < bench->max_requests); count ++)
+  {
+    // Pick an operation using a simple xorshift generator...
+    thread->seed ^= thread->seed << 13;
+    thread->seed ^= thread->seed >> 17;
+    thread->seed ^= thread->seed << 5;
+
+    for (op = BENCH_OP_PASSWORD, choice = (int)(thread->seed % (unsigned)bench->total_weight); op < (BENCH_OP_MAX - 1) && choice >= bench->weights[op]; op ++)
+      choice -= bench->weights[op];
+
+    // Run it on the next connection...
+    start = get_time();
+    ok    = run_op(bench, thread->https[i], op, &loclen);
+    end   = get_time();
+    stats = thread->stats + op;
+
+    if (loclen)
+    {
+      thread->num_locations ++;
+      thread->location_bytes += loclen;
+    }
+
+    if (!ok)
+    {
+      stats->errors ++;
+    }
+    else if (stats->num_usecs < stats->alloc_usecs || (stats->usecs = realloc(stats->usecs, (stats->alloc_usecs = stats->alloc_usecs ? 2 * stats->alloc_usecs : 1024) * sizeof(uint64_t))) != NULL)
+    {
+      stats->usecs[stats->num_usecs ++] = end - start;
+    }
+    else
+    {
+      break;
+    }
+
+    // Rotate through the connections for this thread...
+    if (++ i >= thread->num_https)
+      i = 0;
+  }
+
+  return (NULL);
+}
+
+
+//
+// 'send_request()' - Send a request and read the response.
+//
+
+static http_status_t			// O - HTTP status
+send_request(http_t     *http,		// I - HTTP connection
+             const char *method,	// I - Request method
+             const char *resource,	// I - Resource path
+             const char *token,		// I - Bearer token or `NULL`
+             const char *form,		// I - Form data or `NULL`
+             char       *body,		// I - Response body buffer or `NULL`
+             size_t     bodysize,	// I - Size of response body buffer
+             char       *location,	// I - Location buffer or `NULL`
+             size_t     locsize)	// I - Size of location buffer
+{
+  http_status_t	status;			// HTTP status
+  char		buffer[8192],		// Read buffer
+		*bodyptr = body;	// Pointer into response body
+  ssize_t	bytes;			// Bytes read
+  size_t	formlen = form ? strlen(form) : 0;
+					// Length of form data
+
+
+  httpClearFields(http);
+
+  if (token)
+  {
+    httpSetAuthString(http, "Bearer", token);
+    httpSetField(http, HTTP_FIELD_AUTHORIZATION, httpGetAuthString(http));
+  }
+
+  if (form)
+  {
+    httpSetField(http, HTTP_FIELD_CONTENT_TYPE, "application/x-www-form-urlencoded");
+    httpSetLength(http, formlen);
+  }
+
+  if (!httpWriteRequest(http, method, resource))
+  {
+    // Reconnect if the server closed the connection...
+    if (!httpConnectAgain(http, 30000, NULL) || !httpWriteRequest(http, method, resource))
+      return (HTTP_STATUS_ERROR);
+  }
+
+  if (form && httpWrite(http, form, formlen) < (ssize_t)formlen)
+    return (HTTP_STATUS_ERROR);
+
+  while ((status = httpUpdate(http)) == HTTP_STATUS_CONTINUE);
+
+  if (location)
+    cupsCopyString(location, httpGetField(http, HTTP_FIELD_LOCATION), locsize);
+
+  // Read the whole response so the connection can be reused...
+  while ((bytes = httpRead(http, buffer, sizeof(buffer))) > 0)
+  {
+    if (bodyptr && (size_t)bytes < (bodysize - (size_t)(bodyptr - body)))
+    {
+      memcpy(bodyptr, buffer, (size_t)bytes);
+      bodyptr += bytes;
+    }
+  }
+
+  if (bodyptr)
+    *bodyptr = '\0';
+
+  return (status);
+}
+
+
+//
+// 'show_stats()' - Show throughput and latency for an operation.
+//
+// Latency percentiles use the nearest-rank method.
+//
+
+static void
+show_stats(const char    *name,		// I - Operation name
+           bench_stats_t *stats,	// I - Operation statistics
+           double        elapsed)	// I - Elapsed time in seconds
+{
+  size_t	n = stats->num_usecs;	// Number of latencies
+
+
+  if (n == 0)
+  {
+    printf("%-12s %10lu %8lu %10.1f %9s %9s %9s\n", name, 0UL, (unsigned long)stats->errors, 0.0, "-", "-", "-");
+    return;
+  }
+
+  qsort(stats->usecs, n, sizeof(uint64_t), (int (*)(const void *, const void *))compare_usecs);
+
+  printf("%-12s %10lu %8lu %10.1f %9.3f %9.3f %9.3f\n", name, (unsigned long)n, (unsigned long)stats->errors, n / elapsed, stats->usecs[(n * 500 + 999) / 1000 - 1] / 1000.0, stats->usecs[(n * 990 + 999) / 1000 - 1] / 1000.0, stats->usecs[(n * 999 + 999) / 1000 - 1] / 1000.0);
+}
+
+
+//
+// 'sig_handler()' - Signal handler.
+//
+
+static void
+sig_handler(int sig)			// I - Signal number
+{
+  (void)sig;
+
+  stop_bench = true;
+}
+
+
+//
+// 'start_moauthd()' - Start moauthd with the test config file.
+//
+
+static pid_t				// O - Process ID
+start_moauthd(void)
+{
+  pid_t		pid = 0;		// Process ID
+  static char * const moauthd_argv[] =	// moauthd arguments
+  {
+    "moauthd",
+    "-c",
+    "test.conf",
+    NULL
+  };
+
+
+  if (chdir(".."))
+    return (0);
+
+  unlink("test.state");
+  unlink("test.state.journal");
+  unlink("test.state.tokens");
+
+  if (posix_spawn(&pid, "moauthd/moauthd", NULL, NULL, moauthd_argv, environ))
+    return (0);
+
+  return (pid);
+}
+
+
+//
+// 'usage()' - Show program usage.
+//
+
+static int				// O - Exit status
+usage(FILE *fp)				// I - Output file
+{
+  fputs("Usage: ./moauthbench [OPTIONS] [URL]\n", fp);
+  fputs("Options:\n", fp);
+  fputs("  -c CONNECTIONS      Number of keep-alive connections (default is threads)\n", fp);
+  fputs("  -d SECONDS          Duration of the run (default 10)\n", fp);
+  fputs("  -i IDLE             Number of idle keep-alive connections (default 0)\n", fp);
+  fputs("  -j THREADS          Number of client threads (default 4, 0 for none)\n", fp);
+  fputs("  -m NAME=WEIGHT,...  Request mix using password, authorize, code,\n", fp);
+  fputs("                      introspect, userinfo, bearer, and wellknown operations\n", fp);
+  fputs("  -n REQUESTS         Stop after this many requests\n", fp);
+  fputs("  -p PASSWORD         Password (default $TEST_PASSWORD or \"test123\")\n", fp);
+  fputs("  -P PID              Server process to measure (default is the started moauthd)\n", fp);
+  fputs("  -r RESOURCE         Resource for Bearer GETs (default \"/shared/shared.pdf\")\n", fp);
+  fputs("  -u USERNAME         Username (default current user)\n", fp);
+  fputs("\nWithout a URL, moauthd is started using \"test.conf\".\n", fp);
+
+  return (fp == stdout ? 0 : 1);
+}
@@ -13,12 +13,15 @@
 #  include <stdio.h>
 #  include <stdlib.h>
 #  include <stdbool.h>
+#  include <stdint.h>
+#  include <stdatomic.h>
 #  include <string.h>
 #  include <ctype.h>
 #  include <errno.h>
 #  include <poll.h>
 #  include <sys/stat.h>
 #  include <cups/thread.h>
+#  include <cups/jwt.h>
 
 
 //
@@ -26,12 +29,90 @@
 //
 
 #  define MOAUTHD_MAX_LISTENERS	4	// Maximum number of listener sockets
+#  define MOAUTHD_IDLE_TIMEOUT	60	// Idle keep-alive timeout in seconds
+#  define MOAUTHD_IO_TIMEOUT	10	// Timeout for reading or writing client data in seconds
+#  define MOAUTHD_REQUEST_TIMEOUT 30	// Timeout for reading a request in seconds
+#  define MOAUTHD_TOKEN_SHARDS	16	// Number of token table shards (power of 2)
+#  define MOAUTHD_TOKEN_BUCKETS	256	// Initial buckets per token shard (power of 2)
+#  define MOAUTHD_REAP_INTERVAL	10	// Seconds between expired token sweeps
+#  define MOAUTHD_REAP_BATCH	256	// Maximum tokens reaped per shard lock
+#  define MOAUTHD_JOURNAL_COMPACT 100000	// Journal records before compaction
+#  define MOAUTHD_REVOKE_BITS	1048576	// Bits in revoked token filter (power of 2)
+#  define MOAUTHD_REVOKE_HASHES	4	// Hash functions for revoked token filter
+#  define MOAUTHD_VERIFY_STRIPES	16	// Verified token cache stripes (power of 2)
+#  define MOAUTHD_VERIFY_ENTRIES	256	// Verified tokens per cache stripe (power of 2)
+#  define MOAUTHD_SCOPE_BITS	64	// Scopes with a bit in the scope bitmasks
+#  define MOAUTHD_IDENT_NEGATIVE	10	// Seconds to cache unknown users and groups
+#  define MOAUTHD_WRITE_SIZE	1048576	// Maximum bytes per file write
+#  define MOAUTHD_MAX_RANGES	16	// Maximum byte ranges per request
+#  define MOAUTHD_LOG_BUFFER	65536	// Bytes of log lines per thread (power of 2)
+#  define MOAUTHD_LOG_LINE	8192	// Maximum length of a log line
+#  define MOAUTHD_METHOD(state)	(1U << (state))
+					// Method bit for an HTTP request state
+#  define MOAUTHD_HISTOGRAM_BUCKETS 14	// Latency histogram buckets (1ms to 8s and +Inf)
 
 
 //
 // Types...
 //
 
+typedef enum moauthd_auth_e		// Authentication results
+{
+  MOAUTHD_AUTH_FAILED,			// Bad username or password
+  MOAUTHD_AUTH_SUCCEEDED,		// Username and password are good
+  MOAUTHD_AUTH_BUSY			// Too many pending authentications
+} moauthd_auth_t;
+
+
+typedef struct moauthd_authreq_s moauthd_authreq_t;
+					// Queued authentication request
+
+
+typedef struct moauthd_authcache_s	// Cached password authentication
+{
+  unsigned char	digest[32];		// Salted SHA-256 of username and password
+  time_t	expires;		// When the entry expires
+} moauthd_authcache_t;
+
+
+typedef struct moauthd_histogram_s	// Latency histogram
+{
+  atomic_size_t	counts[MOAUTHD_HISTOGRAM_BUCKETS];
+					// Counts for latencies up to 2^N ms
+  atomic_uint_least64_t sum;		// Total latency in microseconds
+} moauthd_histogram_t;
+
+
+typedef enum moauthd_scope_e		// Built-in scope IDs
+{
+  MOAUTHD_SCOPE_PUBLIC,			// No authentication required
+  MOAUTHD_SCOPE_PRIVATE,		// Resource owner only
+  MOAUTHD_SCOPE_SHARED			// Any authenticated user
+} moauthd_scope_t;
+
+#  define MOAUTHD_SCOPES_AUTHENTICATED	((1ULL << MOAUTHD_SCOPE_PUBLIC) | (1ULL << MOAUTHD_SCOPE_PRIVATE) | (1ULL << MOAUTHD_SCOPE_SHARED))
+					// Scopes available to any authenticated user
+
+
+typedef struct moauthd_ident_s		// Cached user or group identity
+{
+  char		*name;			// User or group name
+  bool		found;			// Does the user or group exist?
+  uid_t		uid;			// User ID
+  gid_t		gid;			// Primary group ID or group ID
+  char		*gecos;			// Full name, if any
+  int		num_gids;		// Number of groups
+#ifdef __APPLE__
+  int		*gids;			// Groups (sorted)
+#else
+  gid_t		*gids;			// Groups (sorted)
+#endif // __APPLE__
+  uint64_t	scopes;			// Group scopes the user belongs to
+  time_t	expires;		// When the entry expires
+  atomic_int	refcount;		// Reference count
+} moauthd_ident_t;
+
+
 typedef struct moauthd_application_s	//// Application (Client)
 {
   char	*client_id,			// Client identifier
@@ -40,6 +121,7 @@ typedef struct moauthd_application_s	//// Application (Client)
 	*client_uri,			// Web page, if any
 	*logo_uri,			// Logo URI, if any
 	*tos_uri;			// Terms-of-service URI, if any
+  bool	registered;			// Dynamically registered?
 } moauthd_application_t;
 
 
@@ -53,6 +135,9 @@ typedef enum moauthd_restype_e		// Resource Types
 } moauthd_restype_t;
 
 
+typedef struct moauthd_content_s moauthd_content_t;
+					// Cached file content
+
 typedef struct moauthd_resource_s	// Resource
 {
   moauthd_restype_t	type;		// Resource type
@@ -60,37 +145,143 @@ typedef struct moauthd_resource_s	// Resource
 			*local_path,	// Local path
 			*content_type,	// MIME media type, if any
 			*scope;		// Access scope
-  gid_t			scope_gid;	// Scope group ID
+  int			scope_id;	// Scope ID
+  uint64_t		scopes;		// Scope bit for access checks
   size_t		remote_len;	// Length of remote path
   const void		*data;		// Data (static files)
   size_t		length;		// Length (static files)
+  moauthd_content_t	*content;	// Content (cached files)
+  unsigned		generation;	// Change count (cached files)
+  int			watch;		// inotify watch descriptor (cached files)
 } moauthd_resource_t;
 
 
+typedef struct moauthd_route_s moauthd_route_t;
+					// Resource routing trie node
+
+typedef struct moauthd_page_s moauthd_page_t;
+					// Rendered Markdown page
+
+typedef struct moauthd_logbuf_s moauthd_logbuf_t;
+					// Per-thread log buffer
+
+typedef struct moauthd_metrics_s moauthd_metrics_t;
+					// Per-thread metrics
+
+
 typedef enum moauthd_toktype_e		// Token Type
 {
   MOAUTHD_TOKTYPE_ACCESS,		// Access token
   MOAUTHD_TOKTYPE_GRANT,		// Grant token
-  MOAUTHD_TOKTYPE_RENEWAL		// Renewal token
+  MOAUTHD_TOKTYPE_RENEWAL,		// Renewal token
+  MOAUTHD_TOKTYPE_MAX			// Number of token types
 } moauthd_toktype_t;
 
 
+typedef enum moauthd_metric_e		// Event counters
+{
+  MOAUTHD_METRIC_AUTH_CACHE_HITS,	// PAM authentications avoided
+  MOAUTHD_METRIC_AUTH_CACHE_MISSES,	// PAM authentications performed
+  MOAUTHD_METRIC_PAM_SUCCEEDED,		// Successful PAM authentications
+  MOAUTHD_METRIC_PAM_FAILED,		// Failed PAM authentications
+  MOAUTHD_METRIC_FILE_CACHE_HITS,	// Cached file hits
+  MOAUTHD_METRIC_FILE_CACHE_MISSES,	// Cached file misses
+  MOAUTHD_METRIC_PAGE_CACHE_HITS,	// Rendered page cache hits
+  MOAUTHD_METRIC_PAGE_CACHE_MISSES,	// Rendered page cache misses
+  MOAUTHD_METRIC_USER_CACHE_HITS,	// User and group cache hits
+  MOAUTHD_METRIC_USER_CACHE_MISSES,	// User and group cache misses
+  MOAUTHD_METRIC_VERIFY_HITS,		// Verified token cache hits
+  MOAUTHD_METRIC_VERIFY_MISSES,		// Verified token cache misses
+  MOAUTHD_METRIC_TOKENS_ISSUED,		// Tokens issued, one counter per token type
+  MOAUTHD_METRIC_MAX = MOAUTHD_METRIC_TOKENS_ISSUED + MOAUTHD_TOKTYPE_MAX
+					// Number of counters
+} moauthd_metric_t;
+
+
+typedef enum moauthd_timing_e		// Latency histograms
+{
+  MOAUTHD_TIMING_AUTH_WAIT,		// Time spent waiting for a PAM thread
+  MOAUTHD_TIMING_PAM_AUTHENTICATE,	// Time spent in pam_authenticate
+  MOAUTHD_TIMING_PAM_ACCT_MGMT,		// Time spent in pam_acct_mgmt
+  MOAUTHD_TIMING_REQUEST		// Request time, one histogram per endpoint followed by files and other requests
+} moauthd_timing_t;
+
+
 typedef struct moauthd_token_s		// Token
 {
   moauthd_toktype_t	type;		// Type of token
   char			*token,		// Token string
 			*challenge,	// Challenge string
-			*user;		// Authenticated user
+			*user,		// Authenticated user
+			*jti,		// Unique ID (stateless access tokens)
+			*client_id;	// Client ID claim (stateless access tokens)
   moauthd_application_t	*application;	// Client ID/redirection URI used
   char			*scopes;	// Scope(s) string
-  cups_array_t		*scopes_array;	// Scope(s) array
+  uint64_t		scope_bits;	// Known scope(s) bitmask
   uid_t			uid;		// Authenticated UID
   gid_t			gid;		// Primary group ID
+  moauthd_ident_t	*identity;	// User identity at issue time, if any
   time_t		created;	// When the token was created
   time_t		expires;	// When the token expires
+  uint64_t		hash;		// Hash of token string
+  struct moauthd_token_s *next;		// Next token in hash bucket
+  size_t		heap_index;	// Index in expiration heap
+  atomic_int		refcount;	// Reference count
 } moauthd_token_t;
 
 
+typedef struct moauthd_tokshard_s	// Token table shard
+{
+  pthread_rwlock_t	lock;		// R/W lock for shard
+  size_t		num_buckets,	// Number of hash buckets
+			num_tokens;	// Number of tokens
+  moauthd_token_t	**buckets;	// Hash buckets
+  size_t		heap_alloc;	// Allocated expiration heap entries
+  moauthd_token_t	**heap;		// Expiration heap (soonest first)
+  size_t		num_live[MOAUTHD_TOKTYPE_MAX],
+					// Live tokens by type
+			num_reaped[MOAUTHD_TOKTYPE_MAX];
+					// Reaped tokens by type
+} moauthd_tokshard_t;
+
+
+typedef struct moauthd_verified_s moauthd_verified_t;
+					// Verified token cache entry
+
+
+typedef struct moauthd_verstripe_s	// Verified token cache stripe
+{
+  pthread_mutex_t	lock;		// Mutex for stripe
+  size_t		count;		// Number of cached tokens
+  moauthd_verified_t	*buckets[MOAUTHD_VERIFY_ENTRIES],
+					// Hash buckets
+			*first,		// Most recently used
+			*last;		// Least recently used
+} moauthd_verstripe_t;
+
+
+typedef struct moauthd_revoked_s	// Revoked stateless token
+{
+  char			*jti;		// Unique ID of token
+  time_t		expires;	// When the token expires
+} moauthd_revoked_t;
+
+
+typedef struct moauthd_snapshot_s moauthd_snapshot_t;
+					// Memory-mapped token snapshot
+
+
+typedef struct moauthd_tokstats_s	// Token statistics
+{
+  size_t		num_live[MOAUTHD_TOKTYPE_MAX],
+					// Live tokens by type
+			num_reaped[MOAUTHD_TOKTYPE_MAX];
+					// Reaped tokens by type
+  size_t		verify_hits,	// Verified token cache hits
+			verify_misses;	// Verified token cache misses
+} moauthd_tokstats_t;
+
+
 typedef enum moauthd_loglevel_e		// Log Levels
 {
   MOAUTHD_LOGLEVEL_ERROR,		// Error messages only
@@ -101,36 +292,128 @@ typedef enum moauthd_loglevel_e		// Log Levels
 
 typedef enum moauthd_option_e		// Server options
 {
-  MOAUTHD_OPTION_BASIC_AUTH = 1		// Enable Basic authentication as a backup
+  MOAUTHD_OPTION_BASIC_AUTH = 1,	// Enable Basic authentication as a backup
+  MOAUTHD_OPTION_STATELESS_TOKENS = 2	// Validate access tokens by signature and claims
 } moauthd_option_t;
 
 
+struct moauthd_client_s;		// Client (forward declaration)
+
+typedef bool (*moauthd_endpoint_cb_t)(struct moauthd_client_s *client);
+					// Endpoint handler
+
+
+typedef struct moauthd_endpoint_s	// Endpoint
+{
+  const char		*path;		// Request path
+  unsigned		methods;	// Supported methods (`MOAUTHD_METHOD(state)` bits)
+  moauthd_endpoint_cb_t	cb;		// Handler, returns `false` to close the connection
+} moauthd_endpoint_t;
+
+
 typedef struct moauthd_server_s		// Server
 {
   char		*name;			// Server hostname
   int		port;			// Server port
   char		*state_file;		// State file
   int		log_file;		// Log file descriptor
+  int		access_log;		// Access log file descriptor
   moauthd_loglevel_t log_level;		// Log level
+  _Atomic(moauthd_logbuf_t *) log_buffers;
+					// Per-thread log buffers
+  cups_thread_t	log_thread;		// Log writer thread
+  pthread_mutex_t log_lock;		// Mutex for log writer
+  pthread_cond_t log_cond;		// Condition for pending log lines
+  atomic_bool	log_running,		// Is the log writer running?
+		log_idle;		// Is the log writer waiting for lines?
+  atomic_size_t	log_dropped;		// Log lines and access log records dropped because a buffer was full
+  _Atomic(moauthd_metrics_t *) metrics;	// Per-thread metrics
   char		*auth_service;		// PAM authentication service
-  int		num_clients;		// Number of clients served
+  int		auth_cache_life;	// Life of cached authentications in seconds
+  size_t	auth_cache_size;	// Number of cached authentications
+  moauthd_authcache_t *auth_cache;	// Cached authentications
+  unsigned char	auth_cache_salt[16];	// Salt for cached authentications
+  pthread_rwlock_t auth_cache_lock;	// R/W lock for cached authentications
+  int		auth_threads,		// Number of PAM authentication threads
+		auth_queue_size;	// Maximum pending PAM authentications
+  pthread_mutex_t auth_lock;		// Mutex for authentication queue
+  pthread_cond_t auth_cond,		// Condition for queued authentications
+		auth_done_cond;		// Condition for finished authentications
+  moauthd_authreq_t **auth_queue;	// Pending PAM authentications
+  size_t	auth_queue_start,	// First request in queue
+		auth_queue_count;	// Number of requests in queue
+  int		user_cache_life;	// Life of cached users and groups in seconds
+  size_t	user_cache_size;	// Maximum cached users and groups
+  cups_array_t	*users,			// Cached user identities
+		*groups;		// Cached group identities
+  pthread_mutex_t users_lock;		// Mutex for cached users and groups
+  atomic_int	num_clients;		// Number of clients served
+  int		max_clients,		// Maximum number of simultaneous clients
+		num_workers;		// Number of worker threads
+  cups_array_t	*clients;		// Open client connections
+  pthread_mutex_t clients_lock;		// Mutex for clients array and queue
+  pthread_cond_t clients_cond;		// Condition for queued clients
+  struct moauthd_client_s **queue;	// Clients with pending requests
+  size_t	queue_start,		// First client in queue
+		queue_count;		// Number of clients in queue
+#ifdef HAVE_SYS_EPOLL_H
+  int		event_fd;		// epoll file descriptor
+#else
+  int		wake_pipe[2];		// Pipe for waking up the event loop
+#endif // HAVE_SYS_EPOLL_H
   int		num_listeners;		// Number of listener sockets
   struct pollfd	listeners[MOAUTHD_MAX_LISTENERS];
 					// Listener sockets
   unsigned	options;		// Server option flags
   gid_t		introspect_group,	// Group allowed to introspect tokens
+		metrics_group,		// Group allowed to read metrics
 		register_group;		// Group allowed to register clients
   int		max_grant_life,		// Maximum life of a grant in seconds
 		max_token_life;		// Maximum life of a token in seconds
-  int		num_tokens;		// Number of tokens issued
   char		*secret;		// Secret value string for this invocation
   cups_array_t	*applications;		// "Registered" applications
   pthread_mutex_t applications_lock;	// Mutex for applications array
+  int		num_scopes,		// Number of scopes
+		alloc_scopes;		// Allocated scopes
+  char		**scopes;		// Scope names, by ID
+  gid_t		*scope_gids;		// Scope group IDs, by ID
+  size_t	num_endpoints;		// Number of endpoints
+  moauthd_endpoint_t *endpoints;	// Endpoints, sorted by path
+  unsigned	endpoint_methods;	// Methods supported by any endpoint
   cups_array_t	*resources;		// Resources that are shared
   pthread_rwlock_t resources_lock;	// R/W lock for resources array
-  cups_array_t	*tokens;		// Tokens that have been issued
-  pthread_rwlock_t tokens_lock;		// R/W lock for tokens array
+  _Atomic(moauthd_route_t *) routes;	// Resource routing trie, if built
+  moauthd_route_t *old_routes;		// Replaced routing tries
+  size_t	page_cache_size,	// Maximum bytes of cached pages
+		page_cache_used;	// Bytes of cached pages
+  size_t	file_cache_size,	// Maximum bytes of cached files
+		file_cache_used;	// Bytes of cached files
+  pthread_mutex_t files_lock;		// Mutex for cached files
+#ifdef HAVE_SYS_INOTIFY_H
+  int		inotify_fd;		// inotify file descriptor for cached files
+#endif // HAVE_SYS_INOTIFY_H
+  moauthd_page_t *pages_first,		// Most recently used page
+		*pages_last;		// Least recently used page
+  pthread_mutex_t pages_lock;		// Mutex for cached pages
+  moauthd_tokshard_t tokens[MOAUTHD_TOKEN_SHARDS];
+					// Tokens that have been issued
+  moauthd_tokshard_t grants;		// Outstanding authorization grants
+  moauthd_snapshot_t *snapshot;		// Saved tokens, if any
+  atomic_uint_least64_t *revoked_bits;	// Bloom filter of revoked token IDs
+  cups_array_t	*revoked;		// Revoked stateless tokens
+  pthread_rwlock_t revoked_lock;	// R/W lock for revoked tokens
+  moauthd_verstripe_t verified[MOAUTHD_VERIFY_STRIPES];
+					// Recently verified stateless tokens
+  char		*journal_file;		// State journal file
+  int		journal_fd;		// State journal file descriptor
+  pthread_mutex_t journal_lock;		// Mutex for journal buffer
+  pthread_cond_t journal_cond;		// Condition for pending journal records
+  char		*journal_buffer;	// Pending journal records
+  size_t	journal_used,		// Bytes of pending journal records
+		journal_alloc,		// Allocated size of journal buffer
+		journal_records;	// Records since last compaction
   time_t	start_time;		// Startup time
+  cups_jwa_t	signing_alg;		// JWT signing algorithm
   cups_json_t	*private_key;		// JWT private key
   char		*public_key;		// JWT public key
   char		*test_password;		// Testing password
@@ -149,13 +432,26 @@ typedef struct moauthd_client_s		// Client Information
   char		remote_host[256],	// Remote hostname
 		remote_user[256];	// Authenticated username, if any
   uid_t		remote_uid;		// Authenticated UID, if any
-  int		num_remote_gids;	// Number of remote groups, if any
-#ifdef __APPLE__
-  int		remote_gids[100];	// Authenticated groups, if any
-#else
-  gid_t		remote_gids[100];	// Authenticated groups, if any
-#endif // __APPLE__
+  moauthd_ident_t *remote_ident;	// Authenticated user identity, if any
+  uint64_t	remote_scopes;		// Scopes available to the client
   moauthd_token_t *remote_token;	// Access token used, if any
+  bool		started,		// Has the TLS session been established?
+		busy,			// Is a worker processing the client?
+		polled;			// Has the client been added to the event loop?
+  time_t	activity;		// Time of last activity
+  _Atomic(time_t) deadline;		// Deadline for reading the current request, 0 if none
+  bool		accept_ranges;		// Send "Accept-Ranges: bytes"?
+  char		content_range[256];	// Content-Range value, if any
+  char		*output;		// Captured output, if any
+  size_t	output_used,		// Bytes of captured output
+		output_alloc;		// Allocated size of captured output
+  uint64_t	request_time,		// Start of current request in microseconds, 0 if none
+		header_usecs,		// Microseconds reading request headers
+		auth_usecs,		// Microseconds authenticating
+		write_usecs;		// Microseconds writing the response
+  http_status_t	response_status;	// Status of response
+  size_t	request_timing;		// Request time histogram (`MOAUTHD_TIMING_REQUEST` + N)
+  size_t	response_bytes;		// Bytes of response data
 } moauthd_client_t;
 
 
@@ -164,26 +460,72 @@ typedef struct moauthd_client_s		// Client Information
 //
 
 extern moauthd_application_t *moauthdAddApplication(moauthd_server_t *server, const char *client_id, const char *redirect_uri, const char *client_name, const char *client_uri, const char *logo_uri, const char *tos_uri);
-extern bool		moauthdAuthenticateUser(moauthd_client_t *client, const char *username, const char *password);
+extern bool		moauthdAddEndpoint(moauthd_server_t *server, const char *path, unsigned methods, moauthd_endpoint_cb_t cb);
+extern int		moauthdAddScope(moauthd_server_t *server, const char *name);
+extern bool		moauthdAddToken(moauthd_server_t *server, moauthd_token_t *token);
+extern moauthd_auth_t	moauthdAuthenticateUser(moauthd_client_t *client, const char *username, const char *password);
+extern void		moauthdCloseSnapshot(moauthd_server_t *server);
+extern bool		moauthdConsumeSnapshotToken(moauthd_server_t *server, uint64_t hash, const char *token_id);
+extern moauthd_token_t	*moauthdCopySnapshotToken(moauthd_server_t *server, uint64_t hash, const char *token_id);
+extern void		moauthdCountMetric(moauthd_server_t *server, moauthd_metric_t metric);
+extern void		moauthdCountTime(moauthd_server_t *server, size_t timing, uint64_t usecs);
 extern moauthd_client_t	*moauthdCreateClient(moauthd_server_t *server, int fd);
 extern moauthd_resource_t *moauthdCreateResource(moauthd_server_t *server, moauthd_restype_t type, const char *remote_path, const char *local_path, const char *content_type, const char *scope);
 extern moauthd_server_t	*moauthdCreateServer(const char *configfile, const char *statefile, int verbosity);
-extern moauthd_token_t	*moauthdCreateToken(moauthd_server_t *server, moauthd_toktype_t type, moauthd_application_t *application, const char *user, const char *scopes);
+extern moauthd_token_t	*moauthdCreateToken(moauthd_server_t *server, moauthd_toktype_t type, moauthd_application_t *application, const char *user, const char *scopes, const char *challenge);
 extern void		moauthdDeleteClient(moauthd_client_t *client);
 extern void		moauthdDeleteServer(moauthd_server_t *server);
-extern void		moauthdDeleteToken(moauthd_server_t *server, moauthd_token_t *token);
+extern bool		moauthdDeleteToken(moauthd_server_t *server, moauthd_token_t *token);
 extern moauthd_application_t *moauthdFindApplication(moauthd_server_t *server, const char *client_id, const char *redirect_uri);
+extern moauthd_endpoint_t *moauthdFindEndpoint(moauthd_server_t *server, const char *path);
+extern bool		moauthdFindSnapshotToken(moauthd_server_t *server, uint64_t hash, const char *token_id);
 extern moauthd_resource_t *moauthdFindResource(moauthd_server_t *server, const char *path_info, char *name, size_t namesize, struct stat *info);
+extern gid_t		moauthdFindGroup(moauthd_server_t *server, const char *name);
 extern moauthd_token_t	*moauthdFindToken(moauthd_server_t *server, const char *token_id);
+extern moauthd_ident_t	*moauthdFindUser(moauthd_server_t *server, const char *name);
+extern void		moauthdFreeLog(moauthd_server_t *server);
+extern void		moauthdFreeMetrics(moauthd_server_t *server);
+extern void		moauthdFreeResources(moauthd_server_t *server);
+extern void		moauthdFreeTokens(moauthd_server_t *server);
 extern http_status_t	moauthdGetFile(moauthd_client_t *client);
+extern uint64_t		moauthdGetMetric(moauthd_server_t *server, moauthd_metric_t metric);
+extern uint64_t		moauthdGetScopes(moauthd_server_t *server, const char *scopes);
+extern uint64_t		moauthdGetTime(void);
+extern void		moauthdGetTokenStats(moauthd_server_t *server, moauthd_tokstats_t *stats);
+extern bool		moauthdHasGroup(moauthd_ident_t *ident, gid_t gid);
 extern void		moauthdHTMLFooter(moauthd_client_t *client);
 extern void		moauthdHTMLHeader(moauthd_client_t *client, const char *title);
 extern void		moauthdHTMLPrintf(moauthd_client_t *client, const char *format, ...) __attribute__((__format__(__printf__, 2, 3)));
+extern void		moauthdInitEndpoints(moauthd_server_t *server);
+extern void		moauthdInitTokens(moauthd_server_t *server);
+extern void		moauthdJournalApplication(moauthd_server_t *server, moauthd_application_t *app);
+extern void		moauthdJournalCreateToken(moauthd_server_t *server, moauthd_token_t *token);
+extern void		moauthdJournalDeleteToken(moauthd_server_t *server, moauthd_token_t *token);
+extern void		moauthdJournalRevokeToken(moauthd_server_t *server, const char *jti, time_t expires);
+extern bool		moauthdLoadJournal(moauthd_server_t *server);
+extern bool		moauthdLoadSnapshot(moauthd_server_t *server);
+extern void		moauthdLogAccess(moauthd_client_t *client);
 extern void		moauthdLogc(moauthd_client_t *client, moauthd_loglevel_t level, const char *message, ...) __attribute__((__format__(__printf__, 3, 4)));
 extern void		moauthdLogs(moauthd_server_t *server, moauthd_loglevel_t level, const char *message, ...) __attribute__((__format__(__printf__, 3, 4)));
+extern size_t		moauthdReapTokens(moauthd_server_t *server, time_t curtime);
+extern void		moauthdReleaseIdent(moauthd_ident_t *ident);
+extern void		moauthdReleaseToken(moauthd_token_t *token);
+extern bool		moauthdRevokeToken(moauthd_server_t *server, const char *jti, time_t expires);
+extern bool		moauthdReplayState(moauthd_server_t *server, const char *name, const char *value);
 extern bool		moauthdRespondClient(moauthd_client_t *client, http_status_t code, const char *type, const char *uri, time_t mtime, size_t length);
-extern void		*moauthdRunClient(moauthd_client_t *client);
+extern void		*moauthdRunAuth(moauthd_server_t *server);
+extern bool		moauthdRunClient(moauthd_client_t *client);
+extern void		*moauthdRunJournal(moauthd_server_t *server);
+extern void		*moauthdRunLog(moauthd_server_t *server);
 extern int		moauthdRunServer(moauthd_server_t *server);
 extern bool		moauthdSaveServer(moauthd_server_t *server);
+extern bool		moauthdSaveSnapshot(moauthd_server_t *server);
+extern bool		moauthdSendMetrics(moauthd_client_t *client);
+extern bool		moauthdStartLog(moauthd_server_t *server);
+extern void		moauthdStopLog(moauthd_server_t *server);
+extern void		moauthdUpdateResources(moauthd_server_t *server);
+extern bool		moauthdWriteClient(moauthd_client_t *client, const void *data, size_t length);
+extern void		moauthdWriteMarkdown(moauthd_client_t *client, const char *markdown);
+extern void		moauthdWriteState(moauthd_server_t *server, cups_file_t *fp);
 
 #endif // !MOAUTHD_H
@@ -11,21 +11,136 @@
 #include "mmd.h"
 #include <unistd.h>
 #include <sys/fcntl.h>
-#include <grp.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#  include <sys/inotify.h>
+#endif // HAVE_SYS_INOTIFY_H
+
+
+//
+// Local types...
+//
+
+struct moauthd_route_s			// Resource routing trie node
+{
+  char			*segment;	// Path segment
+  moauthd_resource_t	*resource;	// Resource for this path, if any
+  size_t		num_children,	// Number of child nodes
+			alloc_children;	// Allocated child nodes
+  moauthd_route_t	**children;	// Child nodes, sorted by segment
+  moauthd_route_t	*retired;	// Next replaced trie (root only)
+};
+
+typedef struct moauthd_range_s		// Byte range
+{
+  size_t		start,		// First byte
+			length;		// Number of bytes
+} moauthd_range_t;
+
+struct moauthd_content_s		// Cached file content
+{
+  atomic_int		refcount;	// Reference count
+  struct stat		info;		// File information when loaded
+  size_t		length;		// Length of data
+  char			data[];		// File data
+};
+
+struct moauthd_page_s			// Rendered Markdown page
+{
+  moauthd_page_t	*prev,		// Previous (more recently used) page
+			*next;		// Next (less recently used) page
+  const moauthd_resource_t *resource;	// Resource
+  char			*filename,	// Local filename, if any
+			*title,		// Document title, if any
+			*html;		// Rendered HTML body
+  time_t		mtime;		// Modification time of source
+  off_t			size;		// Size of source
+  size_t		length;		// Length of HTML body
+  atomic_int		refcount;	// Reference count
+};
 
 
 //
 // Local functions...
 //
 
+static moauthd_route_t	*add_route(moauthd_route_t *parent, const char *segment, size_t seglen);
+static moauthd_route_t	*build_routes(moauthd_server_t *server);
+static void		cache_page(moauthd_server_t *server, moauthd_page_t *page);
 static int		compare_resources(moauthd_resource_t *a, moauthd_resource_t *b);
+static bool		content_fits(moauthd_server_t *server, size_t length);
+static moauthd_page_t	*find_page(moauthd_server_t *server, moauthd_resource_t *resource, const char *filename, struct stat *info);
+static moauthd_route_t	*find_route(moauthd_route_t *parent, const char *segment, size_t seglen, size_t *pos);
 static void		free_resource(moauthd_resource_t *resource);
+static moauthd_content_t *get_content(moauthd_server_t *server, moauthd_resource_t *resource, const char *filename, struct stat *info);
+static int		get_ranges(const char *value, size_t length, moauthd_range_t *ranges);
+static void		free_routes(moauthd_route_t *route);
 static const char	*make_anchor(const char *text, char *buffer, size_t bufsize);
+static void		release_content(moauthd_content_t *content);
+static void		release_page(moauthd_page_t *page);
+static moauthd_page_t	*render_page(moauthd_client_t *client, moauthd_resource_t *resource, const char *filename, struct stat *info);
+static void		unlink_page(moauthd_server_t *server, moauthd_page_t *page);
 static void		write_block(moauthd_client_t *client, mmd_t *parent);
+static bool		write_data(moauthd_client_t *client, const char *data, int fd, size_t offset, size_t length);
+static bool		write_file(moauthd_client_t *client, int fd, size_t offset, size_t length);
 static void		write_leaf(moauthd_client_t *client, mmd_t *node);
+static bool		write_ranges(moauthd_client_t *client, const char *type, const char *uri, time_t mtime, const char *data, int fd, size_t length, moauthd_range_t *ranges, size_t num_ranges);
 static void		write_string(moauthd_client_t *client, const char *s);
 
 
+//
+// 'moauthdAddScope()' - Add a scope to the server's scope table.
+//
+// Scopes are interned when the configuration is loaded so that access checks
+// only need to test a bit.  Scopes other than "public", "private", and
+// "shared" name a group whose members may access the resource.  Only the first
+// `MOAUTHD_SCOPE_BITS` scopes get a bit - later scopes are checked against
+// the user's groups.
+//
+
+int					// O - Scope ID or `-1` on error
+moauthdAddScope(
+    moauthd_server_t *server,		// I - Server object
+    const char       *name)		// I - Scope name
+{
+  int	i;				// Looping var
+
+
+  for (i = 0; i < server->num_scopes; i ++)
+  {
+    if (!strcmp(server->scopes[i], name))
+      return (i);
+  }
+
+  if (server->num_scopes >= server->alloc_scopes)
+  {
+    // Grow the scope table...
+    int		alloc_scopes = server->alloc_scopes + MOAUTHD_SCOPE_BITS;
+					// New size of table
+    char	**scopes;		// New scope names
+    gid_t	*scope_gids;		// New scope group IDs
+
+    if ((scopes = (char **)realloc(server->scopes, (size_t)alloc_scopes * sizeof(char *))) == NULL)
+      return (-1);
+
+    server->scopes = scopes;
+
+    if ((scope_gids = (gid_t *)realloc(server->scope_gids, (size_t)alloc_scopes * sizeof(gid_t))) == NULL)
+      return (-1);
+
+    server->scope_gids   = scope_gids;
+    server->alloc_scopes = alloc_scopes;
+  }
+
+  if ((server->scopes[i] = strdup(name)) == NULL)
+    return (-1);
+
+  server->scope_gids[i] = i > MOAUTHD_SCOPE_SHARED ? moauthdFindGroup(server, name) : (gid_t)-1;
+  server->num_scopes ++;
+
+  return (i);
+}
+
+
 //
 // 'moauthdCreateResource()' - Create a resource record for a server.
 //
@@ -40,10 +155,7 @@ moauthdCreateResource(
     const char        *scope)		// I - Scope string
 {
   moauthd_resource_t	*resource;	// Resource object
-  struct group		grp,		// Group record
-			*grpresult = NULL;
-					// Found group
-  char			grpbuffer[8192];// Group buffer
+  moauthd_route_t	*routes;	// Current routing trie
   static const char * const types[] =	// Resource types
   {
     "Directory",
@@ -64,13 +176,10 @@ moauthdCreateResource(
   resource->local_path   = local_path ? strdup(local_path) : NULL;
   resource->content_type = content_type ? strdup(content_type) : NULL;
   resource->scope        = strdup(scope);
+  resource->watch        = -1;
 
-  if (strcmp(scope, "private") && strcmp(scope, "public") && strcmp(scope, "shared"))
-  {
-    // Get the group ID for the named group...
-    if (!getgrnam_r(scope, &grp, grpbuffer, sizeof(grpbuffer), &grpresult))
-      resource->scope_gid = grpresult->gr_gid;
-  }
+  if ((resource->scope_id = moauthdAddScope(server, scope)) >= 0 && resource->scope_id < MOAUTHD_SCOPE_BITS)
+    resource->scopes = 1ULL << resource->scope_id;
 
   cupsRWLockWrite(&server->resources_lock);
 
@@ -79,6 +188,13 @@ moauthdCreateResource(
 
   cupsArrayAdd(server->resources, resource);
 
+  // Retire the current routing trie, it is rebuilt on the next lookup...
+  if ((routes = atomic_exchange(&server->routes, NULL)) != NULL)
+  {
+    routes->retired     = server->old_routes;
+    server->old_routes = routes;
+  }
+
   cupsRWUnlock(&server->resources_lock);
 
   return (resource);
@@ -89,6 +205,9 @@ moauthdCreateResource(
 // 'moauthdFindResource()' - Find the best matching resource for the request
 //                           path.
 //
+// Resources are found using a trie of remote path segments that is built
+// after resources are added and never changed, so lookups take no lock.
+//
 
 moauthd_resource_t *			// O - Matching resource
 moauthdFindResource(
@@ -98,10 +217,10 @@ moauthdFindResource(
     size_t           namesize,		// I - Size of filename buffer
     struct stat      *info)		// O - File information
 {
-  size_t		i,		// Looping var
-			count;		// Number of resources
-  moauthd_resource_t	*resource,	// Current resource
-			*best = NULL;	// Best match
+  moauthd_route_t	*route;		// Current trie node
+  const char		*segment,	// Current path segment
+			*next;		// Next path segment
+  moauthd_resource_t	*best = NULL;	// Best match
 
 
   moauthdLogs(server, MOAUTHD_LOGLEVEL_DEBUG, "FindResource %s", path_info);
@@ -109,27 +228,46 @@ moauthdFindResource(
 
   // Find the best matching (longest path match) resource based on the remote
   // path...
-  cupsRWLockRead(&server->resources_lock);
+  if ((route = atomic_load(&server->routes)) == NULL)
+    route = build_routes(server);
 
-  for (i = 0, count = cupsArrayGetCount(server->resources); i < count; i ++)
+  if (route && *path_info == '/')
   {
-    resource = cupsArrayGetElement(server->resources, i);
+    best = route->resource;
 
-    if (!strncmp(path_info, resource->remote_path, resource->remote_len) && (!path_info[resource->remote_len] || path_info[resource->remote_len] == '/' || !strcmp(resource->remote_path, "/")))
+    for (segment = path_info + 1; route; segment = next + 1)
     {
-      if (!best || resource->remote_len > best->remote_len)
-        best = resource;
+      if ((next = strchr(segment, '/')) == NULL)
+        next = segment + strlen(segment);
+
+      if ((route = find_route(route, segment, (size_t)(next - segment), NULL)) != NULL && route->resource)
+        best = route->resource;
+
+      if (!*next)
+        break;
     }
   }
 
-  cupsRWUnlock(&server->resources_lock);
-
   if (best)
     moauthdLogs(server, MOAUTHD_LOGLEVEL_DEBUG, "FindResource %s matches %s", path_info, best->remote_path);
 
   *name = '\0';
 
-  if (best && best->local_path)
+#ifdef HAVE_SYS_INOTIFY_H
+  if (best && best->type == MOAUTHD_RESTYPE_CACHED_FILE && !path_info[best->remote_len])
+  {
+    // Use the file information from watched cached files...
+    cupsMutexLock(&server->files_lock);
+    if (best->content && best->watch >= 0)
+    {
+      cupsCopyString(name, best->local_path, namesize);
+      *info = best->content->info;
+    }
+    cupsMutexUnlock(&server->files_lock);
+  }
+#endif // HAVE_SYS_INOTIFY_H
+
+  if (best && best->local_path && !*name)
   {
     // Map local filename...
     if (path_info[best->remote_len])
@@ -147,7 +285,7 @@ moauthdFindResource(
     }
 
     // Make sure we can access the file or directory...
-    if (stat(name, info) || (S_ISDIR(info->st_mode) && best->type == MOAUTHD_RESTYPE_FILE) || (!S_ISDIR(info->st_mode) && !S_ISREG(info->st_mode)))
+    if (stat(name, info) || (S_ISDIR(info->st_mode) && (best->type == MOAUTHD_RESTYPE_FILE || best->type == MOAUTHD_RESTYPE_CACHED_FILE)) || (!S_ISDIR(info->st_mode) && !S_ISREG(info->st_mode)))
     {
       // No, return NULL for no match...
       best  = NULL;
@@ -172,6 +310,46 @@ moauthdFindResource(
 }
 
 
+//
+// 'moauthdFreeResources()' - Free all resources and routing tries.
+//
+
+void
+moauthdFreeResources(
+    moauthd_server_t *server)		// I - Server object
+{
+  moauthd_route_t	*routes,	// Current routing trie
+			*retired;	// Next replaced trie
+
+
+  cupsArrayDelete(server->resources);
+  server->resources = NULL;
+
+  for (routes = atomic_exchange(&server->routes, NULL); routes; routes = retired)
+  {
+    retired = routes->retired;
+    free_routes(routes);
+  }
+
+  for (routes = server->old_routes; routes; routes = retired)
+  {
+    retired = routes->retired;
+    free_routes(routes);
+  }
+
+  server->old_routes = NULL;
+
+  while (server->pages_first)
+  {
+    moauthd_page_t *page = server->pages_first;
+					// Cached page
+
+    unlink_page(server, page);
+    release_page(page);
+  }
+}
+
+
 //
 // 'moauthdGetFile()' - Get the named resource file.
 //
@@ -187,7 +365,10 @@ moauthdGetFile(moauthd_client_t *client)// I - Client object
 			localfile[1024];// Local filename
   struct stat		localinfo;	// Local file information
   const char		*ext,		// Extension on local file
-			*content_type;	// Content type of file
+			*content_type,	// Content type of file
+			*ims;		// If-Modified-Since value
+  moauthd_content_t	*content = NULL;// Cached file content
+  bool			allowed;	// Is access allowed?
 
 
   // Find the file...
@@ -204,35 +385,22 @@ moauthdGetFile(moauthd_client_t *client)// I - Client object
   }
 
   // Support authentication...
-  if (best->scope && strcmp(best->scope, "public"))
+  if (best->scopes)
+    allowed = (client->remote_scopes & best->scopes) != 0;
+  else if (best->scope_id > MOAUTHD_SCOPE_SHARED)
+    allowed = moauthdHasGroup(client->remote_ident, client->server->scope_gids[best->scope_id]);
+  else
+    allowed = false;
+
+  if (!allowed || (best->scope_id == MOAUTHD_SCOPE_PRIVATE && client->remote_uid != localinfo.st_uid))
   {
-    // Need authentication...
-    if (!client->remote_user[0] || (!strcmp(best->scope, "private") && client->remote_uid != localinfo.st_uid))
-    {
-      http_status_t status = client->remote_user[0] ? HTTP_STATUS_FORBIDDEN : HTTP_STATUS_UNAUTHORIZED;
+    // Need authentication or group membership...
+    http_status_t status = client->remote_user[0] ? HTTP_STATUS_FORBIDDEN : HTTP_STATUS_UNAUTHORIZED;
 					// Returned HTTP status
 
-      moauthdRespondClient(client, status, NULL, NULL, 0, 0);
-
-      return (status);
-    }
-
-    if (strcmp(best->scope, "private") && strcmp(best->scope, "shared"))
-    {
-      size_t	i;			// Looping var
-
-      for (i = 0; i < client->num_remote_gids; i ++)
-      {
-        if (client->remote_gids[i] == best->scope_gid)
-          break;
-      }
+    moauthdRespondClient(client, status, NULL, NULL, 0, 0);
 
-      if (i >= client->num_remote_gids)
-      {
-	moauthdRespondClient(client, HTTP_STATUS_FORBIDDEN, NULL, NULL, 0, 0);
-	return (HTTP_STATUS_FORBIDDEN);
-      }
-    }
+    return (status);
   }
 
   // Redirect for directories...
@@ -317,88 +485,128 @@ moauthdGetFile(moauthd_client_t *client)// I - Client object
       content_type = "text/plain";
   }
 
-  if (client->request_method == HTTP_STATE_GET)
+  // Check for conditional requests...
+  if ((ims = httpGetField(client->http, HTTP_FIELD_IF_MODIFIED_SINCE)) != NULL && *ims && localinfo.st_mtime <= httpGetDateTime(ims))
+  {
+    moauthdRespondClient(client, HTTP_STATUS_NOT_MODIFIED, NULL, uri, localinfo.st_mtime, 0);
+    return (HTTP_STATUS_NOT_MODIFIED);
+  }
+
+  if (client->request_method == HTTP_STATE_HEAD)
+  {
+    // Just send the response header...
+    client->accept_ranges = strcmp(ext, ".md") != 0;
+
+    moauthdRespondClient(client, HTTP_STATUS_OK, content_type, uri, localinfo.st_mtime, strcmp(ext, ".md") ? (size_t)localinfo.st_size : 0);
+  }
+  else if (client->request_method == HTTP_STATE_GET)
   {
     if (!strcmp(ext, ".md"))
     {
       // Serve a Markdown file...
-      FILE	*fp;			// File
-      mmd_t	*doc;			// Markdown document
-      const char *title;		// Document title
-      char	buffer[1024],		// Temporary buffer
-		*bufptr;		// Pointer into buffer
+      moauthd_page_t	*page;		// Rendered page
+      const char	*title;		// Document title
+      char		*output;	// Assembled page
+      size_t		output_used;	// Length of assembled page
 
-      if (best->data)
-        fp = fmemopen((void *)best->data, best->length, "rb");
-      else
-        fp = fopen(localfile, "rb");
-
-      doc = mmdLoadFile(NULL, fp);
-      fclose(fp);
-
-      if ((title = mmdGetMetadata(doc, "title")) == NULL)
+      if ((page = find_page(client->server, best, localfile, &localinfo)) == NULL && (page = render_page(client, best, localfile, &localinfo)) == NULL)
       {
-        mmd_t *node;			// Current Markdown node
+	moauthdRespondClient(client, HTTP_STATUS_SERVER_ERROR, NULL, NULL, 0, 0);
+	return (HTTP_STATUS_SERVER_ERROR);
+      }
 
-        for (node = mmdGetFirstChild(doc); node; node = mmdGetNextSibling(node))
-        {
-          if (mmdGetType(node) == MMD_TYPE_HEADING_1)
-          {
-            buffer[sizeof(buffer) - 1] = '\0';
-
-            for (bufptr = buffer, node = mmdGetFirstChild(node); node && bufptr < (buffer + sizeof(buffer) - 2); node = mmdGetNextSibling(node))
-            {
-              if (mmdGetWhitespace(node))
-                *bufptr++ = ' ';
-	      cupsCopyString(bufptr, mmdGetText(node), sizeof(buffer) - (bufptr - buffer));
-	      bufptr += strlen(bufptr);
-	    }
-
-	    *bufptr = '\0';
-	    title   = buffer;
-            break;
-	  }
-	}
+      if ((title = page->title) == NULL)
+        title = strrchr(client->path_info, '/') + 1;
+
+      // Assemble the page so it can be sent with a known length...
+      client->output_used  = 0;
+      client->output_alloc = page->length + 4096;
 
-	if (!title)
-          title = strrchr(client->path_info, '/') + 1;
+      if ((client->output = malloc(client->output_alloc)) == NULL)
+      {
+        release_page(page);
+	moauthdRespondClient(client, HTTP_STATUS_SERVER_ERROR, NULL, NULL, 0, 0);
+	return (HTTP_STATUS_SERVER_ERROR);
       }
 
-      moauthdRespondClient(client, HTTP_STATUS_OK, content_type, uri, localinfo.st_mtime, 0);
       moauthdHTMLHeader(client, title);
-      write_block(client, doc);
+      moauthdWriteClient(client, page->html, page->length);
       moauthdHTMLFooter(client);
-      mmdFree(doc);
-    }
-    else if (best->data)
-    {
-      // Serve a static/cached file...
-      moauthdRespondClient(client, HTTP_STATUS_OK, content_type, uri, localinfo.st_mtime, best->length);
+      release_page(page);
 
-      if (httpWrite(client->http, best->data, best->length) < best->length)
-        return (HTTP_STATUS_BAD_REQUEST);
+      output               = client->output;
+      output_used          = client->output_used;
+      client->output       = NULL;
+      client->output_used  = 0;
+      client->output_alloc = 0;
+
+      if (moauthdRespondClient(client, HTTP_STATUS_OK, content_type, uri, localinfo.st_mtime, output_used))
+        moauthdWriteClient(client, output, output_used);
+
+      free(output);
     }
     else
     {
-      // Serve any other file...
-      int	fd;			// File descriptor
-      char	buffer[16384];		// Buffer
-      ssize_t	bytes;			// Bytes read/written
+      // Serve a static, cached, or local file...
+      const char	*data = NULL;	// File data, if in memory
+      int		fd = -1;	// File descriptor, if not in memory
+      size_t		length;		// Length of file
+      moauthd_range_t	ranges[MOAUTHD_MAX_RANGES];
+					// Requested byte ranges
+      int		num_ranges;	// Number of byte ranges
+      bool		written;	// Was the response written?
 
-      if ((fd = open(localfile, O_RDONLY)) >= 0)
+      if (best->data)
       {
-	moauthdRespondClient(client, HTTP_STATUS_OK, content_type, uri, localinfo.st_mtime, localinfo.st_size);
-
-        while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
-          httpWrite(client->http, buffer, (size_t)bytes);
-
-        close(fd);
+        data   = (const char *)best->data;
+        length = best->length;
+      }
+      else if ((content = get_content(client->server, best, localfile, &localinfo)) != NULL)
+      {
+        data   = content->data;
+        length = content->length;
+      }
+      else if ((fd = open(localfile, O_RDONLY)) >= 0 && !fstat(fd, &localinfo))
+      {
+        length = (size_t)localinfo.st_size;
       }
       else
       {
+        if (fd >= 0)
+          close(fd);
+
 	moauthdRespondClient(client, HTTP_STATUS_BAD_REQUEST, NULL, NULL, 0, 0);
 	return (HTTP_STATUS_BAD_REQUEST);
       }
+
+      if ((num_ranges = get_ranges(httpGetField(client->http, HTTP_FIELD_RANGE), length, ranges)) < 0)
+      {
+        // None of the ranges can be satisfied...
+        snprintf(client->content_range, sizeof(client->content_range), "bytes */%lu", (unsigned long)length);
+        written = moauthdRespondClient(client, HTTP_STATUS_REQUESTED_RANGE, NULL, NULL, 0, 0);
+      }
+      else if (num_ranges > 0)
+      {
+        // Send the requested byte ranges...
+        written = write_ranges(client, content_type, uri, localinfo.st_mtime, data, fd, length, ranges, (size_t)num_ranges);
+      }
+      else
+      {
+        // Send the whole file...
+        client->accept_ranges = true;
+
+	moauthdRespondClient(client, HTTP_STATUS_OK, content_type, uri, localinfo.st_mtime, length);
+
+        written = write_data(client, data, fd, 0, length);
+      }
+
+      release_content(content);
+
+      if (fd >= 0)
+        close(fd);
+
+      if (!written)
+        return (HTTP_STATUS_BAD_REQUEST);
     }
   }
 
@@ -407,121 +615,951 @@ moauthdGetFile(moauthd_client_t *client)// I - Client object
 
 
 //
-// 'compare_resources()' - Compare the remote path of two resource objects...
+// 'moauthdGetScopes()' - Get the bitmask for a list of scopes.
+//
+// Scopes that are not in the server's scope table or that have no bit are
+// ignored.
 //
 
-static int				// O - Result of comparison
-compare_resources(moauthd_resource_t *a,// I - First resource
-                  moauthd_resource_t *b)// I - Second resource
+uint64_t				// O - Scope bitmask
+moauthdGetScopes(
+    moauthd_server_t *server,		// I - Server object
+    const char       *scopes)		// I - Space-delimited scopes
 {
-  return (strcmp(a->remote_path, b->remote_path));
-}
+  uint64_t	bits = 0;		// Scope bitmask
+  const char	*end;			// End of current scope
+  size_t	len;			// Length of current scope
+  int		i;			// Looping var
+
+
+  while (scopes && *scopes)
+  {
+    // Skip leading whitespace and find the end of the scope...
+    while (*scopes == ' ')
+      scopes ++;
+
+    if ((end = strchr(scopes, ' ')) == NULL)
+      end = scopes + strlen(scopes);
+
+    if ((len = (size_t)(end - scopes)) > 0)
+    {
+      for (i = 0; i < server->num_scopes && i < MOAUTHD_SCOPE_BITS; i ++)
+      {
+        if (!strncmp(server->scopes[i], scopes, len) && !server->scopes[i][len])
+        {
+          bits |= 1ULL << i;
+          break;
+        }
+      }
+    }
+
+    scopes = end;
+  }
 
+  return (bits);
+}
 
 //
-// 'free_resource()' - Free a resource object.
+// 'moauthdUpdateResources()' - Process changes to cached files.
+//
+// The content of changed files is discarded and reloaded on the next request.
 //
 
-static void
-free_resource(
-    moauthd_resource_t *resource)	// I - Resource object
+void
+moauthdUpdateResources(
+    moauthd_server_t *server)		// I - Server object
 {
-  free(resource->remote_path);
-  if (resource->local_path)
-    free(resource->local_path);
-  if (resource->content_type)
-    free(resource->content_type);
-  free(resource->scope);
-  free(resource);
+#ifdef HAVE_SYS_INOTIFY_H
+  char			buffer[4096],	// Event buffer
+			*bufptr;	// Pointer into buffer
+  ssize_t		bytes;		// Bytes read
+  struct inotify_event	*event;		// Current event
+  size_t		i,		// Looping var
+			count;		// Number of resources
+  moauthd_resource_t	*resource;	// Current resource
+
+
+  if (server->inotify_fd < 0)
+    return;
+
+  while ((bytes = read(server->inotify_fd, buffer, sizeof(buffer))) > 0)
+  {
+    cupsRWLockRead(&server->resources_lock);
+    cupsMutexLock(&server->files_lock);
+
+    for (bufptr = buffer; bufptr < (buffer + bytes); bufptr += sizeof(struct inotify_event) + event->len)
+    {
+      event = (struct inotify_event *)bufptr;
+
+      for (i = 0, count = cupsArrayGetCount(server->resources); i < count; i ++)
+      {
+        resource = (moauthd_resource_t *)cupsArrayGetElement(server->resources, i);
+
+        if (resource->watch != event->wd)
+          continue;
+
+        moauthdLogs(server, MOAUTHD_LOGLEVEL_DEBUG, "UpdateResources %s changed.", resource->local_path);
+
+        if (resource->content)
+        {
+          server->file_cache_used -= resource->content->length;
+          release_content(resource->content);
+          resource->content = NULL;
+        }
+
+        if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+        {
+          // File was replaced, watch the new file when it is loaded...
+          inotify_rm_watch(server->inotify_fd, resource->watch);
+          resource->watch = -1;
+        }
+        else if (event->mask & IN_IGNORED)
+          resource->watch = -1;
+
+        resource->generation ++;
+      }
+    }
+
+    cupsMutexUnlock(&server->files_lock);
+    cupsRWUnlock(&server->resources_lock);
+  }
+
+#else
+  (void)server;
+#endif // HAVE_SYS_INOTIFY_H
 }
 
 
 //
-// 'make_anchor()' - Make an anchor for internal links.
+// 'moauthdWriteMarkdown()' - Write Markdown text as HTML.
 //
 
-static const char *                     // O - Anchor string
-make_anchor(const char *text,           // I - Text
-            char       *buffer,		// I - Buffer
-            size_t     bufsize)		// I - Size of buffer
+void
+moauthdWriteMarkdown(
+    moauthd_client_t *client,		// I - Client object
+    const char       *markdown)		// I - Markdown text
 {
-  char	*bufptr,			// Pointer into buffer
-	*bufend = buffer + bufsize - 1;	// End of buffer
+  mmd_t	*doc;				// Markdown document
 
 
-  for (bufptr = buffer; *text && bufptr < bufend; text ++)
+  if ((doc = mmdLoadString(NULL, markdown)) != NULL)
   {
-    if ((*text >= '0' && *text <= '9') || (*text >= 'a' && *text <= 'z') || (*text >= 'A' && *text <= 'Z') || *text == '.' || *text == '-')
-      *bufptr++ = (char)tolower(*text & 255);
-    else if (*text == ' ')
-      *bufptr++ = '-';
+    write_block(client, doc);
+    mmdFree(doc);
   }
-
-  *bufptr = '\0';
-
-  return (buffer);
 }
 
 
+
 //
-// 'write_block()' - Write a block node as HTML.
+// 'add_route()' - Add a child node to the routing trie.
 //
 
-static void
-write_block(moauthd_client_t *client,	// I - Client connection
-            mmd_t            *parent)	// I - Parent node
+static moauthd_route_t *		// O - Child node or `NULL` on error
+add_route(moauthd_route_t *parent,	// I - Parent node
+          const char      *segment,	// I - Path segment
+          size_t          seglen)	// I - Length of path segment
 {
-  const char	*element,		// Enclosing element, if any
-		*hclass = NULL;		// HTML class, if any
-  mmd_t         *node;                  // Current child node
-  mmd_type_t    type;                   // Node type
+  moauthd_route_t	*route,		// Child node
+			**children;	// New child array
+  size_t		pos;		// Insertion point
 
 
-  switch (type = mmdGetType(parent))
+  if ((route = find_route(parent, segment, seglen, &pos)) != NULL)
+    return (route);
+
+  if (parent->num_children >= parent->alloc_children)
   {
-    case MMD_TYPE_BLOCK_QUOTE :
-        element = "blockquote";
-        break;
+    size_t alloc_children = parent->alloc_children ? 2 * parent->alloc_children : 4;
+					// New size of child array
 
-    case MMD_TYPE_ORDERED_LIST :
-        element = "ol";
-        break;
+    if ((children = realloc(parent->children, alloc_children * sizeof(moauthd_route_t *))) == NULL)
+      return (NULL);
 
-    case MMD_TYPE_UNORDERED_LIST :
-        element = "ul";
-        break;
+    parent->children       = children;
+    parent->alloc_children = alloc_children;
+  }
 
-    case MMD_TYPE_LIST_ITEM :
-        element = "li";
-        break;
+  if ((route = (moauthd_route_t *)calloc(1, sizeof(moauthd_route_t))) == NULL)
+    return (NULL);
 
-    case MMD_TYPE_HEADING_1 :
-        element = "h1";
-        break;
+  if ((route->segment = strndup(segment, seglen)) == NULL)
+  {
+    free(route);
+    return (NULL);
+  }
 
-    case MMD_TYPE_HEADING_2 :
-        element = "h2";
-        break;
+  if (pos < parent->num_children)
+    memmove(parent->children + pos + 1, parent->children + pos, (parent->num_children - pos) * sizeof(moauthd_route_t *));
 
-    case MMD_TYPE_HEADING_3 :
-        element = "h3";
-        break;
+  parent->children[pos] = route;
+  parent->num_children ++;
 
-    case MMD_TYPE_HEADING_4 :
-        element = "h4";
-        break;
+  return (route);
+}
 
-    case MMD_TYPE_HEADING_5 :
-        element = "h5";
-        break;
 
-    case MMD_TYPE_HEADING_6 :
-        element = "h6";
-        break;
+//
+// 'build_routes()' - Build and publish the routing trie for all resources.
+//
+// Resources are normally only added at startup, but a trie that is replaced
+// is kept until the server is deleted since lookups do not hold a lock.
+//
+
+static moauthd_route_t *		// O - Routing trie or `NULL` on error
+build_routes(moauthd_server_t *server)	// I - Server object
+{
+  moauthd_route_t	*routes,	// Routing trie
+			*route;		// Current node
+  moauthd_resource_t	*resource;	// Current resource
+  const char		*segment,	// Current path segment
+			*next;		// Next path segment
+  size_t		i,		// Looping var
+			count;		// Number of resources
+
+
+  cupsRWLockWrite(&server->resources_lock);
+
+  if ((routes = atomic_load(&server->routes)) != NULL)
+    goto done;				// Another thread built it
+
+  if ((routes = (moauthd_route_t *)calloc(1, sizeof(moauthd_route_t))) == NULL)
+    goto done;
+
+  for (i = 0, count = cupsArrayGetCount(server->resources); i < count; i ++)
+  {
+    resource = cupsArrayGetElement(server->resources, i);
+
+    if (resource->remote_path[0] != '/')
+      continue;
+
+    // Find or add the node for each segment of the remote path...
+    route = routes;
+
+    if (resource->remote_path[1])
+    {
+      for (segment = resource->remote_path + 1; route; segment = next + 1)
+      {
+	if ((next = strchr(segment, '/')) == NULL)
+	  next = segment + strlen(segment);
+
+	route = add_route(route, segment, (size_t)(next - segment));
+
+	if (!*next)
+	  break;
+      }
+    }
+
+    if (!route)
+    {
+      moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to add route for \"%s\": %s", resource->remote_path, strerror(errno));
+      free_routes(routes);
+      routes = NULL;
+      goto done;
+    }
+
+    if (!route->resource)
+      route->resource = resource;
+  }
+
+  atomic_store(&server->routes, routes);
+
+  done:
+
+  cupsRWUnlock(&server->resources_lock);
+
+  return (routes);
+}
+
+
+//
+// 'cache_page()' - Add a rendered page to the cache.
+//
+// Least recently used pages are removed until the new page fits in
+// `MarkdownCacheSize` bytes.  Pages that are larger than the cache are not
+// added.
+//
+
+static void
+cache_page(moauthd_server_t *server,	// I - Server object
+           moauthd_page_t   *page)	// I - Rendered page
+{
+  moauthd_page_t	*current;	// Current cached page
+  size_t		bytes = sizeof(moauthd_page_t) + page->length;
+					// Size of page
+
+
+  if (bytes > server->page_cache_size)
+    return;
+
+  cupsMutexLock(&server->pages_lock);
+
+  // Remove any older rendering of the same file...
+  for (current = server->pages_first; current; current = current->next)
+  {
+    if (current->resource == page->resource && !strcmp(current->filename, page->filename))
+    {
+      unlink_page(server, current);
+      release_page(current);
+      break;
+    }
+  }
+
+  // Make room...
+  while (server->pages_last && (server->page_cache_used + bytes) > server->page_cache_size)
+  {
+    current = server->pages_last;
+
+    unlink_page(server, current);
+    release_page(current);
+  }
+
+  // Add the page as the most recently used...
+  atomic_fetch_add(&page->refcount, 1);
+
+  page->prev = NULL;
+  page->next = server->pages_first;
+
+  if (server->pages_first)
+    server->pages_first->prev = page;
+  else
+    server->pages_last = page;
+
+  server->pages_first     = page;
+  server->page_cache_used += bytes;
+
+  cupsMutexUnlock(&server->pages_lock);
+}
+
+
+//
+// 'compare_resources()' - Compare the remote path of two resource objects...
+//
+
+static int				// O - Result of comparison
+compare_resources(moauthd_resource_t *a,// I - First resource
+                  moauthd_resource_t *b)// I - Second resource
+{
+  return (strcmp(a->remote_path, b->remote_path));
+}
+
+
+//
+// 'content_fits()' - Determine whether file content fits in the file cache.
+//
+
+static bool				// O - `true` if it fits, `false` otherwise
+content_fits(moauthd_server_t *server,	// I - Server object
+             size_t           length)	// I - Length of content
+{
+  bool	fits;				// Does the content fit?
+
+
+  cupsMutexLock(&server->files_lock);
+  fits = (server->file_cache_used + length) <= server->file_cache_size;
+  cupsMutexUnlock(&server->files_lock);
+
+  return (fits);
+}
+
+
+//
+// 'find_page()' - Find a current rendered page in the cache.
+//
+// Sites have few enough Markdown pages that a linear search of the LRU list
+// is cheaper than rendering.  The returned page must be released using
+// `release_page`.
+//
+
+static moauthd_page_t *			// O - Rendered page or `NULL`
+find_page(moauthd_server_t   *server,	// I - Server object
+          moauthd_resource_t *resource,	// I - Resource
+          const char         *filename,	// I - Local filename
+          struct stat        *info)	// I - File information
+{
+  moauthd_page_t	*page;		// Current page
+
+
+  cupsMutexLock(&server->pages_lock);
+
+  for (page = server->pages_first; page; page = page->next)
+  {
+    if (page->resource == resource && !strcmp(page->filename, filename))
+      break;
+  }
+
+  if (page && (page->mtime != info->st_mtime || page->size != info->st_size))
+  {
+    // File has changed...
+    page = NULL;
+  }
+  else if (page)
+  {
+    // Move the page to the front of the list...
+    if (page != server->pages_first)
+    {
+      unlink_page(server, page);
+
+      page->next = server->pages_first;
+      server->pages_first->prev = page;
+      server->pages_first       = page;
+      server->page_cache_used   += sizeof(moauthd_page_t) + page->length;
+    }
+
+    atomic_fetch_add(&page->refcount, 1);
+  }
+
+  cupsMutexUnlock(&server->pages_lock);
+
+  if (page)
+    moauthdCountMetric(server, MOAUTHD_METRIC_PAGE_CACHE_HITS);
+  else
+    moauthdCountMetric(server, MOAUTHD_METRIC_PAGE_CACHE_MISSES);
+
+  return (page);
+}
+
+
+//
+// 'find_route()' - Find a child node in the routing trie.
+//
+
+static moauthd_route_t *		// O - Child node or `NULL` if not found
+find_route(moauthd_route_t *parent,	// I - Parent node
+           const char      *segment,	// I - Path segment
+           size_t          seglen,	// I - Length of path segment
+           size_t          *pos)	// O - Insertion point or `NULL`
+{
+  size_t	left,			// Left side of search
+		right,			// Right side of search
+		current;		// Current child
+  int		result;			// Result of comparison
 
-    case MMD_TYPE_PARAGRAPH :
-        element = "p";
-        break;
+
+  for (left = 0, right = parent->num_children; left < right;)
+  {
+    current = (left + right) / 2;
+
+    if ((result = strncmp(parent->children[current]->segment, segment, seglen)) == 0 && parent->children[current]->segment[seglen])
+      result = 1;			// Child segment is longer
+
+    if (result == 0)
+      return (parent->children[current]);
+    else if (result < 0)
+      left = current + 1;
+    else
+      right = current;
+  }
+
+  if (pos)
+    *pos = left;
+
+  return (NULL);
+}
+
+
+//
+// 'free_resource()' - Free a resource object.
+//
+
+static void
+free_resource(
+    moauthd_resource_t *resource)	// I - Resource object
+{
+  free(resource->remote_path);
+  if (resource->local_path)
+    free(resource->local_path);
+  if (resource->content_type)
+    free(resource->content_type);
+  free(resource->scope);
+  release_content(resource->content);
+  free(resource);
+}
+
+
+//
+// 'free_routes()' - Free a routing trie.
+//
+
+static void
+free_routes(moauthd_route_t *route)	// I - Trie node
+{
+  size_t	i;			// Looping var
+
+
+  for (i = 0; i < route->num_children; i ++)
+    free_routes(route->children[i]);
+
+  free(route->children);
+  free(route->segment);
+  free(route);
+}
+
+
+//
+// 'get_content()' - Get the content of a cached file.
+//
+// Files are loaded on first use and kept in memory until they change or
+// `FileCacheSize` bytes are used.  Files that do not fit in the cache are not
+// loaded - `NULL` is returned so the caller sends them from the file like
+// other resources.  The returned content must be released using
+// `release_content`.
+//
+
+static moauthd_content_t *		// O - File content or `NULL` if not a cached file
+get_content(
+    moauthd_server_t   *server,		// I - Server object
+    moauthd_resource_t *resource,	// I - Resource
+    const char         *filename,	// I - Local filename
+    struct stat        *info)		// IO - File information
+{
+  moauthd_content_t	*content;	// File content
+  unsigned		generation;	// Change count when loaded
+  int			fd;		// File descriptor
+  size_t		total;		// Total bytes read
+  ssize_t		bytes;		// Bytes read
+
+
+  if (resource->type != MOAUTHD_RESTYPE_CACHED_FILE)
+    return (NULL);
+
+  // See if the current content is cached...
+  cupsMutexLock(&server->files_lock);
+
+  if ((content = resource->content) != NULL && (content->info.st_mtime != info->st_mtime || content->info.st_size != info->st_size))
+  {
+    // File has changed...
+    server->file_cache_used -= content->length;
+    release_content(content);
+    resource->content = content = NULL;
+  }
+
+  if (content)
+    atomic_fetch_add(&content->refcount, 1);
+
+  generation = resource->generation;
+
+#ifdef HAVE_SYS_INOTIFY_H
+  // Watch for changes before loading so that none are missed...
+  if (!content && resource->watch < 0 && server->inotify_fd >= 0)
+    resource->watch = inotify_add_watch(server->inotify_fd, filename, IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF);
+#endif // HAVE_SYS_INOTIFY_H
+
+  cupsMutexUnlock(&server->files_lock);
+
+  if (content)
+  {
+    moauthdCountMetric(server, MOAUTHD_METRIC_FILE_CACHE_HITS);
+    return (content);
+  }
+
+  moauthdCountMetric(server, MOAUTHD_METRIC_FILE_CACHE_MISSES);
+
+  if (!content_fits(server, (size_t)info->st_size))
+    return (NULL);
+
+  // Load the file...
+  if ((fd = open(filename, O_RDONLY)) < 0)
+    return (NULL);
+
+  if (fstat(fd, info) || !content_fits(server, (size_t)info->st_size) || (content = (moauthd_content_t *)malloc(sizeof(moauthd_content_t) + (size_t)info->st_size)) == NULL)
+  {
+    close(fd);
+    return (NULL);
+  }
+
+  content->refcount = 1;		// Caller
+  content->info     = *info;
+  content->length   = (size_t)info->st_size;
+
+  for (total = 0; total < content->length; total += (size_t)bytes)
+  {
+    if ((bytes = read(fd, content->data + total, content->length - total)) <= 0)
+      break;
+  }
+
+  close(fd);
+
+  if (total < content->length)
+  {
+    release_content(content);
+    return (NULL);
+  }
+
+  // Cache the content if it is unchanged and fits...
+  cupsMutexLock(&server->files_lock);
+
+  if (!resource->content && resource->generation == generation && (server->file_cache_used + content->length) <= server->file_cache_size)
+  {
+    atomic_fetch_add(&content->refcount, 1);
+    resource->content       = content;
+    server->file_cache_used += content->length;
+  }
+
+  cupsMutexUnlock(&server->files_lock);
+
+  return (content);
+}
+
+
+//
+// 'get_ranges()' - Get the byte ranges from a Range header.
+//
+// Ranges that start past the end of the file are dropped.  Invalid Range
+// headers and requests for more than `MOAUTHD_MAX_RANGES` ranges are ignored
+// so that the whole file is sent.
+//
+
+static int				// O - Number of ranges, 0 for the whole file, or -1 if not satisfiable
+get_ranges(const char      *value,	// I - Range header value
+           size_t          length,	// I - Length of file
+           moauthd_range_t *ranges)	// O - Byte ranges
+{
+  int			num_ranges = 0,	// Number of ranges
+			num_specs = 0;	// Number of range specs
+  bool			satisfiable = false;
+					// Can any range be satisfied?
+  unsigned long long	start,		// First byte
+			end;		// Last byte
+  char			*ptr;		// Pointer into value
+
+
+  if (!value || strncmp(value, "bytes=", 6))
+    return (0);
+
+  for (value += 6; *value;)
+  {
+    while (isspace(*value & 255))
+      value ++;
+
+    if (*value == '-')
+    {
+      // Suffix range ("-N")...
+      if (!isdigit(value[1] & 255))
+        return (0);
+
+      end = strtoull(value + 1, &ptr, 10);
+
+      if (end == 0 || length == 0)
+      {
+        value = ptr;
+        goto next_range;
+      }
+
+      start = end < length ? length - end : 0;
+      end   = length - 1;
+    }
+    else if (isdigit(*value & 255))
+    {
+      // Range ("M-N" or "M-")...
+      start = strtoull(value, &ptr, 10);
+
+      if (*ptr != '-')
+        return (0);
+
+      if (isdigit(ptr[1] & 255))
+      {
+        end = strtoull(ptr + 1, &ptr, 10);
+
+        if (end < start)
+          return (0);
+      }
+      else
+      {
+        end = length;
+        ptr ++;
+      }
+
+      if (start >= length)
+      {
+        value = ptr;
+        goto next_range;
+      }
+
+      if (end >= length)
+        end = length - 1;
+    }
+    else
+    {
+      return (0);
+    }
+
+    value = ptr;
+
+    if (num_ranges >= MOAUTHD_MAX_RANGES)
+      return (0);
+
+    ranges[num_ranges].start  = (size_t)start;
+    ranges[num_ranges].length = (size_t)(end - start + 1);
+    num_ranges ++;
+    satisfiable = true;
+
+    next_range:
+
+    num_specs ++;
+
+    while (isspace(*value & 255))
+      value ++;
+
+    if (*value == ',')
+      value ++;
+    else if (*value)
+      return (0);
+  }
+
+  // "bytes=" with no ranges is invalid and is ignored...
+  if (num_specs == 0)
+    return (0);
+
+  return (satisfiable ? num_ranges : -1);
+}
+
+
+//
+// 'make_anchor()' - Make an anchor for internal links.
+//
+
+static const char *                     // O - Anchor string
+make_anchor(const char *text,           // I - Text
+            char       *buffer,		// I - Buffer
+            size_t     bufsize)		// I - Size of buffer
+{
+  char	*bufptr,			// Pointer into buffer
+	*bufend = buffer + bufsize - 1;	// End of buffer
+
+
+  for (bufptr = buffer; *text && bufptr < bufend; text ++)
+  {
+    if ((*text >= '0' && *text <= '9') || (*text >= 'a' && *text <= 'z') || (*text >= 'A' && *text <= 'Z') || *text == '.' || *text == '-')
+      *bufptr++ = (char)tolower(*text & 255);
+    else if (*text == ' ')
+      *bufptr++ = '-';
+  }
+
+  *bufptr = '\0';
+
+  return (buffer);
+}
+
+
+//
+// 'release_content()' - Release a reference to cached file content.
+//
+
+static void
+release_content(
+    moauthd_content_t *content)		// I - File content
+{
+  if (content && atomic_fetch_sub(&content->refcount, 1) == 1)
+    free(content);
+}
+
+
+//
+// 'release_page()' - Release a reference to a rendered page.
+//
+
+static void
+release_page(moauthd_page_t *page)	// I - Rendered page
+{
+  if (page && atomic_fetch_sub(&page->refcount, 1) == 1)
+  {
+    free(page->filename);
+    free(page->title);
+    free(page->html);
+    free(page);
+  }
+}
+
+
+//
+// 'render_page()' - Render a Markdown file as HTML.
+//
+// The rendered page is added to the cache and must be released using
+// `release_page`.
+//
+
+static moauthd_page_t *			// O - Rendered page or `NULL` on error
+render_page(
+    moauthd_client_t   *client,		// I - Client object
+    moauthd_resource_t *resource,	// I - Resource
+    const char         *filename,	// I - Local filename
+    struct stat        *info)		// I - File information
+{
+  moauthd_page_t *page;			// Rendered page
+  FILE		*fp;			// File
+  mmd_t		*doc,			// Markdown document
+		*node;			// Current Markdown node
+  const char	*title;			// Document title
+  char		buffer[1024],		// Temporary buffer
+		*bufptr;		// Pointer into buffer
+
+
+  // Load the Markdown document...
+  if (resource->data)
+    fp = fmemopen((void *)resource->data, resource->length, "rb");
+  else
+    fp = fopen(filename, "rb");
+
+  if (!fp)
+  {
+    moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Unable to open \"%s\": %s", filename, strerror(errno));
+    return (NULL);
+  }
+
+  doc = mmdLoadFile(NULL, fp);
+  fclose(fp);
+
+  // Get the document title, if any...
+  if ((title = mmdGetMetadata(doc, "title")) == NULL)
+  {
+    for (node = mmdGetFirstChild(doc); node; node = mmdGetNextSibling(node))
+    {
+      if (mmdGetType(node) == MMD_TYPE_HEADING_1)
+      {
+	buffer[sizeof(buffer) - 1] = '\0';
+
+	for (bufptr = buffer, node = mmdGetFirstChild(node); node && bufptr < (buffer + sizeof(buffer) - 2); node = mmdGetNextSibling(node))
+	{
+	  if (mmdGetWhitespace(node))
+	    *bufptr++ = ' ';
+	  cupsCopyString(bufptr, mmdGetText(node), sizeof(buffer) - (bufptr - buffer));
+	  bufptr += strlen(bufptr);
+	}
+
+	*bufptr = '\0';
+	title   = buffer;
+	break;
+      }
+    }
+  }
+
+  // Render the body...
+  client->output_used  = 0;
+  client->output_alloc = (size_t)info->st_size + 4096;
+
+  if ((page = (moauthd_page_t *)calloc(1, sizeof(moauthd_page_t))) == NULL || (client->output = malloc(client->output_alloc)) == NULL)
+  {
+    free(page);
+    mmdFree(doc);
+    return (NULL);
+  }
+
+  write_block(client, doc);
+  mmdFree(doc);
+
+  page->refcount = 1;			// Caller
+  page->resource = resource;
+  page->filename = strdup(filename);
+  page->title    = title ? strdup(title) : NULL;
+  page->html     = client->output;
+  page->mtime    = info->st_mtime;
+  page->size     = info->st_size;
+  page->length   = client->output_used;
+
+  client->output       = NULL;
+  client->output_used  = 0;
+  client->output_alloc = 0;
+
+  if (!page->filename)
+  {
+    release_page(page);
+    return (NULL);
+  }
+
+  cache_page(client->server, page);
+
+  return (page);
+}
+
+
+//
+// 'unlink_page()' - Remove a page from the LRU list.
+//
+// The caller must hold the `pages_lock` mutex and release the list's
+// reference as needed.
+//
+
+static void
+unlink_page(moauthd_server_t *server,	// I - Server object
+            moauthd_page_t   *page)	// I - Cached page
+{
+  if (page->prev)
+    page->prev->next = page->next;
+  else
+    server->pages_first = page->next;
+
+  if (page->next)
+    page->next->prev = page->prev;
+  else
+    server->pages_last = page->prev;
+
+  page->prev = NULL;
+  page->next = NULL;
+
+  server->page_cache_used -= sizeof(moauthd_page_t) + page->length;
+}
+
+
+//
+// 'write_block()' - Write a block node as HTML.
+//
+
+static void
+write_block(moauthd_client_t *client,	// I - Client connection
+            mmd_t            *parent)	// I - Parent node
+{
+  const char	*element,		// Enclosing element, if any
+		*hclass = NULL;		// HTML class, if any
+  mmd_t         *node;                  // Current child node
+  mmd_type_t    type;                   // Node type
+
+
+  switch (type = mmdGetType(parent))
+  {
+    case MMD_TYPE_BLOCK_QUOTE :
+        element = "blockquote";
+        break;
+
+    case MMD_TYPE_ORDERED_LIST :
+        element = "ol";
+        break;
+
+    case MMD_TYPE_UNORDERED_LIST :
+        element = "ul";
+        break;
+
+    case MMD_TYPE_LIST_ITEM :
+        element = "li";
+        break;
+
+    case MMD_TYPE_HEADING_1 :
+        element = "h1";
+        break;
+
+    case MMD_TYPE_HEADING_2 :
+        element = "h2";
+        break;
+
+    case MMD_TYPE_HEADING_3 :
+        element = "h3";
+        break;
+
+    case MMD_TYPE_HEADING_4 :
+        element = "h4";
+        break;
+
+    case MMD_TYPE_HEADING_5 :
+        element = "h5";
+        break;
+
+    case MMD_TYPE_HEADING_6 :
+        element = "h6";
+        break;
+
+    case MMD_TYPE_PARAGRAPH :
+        element = "p";
+        break;
 
     case MMD_TYPE_CODE_BLOCK :
         write_string(client, "    <pre><code>");
@@ -603,6 +1641,83 @@ write_block(moauthd_client_t *client,	// I - Client connection
 }
 
 
+//
+// 'write_data()' - Write part of a file or in-memory data to the client.
+//
+
+static bool				// O - `true` on success, `false` on error
+write_data(moauthd_client_t *client,	// I - Client connection
+           const char       *data,	// I - File data or `NULL` to use file
+           int              fd,		// I - File descriptor
+           size_t           offset,	// I - Offset in file
+           size_t           length)	// I - Number of bytes to write
+{
+  size_t	total,			// Total bytes written
+		count;			// Bytes to write
+
+
+  if (!data)
+    return (write_file(client, fd, offset, length));
+
+  for (total = 0; total < length; total += count)
+  {
+    count = length - total;
+    if (count > MOAUTHD_WRITE_SIZE)
+      count = MOAUTHD_WRITE_SIZE;
+
+    if (!moauthdWriteClient(client, data + offset + total, count))
+      break;
+  }
+
+  return (total == length);
+}
+
+
+//
+// 'write_file()' - Write part of a file to the client.
+//
+// All client connections are encrypted by libcups, so the data has to pass
+// through user space and `sendfile` cannot be used.  The file is read and
+// written in `MOAUTHD_WRITE_SIZE` slices.  Files are not mapped into memory
+// since a file that is truncated while it is being sent would crash the
+// server - instead the response is cut short.
+//
+
+static bool				// O - `true` on success, `false` on error
+write_file(moauthd_client_t *client,	// I - Client connection
+           int              fd,		// I - File descriptor
+           size_t           offset,	// I - Offset in file
+           size_t           length)	// I - Number of bytes to write
+{
+  char		*buffer;		// Read buffer
+  size_t	total,			// Total bytes written
+		count;			// Bytes to write
+  ssize_t	bytes;			// Bytes read/written
+
+
+  // Read and write the file...
+  if ((buffer = malloc(length < MOAUTHD_WRITE_SIZE ? (length > 0 ? length : 1) : MOAUTHD_WRITE_SIZE)) == NULL)
+    return (false);
+
+  for (total = 0; total < length; total += (size_t)bytes)
+  {
+    count = length - total;
+    if (count > MOAUTHD_WRITE_SIZE)
+      count = MOAUTHD_WRITE_SIZE;
+
+    if ((bytes = pread(fd, buffer, count, (off_t)(offset + total))) <= 0)
+      break;
+
+    if (!moauthdWriteClient(client, buffer, (size_t)bytes))
+      break;
+  }
+
+  free(buffer);
+
+  return (total == length);
+}
+
+
 //
 // 'write_leaf()' - Write a leaf node as HTML.
 //
@@ -694,6 +1809,71 @@ write_leaf(moauthd_client_t *client,	// I - Client connection
 }
 
 
+//
+// 'write_ranges()' - Write byte ranges of a file to the client.
+//
+// A single range is sent as-is, while multiple ranges are sent as a
+// "multipart/byteranges" message.
+//
+
+static bool				// O - `true` on success, `false` on error
+write_ranges(
+    moauthd_client_t *client,		// I - Client connection
+    const char       *type,		// I - MIME media type of file
+    const char       *uri,		// I - URI of file
+    time_t           mtime,		// I - Modification time of file
+    const char       *data,		// I - File data or `NULL` to use file
+    int              fd,		// I - File descriptor
+    size_t           length,		// I - Length of file
+    moauthd_range_t  *ranges,		// I - Byte ranges
+    size_t           num_ranges)	// I - Number of byte ranges
+{
+  size_t	i,			// Looping var
+		total;			// Length of response
+  unsigned char	bytes[8];		// Random bytes for boundary
+  char		boundary[32],		// Multipart boundary
+		mtype[256],		// Multipart MIME media type
+		header[512];		// Part header
+
+
+  if (num_ranges == 1)
+  {
+    // Send a single range...
+    snprintf(client->content_range, sizeof(client->content_range), "bytes %lu-%lu/%lu", (unsigned long)ranges[0].start, (unsigned long)(ranges[0].start + ranges[0].length - 1), (unsigned long)length);
+
+    if (!moauthdRespondClient(client, HTTP_STATUS_PARTIAL_CONTENT, type, uri, mtime, ranges[0].length))
+      return (false);
+
+    return (write_data(client, data, fd, ranges[0].start, ranges[0].length));
+  }
+
+  // Send multiple ranges, computing the total length first...
+  _moauthGetRandomBytes(bytes, sizeof(bytes));
+  snprintf(boundary, sizeof(boundary), "%02x%02x%02x%02x%02x%02x%02x%02x", bytes[0], bytes[1], bytes[2], bytes[3], bytes[4], bytes[5], bytes[6], bytes[7]);
+  snprintf(mtype, sizeof(mtype), "multipart/byteranges; boundary=%s", boundary);
+
+  for (i = 0, total = 0; i < num_ranges; i ++)
+    total += (size_t)snprintf(header, sizeof(header), "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lu-%lu/%lu\r\n\r\n", boundary, type, (unsigned long)ranges[i].start, (unsigned long)(ranges[i].start + ranges[i].length - 1), (unsigned long)length) + ranges[i].length;
+
+  total += (size_t)snprintf(header, sizeof(header), "\r\n--%s--\r\n", boundary);
+
+  if (!moauthdRespondClient(client, HTTP_STATUS_PARTIAL_CONTENT, mtype, uri, mtime, total))
+    return (false);
+
+  for (i = 0; i < num_ranges; i ++)
+  {
+    snprintf(header, sizeof(header), "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lu-%lu/%lu\r\n\r\n", boundary, type, (unsigned long)ranges[i].start, (unsigned long)(ranges[i].start + ranges[i].length - 1), (unsigned long)length);
+
+    if (!moauthdWriteClient(client, header, strlen(header)) || !write_data(client, data, fd, ranges[i].start, ranges[i].length))
+      return (false);
+  }
+
+  snprintf(header, sizeof(header), "\r\n--%s--\r\n", boundary);
+
+  return (moauthdWriteClient(client, header, strlen(header)));
+}
+
+
 //
 // 'write_string()' - Write a string to the client...
 //
@@ -702,5 +1882,5 @@ static void
 write_string(moauthd_client_t *client,	// I - Client connection
              const char       *s)	// I - String to write
 {
-  httpWrite(client->http, s, strlen(s));
+  moauthdWriteClient(client, s, strlen(s));
 }
@@ -11,9 +11,16 @@
 #include <cups/jwt.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <syslog.h>
 #include <grp.h>
+#ifdef HAVE_SYS_EPOLL_H
+#  include <sys/epoll.h>
+#endif // HAVE_SYS_EPOLL_H
+#ifdef HAVE_SYS_INOTIFY_H
+#  include <sys/inotify.h>
+#endif // HAVE_SYS_INOTIFY_H
 #include "index-md.h"
 #include "moauth-png.h"
 #include "style-css.h"
@@ -21,16 +28,45 @@
 
 
 
+//
+// Local globals...
+//
+
+static const struct
+{
+  const char	*name;			// Algorithm name
+  cups_jwa_t	alg;			// Algorithm
+  const char	*kty,			// Key type
+		*crv;			// Curve, if any
+} signing_algs[] =
+{
+  { "RS256", CUPS_JWA_RS256, "RSA", NULL },
+  { "RS384", CUPS_JWA_RS384, "RSA", NULL },
+  { "RS512", CUPS_JWA_RS512, "RSA", NULL },
+  { "ES256", CUPS_JWA_ES256, "EC", "P-256" },
+  { "ES384", CUPS_JWA_ES384, "EC", "P-384" },
+  { "ES512", CUPS_JWA_ES512, "EC", "P-521" }
+};
+
+
 //
 // Local functions...
 //
 
+static void	accept_client(moauthd_server_t *server, int fd);
+static void	close_client(moauthd_server_t *server, moauthd_client_t *client);
 static int	compare_applications(moauthd_application_t *a, moauthd_application_t *b);
 static moauthd_application_t *copy_application(moauthd_application_t *a);
 static void	free_application(moauthd_application_t *a);
 static int	get_seconds(const char *value);
+static size_t	get_signing_alg(moauthd_server_t *server);
 static bool	load_config(moauthd_server_t *server, const char *configfile, cups_file_t *fp);
 static bool	load_state(moauthd_server_t *server);
+static void	park_client(moauthd_server_t *server, moauthd_client_t *client);
+static void	queue_client(moauthd_server_t *server, moauthd_client_t *client);
+static void	*run_reaper(moauthd_server_t *server);
+static void	*run_worker(moauthd_server_t *server);
+static bool	sync_directory(moauthd_server_t *server, const char *filename);
 
 
 //
@@ -108,15 +144,59 @@ moauthdCreateServer(
   server = calloc(1, sizeof(moauthd_server_t));
 
   cupsMutexInit(&server->applications_lock);
+  cupsMutexInit(&server->auth_lock);
+  cupsCondInit(&server->auth_cond);
+  cupsCondInit(&server->auth_done_cond);
+  cupsMutexInit(&server->clients_lock);
+  cupsCondInit(&server->clients_cond);
+  cupsMutexInit(&server->journal_lock);
+  cupsCondInit(&server->journal_cond);
+  cupsMutexInit(&server->log_lock);
+  cupsCondInit(&server->log_cond);
   cupsRWInit(&server->resources_lock);
-  cupsRWInit(&server->tokens_lock);
-
+  cupsRWInit(&server->auth_cache_lock);
+  cupsMutexInit(&server->users_lock);
+  cupsMutexInit(&server->files_lock);
+  cupsMutexInit(&server->pages_lock);
+
+  moauthdInitEndpoints(server);
+  moauthdInitTokens(server);
+
+  server->access_log       = -1;	// none
+  server->auth_cache_life  = 60;	// 1 minute
+  server->auth_cache_size  = 1024;
+  server->auth_queue_size  = 8;
+  server->auth_threads     = 4;
+  server->file_cache_size  = 4194304;	// 4MiB
   server->introspect_group = -1;	// none
+  server->journal_fd       = -1;
   server->log_file         = 2;		// stderr
   server->log_level        = MOAUTHD_LOGLEVEL_ERROR;
+  server->max_clients      = 1024;
   server->max_grant_life   = 300;	// 5 minutes
   server->max_token_life   = 604800;	// 1 week
+  server->metrics_group    = -1;	// none
+  server->num_workers      = 16;
+  server->page_cache_size  = 4194304;	// 4MiB
+  server->signing_alg      = CUPS_JWA_RS256;
   server->register_group   = -1;	// none
+  server->user_cache_life  = 300;	// 5 minutes
+  server->user_cache_size  = 1024;
+
+  moauthdAddScope(server, "public");	// MOAUTHD_SCOPE_PUBLIC
+  moauthdAddScope(server, "private");	// MOAUTHD_SCOPE_PRIVATE
+  moauthdAddScope(server, "shared");	// MOAUTHD_SCOPE_SHARED
+
+#ifdef HAVE_SYS_INOTIFY_H
+  server->inotify_fd       = -1;
+#endif // HAVE_SYS_INOTIFY_H
+
+#ifdef HAVE_SYS_EPOLL_H
+  server->event_fd         = -1;
+#else
+  server->wake_pipe[0]     = -1;
+  server->wake_pipe[1]     = -1;
+#endif // HAVE_SYS_EPOLL_H
 
   if (fp)
   {
@@ -311,6 +391,8 @@ moauthdCreateServer(
   // Authorization Code Flow).
   jarray = cupsJSONNew(json, cupsJSONNewKey(json, NULL, "id_token_signing_alg_values_supported"), CUPS_JTYPE_ARRAY);
   cupsJSONNewString(jarray, NULL, "RS256");
+  if (server->signing_alg != CUPS_JWA_RS256)
+    cupsJSONNewString(jarray, NULL, signing_algs[get_signing_alg(server)].name);
 
   // claims_supported
   //
@@ -338,6 +420,13 @@ moauthdCreateServer(
   httpAssembleURI(HTTP_URI_CODING_ALL, temp, sizeof(temp), "https", /*userpass*/NULL, server->name, server->port, "/introspect");
   cupsJSONNewString(json, cupsJSONNewKey(json, NULL, "introspection_endpoint"), temp);
 
+  // revocation_endpoint
+  //
+  // URL of the authorization server's OAuth 2.0 revocation endpoint [RFC8414]
+  // [RFC7009].
+  httpAssembleURI(HTTP_URI_CODING_ALL, temp, sizeof(temp), "https", /*userpass*/NULL, server->name, server->port, "/revoke");
+  cupsJSONNewString(json, cupsJSONNewKey(json, NULL, "revocation_endpoint"), temp);
+
   // grant_types_supported
   //
   // OPTIONAL. JSON array containing a list of the OAuth 2.0 Grant Type values
@@ -375,6 +464,13 @@ moauthdCreateServer(
     server->secret = strdup(temp);
   }
 
+  if (server->auth_cache_life > 0 && server->auth_cache_size > 0)
+  {
+    // Allocate the authentication cache...
+    _moauthGetRandomBytes(server->auth_cache_salt, sizeof(server->auth_cache_salt));
+    server->auth_cache = calloc(server->auth_cache_size, sizeof(moauthd_authcache_t));
+  }
+
   // Add RFC 8414 configuration file.
   r = moauthdCreateResource(server, MOAUTHD_RESTYPE_STATIC_FILE, "/.well-known/oauth-authorization-server", NULL, "text/json", "public");
   r->data   = server->metadata;
@@ -439,6 +535,13 @@ moauthdDeleteServer(
   int	i;				// Looping var
 
 
+  moauthdStopLog(server);
+  moauthdFreeLog(server);
+  moauthdFreeMetrics(server);
+
+  if (server->access_log > 2)
+    close(server->access_log);
+
   free(server->name);
   free(server->state_file);
   free(server->auth_service);
@@ -446,13 +549,65 @@ moauthdDeleteServer(
   for (i = 0; i < server->num_listeners; i ++)
     httpAddrClose(NULL, server->listeners[i].fd);
 
+#ifdef HAVE_SYS_EPOLL_H
+  if (server->event_fd >= 0)
+    close(server->event_fd);
+#else
+  if (server->wake_pipe[0] >= 0)
+  {
+    close(server->wake_pipe[0]);
+    close(server->wake_pipe[1]);
+  }
+#endif // HAVE_SYS_EPOLL_H
+
+#ifdef HAVE_SYS_INOTIFY_H
+  if (server->inotify_fd >= 0)
+    close(server->inotify_fd);
+#endif // HAVE_SYS_INOTIFY_H
+
   cupsArrayDelete(server->applications);
-  cupsArrayDelete(server->resources);
-  cupsArrayDelete(server->tokens);
+  cupsArrayDelete(server->clients);
+  moauthdFreeResources(server);
+
+  free(server->endpoints);
+  cupsArrayDelete(server->users);
+  cupsArrayDelete(server->groups);
+
+  for (i = 0; i < server->num_scopes; i ++)
+    free(server->scopes[i]);
+
+  free(server->scopes);
+  free(server->scope_gids);
+
+  free(server->queue);
+  free(server->auth_queue);
+
+  if (server->journal_fd >= 0)
+    close(server->journal_fd);
+
+  free(server->journal_file);
+  free(server->journal_buffer);
 
   cupsMutexDestroy(&server->applications_lock);
+  cupsMutexDestroy(&server->auth_lock);
+  cupsCondDestroy(&server->auth_cond);
+  cupsCondDestroy(&server->auth_done_cond);
+  cupsMutexDestroy(&server->clients_lock);
+  cupsCondDestroy(&server->clients_cond);
+  cupsMutexDestroy(&server->journal_lock);
+  cupsCondDestroy(&server->journal_cond);
+  cupsMutexDestroy(&server->log_lock);
+  cupsCondDestroy(&server->log_cond);
   cupsRWDestroy(&server->resources_lock);
-  cupsRWDestroy(&server->tokens_lock);
+  cupsRWDestroy(&server->auth_cache_lock);
+  cupsMutexDestroy(&server->users_lock);
+  cupsMutexDestroy(&server->files_lock);
+  cupsMutexDestroy(&server->pages_lock);
+
+  free(server->auth_cache);
+
+  moauthdFreeTokens(server);
+  moauthdCloseSnapshot(server);
 
   cupsJSONDelete(server->private_key);
 
@@ -507,22 +662,250 @@ moauthdFindApplication(
 //
 // 'moauthdRunServer()' - Listen for client connections and process requests.
 //
+// The main thread runs the event loop, accepting new connections and watching
+// idle keep-alive connections for new requests.  Clients with pending requests
+// are queued for a fixed pool of worker threads.
+//
 
 int					// O - Exit status
 moauthdRunServer(
     moauthd_server_t *server)		// I - Server object
 {
-  bool	done = false;			// Are we done yet?
+  bool		done = false;		// Are we done yet?
+  int		i;			// Looping var
+  time_t	curtime,		// Current time
+		next_sweep;		// Next idle sweep time
+  moauthd_client_t *client;		// Current client
+#ifdef HAVE_SYS_EPOLL_H
+  int		nevents;		// Number of events
+  struct epoll_event events[100],	// Events
+		*event;			// Current event
+#else
+  struct pollfd	*pfds = NULL,		// Polling data
+		*pfd;			// Current polling data
+  moauthd_client_t **pclients = NULL;	// Clients being polled
+  int		npfds;			// Number of polling entries
+  char		wake[256];		// Wakeup data
+#endif // HAVE_SYS_EPOLL_H
 
 
   if (!server)
     return (1);
 
-  moauthdLogs(server, MOAUTHD_LOGLEVEL_INFO, "Listening for client connections.");
+  // Allocate the client array and request queue...
+  server->clients = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
+
+  if ((server->queue = calloc((size_t)server->max_clients, sizeof(moauthd_client_t *))) == NULL)
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to allocate client queue: %s", strerror(errno));
+    return (1);
+  }
+
+#ifdef HAVE_SYS_EPOLL_H
+  // Create the epoll instance and add the listeners...
+  if ((server->event_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to create epoll instance: %s", strerror(errno));
+    return (1);
+  }
+
+  for (i = 0; i < server->num_listeners; i ++)
+  {
+    struct epoll_event lisevent;	// Listener event
+
+    lisevent.events   = EPOLLIN;
+    lisevent.data.ptr = server->listeners + i;
+
+    if (epoll_ctl(server->event_fd, EPOLL_CTL_ADD, server->listeners[i].fd, &lisevent))
+    {
+      moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to add listener to epoll instance: %s", strerror(errno));
+      return (1);
+    }
+  }
+
+#  ifdef HAVE_SYS_INOTIFY_H
+  // Watch for changes to cached files...
+  if ((server->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0)
+  {
+    struct epoll_event notevent;	// inotify event
+
+    notevent.events   = EPOLLIN;
+    notevent.data.ptr = &server->inotify_fd;
+
+    if (epoll_ctl(server->event_fd, EPOLL_CTL_ADD, server->inotify_fd, &notevent))
+    {
+      moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to add inotify instance to epoll instance: %s", strerror(errno));
+      close(server->inotify_fd);
+      server->inotify_fd = -1;
+    }
+  }
+  else
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to create inotify instance: %s", strerror(errno));
+#  endif // HAVE_SYS_INOTIFY_H
+
+#else
+  // Create the wakeup pipe and polling arrays...
+  if (pipe(server->wake_pipe))
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to create wakeup pipe: %s", strerror(errno));
+    return (1);
+  }
+
+  fcntl(server->wake_pipe[0], F_SETFL, fcntl(server->wake_pipe[0], F_GETFL) | O_NONBLOCK);
+  fcntl(server->wake_pipe[1], F_SETFL, fcntl(server->wake_pipe[1], F_GETFL) | O_NONBLOCK);
+
+  pfds     = calloc((size_t)(server->max_clients + server->num_listeners + 1), sizeof(struct pollfd));
+  pclients = calloc((size_t)server->max_clients, sizeof(moauthd_client_t *));
+
+  if (!pfds || !pclients)
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to allocate polling data: %s", strerror(errno));
+    free(pfds);
+    free(pclients);
+    return (1);
+  }
+
+#  ifdef HAVE_SYS_INOTIFY_H
+  // Watch for changes to cached files, checked by the idle sweep...
+  if ((server->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to create inotify instance: %s", strerror(errno));
+#  endif // HAVE_SYS_INOTIFY_H
+#endif // HAVE_SYS_EPOLL_H
+
+  // Start the worker threads...
+  for (i = 0; i < server->num_workers; i ++)
+  {
+    cups_thread_t tid;			// Worker thread
+
+    if ((tid = cupsThreadCreate((void *(*)(void *))run_worker, server)) == CUPS_THREAD_INVALID)
+    {
+      moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to create worker thread: %s", strerror(errno));
+      return (1);
+    }
+
+    cupsThreadDetach(tid);
+  }
+
+#ifdef HAVE_LIBPAM
+  // Start the PAM authentication threads...
+  if (!server->test_password)
+  {
+    if ((server->auth_queue = calloc((size_t)server->auth_queue_size, sizeof(moauthd_authreq_t *))) == NULL)
+    {
+      moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to allocate authentication queue: %s", strerror(errno));
+      return (1);
+    }
+
+    for (i = 0; i < server->auth_threads; i ++)
+    {
+      cups_thread_t tid;		// Authentication thread
+
+      if ((tid = cupsThreadCreate((void *(*)(void *))moauthdRunAuth, server)) == CUPS_THREAD_INVALID)
+      {
+	moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to create authentication thread: %s", strerror(errno));
+	return (1);
+      }
+
+      cupsThreadDetach(tid);
+    }
+  }
+#endif // HAVE_LIBPAM
+
+  // Start the state journal writer...
+  {
+    cups_thread_t tid;			// Journal thread
+
+    if ((tid = cupsThreadCreate((void *(*)(void *))moauthdRunJournal, server)) == CUPS_THREAD_INVALID)
+    {
+      moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to create journal thread: %s", strerror(errno));
+      return (1);
+    }
+
+    cupsThreadDetach(tid);
+  }
+
+  // Start the expired token reaper...
+  {
+    cups_thread_t tid;			// Reaper thread
+
+    if ((tid = cupsThreadCreate((void *(*)(void *))run_reaper, server)) == CUPS_THREAD_INVALID)
+    {
+      moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to create token reaper thread: %s", strerror(errno));
+      return (1);
+    }
+
+    cupsThreadDetach(tid);
+  }
+
+  // Start the log writer...
+  if (!moauthdStartLog(server))
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to create log thread: %s", strerror(errno));
+    return (1);
+  }
+
+  moauthdLogs(server, MOAUTHD_LOGLEVEL_INFO, "Listening for client connections with %d worker threads.", server->num_workers);
+
+  next_sweep = time(NULL) + 1;
 
   while (!done)
   {
-    if (poll(server->listeners, server->num_listeners, -1) < 0)
+#ifdef HAVE_SYS_EPOLL_H
+    if ((nevents = epoll_wait(server->event_fd, events, (int)(sizeof(events) / sizeof(events[0])), 1000)) < 0)
+    {
+      if (errno != EAGAIN && errno != EINTR)
+      {
+        moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "epoll_wait() failed: %s", strerror(errno));
+        done = true;
+      }
+    }
+
+    for (i = nevents, event = events; i > 0; i --, event ++)
+    {
+      if (event->data.ptr >= (void *)server->listeners && event->data.ptr < (void *)(server->listeners + server->num_listeners))
+      {
+        // New connection...
+        accept_client(server, ((struct pollfd *)event->data.ptr)->fd);
+      }
+#  ifdef HAVE_SYS_INOTIFY_H
+      else if (event->data.ptr == &server->inotify_fd)
+      {
+        // Cached files have changed...
+        moauthdUpdateResources(server);
+      }
+#  endif // HAVE_SYS_INOTIFY_H
+      else
+      {
+        // New request (or closed connection) from a parked client...
+        queue_client(server, (moauthd_client_t *)event->data.ptr);
+      }
+    }
+
+#else
+    // Build the list of listeners and parked clients to poll...
+    pfds[0].fd     = server->wake_pipe[0];
+    pfds[0].events = POLLIN;
+
+    for (i = 0, npfds = 1; i < server->num_listeners; i ++, npfds ++)
+      pfds[npfds] = server->listeners[i];
+
+    cupsMutexLock(&server->clients_lock);
+
+    for (client = (moauthd_client_t *)cupsArrayGetFirst(server->clients), i = 0; client; client = (moauthd_client_t *)cupsArrayGetNext(server->clients))
+    {
+      if (client->busy)
+        continue;
+
+      pfds[npfds].fd      = httpGetFd(client->http);
+      pfds[npfds].events  = POLLIN;
+      pfds[npfds].revents = 0;
+      pclients[i ++]      = client;
+      npfds ++;
+    }
+
+    cupsMutexUnlock(&server->clients_lock);
+
+    if (poll(pfds, (nfds_t)npfds, 1000) < 0)
     {
       if (errno != EAGAIN && errno != EINTR)
       {
@@ -532,37 +915,80 @@ moauthdRunServer(
     }
     else
     {
-      int		i;		// Looping var
-      struct pollfd	*lis;		// Current listener
+      if (pfds[0].revents & POLLIN)
+      {
+        // Drain wakeup data from workers...
+        while (read(server->wake_pipe[0], wake, sizeof(wake)) > 0);
+      }
 
-      for (i = server->num_listeners, lis = server->listeners; i > 0; i --, lis ++)
+      for (i = 0, pfd = pfds + 1; i < server->num_listeners; i ++, pfd ++)
       {
-        if (lis->revents & POLLIN)
-	{
-	  moauthd_client_t *client = moauthdCreateClient(server, lis->fd);
-					// New client
-
-          if (client)
-          {
-            cups_thread_t tid;		// New processing thread
-
-            if ((tid = cupsThreadCreate((void *(*)(void *))moauthdRunClient, client)) == CUPS_THREAD_INVALID)
-            {
-              // Unable to create client thread...
-              moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to create client processing thread: %s", strerror(errno));
-              moauthdDeleteClient(client);
-	    }
-	    else
-	    {
-	      // Client thread created, detach!
-	      cupsThreadDetach(tid);
-	    }
-          }
-	}
+        if (pfd->revents & POLLIN)
+          accept_client(server, pfd->fd);
+      }
+
+      for (i = 0; pfd < (pfds + npfds); i ++, pfd ++)
+      {
+        if (pfd->revents)
+          queue_client(server, pclients[i]);
+      }
+    }
+#endif // HAVE_SYS_EPOLL_H
+
+    // Close idle keep-alive connections and shut down connections that are
+    // too slow sending a request...
+    if ((curtime = time(NULL)) >= next_sweep)
+    {
+      cups_array_t *idle = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
+					// Idle clients
+      time_t	deadline;		// Request deadline
+
+      cupsMutexLock(&server->clients_lock);
+
+      for (client = (moauthd_client_t *)cupsArrayGetFirst(server->clients); client; client = (moauthd_client_t *)cupsArrayGetNext(server->clients))
+      {
+        if (!client->busy && (curtime - client->activity) >= MOAUTHD_IDLE_TIMEOUT)
+        {
+          cupsArrayAdd(idle, client);
+        }
+        else if (client->busy && (deadline = client->deadline) != 0 && curtime >= deadline)
+        {
+          // The worker owns the connection, so just make its reads fail...
+          moauthdLogc(client, MOAUTHD_LOGLEVEL_INFO, "Timed out reading request.");
+          shutdown(httpGetFd(client->http), SHUT_RDWR);
+          client->deadline = 0;
+        }
+      }
+
+      for (client = (moauthd_client_t *)cupsArrayGetFirst(idle); client; client = (moauthd_client_t *)cupsArrayGetNext(idle))
+        cupsArrayRemove(server->clients, client);
+
+      cupsMutexUnlock(&server->clients_lock);
+
+      for (client = (moauthd_client_t *)cupsArrayGetFirst(idle); client; client = (moauthd_client_t *)cupsArrayGetNext(idle))
+      {
+        moauthdLogc(client, MOAUTHD_LOGLEVEL_INFO, "Closing idle connection.");
+        moauthdDeleteClient(client);
       }
+
+      cupsArrayDelete(idle);
+
+#ifndef HAVE_SYS_EPOLL_H
+      // Check for changes to cached files...
+      moauthdUpdateResources(server);
+#endif // !HAVE_SYS_EPOLL_H
+
+      next_sweep = curtime + 1;
     }
   }
 
+#ifndef HAVE_SYS_EPOLL_H
+  free(pfds);
+  free(pclients);
+#endif // !HAVE_SYS_EPOLL_H
+
+  moauthdStopLog(server);
+
   return (0);
 }
 
@@ -570,24 +996,27 @@ moauthdRunServer(
 //
 // 'moauthdSaveServer()' - Save the server state.
 //
+// The new state is written to "STATEFILE.N", synced, and renamed over the
+// state file, so a crash leaves either the old or the new state.  The
+// directory is synced after the token snapshot is saved, so when this
+// function returns `true` the caller can safely remove the old journal.
+//
 
 bool					// O - `true` on success, `false` on error
 moauthdSaveServer(
     moauthd_server_t *server)		// I - Server
 {
   cups_file_t	*fp;			// State file
-  char		oldfile[1024],		// Old state file
-		newfile[1024],		// New state file
+  char		newfile[1024],		// New state file
 		*temp;			// Temporary string
 
 
-  // Write the new state then rename the old...
-  snprintf(oldfile, sizeof(oldfile), "%s.O", server->state_file);
+  // Write the new state...
   snprintf(newfile, sizeof(newfile), "%s.N", server->state_file);
 
   if ((fp = cupsFileOpen(newfile, "w")) == NULL)
   {
-    fprintf(stderr, "moauthd: Unable to write state file \"%s\": %s\n", newfile, strerror(errno));
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to write state file \"%s\": %s", newfile, strerror(errno));
     return (false);
   }
 
@@ -601,23 +1030,85 @@ moauthdSaveServer(
     free(temp);
   }
 
-  // Close file and rename...
-  cupsFileClose(fp);
-  if (rename(server->state_file, oldfile) && errno != ENOENT)
+  moauthdWriteState(server, fp);
+
+  // Make sure the new state is on disk before replacing the old state...
+  if (!cupsFileFlush(fp) || fsync(cupsFileNumber(fp)))
   {
-    // Can't rename old state, try removing...
-    fprintf(stderr, "moauthd: Unable to rename state file \"%s\": %s\n", server->state_file, strerror(errno));
-    if (unlink(server->state_file))
-      return (false);
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to write state file \"%s\": %s", newfile, strerror(errno));
+    cupsFileClose(fp);
+    unlink(newfile);
+    return (false);
+  }
+
+  if (!cupsFileClose(fp))
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to write state file \"%s\": %s", newfile, strerror(errno));
+    unlink(newfile);
+    return (false);
   }
 
   if (rename(newfile, server->state_file))
   {
-    fprintf(stderr, "moauthd: Unable to rename state file \"%s\": %s\n", newfile, strerror(errno));
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to rename state file \"%s\": %s", newfile, strerror(errno));
+    unlink(newfile);
     return (false);
   }
 
-  return (true);
+  // Save tokens and then sync the renames...
+  return (moauthdSaveSnapshot(server) && sync_directory(server, server->state_file));
+}
+
+
+//
+// 'accept_client()' - Accept a new client connection.
+//
+
+static void
+accept_client(moauthd_server_t *server,	// I - Server
+              int              fd)	// I - Listener socket
+{
+  moauthd_client_t	*client;	// New client
+  bool			full;		// At the client limit?
+
+
+  if ((client = moauthdCreateClient(server, fd)) == NULL)
+    return;
+
+  cupsMutexLock(&server->clients_lock);
+
+  if ((full = cupsArrayGetCount(server->clients) >= (size_t)server->max_clients) == false)
+    cupsArrayAdd(server->clients, client);
+
+  cupsMutexUnlock(&server->clients_lock);
+
+  if (full)
+  {
+    moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Too many clients (MaxClients %d), closing connection.", server->max_clients);
+    moauthdDeleteClient(client);
+  }
+  else
+  {
+    // Wait for the TLS handshake in the event loop so that connections that
+    // send nothing don't tie up a worker...
+    park_client(server, client);
+  }
+}
+
+
+//
+// 'close_client()' - Remove a client from the server and close the connection.
+//
+
+static void
+close_client(moauthd_server_t *server,	// I - Server
+             moauthd_client_t *client)	// I - Client
+{
+  cupsMutexLock(&server->clients_lock);
+  cupsArrayRemove(server->clients, client);
+  cupsMutexUnlock(&server->clients_lock);
+
+  moauthdDeleteClient(client);
 }
 
 
@@ -708,6 +1199,27 @@ get_seconds(const char *value)		// I - Value string
 }
 
 
+//
+// 'get_signing_alg()' - Get the index of the server's signing algorithm.
+//
+
+static size_t				// O - Index in `signing_algs` table
+get_signing_alg(
+    moauthd_server_t *server)		// I - Server
+{
+  size_t	i;			// Looping var
+
+
+  for (i = 0; i < (sizeof(signing_algs) / sizeof(signing_algs[0])); i ++)
+  {
+    if (signing_algs[i].alg == server->signing_alg)
+      return (i);
+  }
+
+  return (0);
+}
+
+
 //
 // 'load_config()' - Load the server configuration.
 //
@@ -728,7 +1240,24 @@ load_config(
   // Load configuration from file...
   while (cupsFileGetConf(fp, line, sizeof(line), &value, &linenum))
   {
-    if (!strcasecmp(line, "Application"))
+    if (!strcasecmp(line, "AccessLog"))
+    {
+      // AccessLog {filename,none,stderr}
+      if (!value || !strcmp(value, "none"))
+      {
+	server->access_log = -1;
+      }
+      else if (!strcasecmp(value, "stderr"))
+      {
+	server->access_log = 2;
+      }
+      else if ((server->access_log = open(value, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600)) < 0)
+      {
+	fprintf(stderr, "moauthd: Unable to open access log file \"%s\" on line %d of \"%s\": %s\n", value, linenum, configfile, strerror(errno));
+	return (false);
+      }
+    }
+    else if (!strcasecmp(line, "Application"))
     {
       // Application client-id redirect-uri client-name
       const char	*client_id,	// Client ID
@@ -763,6 +1292,64 @@ load_config(
 
       moauthdAddApplication(server, client_id, redirect_uri, client_name, NULL, NULL, NULL);
     }
+    else if (!strcasecmp(line, "AuthCacheLife"))
+    {
+      // AuthCacheLife NNN{m,h,d,w}
+      int	auth_cache_life;	// Authentication cache life value
+
+      if (!value)
+      {
+	fprintf(stderr, "moauthd: Missing time value on line %d of \"%s\".\n", linenum, configfile);
+	return (false);
+      }
+
+      if ((auth_cache_life = get_seconds(value)) < 0)
+      {
+	fprintf(stderr, "moauthd: Unknown time value \"%s\" on line %d of \"%s\".\n", value, linenum, configfile);
+	return (false);
+      }
+
+      server->auth_cache_life = auth_cache_life;
+    }
+    else if (!strcasecmp(line, "AuthCacheSize"))
+    {
+      // AuthCacheSize NNN
+      int	auth_cache_size;	// Authentication cache size
+
+      if (!value || (auth_cache_size = atoi(value)) < 0)
+      {
+	fprintf(stderr, "moauthd: Bad AuthCacheSize value on line %d of \"%s\".\n", linenum, configfile);
+	return (false);
+      }
+
+      server->auth_cache_size = (size_t)auth_cache_size;
+    }
+    else if (!strcasecmp(line, "AuthQueueSize"))
+    {
+      // AuthQueueSize NNN
+      int	auth_queue_size;	// Maximum pending authentications
+
+      if (!value || (auth_queue_size = atoi(value)) < 1)
+      {
+	fprintf(stderr, "moauthd: Bad AuthQueueSize value on line %d of \"%s\".\n", linenum, configfile);
+	return (false);
+      }
+
+      server->auth_queue_size = auth_queue_size;
+    }
+    else if (!strcasecmp(line, "AuthThreads"))
+    {
+      // AuthThreads NNN
+      int	auth_threads;		// Number of authentication threads
+
+      if (!value || (auth_threads = atoi(value)) < 1)
+      {
+	fprintf(stderr, "moauthd: Bad AuthThreads value on line %d of \"%s\".\n", linenum, configfile);
+	return (false);
+      }
+
+      server->auth_threads = auth_threads;
+    }
     else if (!strcasecmp(line, "LogFile"))
     {
       // LogFile {filename,none,stderr,syslog}
@@ -804,6 +1391,32 @@ load_config(
 	fprintf(stderr, "moauthd: Unknown LogLevel \"%s\" on line %d of \"%s\" ignored.\n", value, linenum, configfile);
       }
     }
+    else if (!strcasecmp(line, "FileCacheSize"))
+    {
+      // FileCacheSize NNN
+      long	file_cache_size;	// File cache size
+
+      if (!value || (file_cache_size = strtol(value, NULL, 10)) < 0)
+      {
+	fprintf(stderr, "moauthd: Bad FileCacheSize value on line %d of \"%s\".\n", linenum, configfile);
+	return (false);
+      }
+
+      server->file_cache_size = (size_t)file_cache_size;
+    }
+    else if (!strcasecmp(line, "MarkdownCacheSize"))
+    {
+      // MarkdownCacheSize NNN
+      long	page_cache_size;	// Markdown cache size
+
+      if (!value || (page_cache_size = strtol(value, NULL, 10)) < 0)
+      {
+	fprintf(stderr, "moauthd: Bad MarkdownCacheSize value on line %d of \"%s\".\n", linenum, configfile);
+	return (false);
+      }
+
+      server->page_cache_size = (size_t)page_cache_size;
+    }
     else if (!strcasecmp(line, "IntrospectGroup"))
     {
       // IntrospectGroup nnn
@@ -836,6 +1449,38 @@ load_config(
 	return (false);
       }
     }
+    else if (!strcasecmp(line, "MetricsGroup"))
+    {
+      // MetricsGroup nnn
+      // MetricsGroup name
+      //
+      // Required group membership (and thus required authentication for)
+      // the "/metrics" resource.
+      if (!value)
+      {
+	fprintf(stderr, "moauthd: Missing MetricsGroup on line %d of \"%s\".\n", linenum, configfile);
+	return (false);
+      }
+      else if (isdigit(*value))
+      {
+	server->metrics_group = (gid_t)strtol(value, &ptr, 10);
+
+	if (ptr && *ptr)
+	{
+	  fprintf(stderr, "moauthd: Bad MetricsGroup \"%s\" on line %d of \"%s\".\n", value, linenum, configfile);
+	  return (false);
+	}
+      }
+      else if ((group = getgrnam(value)) != NULL)
+      {
+	server->metrics_group = group->gr_gid;
+      }
+      else
+      {
+	fprintf(stderr, "moauthd: Unknown MetricsGroup \"%s\" on line %d of \"%s\".\n", value, linenum, configfile);
+	return (false);
+      }
+    }
     else if (!strcasecmp(line, "RegisterGroup"))
     {
       // RegisterGroup nnn
@@ -912,9 +1557,35 @@ load_config(
 
       server->max_token_life = max_token_life;
     }
+    else if (!strcasecmp(line, "MaxClients"))
+    {
+      // MaxClients NNN
+      int	max_clients;		// Maximum number of clients
+
+      if (!value || (max_clients = atoi(value)) < 1)
+      {
+	fprintf(stderr, "moauthd: Bad MaxClients value on line %d of \"%s\".\n", linenum, configfile);
+	return (false);
+      }
+
+      server->max_clients = max_clients;
+    }
+    else if (!strcasecmp(line, "WorkerThreads"))
+    {
+      // WorkerThreads NNN
+      int	num_workers;		// Number of worker threads
+
+      if (!value || (num_workers = atoi(value)) < 1)
+      {
+	fprintf(stderr, "moauthd: Bad WorkerThreads value on line %d of \"%s\".\n", linenum, configfile);
+	return (false);
+      }
+
+      server->num_workers = num_workers;
+    }
     else if (!strcasecmp(line, "Option"))
     {
-      // Option {[-]BasicAuth}
+      // Option {BasicAuth,StatelessTokens}
       if (!value)
       {
 	fprintf(stderr, "moauthd: Bad Option on line %d of \"%s\".\n", linenum, configfile);
@@ -923,12 +1594,14 @@ load_config(
 
       if (!strcasecmp(value, "BasicAuth"))
 	server->options |= MOAUTHD_OPTION_BASIC_AUTH;
+      else if (!strcasecmp(value, "StatelessTokens"))
+	server->options |= MOAUTHD_OPTION_STATELESS_TOKENS;
       else
 	fprintf(stderr, "moauthd: Unknown Option %s on line %d of \"%s\".\n", value, linenum, configfile);
     }
-    else if (!strcasecmp(line, "Resource"))
+    else if (!strcasecmp(line, "Resource") || !strcasecmp(line, "CachedResource"))
     {
-      // Resource {public,private,shared} /remote/path /local/path
+      // [Cached]Resource {public,private,shared} /remote/path /local/path
       char		*scope,		// Access scope
 			*remote_path,	// Remote path
 			*local_path;	// Local path
@@ -936,7 +1609,7 @@ load_config(
 
       if (!value)
       {
-	fprintf(stderr, "moauthd: Bad Resource on line %d of \"%s\".\n", linenum, configfile);
+	fprintf(stderr, "moauthd: Bad %s on line %d of \"%s\".\n", line, linenum, configfile);
 	return (false);
       }
 
@@ -946,17 +1619,32 @@ load_config(
 
       if (!scope || !remote_path || !local_path)
       {
-	fprintf(stderr, "moauthd: Bad Resource on line %d of \"%s\".\n", linenum, configfile);
+	fprintf(stderr, "moauthd: Bad %s on line %d of \"%s\".\n", line, linenum, configfile);
 	return (false);
       }
 
       if (stat(local_path, &local_info))
       {
-	fprintf(stderr, "moauthd: Unable to access Resource on line %d of \"%s\": %s\n", linenum, configfile, strerror(errno));
+	fprintf(stderr, "moauthd: Unable to access %s on line %d of \"%s\": %s\n", line, linenum, configfile, strerror(errno));
+	return (false);
+      }
+
+      if (!strcasecmp(line, "CachedResource") && !S_ISREG(local_info.st_mode))
+      {
+	fprintf(stderr, "moauthd: CachedResource on line %d of \"%s\" is not a file.\n", linenum, configfile);
+	return (false);
+      }
+
+      if (moauthdAddScope(server, scope) < 0)
+      {
+	fprintf(stderr, "moauthd: Unable to add %s scope on line %d of \"%s\": %s\n", line, linenum, configfile, strerror(errno));
 	return (false);
       }
 
-      moauthdCreateResource(server, S_ISREG(local_info.st_mode) ? MOAUTHD_RESTYPE_FILE : MOAUTHD_RESTYPE_DIR, remote_path, local_path, NULL, scope);
+      if (!strcasecmp(line, "CachedResource"))
+        moauthdCreateResource(server, MOAUTHD_RESTYPE_CACHED_FILE, remote_path, local_path, NULL, scope);
+      else
+        moauthdCreateResource(server, S_ISREG(local_info.st_mode) ? MOAUTHD_RESTYPE_FILE : MOAUTHD_RESTYPE_DIR, remote_path, local_path, NULL, scope);
     }
     else if (!strcasecmp(line, "ServerName"))
     {
@@ -982,6 +1670,25 @@ load_config(
         return (false);
       }
     }
+    else if (!strcasecmp(line, "SigningAlgorithm"))
+    {
+      // SigningAlgorithm {RS256,RS384,RS512,ES256,ES384,ES512}
+      size_t	i;			// Looping var
+
+      for (i = 0; value && i < (sizeof(signing_algs) / sizeof(signing_algs[0])); i ++)
+      {
+        if (!strcasecmp(value, signing_algs[i].name))
+          break;
+      }
+
+      if (!value || i >= (sizeof(signing_algs) / sizeof(signing_algs[0])))
+      {
+	fprintf(stderr, "moauthd: Bad SigningAlgorithm value on line %d of \"%s\".\n", linenum, configfile);
+	return (false);
+      }
+
+      server->signing_alg = signing_algs[i].alg;
+    }
     else if (!strcasecmp(line, "TestPassword"))
     {
       if (value)
@@ -994,12 +1701,62 @@ load_config(
 	return (false);
       }
     }
+    else if (!strcasecmp(line, "UserCacheLife"))
+    {
+      // UserCacheLife NNN{m,h,d,w}
+      int	user_cache_life;	// User cache life value
+
+      if (!value)
+      {
+	fprintf(stderr, "moauthd: Missing time value on line %d of \"%s\".\n", linenum, configfile);
+	return (false);
+      }
+
+      if ((user_cache_life = get_seconds(value)) < 0)
+      {
+	fprintf(stderr, "moauthd: Unknown time value \"%s\" on line %d of \"%s\".\n", value, linenum, configfile);
+	return (false);
+      }
+
+      server->user_cache_life = user_cache_life;
+    }
+    else if (!strcasecmp(line, "UserCacheSize"))
+    {
+      // UserCacheSize NNN
+      int	user_cache_size;	// User cache size
+
+      if (!value || (user_cache_size = atoi(value)) < 0)
+      {
+	fprintf(stderr, "moauthd: Bad UserCacheSize value on line %d of \"%s\".\n", linenum, configfile);
+	return (false);
+      }
+
+      server->user_cache_size = (size_t)user_cache_size;
+    }
     else
     {
       fprintf(stderr, "moauthd: Unknown configuration directive \"%s\" on line %d of \"%s\" ignored.\n", line, linenum, configfile);
     }
   }
 
+  // Make sure slow PAM authentications cannot tie up every worker thread...
+  if ((server->auth_threads + server->auth_queue_size) >= server->num_workers)
+  {
+    if (server->num_workers < 3)
+    {
+      fprintf(stderr, "moauthd: WorkerThreads %d in \"%s\" is too small to limit PAM authentications.\n", server->num_workers, configfile);
+    }
+    else
+    {
+      if (server->auth_threads > (server->num_workers - 2))
+        server->auth_threads = server->num_workers - 2;
+
+      server->auth_queue_size = server->num_workers - server->auth_threads - 1;
+
+      fprintf(stderr, "moauthd: AuthThreads plus AuthQueueSize must be less than WorkerThreads %d in \"%s\", using AuthThreads %d and AuthQueueSize %d.\n", server->num_workers, configfile, server->auth_threads, server->auth_queue_size);
+    }
+  }
+
   return (true);
 }
 
@@ -1015,7 +1772,13 @@ load_state(moauthd_server_t *server)	// I - Server
   char		line[16384],		// Line from config/state file
 		*value;			// Value from config/state file
   int		linenum;		// Current line number
+  size_t	alg;			// Index of signing algorithm
+  const char	*kty,			// Key type
+		*crv;			// Curve, if any
+  bool		new_key = false;	// Generated a new private key?
+
 
+  alg = get_signing_alg(server);
 
   if ((fp = cupsFileOpen(server->state_file, "r")) == NULL)
   {
@@ -1027,8 +1790,8 @@ load_state(moauthd_server_t *server)	// I - Server
     }
 
     // No file means we need to generate the private key...
-    server->private_key = cupsJWTMakePrivateKey(CUPS_JWA_RS256);
-    return (server->private_key != NULL && moauthdSaveServer(server));
+    server->private_key = cupsJWTMakePrivateKey(server->signing_alg);
+    return (server->private_key != NULL && moauthdLoadSnapshot(server) && moauthdSaveServer(server) && moauthdLoadJournal(server));
   }
 
   // Read lines from the state file...
@@ -1036,11 +1799,204 @@ load_state(moauthd_server_t *server)	// I - Server
   {
     if (!strcmp(line, "PrivateKey") && value)
       server->private_key = cupsJSONImportString(value);
-    else
+    else if (!moauthdReplayState(server, line, value))
       fprintf(stderr, "moauthd: Unknown state directive \"%s\" on line %d of \"%s\".\n", line, linenum, server->state_file);
   }
 
   cupsFileClose(fp);
 
-  return (server->private_key != NULL);
+  // Make sure the private key can be used with the signing algorithm...
+  kty = cupsJSONGetString(cupsJSONFind(server->private_key, "kty"));
+  crv = cupsJSONGetString(cupsJSONFind(server->private_key, "crv"));
+
+  if (!kty || strcmp(kty, signing_algs[alg].kty) || (signing_algs[alg].crv && (!crv || strcmp(crv, signing_algs[alg].crv))))
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_INFO, "Generating new %s private key.", signing_algs[alg].name);
+
+    cupsJSONDelete(server->private_key);
+    server->private_key = cupsJWTMakePrivateKey(server->signing_alg);
+    new_key             = true;
+  }
+
+  // Then map saved tokens and apply any changes from the journal...
+  return (server->private_key != NULL && moauthdLoadSnapshot(server) && (!new_key || moauthdSaveServer(server)) && moauthdLoadJournal(server));
+}
+
+
+//
+// 'park_client()' - Return a client to the event loop to wait for its next request.
+//
+
+static void
+park_client(moauthd_server_t *server,	// I - Server
+            moauthd_client_t *client)	// I - Client
+{
+#ifdef HAVE_SYS_EPOLL_H
+  struct epoll_event event;		// Client event
+  int		status;			// epoll_ctl status
+
+
+  cupsMutexLock(&server->clients_lock);
+
+  client->busy     = false;
+  client->activity = time(NULL);
+
+  // Use one-shot events so that only one worker processes the client at a time...
+  event.events   = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+  event.data.ptr = client;
+
+  if ((status = epoll_ctl(server->event_fd, client->polled ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, httpGetFd(client->http), &event)) == 0)
+    client->polled = true;
+  else
+    client->busy = true;
+
+  cupsMutexUnlock(&server->clients_lock);
+
+  if (status)
+  {
+    moauthdLogc(client, MOAUTHD_LOGLEVEL_ERROR, "Unable to add connection to epoll instance: %s", strerror(errno));
+    close_client(server, client);
+  }
+
+#else
+  cupsMutexLock(&server->clients_lock);
+
+  client->busy     = false;
+  client->activity = time(NULL);
+
+  cupsMutexUnlock(&server->clients_lock);
+
+  // Wake up the event loop so it polls the client...
+  if (write(server->wake_pipe[1], "", 1) < 0 && errno != EAGAIN)
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to wake up event loop: %s", strerror(errno));
+#endif // HAVE_SYS_EPOLL_H
+}
+
+
+//
+// 'queue_client()' - Queue a client for processing by a worker thread.
+//
+
+static void
+queue_client(moauthd_server_t *server,	// I - Server
+             moauthd_client_t *client)	// I - Client
+{
+  cupsMutexLock(&server->clients_lock);
+
+  // The queue holds up to MaxClients entries and a client is only queued while
+  // it isn't busy, so the queue cannot overflow...
+  client->busy = true;
+  server->queue[(server->queue_start + server->queue_count) % (size_t)server->max_clients] = client;
+  server->queue_count ++;
+
+  cupsCondBroadcast(&server->clients_cond);
+  cupsMutexUnlock(&server->clients_lock);
+}
+
+
+//
+// 'run_reaper()' - Periodically remove expired tokens.
+//
+
+static void *				// O - Thread exit status
+run_reaper(moauthd_server_t *server)	// I - Server
+{
+  size_t		count;		// Number of tokens reaped
+  moauthd_tokstats_t	stats;		// Token statistics
+
+
+  for (;;)
+  {
+    sleep(MOAUTHD_REAP_INTERVAL);
+
+    if ((count = moauthdReapTokens(server, time(NULL))) > 0)
+    {
+      moauthdGetTokenStats(server, &stats);
+      moauthdLogs(server, MOAUTHD_LOGLEVEL_INFO, "Reaped %u expired tokens, %u access, %u grant, and %u renewal tokens remain.", (unsigned)count, (unsigned)stats.num_live[MOAUTHD_TOKTYPE_ACCESS], (unsigned)stats.num_live[MOAUTHD_TOKTYPE_GRANT], (unsigned)stats.num_live[MOAUTHD_TOKTYPE_RENEWAL]);
+    }
+
+    if ((server->options & MOAUTHD_OPTION_STATELESS_TOKENS) && server->log_level >= MOAUTHD_LOGLEVEL_DEBUG)
+    {
+      moauthdGetTokenStats(server, &stats);
+      moauthdLogs(server, MOAUTHD_LOGLEVEL_DEBUG, "Verified token cache: %u hits, %u misses.", (unsigned)stats.verify_hits, (unsigned)stats.verify_misses);
+    }
+  }
+
+  return (NULL);
+}
+
+
+//
+// 'run_worker()' - Process queued client requests.
+//
+
+static void *				// O - Thread exit status
+run_worker(moauthd_server_t *server)	// I - Server
+{
+  moauthd_client_t	*client;	// Current client
+
+
+  for (;;)
+  {
+    // Wait for a client...
+    cupsMutexLock(&server->clients_lock);
+
+    while (server->queue_count == 0)
+      cupsCondWait(&server->clients_cond, &server->clients_lock, 0.0);
+
+    client = server->queue[server->queue_start];
+    server->queue_start = (server->queue_start + 1) % (size_t)server->max_clients;
+    server->queue_count --;
+
+    cupsMutexUnlock(&server->clients_lock);
+
+    // Process requests until the client is idle or closed...
+    if (moauthdRunClient(client))
+      park_client(server, client);
+    else
+      close_client(server, client);
+  }
+
+  return (NULL);
+}
+
+
+//
+// 'sync_directory()' - Sync the directory containing a file.
+//
+// This makes renames and new files in the directory durable.
+//
+
+static bool				// O - `true` on success, `false` on error
+sync_directory(
+    moauthd_server_t *server,		// I - Server
+    const char       *filename)		// I - File in directory
+{
+  char		dirname[1024],		// Directory name
+		*ptr;			// Pointer into directory name
+  int		fd;			// Directory file descriptor
+  bool		ret;			// Return value
+
+
+  cupsCopyString(dirname, filename, sizeof(dirname));
+
+  if ((ptr = strrchr(dirname, '/')) == NULL)
+    cupsCopyString(dirname, ".", sizeof(dirname));
+  else if (ptr == dirname)
+    ptr[1] = '\0';
+  else
+    *ptr = '\0';
+
+  if ((fd = open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to open directory \"%s\": %s", dirname, strerror(errno));
+    return (false);
+  }
+
+  if ((ret = !fsync(fd)) == false)
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to sync directory \"%s\": %s", dirname, strerror(errno));
+
+  close(fd);
+
+  return (ret);
 }
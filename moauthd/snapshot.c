@@ -0,0 +1,641 @@
+//
+// Binary token snapshot for moauth daemon
+//
+// Copyright © 2017-2026 by Michael R Sweet
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Tokens are saved in a binary snapshot file ("STATEFILE.tokens") that is
+// memory-mapped at startup and used in place as the initial token index, so
+// startup time does not depend on the number of saved tokens.  The file
+// contains a header, an array of fixed-size token records sorted by hash, and
+// a pool of nul-terminated strings.  The header and records are covered by a
+// checksum; string offsets are bounds-checked when a record is used.
+//
+// Token objects are only created ("materialized") for snapshot records when
+// they are first looked up.  A per-record flag tracks records that have been
+// materialized or replaced so that they are never used twice.
+//
+
+#include "moauthd.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+
+//
+// Constants...
+//
+
+#define MOAUTHD_SNAPSHOT_MAGIC	"MOAUTHD\n"
+#define MOAUTHD_SNAPSHOT_VERSION 1
+#define MOAUTHD_SNAPSHOT_BOM	0x01020304
+
+
+//
+// Types...
+//
+
+typedef struct moauthd_snaphdr_s	// Snapshot file header
+{
+  char		magic[8];		// "MOAUTHD\n"
+  uint32_t	version,		// File format version
+		byte_order;		// Byte order mark
+  uint64_t	num_records,		// Number of token records
+		strings_length,		// Length of string pool
+		checksum;		// Checksum of header and records
+} moauthd_snaphdr_t;
+
+typedef struct moauthd_snaprec_s	// Snapshot token record
+{
+  uint64_t	hash;			// Hash of token string
+  int64_t	created,		// When the token was created
+		expires;		// When the token expires
+  uint32_t	token,			// Offset of token string
+		user,			// Offset of user name
+		scopes,			// Offset of scopes
+		challenge,		// Offset of challenge or 0 for none
+		client_id;		// Offset of client ID or 0 for none
+  int32_t	uid,			// Authenticated UID
+		gid;			// Primary group ID
+  uint32_t	type;			// Token type
+} moauthd_snaprec_t;
+
+struct moauthd_snapshot_s		// Memory-mapped token snapshot
+{
+  void			*data;		// Mapped file
+  size_t		length;		// Length of mapped file
+  const moauthd_snaprec_t *records;	// Token records
+  size_t		num_records;	// Number of token records
+  const char		*strings;	// String pool
+  size_t		strings_length;	// Length of string pool
+  unsigned char		*consumed;	// Records that have been materialized or replaced
+};
+
+typedef struct moauthd_snapent_s	// Token being saved
+{
+  uint64_t		hash;		// Hash of token string
+  moauthd_token_t	*token;		// Live token or `NULL`
+  size_t		record;		// Snapshot record if no live token
+} moauthd_snapent_t;
+
+
+//
+// Local functions...
+//
+
+static uint64_t	checksum_data(uint64_t checksum, const void *data, size_t length);
+static int	compare_entries(const moauthd_snapent_t *a, const moauthd_snapent_t *b);
+static ssize_t	find_record(moauthd_snapshot_t *snapshot, uint64_t hash, const char *token_id);
+static const char *get_string(moauthd_snapshot_t *snapshot, uint32_t offset);
+
+
+//
+// 'moauthdCloseSnapshot()' - Unmap the token snapshot.
+//
+
+void
+moauthdCloseSnapshot(
+    moauthd_server_t *server)		// I - Server object
+{
+  moauthd_snapshot_t	*snapshot = server->snapshot;
+					// Token snapshot
+
+
+  if (!snapshot)
+    return;
+
+  munmap(snapshot->data, snapshot->length);
+  free(snapshot->consumed);
+  free(snapshot);
+
+  server->snapshot = NULL;
+}
+
+
+//
+// 'moauthdConsumeSnapshotToken()' - Mark a snapshot token as replaced.
+//
+// The caller must hold the write lock of the shard for the token hash.
+//
+
+bool					// O - `true` if the token was in the snapshot, `false` otherwise
+moauthdConsumeSnapshotToken(
+    moauthd_server_t *server,		// I - Server object
+    uint64_t         hash,		// I - Hash of token string
+    const char       *token_id)		// I - Token string
+{
+  ssize_t	record;			// Record number
+
+
+  if (!server->snapshot || (record = find_record(server->snapshot, hash, token_id)) < 0)
+    return (false);
+
+  server->snapshot->consumed[record] = 1;
+
+  return (true);
+}
+
+
+//
+// 'moauthdCopySnapshotToken()' - Materialize a token from the snapshot.
+//
+// The caller must hold the write lock of the shard for the token hash and
+// add the returned token to the shard.
+//
+
+moauthd_token_t *			// O - New token or `NULL` if not found
+moauthdCopySnapshotToken(
+    moauthd_server_t *server,		// I - Server object
+    uint64_t         hash,		// I - Hash of token string
+    const char       *token_id)		// I - Token string
+{
+  moauthd_snapshot_t	*snapshot = server->snapshot;
+					// Token snapshot
+  ssize_t		record;		// Record number
+  const moauthd_snaprec_t *rec;		// Token record
+  const char		*user,		// User name
+			*scopes,	// Scopes
+			*challenge,	// Challenge, if any
+			*client_id;	// Client ID, if any
+  moauthd_application_t	*app = NULL;	// Application
+  moauthd_token_t	*token;		// New token
+
+
+  if (!snapshot || (record = find_record(snapshot, hash, token_id)) < 0)
+    return (NULL);
+
+  snapshot->consumed[record] = 1;
+
+  rec       = snapshot->records + record;
+  user      = get_string(snapshot, rec->user);
+  scopes    = get_string(snapshot, rec->scopes);
+  challenge = rec->challenge ? get_string(snapshot, rec->challenge) : NULL;
+  client_id = rec->client_id ? get_string(snapshot, rec->client_id) : NULL;
+
+  if (!user || !scopes || rec->type >= MOAUTHD_TOKTYPE_MAX || (client_id && (app = moauthdFindApplication(server, client_id, NULL)) == NULL))
+  {
+    // Bad or orphaned token...
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_DEBUG, "Ignoring bad snapshot token record %u.", (unsigned)record);
+    return (NULL);
+  }
+
+  if ((token = (moauthd_token_t *)calloc(1, sizeof(moauthd_token_t))) == NULL)
+    return (NULL);
+
+  token->type         = (moauthd_toktype_t)rec->type;
+  token->token        = strdup(token_id);
+  token->challenge    = challenge ? strdup(challenge) : NULL;
+  token->user         = strdup(user);
+  token->application  = app;
+  token->scopes       = strdup(scopes);
+  token->scope_bits   = moauthdGetScopes(server, scopes);
+  token->uid          = (uid_t)rec->uid;
+  token->gid          = (gid_t)rec->gid;
+  token->created      = (time_t)rec->created;
+  token->expires      = (time_t)rec->expires;
+  token->hash         = hash;
+
+  return (token);
+}
+
+
+//
+// 'moauthdFindSnapshotToken()' - Check whether an unused token is in the snapshot.
+//
+// The caller must hold the read or write lock of the shard for the token hash.
+//
+
+bool					// O - `true` if found, `false` otherwise
+moauthdFindSnapshotToken(
+    moauthd_server_t *server,		// I - Server object
+    uint64_t         hash,		// I - Hash of token string
+    const char       *token_id)		// I - Token string
+{
+  return (server->snapshot && find_record(server->snapshot, hash, token_id) >= 0);
+}
+
+
+//
+// 'moauthdLoadSnapshot()' - Map the token snapshot.
+//
+// A missing snapshot is not an error.  A damaged snapshot is logged and
+// ignored so that the server can still start.
+//
+
+bool					// O - `true` on success, `false` on failure
+moauthdLoadSnapshot(
+    moauthd_server_t *server)		// I - Server object
+{
+  char			filename[1024];	// Snapshot filename
+  int			fd;		// Snapshot file
+  struct stat		fileinfo;	// Snapshot file information
+  void			*data;		// Mapped data
+  moauthd_snaphdr_t	hdr;		// Header
+  uint64_t		checksum;	// Checksum
+  moauthd_snapshot_t	*snapshot;	// Token snapshot
+
+
+  snprintf(filename, sizeof(filename), "%s.tokens", server->state_file);
+
+  if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0)
+  {
+    if (errno == ENOENT)
+      return (true);
+
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to open token snapshot \"%s\": %s", filename, strerror(errno));
+    return (false);
+  }
+
+  if (fstat(fd, &fileinfo) || fileinfo.st_size < (off_t)sizeof(moauthd_snaphdr_t))
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Ignoring short token snapshot \"%s\".", filename);
+    close(fd);
+    return (true);
+  }
+
+  data = mmap(NULL, (size_t)fileinfo.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (data == MAP_FAILED)
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to map token snapshot \"%s\": %s", filename, strerror(errno));
+    return (false);
+  }
+
+  // Validate the header and records...
+  memcpy(&hdr, data, sizeof(hdr));
+
+  if (memcmp(hdr.magic, MOAUTHD_SNAPSHOT_MAGIC, sizeof(hdr.magic)) || hdr.version != MOAUTHD_SNAPSHOT_VERSION || hdr.byte_order != MOAUTHD_SNAPSHOT_BOM || hdr.num_records > (((uint64_t)fileinfo.st_size - sizeof(hdr)) / sizeof(moauthd_snaprec_t)) || (sizeof(hdr) + hdr.num_records * sizeof(moauthd_snaprec_t) + hdr.strings_length) != (uint64_t)fileinfo.st_size)
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Ignoring bad token snapshot \"%s\".", filename);
+    munmap(data, (size_t)fileinfo.st_size);
+    return (true);
+  }
+
+  checksum = hdr.checksum;
+  hdr.checksum = 0;
+  if (checksum != checksum_data(checksum_data(0xcbf29ce484222325ULL, &hdr, sizeof(hdr)), (char *)data + sizeof(hdr), (size_t)hdr.num_records * sizeof(moauthd_snaprec_t)))
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Ignoring corrupt token snapshot \"%s\".", filename);
+    munmap(data, (size_t)fileinfo.st_size);
+    return (true);
+  }
+
+  if ((snapshot = calloc(1, sizeof(moauthd_snapshot_t))) == NULL || (snapshot->consumed = calloc((size_t)hdr.num_records + 1, 1)) == NULL)
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to allocate token snapshot: %s", strerror(errno));
+    free(snapshot);
+    munmap(data, (size_t)fileinfo.st_size);
+    return (false);
+  }
+
+  snapshot->data           = data;
+  snapshot->length         = (size_t)fileinfo.st_size;
+  snapshot->records        = (const moauthd_snaprec_t *)((char *)data + sizeof(hdr));
+  snapshot->num_records    = (size_t)hdr.num_records;
+  snapshot->strings        = (const char *)(snapshot->records + snapshot->num_records);
+  snapshot->strings_length = (size_t)hdr.strings_length;
+
+  server->snapshot = snapshot;
+
+  moauthdLogs(server, MOAUTHD_LOGLEVEL_INFO, "Mapped %u tokens from \"%s\".", (unsigned)snapshot->num_records, filename);
+
+  return (true);
+}
+
+
+//
+// 'moauthdSaveSnapshot()' - Save the token snapshot.
+//
+// Live tokens and unused snapshot records are written to a new file that
+// replaces the current snapshot.  The current mapping stays valid since the
+// old file is only unlinked.
+//
+
+bool					// O - `true` on success, `false` on failure
+moauthdSaveSnapshot(
+    moauthd_server_t *server)		// I - Server object
+{
+  char			filename[1024],	// Snapshot filename
+			newfile[1024];	// New snapshot filename
+  moauthd_snapshot_t	*snapshot = server->snapshot;
+					// Current token snapshot
+  moauthd_snapent_t	*entries = NULL,// Tokens to save
+			*entry;		// Current token
+  size_t		i,		// Looping var
+			num_entries = 0,// Number of tokens to save
+			alloc_entries = 0;
+					// Allocated entries
+  int			shardnum;	// Current shard
+  moauthd_tokshard_t	*shard;		// Current shard
+  moauthd_snaphdr_t	hdr;		// Header
+  moauthd_snaprec_t	*records = NULL,// Records
+			*rec;		// Current record
+  char			*strings = NULL;// String pool
+  size_t		strings_length = 1,
+					// Length of string pool
+			strings_alloc = 0;
+					// Allocated size of string pool
+  time_t		curtime = time(NULL);
+					// Current time
+  int			fd;		// Snapshot file
+  bool			ret = false;	// Return value
+
+
+  // Collect live tokens and unused snapshot records from each shard...
+  for (shardnum = 0, shard = server->tokens; shardnum < MOAUTHD_TOKEN_SHARDS; shardnum ++, shard ++)
+  {
+    cupsRWLockRead(&shard->lock);
+
+    if ((num_entries + shard->num_tokens + (snapshot ? snapshot->num_records : 0)) > alloc_entries)
+    {
+      size_t		temp_alloc = 2 * (num_entries + shard->num_tokens + (snapshot ? snapshot->num_records : 0)) + 16;
+      moauthd_snapent_t	*temp;		// New entries
+
+      if ((temp = realloc(entries, temp_alloc * sizeof(moauthd_snapent_t))) == NULL)
+      {
+        cupsRWUnlock(&shard->lock);
+        goto done;
+      }
+
+      entries       = temp;
+      alloc_entries = temp_alloc;
+    }
+
+    for (i = 0; i < shard->num_tokens; i ++)
+    {
+      moauthd_token_t *token = shard->heap[i];
+					// Current token
+
+      if (token->expires <= curtime)
+        continue;
+
+      atomic_fetch_add(&token->refcount, 1);
+
+      entry         = entries + num_entries ++;
+      entry->hash   = token->hash;
+      entry->token  = token;
+      entry->record = 0;
+    }
+
+    for (i = 0; snapshot && i < snapshot->num_records; i ++)
+    {
+      if ((snapshot->records[i].hash & (MOAUTHD_TOKEN_SHARDS - 1)) != (uint64_t)shardnum || snapshot->consumed[i] || snapshot->records[i].expires <= curtime)
+        continue;
+
+      entry         = entries + num_entries ++;
+      entry->hash   = snapshot->records[i].hash;
+      entry->token  = NULL;
+      entry->record = i;
+    }
+
+    cupsRWUnlock(&shard->lock);
+  }
+
+  if (num_entries > 1)
+    qsort(entries, num_entries, sizeof(moauthd_snapent_t), (int (*)(const void *, const void *))compare_entries);
+
+  // Build the records and string pool...
+  if (num_entries > 0 && (records = calloc(num_entries, sizeof(moauthd_snaprec_t))) == NULL)
+    goto done;
+
+  for (i = 0, entry = entries, rec = records; i < num_entries; i ++, entry ++, rec ++)
+  {
+    const char	*s[5];			// Strings for record
+    uint32_t	*offsets[5];		// Offsets for strings
+    int		j;			// Looping var
+
+    rec->hash = entry->hash;
+
+    if (entry->token)
+    {
+      moauthd_token_t *token = entry->token;
+					// Live token
+
+      rec->created = (int64_t)token->created;
+      rec->expires = (int64_t)token->expires;
+      rec->uid     = (int32_t)token->uid;
+      rec->gid     = (int32_t)token->gid;
+      rec->type    = (uint32_t)token->type;
+      s[0]         = token->token;
+      s[1]         = token->user;
+      s[2]         = token->scopes;
+      s[3]         = token->challenge;
+      s[4]         = token->application ? token->application->client_id : NULL;
+    }
+    else
+    {
+      const moauthd_snaprec_t *old = snapshot->records + entry->record;
+					// Snapshot record
+
+      rec->created = old->created;
+      rec->expires = old->expires;
+      rec->uid     = old->uid;
+      rec->gid     = old->gid;
+      rec->type    = old->type;
+      s[0]         = get_string(snapshot, old->token);
+      s[1]         = get_string(snapshot, old->user);
+      s[2]         = get_string(snapshot, old->scopes);
+      s[3]         = old->challenge ? get_string(snapshot, old->challenge) : NULL;
+      s[4]         = old->client_id ? get_string(snapshot, old->client_id) : NULL;
+    }
+
+    offsets[0] = &rec->token;
+    offsets[1] = &rec->user;
+    offsets[2] = &rec->scopes;
+    offsets[3] = &rec->challenge;
+    offsets[4] = &rec->client_id;
+
+    for (j = 0; j < 5; j ++)
+    {
+      size_t slen;			// Length of string
+
+      if (!s[j])
+      {
+        *offsets[j] = 0;
+        continue;
+      }
+
+      slen = strlen(s[j]) + 1;
+
+      if ((strings_length + slen) > strings_alloc)
+      {
+        size_t	temp_alloc = 2 * (strings_length + slen) + 65536;
+        char	*temp;			// New string pool
+
+        if (temp_alloc > UINT32_MAX || (temp = realloc(strings, temp_alloc)) == NULL)
+          goto done;
+
+        if (!strings)
+          temp[0] = '\0';		// Offset 0 is the empty string
+
+        strings       = temp;
+        strings_alloc = temp_alloc;
+      }
+
+      memcpy(strings + strings_length, s[j], slen);
+      *offsets[j]     = (uint32_t)strings_length;
+      strings_length += slen;
+    }
+  }
+
+  if (!strings && (strings = calloc(1, 1)) == NULL)
+    goto done;
+
+  // Write the new snapshot...
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, MOAUTHD_SNAPSHOT_MAGIC, sizeof(hdr.magic));
+  hdr.version        = MOAUTHD_SNAPSHOT_VERSION;
+  hdr.byte_order     = MOAUTHD_SNAPSHOT_BOM;
+  hdr.num_records    = num_entries;
+  hdr.strings_length = strings_length;
+  hdr.checksum       = checksum_data(checksum_data(0xcbf29ce484222325ULL, &hdr, sizeof(hdr)), records, num_entries * sizeof(moauthd_snaprec_t));
+
+  snprintf(filename, sizeof(filename), "%s.tokens", server->state_file);
+  snprintf(newfile, sizeof(newfile), "%s.N", filename);
+
+  if ((fd = open(newfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to create token snapshot \"%s\": %s", newfile, strerror(errno));
+    goto done;
+  }
+
+  if (write(fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr) || (num_entries > 0 && write(fd, records, num_entries * sizeof(moauthd_snaprec_t)) != (ssize_t)(num_entries * sizeof(moauthd_snaprec_t))) || write(fd, strings, strings_length) != (ssize_t)strings_length || fsync(fd))
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to write token snapshot \"%s\": %s", newfile, strerror(errno));
+    close(fd);
+    unlink(newfile);
+    goto done;
+  }
+
+  close(fd);
+
+  if (rename(newfile, filename))
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to rename token snapshot \"%s\": %s", newfile, strerror(errno));
+    unlink(newfile);
+    goto done;
+  }
+
+  ret = true;
+
+  // Clean up and return...
+  done:
+
+  for (i = 0; i < num_entries; i ++)
+    moauthdReleaseToken(entries[i].token);
+
+  free(entries);
+  free(records);
+  free(strings);
+
+  return (ret);
+}
+
+
+//
+// 'checksum_data()' - Add data to a checksum.
+//
+// The checksum is FNV-1a applied to 64-bit words rather than bytes, which is
+// eight times faster for the large record arrays in a snapshot.
+//
+
+static uint64_t				// O - New checksum
+checksum_data(uint64_t   checksum,	// I - Current checksum
+              const void *data,		// I - Data
+              size_t     length)	// I - Length of data
+{
+  const unsigned char	*ptr = (const unsigned char *)data;
+					// Pointer into data
+  uint64_t		word;		// Current word
+
+
+  for (; length >= sizeof(word); ptr += sizeof(word), length -= sizeof(word))
+  {
+    memcpy(&word, ptr, sizeof(word));
+    checksum ^= word;
+    checksum *= 0x100000001b3ULL;
+  }
+
+  while (length > 0)
+  {
+    checksum ^= *ptr++;
+    checksum *= 0x100000001b3ULL;
+    length --;
+  }
+
+  return (checksum);
+}
+
+
+//
+// 'compare_entries()' - Compare two tokens by hash.
+//
+
+static int				// O - Result of comparison
+compare_entries(
+    const moauthd_snapent_t *a,		// I - First token
+    const moauthd_snapent_t *b)		// I - Second token
+{
+  if (a->hash < b->hash)
+    return (-1);
+  else if (a->hash > b->hash)
+    return (1);
+  else
+    return (0);
+}
+
+
+//
+// 'find_record()' - Find an unused snapshot record.
+//
+
+static ssize_t				// O - Record number or -1 if not found
+find_record(
+    moauthd_snapshot_t *snapshot,	// I - Token snapshot
+    uint64_t           hash,		// I - Hash of token string
+    const char         *token_id)	// I - Token string
+{
+  size_t	left,			// Left side of search
+		right,			// Right side of search
+		current;		// Current record
+  const char	*s;			// Token string
+
+
+  // Binary search for the first record with a matching hash...
+  for (left = 0, right = snapshot->num_records; left < right;)
+  {
+    current = (left + right) / 2;
+
+    if (snapshot->records[current].hash < hash)
+      left = current + 1;
+    else
+      right = current;
+  }
+
+  // Then compare token strings for all matching hashes...
+  for (current = left; current < snapshot->num_records && snapshot->records[current].hash == hash; current ++)
+  {
+    if (!snapshot->consumed[current] && (s = get_string(snapshot, snapshot->records[current].token)) != NULL && !strcmp(s, token_id))
+      return ((ssize_t)current);
+  }
+
+  return (-1);
+}
+
+
+//
+// 'get_string()' - Get a string from the snapshot string pool.
+//
+
+static const char *			// O - String or `NULL` if invalid
+get_string(moauthd_snapshot_t *snapshot,// I - Token snapshot
+           uint32_t           offset)	// I - Offset in string pool
+{
+  if (offset >= snapshot->strings_length || !memchr(snapshot->strings + offset, '\0', snapshot->strings_length - offset))
+    return (NULL);
+
+  return (snapshot->strings + offset);
+}
@@ -16,6 +16,7 @@
 #include <cups/thread.h>
 #include <signal.h>
 #include <sys/poll.h>
+#include <sys/wait.h>
 #include <moauth/moauth-private.h>
 #include <moauth/test.h>
 #ifdef __APPLE__
@@ -30,6 +31,7 @@ extern char **environ;
 //
 
 #define REDIRECT_URI	"https://localhost:10000"
+#define LARGE_SIZE	1234567		// Size of large test file (> 1MiB)
 
 
 //
@@ -55,12 +57,16 @@ static bool	stop_tests = false;
 // Local functions...
 //
 
+static bool	get_byteranges(http_t *http, const char *resource, const char *range, const char *data, size_t length, const size_t *ranges, size_t num_ranges, char *message, size_t msgsize);
+static http_status_t get_bytes(http_t *http, const char *resource, const char *modified, const char *range, const char *data, size_t *bytes, char *lastmod, size_t lastsize);
 static char	*get_url(const char *url, const char *token, char *filename, size_t filesize);
 static moauth_t	*open_auth_url(const char *url, const char *state, const char *verifier);
 static void	*redirect_server(_moauth_redirect_t *data);
 static bool	respond_client(http_t *http, http_status_t code, const char *message);
+static http_status_t revoke_token(const char *host, int port, const char *token);
 static void	sig_handler(int sig);
 static pid_t	start_moauthd(int verbosity);
+static bool	test_files(const char *host, int port);
 
 
 //
@@ -82,12 +88,17 @@ main(int  argc,				// I - Number of command-line arguments
 			url[1024],	// Authentication URL
 			client_id[256],	// Client ID
 			token[2048],	// Access token
+			code_token[2048],// Access token from authorization code
 			refresh[2048],	// Refresh token
 			filename[256];	// Temporary filename
   const char		*password;	// Password to use for password auth test
   time_t		expires;	// Expiration date/time
   moauth_t		*server;	/* Connection to moauthd*/
   unsigned char		data[32];	// Data for verifier string
+  http_status_t		http_status;	// Status of request
+  http_t		*http;		// HTTP connection
+  size_t		bytes;		// Bytes transferred
+  time_t		end;		// Timeout
 
 
   // Parse command-line arguments...
@@ -108,11 +119,24 @@ main(int  argc,				// I - Number of command-line arguments
   signal(SIGINT, sig_handler);
   signal(SIGTERM, sig_handler);
 
-  // Start daemon...
+  // Start daemon in the top-level directory with no saved state...
+  if (chdir(".."))
+    abort();
+
+  unlink("test.state");
+  unlink("test.state.journal");
+  unlink("test.state.tokens");
+
   testBegin("moauthd");
   moauthd_pid = start_moauthd(verbosity);
   testEndMessage(moauthd_pid > 0, "%d", (int)moauthd_pid);
 
+  // Test conditional and range requests for files...
+  httpGetHostname(NULL, host, sizeof(host));
+
+  if (!test_files(host, 9000 + (getuid() % 1000)))
+    status = 1;
+
   // Start redirect server thread...
   _moauthGetRandomBytes(data, sizeof(data));
   httpEncode64(redirect_data.verifier, sizeof(redirect_data.verifier), (char *)data, sizeof(data), true);
@@ -127,8 +151,6 @@ main(int  argc,				// I - Number of command-line arguments
   }
 
   // Start authentication process...
-  httpGetHostname(NULL, host, sizeof(host));
-
   httpAssembleURI(HTTP_URI_CODING_ALL, url, sizeof(url), "https", NULL, host, 9000 + (getuid() % 1000), "/");
 
   if ((server = open_auth_url(url, redirect_data.state, redirect_data.verifier)) == NULL)
@@ -178,6 +200,7 @@ main(int  argc,				// I - Number of command-line arguments
     char expdate[256];			// Expiration date
 
     testEndMessage(true, "access token=\"%s\", refresh token=\"%s\", expires %s", token, refresh, httpGetDateString(expires, expdate, sizeof(expdate)));
+    cupsCopyString(code_token, token, sizeof(code_token));
   }
   else
   {
@@ -201,6 +224,23 @@ main(int  argc,				// I - Number of command-line arguments
     goto finish_up;
   }
 
+  // Make sure the access token can't be exchanged as a grant...
+  testBegin("moauthGetToken (access token as code)");
+  {
+    char	temp[2048];		// New access token
+    time_t	temp_expires;		// New expiration date/time
+
+    if (moauthGetToken(server, "https://localhost:10000", "testmoauthd", token, NULL, temp, sizeof(temp), NULL, 0, &temp_expires))
+    {
+      testEndMessage(false, "access token was exchanged");
+      status = 1;
+    }
+    else
+    {
+      testEnd(true);
+    }
+  }
+
   // Register a new client...
   testBegin("moauthRegisterClient");
   if (moauthRegisterClient(server, /*redirect_uri*/"https://localhost:10000/newclient", /*client_name*/"Dynamic Test Client", /*client_uri*/NULL, /*logo_uri*/NULL, /*tos_uri*/NULL, client_id, sizeof(client_id)))
@@ -248,6 +288,110 @@ main(int  argc,				// I - Number of command-line arguments
     goto finish_up;
   }
 
+  // Revoke the access token and make sure it can no longer be used...
+  testBegin("POST /revoke");
+  if ((http_status = revoke_token(host, 9000 + (getuid() % 1000), token)) == HTTP_STATUS_OK)
+  {
+    testEnd(true);
+  }
+  else
+  {
+    testEndMessage(false, "status %d", http_status);
+    status = 1;
+    goto finish_up;
+  }
+
+  testBegin("GET %s (revoked token)", url);
+  if (get_url(url, token, filename, sizeof(filename)))
+  {
+    testEndMessage(false, "revoked token was accepted");
+    unlink(filename);
+    status = 1;
+  }
+  else if (!strstr(filename, "status 401"))
+  {
+    testEndMessage(false, "%s", filename);
+    status = 1;
+  }
+  else
+  {
+    testEndMessage(true, "%s", filename);
+  }
+
+  // Restart the server and make sure the tokens and registered client were
+  // saved...
+  testBegin("Restart moauthd");
+  kill(moauthd_pid, SIGTERM);
+  waitpid(moauthd_pid, NULL, 0);
+
+  if ((moauthd_pid = start_moauthd(verbosity)) <= 0)
+  {
+    testEnd(false);
+    status = 1;
+    goto finish_up;
+  }
+
+  for (http = NULL, end = time(NULL) + 30; time(NULL) < end; sleep(1))
+  {
+    testProgress();
+
+    if ((http = httpConnect(host, 9000 + (getuid() % 1000), NULL, AF_UNSPEC, HTTP_ENCRYPTION_ALWAYS, true, 30000, NULL)) != NULL)
+      break;
+  }
+
+  if (!http)
+  {
+    testEndMessage(false, "%s", cupsGetErrorString());
+    status = 1;
+    goto finish_up;
+  }
+
+  testEndMessage(true, "%d", (int)moauthd_pid);
+
+  snprintf(url, sizeof(url), "/authorize?client_id=%s&redirect_uri=https%%3A%%2F%%2Flocalhost%%3A10000%%2Fnewclient&response_type=code", client_id);
+  testBegin("GET /authorize (registered client after restart)");
+  if ((http_status = get_bytes(http, url, NULL, NULL, NULL, &bytes, NULL, 0)) == HTTP_STATUS_OK)
+  {
+    testEnd(true);
+  }
+  else
+  {
+    testEndMessage(false, "status %d", http_status);
+    status = 1;
+  }
+
+  httpClose(http);
+
+  httpAssembleURI(HTTP_URI_CODING_ALL, url, sizeof(url), "https", NULL, host, 9000 + (getuid() % 1000), "/shared/shared.pdf");
+  testBegin("GET %s (token after restart)", url);
+  if (get_url(url, code_token, filename, sizeof(filename)))
+  {
+    testEndMessage(true, "filename=\"%s\"", filename);
+    unlink(filename);
+  }
+  else
+  {
+    testEndMessage(false, "%s", filename);
+    status = 1;
+  }
+
+  testBegin("GET %s (revoked token after restart)", url);
+  if (get_url(url, token, filename, sizeof(filename)))
+  {
+    testEndMessage(false, "revoked token was accepted");
+    unlink(filename);
+    status = 1;
+  }
+  else if (!strstr(filename, "status 401"))
+  {
+    testEndMessage(false, "%s", filename);
+    status = 1;
+  }
+  else
+  {
+    testEndMessage(true, "%s", filename);
+  }
+
   // Stop the test server...
   finish_up:
 
@@ -260,6 +404,201 @@ main(int  argc,				// I - Number of command-line arguments
 }
 
 
+//
+// 'get_byteranges()' - Fetch multiple byte ranges and check each part.
+//
+// The `ranges` array holds the first and last byte of each expected part.
+//
+
+static bool				// O - `true` if the response is correct, `false` otherwise
+get_byteranges(
+    http_t       *http,			// I - HTTP connection
+    const char   *resource,		// I - Resource path
+    const char   *range,		// I - Range value
+    const char   *data,			// I - File data
+    size_t       length,		// I - Length of file
+    const size_t *ranges,		// I - First and last byte of each part
+    size_t       num_ranges,		// I - Number of parts
+    char         *message,		// I - Message buffer
+    size_t       msgsize)		// I - Size of message buffer
+{
+  http_status_t	status;			// HTTP status
+  const char	*type;			// Content-Type value
+  char		delimiter[256],		// Part delimiter
+		header[256],		// Expected Content-Range header
+		*body = NULL,		// Response body
+		*ptr,			// Pointer into body
+		*end;			// End of body/part headers
+  size_t	bodylen = 0,		// Length of body
+		bodyalloc = 0,		// Allocated size of body
+		i;			// Looping var
+  ssize_t	rbytes;			// Bytes read
+  bool		ret = false;		// Return value
+
+
+  httpClearFields(http);
+  httpSetField(http, HTTP_FIELD_RANGE, range);
+
+  if (!httpWriteRequest(http, "GET", resource))
+  {
+    snprintf(message, msgsize, "%s", cupsGetErrorString());
+    return (false);
+  }
+
+  while ((status = httpUpdate(http)) == HTTP_STATUS_CONTINUE);
+
+  type = httpGetField(http, HTTP_FIELD_CONTENT_TYPE);
+
+  if (type && !strncmp(type, "multipart/byteranges; boundary=", 31))
+    snprintf(delimiter, sizeof(delimiter), "\r\n--%s", type + 31);
+  else
+    delimiter[0] = '\0';
+
+  // Read the whole body...
+  for (;;)
+  {
+    if ((bodylen + 8192) > bodyalloc)
+    {
+      bodyalloc += 65536;
+
+      if ((ptr = realloc(body, bodyalloc)) == NULL)
+      {
+        httpFlush(http);
+        snprintf(message, msgsize, "%s", strerror(errno));
+        goto done;
+      }
+
+      body = ptr;
+    }
+
+    if ((rbytes = httpRead(http, body + bodylen, 8192)) <= 0)
+      break;
+
+    bodylen += (size_t)rbytes;
+  }
+
+  if (status != HTTP_STATUS_PARTIAL_CONTENT || !delimiter[0])
+  {
+    snprintf(message, msgsize, "status %d, Content-Type \"%s\"", status, type ? type : "(null)");
+    goto done;
+  }
+
+  // Check each part...
+  for (i = 0, ptr = body, end = body + bodylen; i < num_ranges; i ++)
+  {
+    size_t	first = ranges[2 * i],	// First byte
+		last = ranges[2 * i + 1];// Last byte
+    char	*hend;			// End of part headers
+
+    if ((size_t)(end - ptr) < strlen(delimiter) || strncmp(ptr, delimiter, strlen(delimiter)))
+    {
+      snprintf(message, msgsize, "missing delimiter for part %u", (unsigned)(i + 1));
+      goto done;
+    }
+
+    ptr += strlen(delimiter);
+
+    *end = '\0';			// Nul-terminate for strstr
+    if ((hend = strstr(ptr, "\r\n\r\n")) == NULL)
+    {
+      snprintf(message, msgsize, "missing headers for part %u", (unsigned)(i + 1));
+      goto done;
+    }
+
+    snprintf(header, sizeof(header), "\r\nContent-Range: bytes %lu-%lu/%lu\r\n", (unsigned long)first, (unsigned long)last, (unsigned long)length);
+    hend[2] = '\0';			// Limit search to this part's headers
+
+    if (!strstr(ptr, header))
+    {
+      snprintf(message, msgsize, "bad Content-Range for part %u", (unsigned)(i + 1));
+      goto done;
+    }
+
+    ptr = hend + 4;
+
+    if ((size_t)(end - ptr) < (last - first + 1) || memcmp(ptr, data + first, last - first + 1))
+    {
+      snprintf(message, msgsize, "bad data for part %u", (unsigned)(i + 1));
+      goto done;
+    }
+
+    ptr += last - first + 1;
+  }
+
+  snprintf(header, sizeof(header), "%s--\r\n", delimiter);
+
+  if ((size_t)(end - ptr) != strlen(header) || memcmp(ptr, header, strlen(header)))
+  {
+    snprintf(message, msgsize, "bad end of response");
+    goto done;
+  }
+
+  snprintf(message, msgsize, "%u parts, %lu bytes", (unsigned)num_ranges, (unsigned long)bodylen);
+  ret = true;
+
+  done:
+
+  free(body);
+
+  return (ret);
+}
+
+
+//
+// 'get_bytes()' - Fetch a resource and count the bytes transferred.
+//
+// When `data` is not `NULL`, the response body must match the start of the
+// string and `HTTP_STATUS_ERROR` is returned if it does not.
+//
+
+static http_status_t			// O - HTTP status
+get_bytes(http_t     *http,		// I - HTTP connection
+          const char *resource,		// I - Resource path
+          const char *modified,		// I - If-Modified-Since value or `NULL`
+          const char *range,		// I - Range value or `NULL`
+          const char *data,		// I - Expected data or `NULL`
+          size_t     *bytes,		// O - Bytes transferred
+          char       *lastmod,		// O - Last-Modified value or `NULL`
+          size_t     lastsize)		// I - Size of Last-Modified buffer
+{
+  http_status_t	status;			// HTTP status
+  char		buffer[8192];		// Read buffer
+  ssize_t	rbytes;			// Bytes read
+  size_t	datalen = data ? strlen(data) : 0;
+					// Length of expected data
+
+
+  *bytes = 0;
+
+  httpClearFields(http);
+  if (modified)
+    httpSetField(http, HTTP_FIELD_IF_MODIFIED_SINCE, modified);
+  if (range)
+    httpSetField(http, HTTP_FIELD_RANGE, range);
+
+  if (!httpWriteRequest(http, "GET", resource))
+    return (HTTP_STATUS_ERROR);
+
+  while ((status = httpUpdate(http)) == HTTP_STATUS_CONTINUE);
+
+  if (lastmod)
+    cupsCopyString(lastmod, httpGetField(http, HTTP_FIELD_LAST_MODIFIED), lastsize);
+
+  while ((rbytes = httpRead(http, buffer, sizeof(buffer))) > 0)
+  {
+    if (data && ((*bytes + (size_t)rbytes) > datalen || memcmp(buffer, data + *bytes, (size_t)rbytes)))
+    {
+      status = HTTP_STATUS_ERROR;
+      data   = NULL;
+    }
+
+    *bytes += (size_t)rbytes;
+  }
+
+  return (status);
+}
+
+
 //
 // 'get_url()' - Fetch a URL using the specified Bearer token.
 //
@@ -605,6 +944,60 @@ respond_client(http_t        *http,	// I - HTTP connection
 }
 
 
+//
+// 'revoke_token()' - Revoke a token using the /revoke endpoint.
+//
+
+static http_status_t			// O - HTTP status
+revoke_token(const char *host,		// I - Hostname
+             int        port,		// I - Port number
+             const char *token)		// I - Token to revoke
+{
+  http_t	*http;			// HTTP connection
+  http_status_t	status;			// HTTP status
+  size_t	num_form;		// Number of form variables
+  cups_option_t	*form;			// Form variables
+  char		*form_data;		// POST form data
+  size_t	form_length;		// Length of form data
+
+
+  num_form  = cupsAddOption("token", token, 0, &form);
+  form_data = cupsFormEncode(/*url*/NULL, num_form, form);
+  cupsFreeOptions(num_form, form);
+
+  if (!form_data)
+    return (HTTP_STATUS_ERROR);
+
+  if ((http = httpConnect(host, port, NULL, AF_UNSPEC, HTTP_ENCRYPTION_ALWAYS, true, 30000, NULL)) == NULL)
+  {
+    free(form_data);
+    return (HTTP_STATUS_ERROR);
+  }
+
+  form_length = strlen(form_data);
+
+  httpClearFields(http);
+  httpSetField(http, HTTP_FIELD_CONTENT_TYPE, "application/x-www-form-urlencoded");
+  httpSetLength(http, form_length);
+
+  if (!httpWriteRequest(http, "POST", "/revoke") || httpWrite(http, form_data, form_length) < (ssize_t)form_length)
+  {
+    status = HTTP_STATUS_ERROR;
+  }
+  else
+  {
+    while ((status = httpUpdate(http)) == HTTP_STATUS_CONTINUE);
+
+    httpFlush(http);
+  }
+
+  httpClose(http);
+  free(form_data);
+
+  return (status);
+}
+
+
 //
 // 'sig_handler()' - Signal handler.
 //
@@ -643,11 +1036,6 @@ start_moauthd(int verbosity)		// I - Verbosity
   };
 
 
-  if (chdir(".."))
-    abort();
-
-  unlink("test.state");
-
   if (verbosity)
   {
     int		i, j;			// Looping vars
@@ -672,3 +1060,232 @@ start_moauthd(int verbosity)		// I - Verbosity
 
   return (pid);
 }
+
+
+//
+// 'test_files()' - Test conditional and range requests for files.
+//
+// Both "/style.css" and a large local file are tested.  The large file is
+// written to the "test" directory and is longer than the server's write
+// buffer, and the ranges start at unaligned offsets.  Multiple range
+// responses are compared against "moauthd/style.css" and the large file.
+//
+
+static bool				// O - `true` on success, `false` on failure
+test_files(const char *host,		// I - Hostname
+           int        port)		// I - Port number
+{
+  bool		ret = false;		// Return value
+  http_t	*http = NULL;		// HTTP connection
+  http_status_t	status;			// HTTP status
+  size_t	bytes,			// Bytes transferred
+		length;			// Length of file
+  char		lastmod[256];		// Last-Modified value
+  time_t	end = time(NULL) + 30;	// Timeout
+  char		*large = NULL,		// Large file data
+		*style = NULL,		// Style sheet data
+		message[256];		// Multiple range message
+  FILE		*fp;			// Large file
+  size_t	i,			// Looping var
+		ranges[6];		// Expected byte ranges
+
+
+  testBegin("httpConnect(\"%s\", %d)", host, port);
+
+  while (time(NULL) < end)
+  {
+    testProgress();
+
+    if ((http = httpConnect(host, port, NULL, AF_UNSPEC, HTTP_ENCRYPTION_ALWAYS, true, 30000, NULL)) != NULL)
+      break;
+
+    sleep(1);
+  }
+
+  if (!http)
+  {
+    testEndMessage(false, "%s", cupsGetErrorString());
+    return (false);
+  }
+
+  testEnd(true);
+
+  // Get the whole file...
+  testBegin("GET /style.css");
+  if ((status = get_bytes(http, "/style.css", NULL, NULL, NULL, &length, lastmod, sizeof(lastmod))) != HTTP_STATUS_OK || length == 0 || !lastmod[0])
+  {
+    testEndMessage(false, "status %d, %lu bytes", status, (unsigned long)length);
+    goto done;
+  }
+  testEndMessage(true, "%lu bytes", (unsigned long)length);
+
+  // Get the file again, it should not be sent...
+  testBegin("GET /style.css (If-Modified-Since: %s)", lastmod);
+  if ((status = get_bytes(http, "/style.css", lastmod, NULL, NULL, &bytes, NULL, 0)) != HTTP_STATUS_NOT_MODIFIED || bytes != 0)
+  {
+    testEndMessage(false, "status %d, %lu bytes", status, (unsigned long)bytes);
+    goto done;
+  }
+  testEndMessage(true, "%lu bytes", (unsigned long)bytes);
+
+  // Get the first 100 bytes...
+  testBegin("GET /style.css (Range: bytes=0-99)");
+  if ((status = get_bytes(http, "/style.css", NULL, "bytes=0-99", NULL, &bytes, NULL, 0)) != HTTP_STATUS_PARTIAL_CONTENT || bytes != 100)
+  {
+    testEndMessage(false, "status %d, %lu bytes", status, (unsigned long)bytes);
+    goto done;
+  }
+  testEndMessage(true, "%lu bytes", (unsigned long)bytes);
+
+  // Resume after the first 100 bytes...
+  testBegin("GET /style.css (Range: bytes=100-)");
+  if ((status = get_bytes(http, "/style.css", NULL, "bytes=100-", NULL, &bytes, NULL, 0)) != HTTP_STATUS_PARTIAL_CONTENT || bytes != (length - 100))
+  {
+    testEndMessage(false, "status %d, %lu bytes", status, (unsigned long)bytes);
+    goto done;
+  }
+  testEndMessage(true, "%lu bytes", (unsigned long)bytes);
+
+  // An empty range set is ignored...
+  testBegin("GET /style.css (Range: bytes=)");
+  if ((status = get_bytes(http, "/style.css", NULL, "bytes=", NULL, &bytes, NULL, 0)) != HTTP_STATUS_OK || bytes != length)
+  {
+    testEndMessage(false, "status %d, %lu bytes", status, (unsigned long)bytes);
+    goto done;
+  }
+  testEndMessage(true, "%lu bytes", (unsigned long)bytes);
+
+  // Get two ranges and compare them to the local file...
+  testBegin("GET /style.css (Range: bytes=0-9,-10)");
+  if ((style = malloc(length)) == NULL || (fp = fopen("moauthd/style.css", "r")) == NULL)
+  {
+    testEndMessage(false, "moauthd/style.css: %s", strerror(errno));
+    goto done;
+  }
+
+  bytes = fread(style, 1, length, fp);
+  fclose(fp);
+
+  if (bytes != length)
+  {
+    testEndMessage(false, "moauthd/style.css: short read");
+    goto done;
+  }
+
+  ranges[0] = 0;
+  ranges[1] = 9;
+  ranges[2] = length - 10;
+  ranges[3] = length - 1;
+
+  if (!get_byteranges(http, "/style.css", "bytes=0-9,-10", style, length, ranges, 2, message, sizeof(message)))
+  {
+    testEndMessage(false, "%s", message);
+    goto done;
+  }
+  testEndMessage(true, "%s", message);
+
+  // Ask for a range past the end of the file...
+  testBegin("GET /style.css (Range: bytes=%lu-)", (unsigned long)length);
+  snprintf(lastmod, sizeof(lastmod), "bytes=%lu-", (unsigned long)length);
+  if ((status = get_bytes(http, "/style.css", NULL, lastmod, NULL, &bytes, NULL, 0)) != HTTP_STATUS_REQUESTED_RANGE)
+  {
+    testEndMessage(false, "status %d, %lu bytes", status, (unsigned long)bytes);
+    goto done;
+  }
+  testEndMessage(true, "status %d", status);
+
+  // Create a large local file with a pattern that doesn't repeat on page
+  // boundaries...
+  testBegin("Create test/large.txt");
+  if ((large = malloc(LARGE_SIZE + 1)) == NULL || (fp = fopen("test/large.txt", "w")) == NULL)
+  {
+    testEndMessage(false, "%s", strerror(errno));
+    goto done;
+  }
+
+  for (i = 0; i < LARGE_SIZE; i ++)
+    large[i] = (char)(' ' + i % 89);
+  large[i] = '\0';
+
+  if (fwrite(large, 1, LARGE_SIZE, fp) != LARGE_SIZE)
+  {
+    testEndMessage(false, "%s", strerror(errno));
+    fclose(fp);
+    goto done;
+  }
+
+  if (fclose(fp))
+  {
+    testEndMessage(false, "%s", strerror(errno));
+    goto done;
+  }
+  testEndMessage(true, "%lu bytes", (unsigned long)LARGE_SIZE);
+
+  // Get the whole file...
+  testBegin("GET /large.txt");
+  if ((status = get_bytes(http, "/large.txt", NULL, NULL, large, &length, lastmod, sizeof(lastmod))) != HTTP_STATUS_OK || length != LARGE_SIZE || !lastmod[0])
+  {
+    testEndMessage(false, "status %d, %lu bytes", status, (unsigned long)length);
+    goto done;
+  }
+  testEndMessage(true, "%lu bytes", (unsigned long)length);
+
+  // Get the file again, it should not be sent...
+  testBegin("GET /large.txt (If-Modified-Since: %s)", lastmod);
+  if ((status = get_bytes(http, "/large.txt", lastmod, NULL, NULL, &bytes, NULL, 0)) != HTTP_STATUS_NOT_MODIFIED || bytes != 0)
+  {
+    testEndMessage(false, "status %d, %lu bytes", status, (unsigned long)bytes);
+    goto done;
+  }
+  testEndMessage(true, "%lu bytes", (unsigned long)bytes);
+
+  // Resume at an unaligned offset...
+  testBegin("GET /large.txt (Range: bytes=4097-)");
+  if ((status = get_bytes(http, "/large.txt", NULL, "bytes=4097-", large + 4097, &bytes, NULL, 0)) != HTTP_STATUS_PARTIAL_CONTENT || bytes != (LARGE_SIZE - 4097))
+  {
+    testEndMessage(false, "status %d, %lu bytes", status, (unsigned long)bytes);
+    goto done;
+  }
+  testEndMessage(true, "%lu bytes", (unsigned long)bytes);
+
+  // Get a range that spans more than one write buffer...
+  testBegin("GET /large.txt (Range: bytes=12345-1100000)");
+  if ((status = get_bytes(http, "/large.txt", NULL, "bytes=12345-1100000", large + 12345, &bytes, NULL, 0)) != HTTP_STATUS_PARTIAL_CONTENT || bytes != (1100000 - 12345 + 1))
+  {
+    testEndMessage(false, "status %d, %lu bytes", status, (unsigned long)bytes);
+    goto done;
+  }
+  testEndMessage(true, "%lu bytes", (unsigned long)bytes);
+
+  // Get ranges on either side of a write buffer boundary...
+  testBegin("GET /large.txt (Range: bytes=4097-5000,1048575-1048577,-3)");
+  ranges[0] = 4097;
+  ranges[1] = 5000;
+  ranges[2] = 1048575;
+  ranges[3] = 1048577;
+  ranges[4] = LARGE_SIZE - 3;
+  ranges[5] = LARGE_SIZE - 1;
+
+  if (!get_byteranges(http, "/large.txt", "bytes=4097-5000,1048575-1048577,-3", large, LARGE_SIZE, ranges, 3, message, sizeof(message)))
+  {
+    testEndMessage(false, "%s", message);
+    goto done;
+  }
+  testEndMessage(true, "%s", message);
+
+  ret = true;
+
+  done:
+
+  httpClose(http);
+
+  free(style);
+
+  if (large)
+  {
+    unlink("test/large.txt");
+    free(large);
+  }
+
+  return (ret);
+}
@@ -8,20 +8,103 @@
 
 #include "moauthd.h"
 #include <cups/jwt.h>
-#include <pwd.h>
+
+
+//
+// Local types...
+//
+
+struct moauthd_verified_s		// Verified token cache entry
+{
+  unsigned char		digest[32];	// SHA-256 digest of token string
+  moauthd_token_t	*token;		// Verified token
+  moauthd_verified_t	*next,		// Next entry in hash bucket
+			*lru_prev,	// Previous (more recently used) entry
+			*lru_next;	// Next (less recently used) entry
+};
 
 
 //
 // Local functions...
 //
 
-static int	compare_tokens(moauthd_token_t *a, moauthd_token_t *b, void *data);
-static void	free_token(moauthd_token_t *token, void *data);
+static bool	add_token(moauthd_tokshard_t *shard, moauthd_token_t *token);
+static moauthd_tokshard_t *get_shard(moauthd_server_t *server, uint64_t hash, const char *token_id);
+static void	add_verified(moauthd_server_t *server, const unsigned char *digest, moauthd_token_t *token);
+static int	compare_revoked(moauthd_revoked_t *a, moauthd_revoked_t *b, void *data);
+static size_t	expire_revoked(moauthd_server_t *server, time_t curtime);
+static void	free_revoked(moauthd_revoked_t *revoked, void *data);
+static void	free_token(moauthd_token_t *token);
+static moauthd_token_t *find_verified(moauthd_server_t *server, const unsigned char *digest, time_t curtime);
+static void	get_user_ids(moauthd_server_t *server, moauthd_token_t *token);
+static uint64_t	hash_token(const char *s);
+static void	heap_down(moauthd_tokshard_t *shard, size_t i);
+static void	heap_up(moauthd_tokshard_t *shard, size_t i);
+static bool	is_revoked(moauthd_server_t *server, const char *jti);
+static bool	remove_token(moauthd_tokshard_t *shard, moauthd_token_t *token);
+static void	remove_verified(moauthd_verstripe_t *stripe, moauthd_verified_t *verified);
+static void	resize_shard(moauthd_tokshard_t *shard);
+static void	revoked_bits(const char *jti, size_t bits[MOAUTHD_REVOKE_HASHES]);
+static moauthd_token_t *verify_token(moauthd_server_t *server, const char *token_id);
+
+
+//
+// 'moauthdAddToken()' - Add an existing token to the server.
+//
+// This function is used when loading saved tokens.  The server takes ownership
+// of the token, which is freed if a token with the same string already exists.
+//
+
+bool					// O - `true` if added, `false` if a duplicate or on error
+moauthdAddToken(
+    moauthd_server_t *server,		// I - Server object
+    moauthd_token_t  *token)		// I - Token
+{
+  moauthd_tokshard_t	*shard;		// Token table shard
+  moauthd_token_t	*match;		// Existing token
+  bool			added = false;	// Was the token added?
+
+
+  token->refcount = 1;			// Token table
+  token->hash     = hash_token(token->token);
+  shard           = get_shard(server, token->hash, token->token);
+
+  cupsRWLockWrite(&shard->lock);
+
+  for (match = shard->buckets[(token->hash / MOAUTHD_TOKEN_SHARDS) & (shard->num_buckets - 1)]; match; match = match->next)
+  {
+    if (match->hash == token->hash && !strcmp(match->token, token->token))
+      break;
+  }
+
+  if (!match)
+  {
+    // Replace any copy in the token snapshot...
+    if (shard != &server->grants)
+      moauthdConsumeSnapshotToken(server, token->hash, token->token);
+
+    added = add_token(shard, token);
+  }
+
+  cupsRWUnlock(&shard->lock);
+
+  if (!added)
+    free_token(token);
+
+  return (added);
+}
 
 
 //
 // 'moauthdCreateToken()' - Create an OAuth token.
 //
+// The returned token holds a reference that must be released using
+// `moauthdReleaseToken`.  When the "StatelessTokens" option is set, access
+// tokens carry a unique "jti" claim and are not added to the token table.
+//
+// Grants are opaque random codes that are only redeemed by this server, so
+// they are kept in a separate grant table and are not journaled.
+//
 
 moauthd_token_t *			// O - New token
 moauthdCreateToken(
@@ -29,34 +112,33 @@ moauthdCreateToken(
     moauthd_toktype_t     type,		// I - Token type
     moauthd_application_t *application,	// I - Application
     const char            *user,	// I - Authenticated user
-    const char            *scopes)	// I - Space-delimited list of scopes
+    const char            *scopes,	// I - Space-delimited list of scopes
+    const char            *challenge)	// I - PKCE challenge or `NULL` for none
 {
   moauthd_token_t	*token;		// New token
-  struct passwd		*passwd;	// User info
+  moauthd_tokshard_t	*shard;		// Token table shard
+  bool			added;		// Was the token added?
   cups_jwt_t		*jwt;		// JWT
 
 
   if (!scopes || !*scopes)
     scopes = "private shared";
 
-  token = (moauthd_token_t *)calloc(1, sizeof(moauthd_token_t));
+  if ((token = (moauthd_token_t *)calloc(1, sizeof(moauthd_token_t))) == NULL)
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to allocate token: %s", strerror(errno));
+    return (NULL);
+  }
 
+  token->refcount     = 2;		// Token table + caller
   token->type         = type;
   token->application  = application;
+  token->challenge    = challenge ? strdup(challenge) : NULL;
   token->user         = strdup(user);
   token->scopes       = strdup(scopes);
-  token->scopes_array = cupsArrayNewStrings(scopes, ' ');
+  token->scope_bits   = moauthdGetScopes(server, scopes);
 
-  if ((passwd = getpwnam(user)) != NULL)
-  {
-    token->uid = passwd->pw_uid;
-    token->gid = passwd->pw_gid;
-  }
-  else
-  {
-    token->uid = (uid_t)-1;
-    token->gid = (gid_t)-1;
-  }
+  get_user_ids(server, token);
 
   token->created = time(NULL);
 
@@ -65,28 +147,91 @@ moauthdCreateToken(
   else
     token->expires = token->created + server->max_token_life;
 
-  // Generate the JWT for the token...
-  jwt = cupsJWTNew("JWT", /*claims*/NULL);
-  cupsJWTSetClaimString(jwt, "iss", token->user);
-  cupsJWTSetClaimString(jwt, "scope", token->scopes);
-  cupsJWTSetClaimNumber(jwt, "iat", (double)token->created);
-  cupsJWTSetClaimNumber(jwt, "exp", (double)token->expires);
+  if (type == MOAUTHD_TOKTYPE_GRANT)
+  {
+    // Generate a random base64url grant code...
+    unsigned char	bytes[32];	// Random bytes
+    char		code[45];	// Grant code
 
-  cupsJWTSign(jwt, CUPS_JWA_RS256, server->private_key);
+    _moauthGetRandomBytes(bytes, sizeof(bytes));
+    httpEncode64(code, sizeof(code), (char *)bytes, sizeof(bytes), true);
 
-  token->token = cupsJWTExportString(jwt, CUPS_JWS_FORMAT_COMPACT);
-  cupsJWTDelete(jwt);
+    token->token = strdup(code);
+  }
+  else
+  {
+    if (type == MOAUTHD_TOKTYPE_ACCESS && (server->options & MOAUTHD_OPTION_STATELESS_TOKENS))
+    {
+      // Give stateless access tokens a unique ID for revocation...
+      unsigned char	bytes[16];	// Random bytes
+      char		jti[33];	// Unique ID string
+      size_t		i;		// Looping var
+
+      _moauthGetRandomBytes(bytes, sizeof(bytes));
+
+      for (i = 0; i < sizeof(bytes); i ++)
+	snprintf(jti + 2 * i, sizeof(jti) - 2 * i, "%02x", bytes[i]);
+
+      token->jti = strdup(jti);
+    }
+
+    // Generate the JWT for the token...
+    jwt = cupsJWTNew("JWT", /*claims*/NULL);
+    cupsJWTSetClaimString(jwt, "iss", token->user);
+    cupsJWTSetClaimString(jwt, "scope", token->scopes);
+    cupsJWTSetClaimNumber(jwt, "iat", (double)token->created);
+    cupsJWTSetClaimNumber(jwt, "exp", (double)token->expires);
+    if (token->jti)
+    {
+      cupsJWTSetClaimString(jwt, "jti", token->jti);
+      if (application)
+	cupsJWTSetClaimString(jwt, "client_id", application->client_id);
+    }
+
+    if (cupsJWTSign(jwt, server->signing_alg, server->private_key))
+      token->token = cupsJWTExportString(jwt, CUPS_JWS_FORMAT_COMPACT);
+
+    cupsJWTDelete(jwt);
+  }
+
+  if (!token->token)
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to create token: %s", cupsGetErrorString());
+    free_token(token);
+    return (NULL);
+  }
 
 //  moauthdLogs(server, MOAUTHD_LOGLEVEL_DEBUG, "token->user=\"%s\", ->scopes=\"%s\", uid=%d, gid=%d, created=%ld, expires=%ld, token=\"%s\"", token->user, token->scopes, (int)token->uid, (int)token->gid, (long)token->created, (long)token->expires, token->token);
 
-  cupsRWLockWrite(&server->tokens_lock);
+  token->hash = hash_token(token->token);
 
-  if (!server->tokens)
-    server->tokens = cupsArrayNew((cups_array_cb_t)compare_tokens, NULL, NULL, 0, NULL, (cups_afree_cb_t)free_token);
+  if (token->jti)
+  {
+    // Stateless access tokens are only referenced by the caller...
+    token->refcount = 1;
 
-  cupsArrayAdd(server->tokens, token);
+    moauthdCountMetric(server, (moauthd_metric_t)(MOAUTHD_METRIC_TOKENS_ISSUED + type));
+    return (token);
+  }
 
-  cupsRWUnlock(&server->tokens_lock);
+  // Add the token to the hash table...
+  shard = get_shard(server, token->hash, token->token);
+
+  cupsRWLockWrite(&shard->lock);
+  added = add_token(shard, token);
+  cupsRWUnlock(&shard->lock);
+
+  if (!added)
+  {
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_ERROR, "Unable to add token: %s", strerror(errno));
+    free_token(token);
+    return (NULL);
+  }
+
+  if (shard != &server->grants)
+    moauthdJournalCreateToken(server, token);
+
+  moauthdCountMetric(server, (moauthd_metric_t)(MOAUTHD_METRIC_TOKENS_ISSUED + type));
 
   return (token);
 }
@@ -95,42 +240,113 @@ moauthdCreateToken(
 //
 // 'moauthdDeleteToken()' - Delete a token from the server...
 //
+// Only one caller can delete a given token, so the return value can be used
+// to consume single-use tokens such as grants.  The caller's own reference is
+// not released.  Stateless access tokens are revoked until they expire.
+//
 
-void
+bool					// O - `true` if deleted, `false` if already deleted
 moauthdDeleteToken(
     moauthd_server_t *server,		// I - Server object
     moauthd_token_t  *token)		// I - Token
 {
-  cupsRWLockWrite(&server->tokens_lock);
+  moauthd_tokshard_t	*shard;		// Token table shard
+  bool			removed;	// Was the token removed?
+
+
+  if (token->jti)
+    return (token->expires > time(NULL) && moauthdRevokeToken(server, token->jti, token->expires));
+
+  shard = get_shard(server, token->hash, token->token);
 
-  cupsArrayRemove(server->tokens, token);
+  cupsRWLockWrite(&shard->lock);
+  removed = remove_token(shard, token);
+  cupsRWUnlock(&shard->lock);
 
-  cupsRWUnlock(&server->tokens_lock);
+  if (removed)
+  {
+    if (shard != &server->grants)
+      moauthdJournalDeleteToken(server, token);
+
+    moauthdReleaseToken(token);
+  }
+
+  return (removed);
 }
 
 
 //
 // 'moauthdFindToken()' - Find an OAuth token.
 //
+// The returned token holds a reference that must be released using
+// `moauthdReleaseToken`.  Stateless access tokens are validated using their
+// signature and the revoked token filter without using the token table.
+//
 
 moauthd_token_t	*			// O - Matching token
 moauthdFindToken(
     moauthd_server_t *server,		// I - Server object
     const char       *token_id)		// I - Token ID
 {
-  moauthd_token_t	*match,		// Matching token, if any
-			key;		// Search key
+  uint64_t		hash;		// Hash of token string
+  moauthd_tokshard_t	*shard;		// Token table shard
+  moauthd_token_t	*match;		// Matching token, if any
+  bool			saved = false;	// Is the token in the snapshot?
 
 
 //  moauthdLogs(server, MOAUTHD_LOGLEVEL_DEBUG, "FindToken(\"%s\")", token_id);
 
-  key.token = (char *)token_id;
+  // Only JWTs can be stateless tokens, grant codes never contain a "."...
+  if ((server->options & MOAUTHD_OPTION_STATELESS_TOKENS) && strchr(token_id, '.') && (match = verify_token(server, token_id)) != NULL)
+    return (match);
+
+  hash  = hash_token(token_id);
+  shard = get_shard(server, hash, token_id);
+
+  cupsRWLockRead(&shard->lock);
 
-  cupsRWLockRead(&server->tokens_lock);
+  for (match = shard->buckets[(hash / MOAUTHD_TOKEN_SHARDS) & (shard->num_buckets - 1)]; match; match = match->next)
+  {
+    if (match->hash == hash && !strcmp(match->token, token_id))
+    {
+      atomic_fetch_add(&match->refcount, 1);
+      break;
+    }
+  }
+
+  if (!match && shard != &server->grants)
+    saved = moauthdFindSnapshotToken(server, hash, token_id);
+
+  cupsRWUnlock(&shard->lock);
+
+  if (saved)
+  {
+    // Materialize the token from the snapshot, checking again for a token
+    // that was added while we didn't hold the lock...
+    cupsRWLockWrite(&shard->lock);
+
+    for (match = shard->buckets[(hash / MOAUTHD_TOKEN_SHARDS) & (shard->num_buckets - 1)]; match; match = match->next)
+    {
+      if (match->hash == hash && !strcmp(match->token, token_id))
+        break;
+    }
+
+    if (!match && (match = moauthdCopySnapshotToken(server, hash, token_id)) != NULL)
+    {
+      match->refcount = 1;		// Token table
 
-  match = cupsArrayFind(server->tokens, &key);
+      if (!add_token(shard, match))
+      {
+        free_token(match);
+        match = NULL;
+      }
+    }
 
-  cupsRWUnlock(&server->tokens_lock);
+    if (match)
+      atomic_fetch_add(&match->refcount, 1);
+
+    cupsRWUnlock(&shard->lock);
+  }
 
 //  moauthdLogs(server, MOAUTHD_LOGLEVEL_DEBUG, "FindToken: match=%p(%s)", (void *)match, match ? match->user : "???");
 
@@ -139,35 +355,927 @@ moauthdFindToken(
 
 
 //
-// 'compare_token()' - Compare two tokens.
+// 'moauthdFreeTokens()' - Free all tokens and the token table.
+//
+
+void
+moauthdFreeTokens(
+    moauthd_server_t *server)		// I - Server object
+{
+  int			i;		// Looping var
+  size_t		j;		// Looping var
+  moauthd_tokshard_t	*shard;		// Token table shard
+  moauthd_token_t	*token,		// Current token
+			*next;		// Next token
+  moauthd_verstripe_t	*stripe;	// Verified token cache stripe
+  moauthd_verified_t	*verified,	// Current verified token
+			*vnext;		// Next verified token
+
+
+  for (i = MOAUTHD_VERIFY_STRIPES, stripe = server->verified; i > 0; i --, stripe ++)
+  {
+    for (verified = stripe->first; verified; verified = vnext)
+    {
+      vnext = verified->lru_next;
+      moauthdReleaseToken(verified->token);
+      free(verified);
+    }
+
+    cupsMutexDestroy(&stripe->lock);
+  }
+
+  for (i = 0; i <= MOAUTHD_TOKEN_SHARDS; i ++)
+  {
+    shard = i < MOAUTHD_TOKEN_SHARDS ? server->tokens + i : &server->grants;
+
+    for (j = 0; j < shard->num_buckets; j ++)
+    {
+      for (token = shard->buckets[j]; token; token = next)
+      {
+        next = token->next;
+        free_token(token);
+      }
+    }
+
+    free(shard->buckets);
+    free(shard->heap);
+    cupsRWDestroy(&shard->lock);
+  }
+
+  cupsArrayDelete(server->revoked);
+  free(server->revoked_bits);
+  cupsRWDestroy(&server->revoked_lock);
+}
+
+
+//
+// 'moauthdGetTokenStats()' - Get the number of live and reaped tokens and the
+//                            verified token cache counters.
+//
+
+void
+moauthdGetTokenStats(
+    moauthd_server_t   *server,		// I - Server object
+    moauthd_tokstats_t *stats)		// O - Token statistics
+{
+  int			i,		// Looping var
+			type;		// Token type
+  moauthd_tokshard_t	*shard;		// Token table shard
+
+
+  memset(stats, 0, sizeof(moauthd_tokstats_t));
+
+  for (i = 0; i <= MOAUTHD_TOKEN_SHARDS; i ++)
+  {
+    shard = i < MOAUTHD_TOKEN_SHARDS ? server->tokens + i : &server->grants;
+
+    cupsRWLockRead(&shard->lock);
+
+    for (type = 0; type < MOAUTHD_TOKTYPE_MAX; type ++)
+    {
+      stats->num_live[type]   += shard->num_live[type];
+      stats->num_reaped[type] += shard->num_reaped[type];
+    }
+
+    cupsRWUnlock(&shard->lock);
+  }
+
+  stats->verify_hits   = (size_t)moauthdGetMetric(server, MOAUTHD_METRIC_VERIFY_HITS);
+  stats->verify_misses = (size_t)moauthdGetMetric(server, MOAUTHD_METRIC_VERIFY_MISSES);
+}
+
+
+//
+// 'moauthdInitTokens()' - Initialize the token table.
+//
+// Tokens are spread over `MOAUTHD_TOKEN_SHARDS` independently locked hash
+// tables so that lookups and inserts on different tokens do not contend.
+// Grants use their own table.
+//
+
+void
+moauthdInitTokens(
+    moauthd_server_t *server)		// I - Server object
+{
+  int			i;		// Looping var
+  moauthd_tokshard_t	*shard;		// Token table shard
+  moauthd_verstripe_t	*stripe;	// Verified token cache stripe
+
+
+  for (i = 0; i <= MOAUTHD_TOKEN_SHARDS; i ++)
+  {
+    shard = i < MOAUTHD_TOKEN_SHARDS ? server->tokens + i : &server->grants;
+
+    cupsRWInit(&shard->lock);
+
+    shard->num_buckets = MOAUTHD_TOKEN_BUCKETS;
+    shard->num_tokens  = 0;
+    shard->buckets     = calloc(MOAUTHD_TOKEN_BUCKETS, sizeof(moauthd_token_t *));
+  }
+
+  for (i = MOAUTHD_VERIFY_STRIPES, stripe = server->verified; i > 0; i --, stripe ++)
+    cupsMutexInit(&stripe->lock);
+
+  cupsRWInit(&server->revoked_lock);
+
+  server->revoked      = cupsArrayNew((cups_array_cb_t)compare_revoked, NULL, NULL, 0, NULL, (cups_afree_cb_t)free_revoked);
+  server->revoked_bits = calloc(MOAUTHD_REVOKE_BITS / 64, sizeof(atomic_uint_least64_t));
+}
+
+
+//
+// 'moauthdReapTokens()' - Remove expired tokens from the server.
+//
+// Each shard keeps its tokens in a min-heap ordered by expiration time, so
+// only expired tokens are visited.  The shard lock is released after every
+// `MOAUTHD_REAP_BATCH` tokens so that lookups are never blocked for long.
+// Revoked stateless tokens are forgotten once they expire.
+//
+
+size_t					// O - Number of tokens reaped
+moauthdReapTokens(
+    moauthd_server_t *server,		// I - Server object
+    time_t           curtime)		// I - Current time
+{
+  int			i;		// Looping var
+  size_t		count,		// Number of tokens in batch
+			j,		// Looping var
+			total = 0;	// Total number of tokens reaped
+  moauthd_tokshard_t	*shard;		// Token table shard
+  moauthd_token_t	*batch[MOAUTHD_REAP_BATCH];
+					// Tokens to free
+
+
+  for (i = 0; i <= MOAUTHD_TOKEN_SHARDS; i ++)
+  {
+    shard = i < MOAUTHD_TOKEN_SHARDS ? server->tokens + i : &server->grants;
+
+    do
+    {
+      // Pull a batch of expired tokens from the shard...
+      cupsRWLockWrite(&shard->lock);
+
+      for (count = 0; count < MOAUTHD_REAP_BATCH && shard->num_tokens > 0 && shard->heap[0]->expires <= curtime; count ++)
+      {
+        batch[count] = shard->heap[0];
+        remove_token(shard, batch[count]);
+        shard->num_reaped[batch[count]->type] ++;
+      }
+
+      cupsRWUnlock(&shard->lock);
+
+      // Then free them outside the lock...
+      for (j = 0; j < count; j ++)
+        moauthdReleaseToken(batch[j]);
+
+      total += count;
+    }
+    while (count == MOAUTHD_REAP_BATCH);
+  }
+
+  if ((count = expire_revoked(server, curtime)) > 0)
+    moauthdLogs(server, MOAUTHD_LOGLEVEL_DEBUG, "Forgot %u expired revoked tokens.", (unsigned)count);
+
+  return (total);
+}
+
+
+//
+// 'moauthdReleaseToken()' - Release a reference to a token.
+//
+// The token is freed once it has been deleted from the server and all
+// references have been released.
+//
+
+void
+moauthdReleaseToken(
+    moauthd_token_t *token)		// I - Token or `NULL`
+{
+  if (token && atomic_fetch_sub(&token->refcount, 1) == 1)
+    free_token(token);
+}
+
+
+//
+// 'moauthdRevokeToken()' - Revoke a stateless access token.
+//
+// Revoked token IDs are kept in a small sorted list until the token expires.
+// A Bloom filter in front of the list lets `moauthdFindToken` skip the lock
+// for tokens that have not been revoked.
+//
+
+bool					// O - `true` if revoked, `false` if already revoked
+moauthdRevokeToken(
+    moauthd_server_t *server,		// I - Server object
+    const char       *jti,		// I - Unique ID of token
+    time_t           expires)		// I - When the token expires
+{
+  moauthd_revoked_t	key,		// Search key
+			*revoked;	// Revoked token
+  size_t		i,		// Looping var
+			bits[MOAUTHD_REVOKE_HASHES];
+					// Filter bits
+
+
+  key.jti = (char *)jti;
+
+  cupsRWLockWrite(&server->revoked_lock);
+
+  if (cupsArrayFind(server->revoked, &key) || (revoked = (moauthd_revoked_t *)calloc(1, sizeof(moauthd_revoked_t))) == NULL)
+  {
+    cupsRWUnlock(&server->revoked_lock);
+    return (false);
+  }
+
+  revoked->jti     = strdup(jti);
+  revoked->expires = expires;
+
+  cupsArrayAdd(server->revoked, revoked);
+
+  revoked_bits(jti, bits);
+  for (i = 0; i < MOAUTHD_REVOKE_HASHES; i ++)
+    atomic_fetch_or(server->revoked_bits + bits[i] / 64, (uint64_t)1 << (bits[i] & 63));
+
+  cupsRWUnlock(&server->revoked_lock);
+
+  moauthdJournalRevokeToken(server, jti, expires);
+
+  return (true);
+}
+
+
+//
+// 'add_token()' - Add a token to a shard.
+//
+// The caller must hold the shard's write lock.
+//
+
+static bool				// O - `true` on success, `false` on error
+add_token(moauthd_tokshard_t *shard,	// I - Token table shard
+          moauthd_token_t    *token)	// I - Token
+{
+  moauthd_token_t	**bucket;	// Hash bucket
+
+
+  // Make room in the expiration heap...
+  if (shard->num_tokens >= shard->heap_alloc)
+  {
+    size_t		heap_alloc;	// New heap size
+    moauthd_token_t	**heap;		// New heap
+
+    heap_alloc = shard->heap_alloc ? 2 * shard->heap_alloc : MOAUTHD_TOKEN_BUCKETS;
+
+    if ((heap = realloc(shard->heap, heap_alloc * sizeof(moauthd_token_t *))) == NULL)
+      return (false);
+
+    shard->heap       = heap;
+    shard->heap_alloc = heap_alloc;
+  }
+
+  if (shard->num_tokens >= 2 * shard->num_buckets)
+    resize_shard(shard);
+
+  // Add to the hash bucket and heap...
+  bucket      = shard->buckets + ((token->hash / MOAUTHD_TOKEN_SHARDS) & (shard->num_buckets - 1));
+  token->next = *bucket;
+  *bucket     = token;
+
+  token->heap_index              = shard->num_tokens;
+  shard->heap[shard->num_tokens] = token;
+  shard->num_tokens ++;
+  shard->num_live[token->type] ++;
+
+  heap_up(shard, token->heap_index);
+
+  return (true);
+}
+
+
+//
+// 'add_verified()' - Add a verified stateless token to the cache.
+//
+// The cache holds its own reference to the token.  The least recently used
+// token in the stripe is evicted when the stripe is full.
+//
+
+static void
+add_verified(
+    moauthd_server_t    *server,	// I - Server object
+    const unsigned char *digest,	// I - SHA-256 digest of token string
+    moauthd_token_t     *token)		// I - Verified token
+{
+  moauthd_verstripe_t	*stripe;	// Cache stripe
+  moauthd_verified_t	**bucket,	// Hash bucket
+			*verified,	// New cache entry
+			*match,		// Existing cache entry
+			*evicted = NULL;// Evicted cache entry
+
+
+  if ((verified = (moauthd_verified_t *)calloc(1, sizeof(moauthd_verified_t))) == NULL)
+    return;
+
+  memcpy(verified->digest, digest, sizeof(verified->digest));
+  verified->token = token;
+
+  stripe = server->verified + (digest[0] & (MOAUTHD_VERIFY_STRIPES - 1));
+  bucket = stripe->buckets + ((((size_t)digest[1] << 8) | digest[2]) & (MOAUTHD_VERIFY_ENTRIES - 1));
+
+  cupsMutexLock(&stripe->lock);
+
+  for (match = *bucket; match; match = match->next)
+  {
+    if (!memcmp(match->digest, digest, sizeof(match->digest)))
+      break;
+  }
+
+  if (match)
+  {
+    // Another thread verified the same token...
+    cupsMutexUnlock(&stripe->lock);
+    free(verified);
+    return;
+  }
+
+  if (stripe->count >= MOAUTHD_VERIFY_ENTRIES)
+  {
+    evicted = stripe->last;
+    remove_verified(stripe, evicted);
+  }
+
+  atomic_fetch_add(&token->refcount, 1);
+
+  verified->next     = *bucket;
+  *bucket            = verified;
+  verified->lru_next = stripe->first;
+
+  if (stripe->first)
+    stripe->first->lru_prev = verified;
+  else
+    stripe->last = verified;
+
+  stripe->first = verified;
+  stripe->count ++;
+
+  cupsMutexUnlock(&stripe->lock);
+
+  if (evicted)
+  {
+    moauthdReleaseToken(evicted->token);
+    free(evicted);
+  }
+}
+
+
+//
+// 'compare_revoked()' - Compare two revoked tokens.
 //
 
 static int				// O - Result of comparison
-compare_tokens(moauthd_token_t *a,	// I - First token
-               moauthd_token_t *b,	// I - Second token
-               void            *data)	// I - Callback data (unused)
+compare_revoked(moauthd_revoked_t *a,	// I - First revoked token
+                moauthd_revoked_t *b,	// I - Second revoked token
+                void              *data)// I - Callback data (unused)
 {
   (void)data;
 
-  return (strcmp(a->token, b->token));
+  return (strcmp(a->jti, b->jti));
 }
 
 
 //
-// 'free_token()' - Free the memory used by a token.
+// 'expire_revoked()' - Forget revoked tokens that have expired.
+//
+// The Bloom filter is rebuilt from the remaining tokens.  Each word is
+// replaced with a superset of the bits still needed, so lock-free readers
+// never miss a token that is still revoked.
+//
+
+static size_t				// O - Number of tokens forgotten
+expire_revoked(
+    moauthd_server_t *server,		// I - Server object
+    time_t           curtime)		// I - Current time
+{
+  moauthd_revoked_t	*revoked;	// Current revoked token
+  size_t		count = 0,	// Number of tokens forgotten
+			i,		// Looping var
+			bits[MOAUTHD_REVOKE_HASHES];
+					// Filter bits
+  uint64_t		*words;		// New filter words
+
+
+  cupsRWLockWrite(&server->revoked_lock);
+
+  for (revoked = (moauthd_revoked_t *)cupsArrayGetFirst(server->revoked); revoked; revoked = (moauthd_revoked_t *)cupsArrayGetNext(server->revoked))
+  {
+    if (revoked->expires <= curtime)
+    {
+      cupsArrayRemove(server->revoked, revoked);
+      count ++;
+    }
+  }
+
+  if (count > 0 && (words = calloc(MOAUTHD_REVOKE_BITS / 64, sizeof(uint64_t))) != NULL)
+  {
+    for (revoked = (moauthd_revoked_t *)cupsArrayGetFirst(server->revoked); revoked; revoked = (moauthd_revoked_t *)cupsArrayGetNext(server->revoked))
+    {
+      revoked_bits(revoked->jti, bits);
+      for (i = 0; i < MOAUTHD_REVOKE_HASHES; i ++)
+        words[bits[i] / 64] |= (uint64_t)1 << (bits[i] & 63);
+    }
+
+    for (i = 0; i < MOAUTHD_REVOKE_BITS / 64; i ++)
+      atomic_store(server->revoked_bits + i, words[i]);
+
+    free(words);
+  }
+
+  cupsRWUnlock(&server->revoked_lock);
+
+  return (count);
+}
+
+
+//
+// 'find_verified()' - Find a verified stateless token in the cache.
+//
+// The returned token holds a reference that must be released using
+// `moauthdReleaseToken`.  Expired tokens are removed from the cache.
+//
+
+static moauthd_token_t *		// O - Token or `NULL` if not cached
+find_verified(
+    moauthd_server_t    *server,	// I - Server object
+    const unsigned char *digest,	// I - SHA-256 digest of token string
+    time_t              curtime)	// I - Current time
+{
+  moauthd_verstripe_t	*stripe;	// Cache stripe
+  moauthd_verified_t	*verified;	// Cache entry
+  moauthd_token_t	*token = NULL;	// Token
+
+
+  stripe = server->verified + (digest[0] & (MOAUTHD_VERIFY_STRIPES - 1));
+
+  cupsMutexLock(&stripe->lock);
+
+  for (verified = stripe->buckets[(((size_t)digest[1] << 8) | digest[2]) & (MOAUTHD_VERIFY_ENTRIES - 1)]; verified; verified = verified->next)
+  {
+    if (!memcmp(verified->digest, digest, sizeof(verified->digest)))
+      break;
+  }
+
+  if (verified && verified->token->expires <= curtime)
+  {
+    // Expired, remove from the cache...
+    remove_verified(stripe, verified);
+    cupsMutexUnlock(&stripe->lock);
+
+    moauthdReleaseToken(verified->token);
+    free(verified);
+
+    return (NULL);
+  }
+  else if (verified)
+  {
+    if (verified != stripe->first)
+    {
+      // Move to the front of the LRU list...
+      verified->lru_prev->lru_next = verified->lru_next;
+
+      if (verified->lru_next)
+        verified->lru_next->lru_prev = verified->lru_prev;
+      else
+        stripe->last = verified->lru_prev;
+
+      verified->lru_prev      = NULL;
+      verified->lru_next      = stripe->first;
+      stripe->first->lru_prev = verified;
+      stripe->first           = verified;
+    }
+
+    token = verified->token;
+    atomic_fetch_add(&token->refcount, 1);
+  }
+
+  cupsMutexUnlock(&stripe->lock);
+
+  return (token);
+}
+
+
+//
+// 'free_revoked()' - Free the memory used by a revoked token.
 //
 
 static void
-free_token(moauthd_token_t *token,	// I - Token to free
-           void            *data)	// I - Callback data (unused)
+free_revoked(moauthd_revoked_t *revoked,// I - Revoked token
+             void              *data)	// I - Callback data (unused)
 {
   (void)data;
 
+  free(revoked->jti);
+  free(revoked);
+}
+
+
+//
+// 'free_token()' - Free the memory used by a token.
+//
+
+static void
+free_token(moauthd_token_t *token)	// I - Token to free
+{
   if (token->challenge)
     free(token->challenge);
+  free(token->jti);
+  free(token->client_id);
   free(token->token);
   free(token->user);
   free(token->scopes);
-  cupsArrayDelete(token->scopes_array);
+  moauthdReleaseIdent(token->identity);
   free(token);
 }
+
+
+//
+// 'get_shard()' - Get the table shard for a token.
+//
+// Grant codes never contain a "." while JWTs always do.
+//
+
+static moauthd_tokshard_t *		// O - Token table shard
+get_shard(moauthd_server_t *server,	// I - Server object
+          uint64_t         hash,	// I - Hash of token string
+          const char       *token_id)	// I - Token string
+{
+  if (strchr(token_id, '.'))
+    return (server->tokens + (hash & (MOAUTHD_TOKEN_SHARDS - 1)));
+  else
+    return (&server->grants);
+}
+
+
+//
+// 'get_user_ids()' - Get the identity of a token's user.
+//
+// The identity, including the group list, is kept with the token so that
+// Bearer authentication does not need to look up the user again.
+//
+
+static void
+get_user_ids(moauthd_server_t *server,	// I - Server object
+             moauthd_token_t  *token)	// I - Token
+{
+  if ((token->identity = moauthdFindUser(server, token->user)) != NULL)
+  {
+    token->uid = token->identity->uid;
+    token->gid = token->identity->gid;
+  }
+  else
+  {
+    token->uid = (uid_t)-1;
+    token->gid = (gid_t)-1;
+  }
+}
+
+
+//
+// 'hash_token()' - Compute the 64-bit FNV-1a hash of a token string.
+//
+
+static uint64_t				// O - Hash value
+hash_token(const char *s)		// I - Token string
+{
+  uint64_t	hash = 0xcbf29ce484222325ULL;
+					// Hash value
+
+
+  while (*s)
+  {
+    hash ^= (uint64_t)(*s++ & 255);
+    hash *= 0x100000001b3ULL;
+  }
+
+  return (hash);
+}
+
+
+//
+// 'heap_down()' - Move a heap entry down to its proper position.
+//
+
+static void
+heap_down(moauthd_tokshard_t *shard,	// I - Token table shard
+          size_t             i)		// I - Heap index
+{
+  size_t		child;		// Child index
+  moauthd_token_t	*token = shard->heap[i];
+					// Token being moved
+
+
+  while ((child = 2 * i + 1) < shard->num_tokens)
+  {
+    if (child + 1 < shard->num_tokens && shard->heap[child + 1]->expires < shard->heap[child]->expires)
+      child ++;
+
+    if (shard->heap[child]->expires >= token->expires)
+      break;
+
+    shard->heap[i]             = shard->heap[child];
+    shard->heap[i]->heap_index = i;
+    i                          = child;
+  }
+
+  shard->heap[i]    = token;
+  token->heap_index = i;
+}
+
+
+//
+// 'heap_up()' - Move a heap entry up to its proper position.
+//
+
+static void
+heap_up(moauthd_tokshard_t *shard,	// I - Token table shard
+        size_t             i)		// I - Heap index
+{
+  size_t		parent;		// Parent index
+  moauthd_token_t	*token = shard->heap[i];
+					// Token being moved
+
+
+  while (i > 0)
+  {
+    parent = (i - 1) / 2;
+
+    if (shard->heap[parent]->expires <= token->expires)
+      break;
+
+    shard->heap[i]             = shard->heap[parent];
+    shard->heap[i]->heap_index = i;
+    i                          = parent;
+  }
+
+  shard->heap[i]    = token;
+  token->heap_index = i;
+}
+
+
+//
+// 'is_revoked()' - Check whether a stateless access token has been revoked.
+//
+
+static bool				// O - `true` if revoked, `false` otherwise
+is_revoked(moauthd_server_t *server,	// I - Server object
+           const char       *jti)	// I - Unique ID of token
+{
+  size_t		i,		// Looping var
+			bits[MOAUTHD_REVOKE_HASHES];
+					// Filter bits
+  moauthd_revoked_t	key;		// Search key
+  bool			revoked;	// Is the token revoked?
+
+
+  // Check the Bloom filter first - most tokens are not revoked...
+  revoked_bits(jti, bits);
+  for (i = 0; i < MOAUTHD_REVOKE_HASHES; i ++)
+  {
+    if (!(atomic_load_explicit(server->revoked_bits + bits[i] / 64, memory_order_relaxed) & ((uint64_t)1 << (bits[i] & 63))))
+      return (false);
+  }
+
+  // Then the list of revoked tokens...
+  key.jti = (char *)jti;
+
+  cupsRWLockRead(&server->revoked_lock);
+  revoked = cupsArrayFind(server->revoked, &key) != NULL;
+  cupsRWUnlock(&server->revoked_lock);
+
+  return (revoked);
+}
+
+
+//
+// 'remove_token()' - Remove a token from a shard.
+//
+// The caller must hold the shard's write lock.
+//
+
+static bool				// O - `true` if removed, `false` if not found
+remove_token(moauthd_tokshard_t *shard,	// I - Token table shard
+             moauthd_token_t    *token)	// I - Token
+{
+  moauthd_token_t	**bucket;	// Pointer to token in bucket
+  size_t		i;		// Heap index
+
+
+  for (bucket = shard->buckets + ((token->hash / MOAUTHD_TOKEN_SHARDS) & (shard->num_buckets - 1)); *bucket; bucket = &((*bucket)->next))
+  {
+    if (*bucket == token)
+      break;
+  }
+
+  if (!*bucket)
+    return (false);			// Not in this shard
+
+  *bucket = token->next;
+
+  // Replace the heap entry with the last one and restore the heap order...
+  shard->num_tokens --;
+  shard->num_live[token->type] --;
+
+  if ((i = token->heap_index) < shard->num_tokens)
+  {
+    moauthd_token_t *last = shard->heap[shard->num_tokens];
+					// Last token in heap
+
+    shard->heap[i]   = last;
+    last->heap_index = i;
+
+    heap_up(shard, i);
+    heap_down(shard, last->heap_index);
+  }
+
+  return (true);
+}
+
+
+//
+// 'remove_verified()' - Remove an entry from a verified token cache stripe.
+//
+// The caller must hold the stripe's lock and release the entry's token.
+//
+
+static void
+remove_verified(
+    moauthd_verstripe_t *stripe,	// I - Cache stripe
+    moauthd_verified_t  *verified)	// I - Cache entry
+{
+  moauthd_verified_t	**bucket;	// Pointer to entry in bucket
+
+
+  for (bucket = stripe->buckets + ((((size_t)verified->digest[1] << 8) | verified->digest[2]) & (MOAUTHD_VERIFY_ENTRIES - 1)); *bucket; bucket = &((*bucket)->next))
+  {
+    if (*bucket == verified)
+    {
+      *bucket = verified->next;
+      break;
+    }
+  }
+
+  if (verified->lru_prev)
+    verified->lru_prev->lru_next = verified->lru_next;
+  else
+    stripe->first = verified->lru_next;
+
+  if (verified->lru_next)
+    verified->lru_next->lru_prev = verified->lru_prev;
+  else
+    stripe->last = verified->lru_prev;
+
+  stripe->count --;
+}
+
+
+//
+// 'resize_shard()' - Double the number of buckets in a shard.
+//
+// The caller must hold the shard's write lock.
+//
+
+static void
+resize_shard(moauthd_tokshard_t *shard)	// I - Token table shard
+{
+  size_t		i,		// Looping var
+			num_buckets;	// New number of buckets
+  moauthd_token_t	**buckets,	// New buckets
+			*token,		// Current token
+			*next;		// Next token
+
+
+  num_buckets = 2 * shard->num_buckets;
+
+  if ((buckets = calloc(num_buckets, sizeof(moauthd_token_t *))) == NULL)
+    return;				// Keep using the current buckets
+
+  for (i = 0; i < shard->num_buckets; i ++)
+  {
+    for (token = shard->buckets[i]; token; token = next)
+    {
+      moauthd_token_t **bucket = buckets + ((token->hash / MOAUTHD_TOKEN_SHARDS) & (num_buckets - 1));
+					// New bucket
+
+      next        = token->next;
+      token->next = *bucket;
+      *bucket     = token;
+    }
+  }
+
+  free(shard->buckets);
+
+  shard->buckets     = buckets;
+  shard->num_buckets = num_buckets;
+}
+
+
+//
+// 'revoked_bits()' - Compute the Bloom filter bits for a token ID.
+//
+
+static void
+revoked_bits(
+    const char *jti,			// I - Unique ID of token
+    size_t     bits[MOAUTHD_REVOKE_HASHES])
+					// O - Filter bits
+{
+  uint64_t	hash,			// Hash of token ID
+		step;			// Step between bits
+  size_t	i;			// Looping var
+
+
+  hash = hash_token(jti);
+  step = (hash >> 32) | 1;
+
+  for (i = 0; i < MOAUTHD_REVOKE_HASHES; i ++, hash += step)
+    bits[i] = (size_t)(hash & (MOAUTHD_REVOKE_BITS - 1));
+}
+
+
+//
+// 'verify_token()' - Validate a stateless access token.
+//
+// The token is accepted if it has a "jti" claim, a valid signature, and has
+// not been revoked.  The returned token is not added to the token table.
+// Tokens are cached by the SHA-256 digest of the token string so that repeat
+// presentations skip the signature check.
+//
+
+static moauthd_token_t *		// O - Token or `NULL` if not a valid stateless token
+verify_token(
+    moauthd_server_t *server,		// I - Server object
+    const char       *token_id)		// I - Token string
+{
+  cups_jwt_t		*jwt;		// JWT
+  const char		*jti,		// Unique ID of token
+			*user,		// Authenticated user
+			*scopes,	// Scopes
+			*client_id;	// Client ID, if any
+  moauthd_token_t	*token = NULL;	// Token
+  unsigned char		digest[32];	// SHA-256 digest of token string
+  bool			cache;		// Use the verified token cache?
+
+
+  cache = cupsHashData("sha2-256", token_id, strlen(token_id), digest, sizeof(digest)) == (ssize_t)sizeof(digest);
+
+  if (cache && (token = find_verified(server, digest, time(NULL))) != NULL)
+  {
+    moauthdCountMetric(server, MOAUTHD_METRIC_VERIFY_HITS);
+
+    if (!is_revoked(server, token->jti))
+      return (token);
+
+    moauthdReleaseToken(token);
+    return (NULL);
+  }
+
+  if ((jwt = cupsJWTImportString(token_id, CUPS_JWS_FORMAT_COMPACT)) == NULL)
+    return (NULL);
+
+  jti       = cupsJWTGetClaimString(jwt, "jti");
+  user      = cupsJWTGetClaimString(jwt, "iss");
+  scopes    = cupsJWTGetClaimString(jwt, "scope");
+  client_id = cupsJWTGetClaimString(jwt, "client_id");
+
+  if (!jti || !user || !scopes)
+    goto done;
+
+  moauthdCountMetric(server, MOAUTHD_METRIC_VERIFY_MISSES);
+
+  if (cupsJWTGetAlgorithm(jwt) != server->signing_alg || !cupsJWTHasValidSignature(jwt, server->private_key) || is_revoked(server, jti))
+    goto done;
+
+  if ((token = (moauthd_token_t *)calloc(1, sizeof(moauthd_token_t))) == NULL)
+    goto done;
+
+  token->refcount     = 1;		// Caller
+  token->type         = MOAUTHD_TOKTYPE_ACCESS;
+  token->token        = strdup(token_id);
+  token->jti          = strdup(jti);
+  token->user         = strdup(user);
+  token->client_id    = client_id ? strdup(client_id) : NULL;
+  token->application  = client_id ? moauthdFindApplication(server, client_id, NULL) : NULL;
+  token->scopes       = strdup(scopes);
+  token->scope_bits   = moauthdGetScopes(server, scopes);
+  token->created      = (time_t)cupsJWTGetClaimNumber(jwt, "iat");
+  token->expires      = (time_t)cupsJWTGetClaimNumber(jwt, "exp");
+  token->hash         = hash_token(token_id);
+
+  get_user_ids(server, token);
+
+  if (cache && token->expires > time(NULL))
+    add_verified(server, digest, token);
+
+  done:
+
+  cupsJWTDelete(jwt);
+
+  return (token);
+}
@@ -0,0 +1,359 @@
+//
+// User and group identity cache for moauth daemon
+//
+// Copyright © 2026 by Michael R Sweet
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#include "moauthd.h"
+#include <pwd.h>
+#include <grp.h>
+
+
+//
+// Local functions...
+//
+
+static moauthd_ident_t *cache_ident(moauthd_server_t *server, cups_array_t **idents, moauthd_ident_t *ident, time_t curtime);
+static int	compare_gids(const gid_t *a, const gid_t *b);
+static int	compare_idents(moauthd_ident_t *a, moauthd_ident_t *b, void *data);
+static moauthd_ident_t *find_ident(moauthd_server_t *server, cups_array_t **idents, const char *name, time_t curtime, bool *found);
+static moauthd_ident_t *lookup_group(const char *name);
+static moauthd_ident_t *lookup_user(moauthd_server_t *server, const char *name);
+
+
+//
+// 'moauthdFindGroup()' - Find the group ID for a named group.
+//
+// Group IDs are cached for `UserCacheLife` seconds.  Unknown groups are
+// cached for up to `MOAUTHD_IDENT_NEGATIVE` seconds.
+//
+
+gid_t					// O - Group ID or `(gid_t)-1` if not found
+moauthdFindGroup(
+    moauthd_server_t *server,		// I - Server object
+    const char       *name)		// I - Group name
+{
+  moauthd_ident_t	*group;		// Group identity
+  gid_t			gid;		// Group ID
+  bool			found;		// Was the group cached?
+  time_t		curtime = time(NULL);
+					// Current time
+
+
+  group = find_ident(server, &server->groups, name, curtime, &found);
+
+  if (!found && (group = cache_ident(server, &server->groups, lookup_group(name), curtime)) == NULL)
+    return ((gid_t)-1);
+
+  gid = group->found ? group->gid : (gid_t)-1;
+
+  moauthdReleaseIdent(group);
+
+  return (gid);
+}
+
+
+//
+// 'moauthdFindUser()' - Find the identity of a named user.
+//
+// User identities are cached for `UserCacheLife` seconds.  Unknown users are
+// cached for up to `MOAUTHD_IDENT_NEGATIVE` seconds.  The returned identity
+// must be released using `moauthdReleaseIdent`.
+//
+
+moauthd_ident_t *			// O - User identity or `NULL` if not found
+moauthdFindUser(
+    moauthd_server_t *server,		// I - Server object
+    const char       *name)		// I - Username
+{
+  moauthd_ident_t	*user;		// User identity
+  bool			found;		// Was the user cached?
+  time_t		curtime = time(NULL);
+					// Current time
+
+
+  user = find_ident(server, &server->users, name, curtime, &found);
+
+  if (!found)
+    user = cache_ident(server, &server->users, lookup_user(server, name), curtime);
+
+  if (user && !user->found)
+  {
+    moauthdReleaseIdent(user);
+    user = NULL;
+  }
+
+  return (user);
+}
+
+
+//
+// 'moauthdHasGroup()' - Determine whether a user is a member of a group.
+//
+
+bool					// O - `true` if a member, `false` otherwise
+moauthdHasGroup(
+    moauthd_ident_t *ident,		// I - User identity or `NULL`
+    gid_t           gid)		// I - Group ID
+{
+  if (!ident || !ident->num_gids || gid == (gid_t)-1)
+    return (false);
+
+  return (bsearch(&gid, ident->gids, (size_t)ident->num_gids, sizeof(ident->gids[0]), (int (*)(const void *, const void *))compare_gids) != NULL);
+}
+
+
+//
+// 'moauthdReleaseIdent()' - Release a reference to a user or group identity.
+//
+
+void
+moauthdReleaseIdent(
+    moauthd_ident_t *ident)		// I - User or group identity
+{
+  if (ident && atomic_fetch_sub(&ident->refcount, 1) == 1)
+  {
+    free(ident->name);
+    free(ident->gecos);
+    free(ident->gids);
+    free(ident);
+  }
+}
+
+
+//
+// 'cache_ident()' - Add a user or group identity to the cache.
+//
+// When the cache is full, the entry that expires first is replaced.  The
+// returned identity holds a reference for the caller.
+//
+
+static moauthd_ident_t *		// O - Identity or `NULL` on error
+cache_ident(moauthd_server_t *server,	// I - Server object
+            cups_array_t     **idents,	// IO - Cached identities
+            moauthd_ident_t  *ident,	// I - New identity
+            time_t           curtime)	// I - Current time
+{
+  moauthd_ident_t	*current,	// Current cached identity
+			*oldest = NULL;	// First identity to expire
+
+
+  if (!ident)
+    return (NULL);
+
+  if (ident->found)
+    ident->expires = curtime + server->user_cache_life;
+  else if (server->user_cache_life < MOAUTHD_IDENT_NEGATIVE)
+    ident->expires = curtime + server->user_cache_life;
+  else
+    ident->expires = curtime + MOAUTHD_IDENT_NEGATIVE;
+
+  if (server->user_cache_life <= 0 || server->user_cache_size == 0)
+    return (ident);
+
+  cupsMutexLock(&server->users_lock);
+
+  if (!*idents)
+    *idents = cupsArrayNew((cups_array_cb_t)compare_idents, NULL, NULL, 0, NULL, (cups_afree_cb_t)moauthdReleaseIdent);
+
+  if ((current = (moauthd_ident_t *)cupsArrayFind(*idents, ident)) != NULL)
+  {
+    // Replace the stale entry...
+    cupsArrayRemove(*idents, current);
+  }
+  else if (cupsArrayGetCount(*idents) >= server->user_cache_size)
+  {
+    // Make room...
+    for (current = (moauthd_ident_t *)cupsArrayGetFirst(*idents); current; current = (moauthd_ident_t *)cupsArrayGetNext(*idents))
+    {
+      if (!oldest || current->expires < oldest->expires)
+        oldest = current;
+    }
+
+    cupsArrayRemove(*idents, oldest);
+  }
+
+  atomic_fetch_add(&ident->refcount, 1);
+  cupsArrayAdd(*idents, ident);
+
+  cupsMutexUnlock(&server->users_lock);
+
+  return (ident);
+}
+
+
+//
+// 'compare_gids()' - Compare two group IDs.
+//
+
+static int				// O - Result of comparison
+compare_gids(const gid_t *a,		// I - First group ID
+             const gid_t *b)		// I - Second group ID
+{
+  if (*a < *b)
+    return (-1);
+  else if (*a > *b)
+    return (1);
+  else
+    return (0);
+}
+
+
+//
+// 'compare_idents()' - Compare two user or group identities.
+//
+
+static int				// O - Result of comparison
+compare_idents(moauthd_ident_t *a,	// I - First identity
+               moauthd_ident_t *b,	// I - Second identity
+               void            *data)	// I - Callback data (unused)
+{
+  (void)data;
+
+  return (strcmp(a->name, b->name));
+}
+
+
+//
+// 'find_ident()' - Find an unexpired user or group identity in the cache.
+//
+
+static moauthd_ident_t *		// O - Identity or `NULL`
+find_ident(moauthd_server_t *server,	// I - Server object
+           cups_array_t     **idents,	// I - Cached identities
+           const char       *name,	// I - User or group name
+           time_t           curtime,	// I - Current time
+           bool             *found)	// O - `true` if found in cache
+{
+  moauthd_ident_t	key,		// Search key
+			*ident;		// Matching identity
+
+
+  key.name = (char *)name;
+
+  cupsMutexLock(&server->users_lock);
+
+  if ((ident = (moauthd_ident_t *)cupsArrayFind(*idents, &key)) != NULL && ident->expires > curtime)
+    atomic_fetch_add(&ident->refcount, 1);
+  else
+    ident = NULL;
+
+  cupsMutexUnlock(&server->users_lock);
+
+  if (ident)
+    moauthdCountMetric(server, MOAUTHD_METRIC_USER_CACHE_HITS);
+  else
+    moauthdCountMetric(server, MOAUTHD_METRIC_USER_CACHE_MISSES);
+
+  *found = ident != NULL;
+
+  return (ident);
+}
+
+
+//
+// 'lookup_group()' - Look up a group using the system group database.
+//
+
+static moauthd_ident_t *		// O - New identity or `NULL` on error
+lookup_group(const char *name)		// I - Group name
+{
+  moauthd_ident_t	*group;		// Group identity
+  struct group		grp,		// Group record
+			*grpresult = NULL;
+					// Found group
+  char			grpbuffer[8192];// Group buffer
+
+
+  if ((group = (moauthd_ident_t *)calloc(1, sizeof(moauthd_ident_t))) == NULL)
+    return (NULL);
+
+  group->refcount = 1;			// Caller
+  group->name     = strdup(name);
+  group->uid      = (uid_t)-1;
+  group->gid      = (gid_t)-1;
+
+  if (!getgrnam_r(name, &grp, grpbuffer, sizeof(grpbuffer), &grpresult) && grpresult)
+  {
+    group->found = true;
+    group->gid   = grpresult->gr_gid;
+  }
+
+  return (group);
+}
+
+
+//
+// 'lookup_user()' - Look up a user using the system user database.
+//
+
+static moauthd_ident_t *		// O - New identity or `NULL` on error
+lookup_user(moauthd_server_t *server,	// I - Server object
+            const char       *name)	// I - Username
+{
+  moauthd_ident_t	*user;		// User identity
+  void			*gids;		// New group list
+  int			alloc_gids,	// Groups to allocate
+			num_alloc = 0,	// Allocated groups
+			i;		// Looping var
+  struct passwd		pw,		// User record
+			*pwresult = NULL;
+					// Found user
+  char			pwbuffer[16384];// User buffer
+
+
+  if ((user = (moauthd_ident_t *)calloc(1, sizeof(moauthd_ident_t))) == NULL)
+    return (NULL);
+
+  user->refcount = 1;			// Caller
+  user->name     = strdup(name);
+  user->uid      = (uid_t)-1;
+  user->gid      = (gid_t)-1;
+
+  if (!getpwnam_r(name, &pw, pwbuffer, sizeof(pwbuffer), &pwresult) && pwresult)
+  {
+    user->found    = true;
+    user->uid      = pwresult->pw_uid;
+    user->gid      = pwresult->pw_gid;
+    user->gecos    = strdup(pwresult->pw_gecos ? pwresult->pw_gecos : "");
+
+    // Get the group list, growing the buffer as needed...
+    for (alloc_gids = 32; alloc_gids <= 65536; alloc_gids *= 2)
+    {
+      if ((gids = realloc(user->gids, (size_t)alloc_gids * sizeof(user->gids[0]))) == NULL)
+        break;
+
+      user->gids     = gids;
+      user->num_gids = num_alloc = alloc_gids;
+
+#ifdef __APPLE__
+      if (getgrouplist(name, (int)user->gid, user->gids, &user->num_gids) >= 0)
+#else
+      if (getgrouplist(name, user->gid, user->gids, &user->num_gids) >= 0)
+#endif // __APPLE__
+        break;
+    }
+
+    // Only use the groups that fit in the buffer, which may be smaller than
+    // the number of groups getgrouplist asked for...
+    if (user->num_gids > num_alloc)
+      user->num_gids = num_alloc;
+    else if (user->num_gids < 0 || !user->gids)
+      user->num_gids = 0;
+
+    if (user->num_gids > 1)
+      qsort(user->gids, (size_t)user->num_gids, sizeof(user->gids[0]), (int (*)(const void *, const void *))compare_gids);
+
+    // Get the group scopes for the user...
+    for (i = MOAUTHD_SCOPE_SHARED + 1; i < server->num_scopes && i < MOAUTHD_SCOPE_BITS; i ++)
+    {
+      if (moauthdHasGroup(user, server->scope_gids[i]))
+        user->scopes |= 1ULL << i;
+    }
+  }
+
+  return (user);
+}
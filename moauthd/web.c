@@ -14,6 +14,7 @@
 // Local functions...
 //
 
+static void	get_allow(moauthd_client_t *client, char *buffer, size_t bufsize);
 static void	html_escape(moauthd_client_t *client, const char *s, size_t slen);
 
 
@@ -30,7 +31,9 @@ moauthdHTMLFooter(moauthd_client_t *client)	// I - Client
       "    </div>\n"
       "  </body>\n"
       "</html>\n");
-  httpWrite(client->http, "", 0);
+
+  if (!client->output)
+    moauthdWriteClient(client, "", 0);
 }
 
 
@@ -88,14 +91,14 @@ moauthdHTMLPrintf(
     if (*format == '%')
     {
       if (format > start)
-        httpWrite(client->http, start, (size_t)(format - start));
+        moauthdWriteClient(client, start, (size_t)(format - start));
 
       tptr    = tformat;
       *tptr++ = *format++;
 
       if (*format == '%')
       {
-        httpWrite(client->http, "%", 1);
+        moauthdWriteClient(client, "%", 1);
         format ++;
 	start = format;
 	continue;
@@ -203,7 +206,7 @@ moauthdHTMLPrintf(
 
 	    sprintf(temp, tformat, va_arg(ap, double));
 
-            httpWrite(client->http, temp, strlen(temp));
+            moauthdWriteClient(client, temp, strlen(temp));
 	    break;
 
         case 'B' : // Integer formats
@@ -222,7 +225,7 @@ moauthdHTMLPrintf(
 	    else
 	      sprintf(temp, tformat, va_arg(ap, int));
 
-            httpWrite(client->http, temp, strlen(temp));
+            moauthdWriteClient(client, temp, strlen(temp));
 	    break;
 
 	case 's' : // String
@@ -238,7 +241,7 @@ moauthdHTMLPrintf(
   }
 
   if (format > start)
-    httpWrite(client->http, start, (size_t)(format - start));
+    moauthdWriteClient(client, start, (size_t)(format - start));
 
   va_end(ap);
 }
@@ -257,7 +260,9 @@ moauthdRespondClient(
     time_t           mtime,		// I - Last modified date and time
     size_t           length)		// I - Length of response or 0 for chunked
 {
-  char	message[1024];			// Text message
+  char		message[1024];		// Text message
+  uint64_t	start;			// Start of write
+  bool		ret;			// Return value
 
 
   moauthdLogc(client, MOAUTHD_LOGLEVEL_INFO, "HTTP/1.1 %d %s", code, httpStatusString(code));
@@ -268,8 +273,12 @@ moauthdRespondClient(
     return (httpWriteResponse(client->http, HTTP_STATUS_CONTINUE));
   }
 
+  // The request has been read, only the I/O timeout applies to the response...
+  client->deadline        = 0;
+  client->response_status = code;
+
   // Format an error message...
-  if (!type && !length && code != HTTP_STATUS_OK && code != HTTP_STATUS_SWITCHING_PROTOCOLS)
+  if (!type && !length && code != HTTP_STATUS_OK && code != HTTP_STATUS_SWITCHING_PROTOCOLS && code != HTTP_STATUS_NOT_MODIFIED)
   {
     snprintf(message, sizeof(message), "%d - %s\n", code, httpStatusString(code));
 
@@ -285,7 +294,15 @@ moauthdRespondClient(
   httpClearFields(client->http);
 
   if (code == HTTP_STATUS_METHOD_NOT_ALLOWED || client->request_method == HTTP_STATE_OPTIONS)
-    httpSetField(client->http, HTTP_FIELD_ALLOW, "GET, HEAD, OPTIONS, POST");
+  {
+    char allow[256];			// Allow: header value
+
+    get_allow(client, allow, sizeof(allow));
+    httpSetField(client->http, HTTP_FIELD_ALLOW, allow);
+  }
+
+  if (code == HTTP_STATUS_SERVICE_UNAVAILABLE)
+    httpSetField(client->http, HTTP_FIELD_RETRY_AFTER, "1");
 
   if (code == HTTP_STATUS_UNAUTHORIZED || code == HTTP_STATUS_FORBIDDEN)
   {
@@ -295,6 +312,18 @@ moauthdRespondClient(
       httpSetField(client->http, HTTP_FIELD_WWW_AUTHENTICATE, "Bearer realm=\"mOAuth\"");
   }
 
+  if (client->accept_ranges)
+  {
+    httpSetField(client->http, HTTP_FIELD_ACCEPT_RANGES, "bytes");
+    client->accept_ranges = false;
+  }
+
+  if (client->content_range[0])
+  {
+    httpSetField(client->http, HTTP_FIELD_CONTENT_RANGE, client->content_range);
+    client->content_range[0] = '\0';
+  }
+
   if (mtime)
   {
     char temp[256];			// Temporary string
@@ -320,22 +349,129 @@ moauthdRespondClient(
       httpSetField(client->http, HTTP_FIELD_CONTENT_TYPE, type);
   }
 
-  httpSetLength(client->http, length);
+  if (code != HTTP_STATUS_NOT_MODIFIED)
+    httpSetLength(client->http, length);
 
-  if (!httpWriteResponse(client->http, code))
-    return (false);
+  // Send the response header and message...
+  start = moauthdGetTime();
 
-  // Send the response data...
-  if (message[0])
+  if ((ret = httpWriteResponse(client->http, code)) && message[0])
   {
     // Send a plain text message.
     if (httpWrite(client->http, message, length) < 0)
-      return (false);
+      ret = false;
+    else
+      client->response_bytes += length;
+  }
+
+  if (ret)
+    httpFlushWrite(client->http);
+
+  client->write_usecs += moauthdGetTime() - start;
+
+  return (ret);
+}
+
+
+//
+// 'moauthdWriteClient()' - Write data to the client.
+//
+// When the client is capturing output, the data is appended to the capture
+// buffer instead of being sent.
+//
+
+bool					// O - `true` on success, `false` on error
+moauthdWriteClient(
+    moauthd_client_t *client,		// I - Client
+    const void       *data,		// I - Data to write
+    size_t           length)		// I - Length of data
+{
+  uint64_t	start;			// Start of write
+  ssize_t	bytes;			// Bytes written
+
+
+  if (client->output)
+  {
+    // Append to the capture buffer...
+    if ((client->output_used + length) > client->output_alloc)
+    {
+      char	*output;		// New capture buffer
+      size_t	output_alloc;		// New allocated size
+
+      for (output_alloc = client->output_alloc; output_alloc < (client->output_used + length); output_alloc *= 2);
+
+      if ((output = realloc(client->output, output_alloc)) == NULL)
+        return (false);
+
+      client->output       = output;
+      client->output_alloc = output_alloc;
+    }
+
+    memcpy(client->output + client->output_used, data, length);
+    client->output_used += length;
+
+    return (true);
   }
 
-  httpFlushWrite(client->http);
+  // Send the data and account for it in the access log...
+  start = moauthdGetTime();
+
+  if ((bytes = httpWrite(client->http, data, length)) > 0)
+    client->response_bytes += (size_t)bytes;
 
-  return (true);
+  client->write_usecs += moauthdGetTime() - start;
+
+  return (bytes == (ssize_t)length);
+}
+
+
+//
+// 'get_allow()' - Get the Allow: header value for the request path.
+//
+// Endpoints list the methods they were added with, "*" lists every method
+// the server supports, and all other paths are resources.
+//
+
+static void
+get_allow(moauthd_client_t *client,	// I - Client
+          char             *buffer,	// I - Buffer
+          size_t           bufsize)	// I - Size of buffer
+{
+  moauthd_endpoint_t	*endpoint;	// Endpoint for path
+  unsigned		methods;	// Supported methods
+  size_t		i;		// Looping var
+  char			*bufptr,	// Pointer into buffer
+			*bufend;	// End of buffer
+  static const struct
+  {
+    http_state_t	state;		// Request state
+    const char		*name;		// Method name
+  }			states[] =	// Methods in header order
+  {
+    { HTTP_STATE_GET,     "GET" },
+    { HTTP_STATE_HEAD,    "HEAD" },
+    { HTTP_STATE_OPTIONS, "OPTIONS" },
+    { HTTP_STATE_POST,    "POST" }
+  };
+
+
+  if (!strcmp(client->path_info, "*"))
+    methods = client->server->endpoint_methods | MOAUTHD_METHOD(HTTP_STATE_GET) | MOAUTHD_METHOD(HTTP_STATE_HEAD);
+  else if ((endpoint = moauthdFindEndpoint(client->server, client->path_info)) != NULL)
+    methods = endpoint->methods;
+  else
+    methods = MOAUTHD_METHOD(HTTP_STATE_GET) | MOAUTHD_METHOD(HTTP_STATE_HEAD);
+
+  methods |= MOAUTHD_METHOD(HTTP_STATE_OPTIONS);
+
+  for (i = 0, bufptr = buffer, bufend = buffer + bufsize, *buffer = '\0'; i < (sizeof(states) / sizeof(states[0])); i ++)
+  {
+    if (methods & MOAUTHD_METHOD(states[i].state))
+    {
+      snprintf(bufptr, (size_t)(bufend - bufptr), "%s%s", bufptr > buffer ? ", " : "", states[i].name);
+      bufptr += strlen(bufptr);
+    }
+  }
 }
 
 
@@ -360,12 +496,12 @@ html_escape(moauthd_client_t *client,	// I - Client
     if (*s == '&' || *s == '<')
     {
       if (s > start)
-        httpWrite(client->http, start, (size_t)(s - start));
+        moauthdWriteClient(client, start, (size_t)(s - start));
 
       if (*s == '&')
-        httpWrite(client->http, "&amp;", 5);
+        moauthdWriteClient(client, "&amp;", 5);
       else
-        httpWrite(client->http, "&lt;", 4);
+        moauthdWriteClient(client, "&lt;", 4);
 
       start = s + 1;
     }
@@ -374,5 +510,5 @@ html_escape(moauthd_client_t *client,	// I - Client
   }
 
   if (s > start)
-    httpWrite(client->http, start, (size_t)(s - start));
+    moauthdWriteClient(client, start, (size_t)(s - start));
 }